@@ -295,6 +295,7 @@ LOCAL_C_INCLUDES += \
 ifeq ($(ENABLE_FEM),yes)
 LOCAL_C_INCLUDES += \
 	frameworks/base/include
+LOCAL_CFLAGS += -DSK_FONTHOST_FEM
 else
 LOCAL_C_INCLUDES += \
 	external/freetype/include
@@ -393,6 +394,14 @@ LOCAL_C_INCLUDES += \
 
 LOCAL_CFLAGS += -W -Wall
 
+# render LCD_H and LCD_V masks with FreeType's LCD modes and filter; the
+# engine falls back to gray coverage if libft2 was built without them
+LOCAL_CFLAGS += -DSUPPORT_LCDTEXT
+
+ifeq ($(ARCH_ARM_HAVE_NEON),true)
+	LOCAL_CFLAGS += -D__ARM_HAVE_NEON
+endif
+
 ifeq ($(TARGET_BUILD_TYPE),release)
 	LOCAL_CFLAGS += -O2
 endif
@@ -418,6 +427,9 @@ LOCAL_STATIC_LIBRARIES += libft2
 LOCAL_PRELINK_MODULE := false
 
 include $(BUILD_SHARED_LIBRARY)
+
+# font engine benchmark
+include $(BASE_PATH)/fembench/Android.mk
 endif
 
 #############################################################
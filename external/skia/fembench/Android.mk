@@ -0,0 +1,25 @@
+LOCAL_PATH:= $(call my-dir)
+
+#############################################################
+# Build the font engine manager benchmark
+#
+# Measures the font engines through FontEngineManager; see the top of
+# FontEngineBench.cpp for how to run it and how to build it on a host.
+#
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := FontEngineBench.cpp
+
+LOCAL_C_INCLUDES += \
+	frameworks/base/include
+
+LOCAL_CFLAGS += -W -Wall -O2
+
+LOCAL_SHARED_LIBRARIES := \
+	libutils \
+	libcutils
+
+LOCAL_MODULE_TAGS := optional
+LOCAL_MODULE := fem_bench
+
+include $(BUILD_EXECUTABLE)
@@ -0,0 +1,1182 @@
+/* external/skia/fembench/FontEngineBench.cpp
+**
+** Copyright (c) 1989-2010, Bitstream Inc. and others. All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+** Redistributions of source code must retain the above copyright notice,
+** this list of conditions and the following disclaimer.
+** Redistributions in binary form must reproduce the above copyright notice,
+** this list of conditions and the following disclaimer in the documentation
+** and/or other materials provided with the distribution.
+** Neither the name of Bitstream Inc. nor the names of its contributors may
+** be used to endorse or promote products derived from this software without
+** specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+** LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+** INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+** CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+** ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+** POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+   Benchmark of the font engine manager and its font engine plugins.
+
+   Every font of a directory is measured through FontEngineManager for each
+   combination of the selected benchmarks, sizes, hinting modes, subpixel
+   positioning, emboldening, mask formats (image benchmark only) and thread
+   counts. A case reports its throughput and the latency percentiles of a
+   single call; with --json the results are also written as JSON, to be
+   compared against a baseline run.
+
+   The plugins are loaded from FEM_FONT_ENGINE_PATH if set. On a Linux host
+   with the FreeType development files, the headers in fembench/host stand in
+   for those of the Android utils library; from the top of the tree, e.g.
+
+       mkdir -p out/fontengines
+       g++ -O2 -fPIC -shared -Iexternal/skia/fembench/host -Iframeworks/base/include \
+           frameworks/base/libs/utils/FontEngineManager.cpp \
+           -o out/libfem.so -lpthread -ldl
+       g++ -O2 -fPIC -shared -DANDROID -Iexternal/skia/fembench/host -Iframeworks/base/include \
+           `pkg-config --cflags freetype2` external/skia/src/ports/FontEngineFT.cpp \
+           -o out/fontengines/libfem_freetype.so -Lout -lfem `pkg-config --libs freetype2`
+       g++ -O2 -Iexternal/skia/fembench/host -Iframeworks/base/include \
+           external/skia/fembench/FontEngineBench.cpp \
+           -o out/fem_bench -Lout -lfem -lpthread -Wl,-rpath,'$ORIGIN'
+
+       FEM_FONT_ENGINE_PATH=out/fontengines out/fem_bench --fonts /usr/share/fonts/truetype \
+           --sizes 12,16,24 --threads 1,4 --json out/bench.json
+
+   With --check nothing is timed: the glyph images of every image case are
+   compared with those a child process renders with FEM_FT_SIMD=0, that is
+   with the portable bitmap kernels of the FreeType engine instead of its
+   SSE2 or NEON ones, in every mask format unless --masks is given, and the
+   cases whose images differ are reported. It
+   also checks that the metrics of the ASCII glyphs, asked for again, come
+   from the glyph cache of the FreeType engine, and that the batched glyph
+   calls return what the single glyph calls do.
+*/
+
+#include <utils/FontEngineManager.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Fonts are opened by path or from a buffer; there are no streams here. */
+extern "C" unsigned long streamRead(void*, unsigned long, unsigned char*, unsigned long)
+{
+    return 0;
+}/* end streamRead */
+
+extern "C" void streamClose(void*)
+{
+}/* end streamClose */
+
+#define MAX_PATH_LEN     1024
+#define MAX_FONTS        64
+#define MAX_VALUES       16
+
+/* Characters whose glyphs are measured. */
+#define FIRST_CHAR       0x20
+#define LAST_CHAR        0x7E
+
+/* Font IDs handed out to the fonts; kept clear of the ids of a real font host. */
+#define BENCH_FONT_ID    0x40000000
+
+typedef enum
+{
+    BENCH_CREATE = 0,       /* createFontScalerContext() and delete */
+    BENCH_CMAP,             /* getCharToGlyphID() */
+    BENCH_ADVANCE,          /* getGlyphAdvance() */
+    BENCH_METRICS,          /* getGlyphMetrics() */
+    BENCH_IMAGE,            /* getGlyphImage() */
+    BENCH_OUTLINE,          /* getGlyphOutline() */
+    BENCH_FONT_METRICS,     /* getFontMetrics() */
+    BENCH_QUERY,            /* getFontNameAndAttribute() */
+    BENCH_COUNT
+} BenchId;
+
+static const char* const gBenchNames[BENCH_COUNT] = {
+    "create", "cmap", "advance", "metrics", "image", "outline", "fontmetrics", "query"
+};
+
+static const char* const gHintingNames[] = { "none", "light", "normal", "full" };
+
+static const char* const gMaskNames[] = { "mono", "gray", "lcd16", "lcd_h", "lcd_v" };
+static const fem::AliasMode gMaskModes[] = {
+    fem::ALIAS_MONOCHROME, fem::ALIAS_GRAYSCALE, fem::ALIAS_LCD16, fem::ALIAS_LCD_H, fem::ALIAS_LCD_V
+};
+
+#define MASK_GRAY   1
+#define MASK_COUNT  (int)(sizeof(gMaskNames) / sizeof(gMaskNames[0]))
+
+typedef struct
+{
+    char*       pPath;
+    uint8_t*    pBuffer;        /* font data if read into memory */
+    size_t      size;
+    uint32_t    fontID;
+} BenchFont;
+
+typedef struct
+{
+    const char* fontDir;
+    bool        useBuffer;                  /* open fonts from memory rather than by path */
+    bool        check;                      /* compare the images with the portable kernels' */
+    bool        benches[BENCH_COUNT];
+    int         sizes[MAX_VALUES];
+    int         sizeCount;
+    int         hintings[MAX_VALUES];
+    int         hintingCount;
+    int         subpixels[MAX_VALUES];
+    int         subpixelCount;
+    int         emboldens[MAX_VALUES];
+    int         emboldenCount;
+    int         masks[MAX_VALUES];          /* indexes of gMaskNames */
+    int         maskCount;
+    int         threads[MAX_VALUES];
+    int         threadCount;
+    int         iterations;                 /* timed passes over the glyphs */
+    int         warmup;                     /* untimed passes before them */
+    const char* jsonPath;
+} BenchOptions;
+
+/* One combination of the options. */
+typedef struct
+{
+    BenchId         bench;
+    const BenchFont* font;
+    int             size;
+    int             hinting;
+    bool            subpixel;
+    bool            embolden;
+    int             mask;
+    int             threads;
+} BenchCase;
+
+typedef struct
+{
+    uint64_t    ops;
+    uint64_t    wallNanos;
+    uint32_t    p50;
+    uint32_t    p90;
+    uint32_t    p99;
+    uint32_t    max;
+} BenchResult;
+
+/* State shared by the threads running one case. */
+typedef struct
+{
+    const BenchCase*    pCase;
+    const BenchOptions* pOptions;
+    pthread_mutex_t     mutex;
+    pthread_cond_t      cond;
+    int                 ready;      /* threads done with their setup */
+    bool                go;
+    bool                failed;
+} BenchRun;
+
+typedef struct
+{
+    BenchRun*   run;
+    uint32_t*   samples;            /* nanoseconds of each timed call */
+    uint32_t    sampleCount;
+    uint32_t    sampleCapacity;
+    uint64_t    startNanos;
+    uint64_t    endNanos;
+} BenchThread;
+
+static BenchFont    gFonts[MAX_FONTS];
+static int          gFontCount = 0;
+
+static inline uint64_t nowNanos()
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000ULL + t.tv_nsec;
+}/* end nowNanos */
+
+static int compareSamples(const void* a, const void* b)
+{
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+
+    return x < y ? -1 : (x > y ? 1 : 0);
+}/* end compareSamples */
+
+static int comparePaths(const void* a, const void* b)
+{
+    return strcmp(((const BenchFont*)a)->pPath, ((const BenchFont*)b)->pPath);
+}/* end comparePaths */
+
+static bool hasFontSuffix(const char name[])
+{
+    static const char* const suffixes[] = { ".ttf", ".otf", ".ttc", ".TTF", ".OTF", ".TTC" };
+    size_t length = strlen(name);
+
+    for (size_t i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); i++) {
+        if (length > 4 && ! strcmp(&name[length - 4], suffixes[i])) {
+            return true;
+        }/* end if */
+    }/* end for */
+
+    return false;
+}/* end hasFontSuffix */
+
+static uint8_t* readFile(const char path[], size_t* size)
+{
+    FILE*       fp = fopen(path, "rb");
+    uint8_t*    data = NULL;
+    long        length;
+
+    if (fp == NULL) {
+        return NULL;
+    }/* end if */
+
+    if (fseek(fp, 0, SEEK_END) == 0 && (length = ftell(fp)) > 0 && fseek(fp, 0, SEEK_SET) == 0) {
+        data = (uint8_t*)malloc(length);
+        if (data && fread(data, 1, length, fp) != (size_t)length) {
+            free(data);
+            data = NULL;
+        }/* end if */
+        *size = length;
+    }/* end if */
+
+    fclose(fp);
+    return data;
+}/* end readFile */
+
+static bool loadFonts(const BenchOptions& options)
+{
+    DIR*            dir = opendir(options.fontDir);
+    struct dirent*  entry;
+    char            path[MAX_PATH_LEN];
+
+    if (dir == NULL) {
+        fprintf(stderr, "cannot open font directory %s\n", options.fontDir);
+        return false;
+    }/* end if */
+
+    while ((entry = readdir(dir)) != NULL && gFontCount < MAX_FONTS) {
+        if (! hasFontSuffix(entry->d_name)) {
+            continue;
+        }/* end if */
+
+        snprintf(path, sizeof(path), "%s/%s", options.fontDir, entry->d_name);
+        gFonts[gFontCount].pPath = strdup(path);
+        gFontCount++;
+    }/* end while */
+
+    closedir(dir);
+
+    qsort(gFonts, gFontCount, sizeof(BenchFont), comparePaths);
+
+    for (int i = 0; i < gFontCount; i++) {
+        BenchFont* font = &gFonts[i];
+        struct stat st;
+
+        font->fontID = BENCH_FONT_ID + i;
+        font->size = stat(font->pPath, &st) == 0 ? st.st_size : 0;
+
+        if (options.useBuffer) {
+            font->pBuffer = readFile(font->pPath, &font->size);
+            if (font->pBuffer == NULL) {
+                fprintf(stderr, "cannot read %s\n", font->pPath);
+                return false;
+            }/* end if */
+        }/* end if */
+    }/* end for */
+
+    if (gFontCount == 0) {
+        fprintf(stderr, "no fonts found in %s\n", options.fontDir);
+        return false;
+    }/* end if */
+
+    return true;
+}/* end loadFonts */
+
+static void fillScalerInfo(const BenchCase& bc, FontScalerInfo* desc)
+{
+    memset(desc, 0, sizeof(FontScalerInfo));
+
+    desc->fontID = bc.font->fontID;
+    desc->pPath = bc.font->pPath;
+    desc->pathSz = strlen(bc.font->pPath);
+    desc->pBuffer = bc.font->pBuffer;
+    desc->size = bc.font->size;
+
+    desc->subpixelPositioning = bc.subpixel;
+    desc->maskFormat = gMaskModes[bc.mask];
+    desc->fScaleX = bc.size << 16;
+    desc->fScaleY = bc.size << 16;
+
+    desc->flags = (bc.hinting << 1) & fem::Hinting_Flag;
+    if (bc.embolden) {
+        desc->flags |= fem::Embolden_Flag;
+    }/* end if */
+}/* end fillScalerInfo */
+
+/* Row bytes of the image of a glyph in the mask format of the case. */
+static uint32_t imageRowBytes(fem::AliasMode mode, uint16_t width)
+{
+    GlyphImageBuffer image;
+
+    image.format = mode;
+    return image.computeRowBytes(width);
+}/* end imageRowBytes */
+
+/* Bytes of the image of a glyph, with the 32 bit plane of the LCD_H and
+   LCD_V formats. */
+static uint32_t glyphImageSize(fem::AliasMode mode, uint16_t width, uint16_t height)
+{
+    GlyphImageBuffer image;
+
+    image.format = mode;
+    return image.computeImageSize(width, height);
+}/* end glyphImageSize */
+
+static inline void addSample(BenchThread* thread, uint64_t start)
+{
+    if (thread->sampleCount < thread->sampleCapacity) {
+        thread->samples[thread->sampleCount++] = (uint32_t)(nowNanos() - start);
+    }/* end if */
+}/* end addSample */
+
+/* Runs the timed passes of one thread; 'timed' is false for the warmup. */
+static void runPasses(BenchThread* thread, FontScaler* scaler, const FontScalerInfo& desc,
+                      const uint16_t glyphs[], const GlyphMetrics metrics[], uint32_t glyphCount,
+                      uint8_t* image, int passes, bool timed)
+{
+    const BenchCase&  bc = *thread->run->pCase;
+    uint64_t          start = 0;
+
+    for (int pass = 0; pass < passes; pass++) {
+        for (uint32_t i = 0; i < glyphCount; i++) {
+            /* quarter pixel positions, as a text run would produce */
+            FEM16Dot16 fracX = bc.subpixel ? (FEM16Dot16)((i & 3) << 14) : 0;
+
+            if (timed) {
+                start = nowNanos();
+            }/* end if */
+
+            switch (bc.bench) {
+            case BENCH_CREATE: {
+                FontScaler* fs = FontEngineManager::getInstance().createFontScalerContext(desc);
+                delete fs;
+                break;
+            }
+            case BENCH_CMAP:
+                scaler->getCharToGlyphID(FIRST_CHAR + (i % (LAST_CHAR - FIRST_CHAR + 1)));
+                break;
+            case BENCH_ADVANCE:
+                scaler->getGlyphAdvance(glyphs[i], fracX, 0);
+                break;
+            case BENCH_METRICS:
+                scaler->getGlyphMetrics(glyphs[i], fracX, 0);
+                break;
+            case BENCH_IMAGE:
+                scaler->getGlyphImage(glyphs[i], fracX, 0, imageRowBytes(desc.maskFormat, metrics[i].width),
+                                      metrics[i].width, metrics[i].height, image);
+                break;
+            case BENCH_OUTLINE:
+                delete scaler->getGlyphOutline(glyphs[i], fracX, 0);
+                break;
+            case BENCH_FONT_METRICS: {
+                FontMetrics mX, mY;
+                scaler->getFontMetrics(&mX, &mY);
+                break;
+            }
+            case BENCH_QUERY: {
+                char            name[64];
+                fem::FontStyle  style;
+                bool            fixedWidth;
+
+                /* from the buffer with --buffer, as a font host does */
+                if (desc.pBuffer) {
+                    FontEngineManager::getInstance().getFontNameAndAttribute(desc.pBuffer, desc.size, name, sizeof(name), &style, &fixedWidth);
+                } else {
+                    FontEngineManager::getInstance().getFontNameAndAttribute(desc.pPath, name, sizeof(name), &style, &fixedWidth);
+                }/* end else if */
+                break;
+            }
+            default:
+                break;
+            }/* end switch */
+
+            if (timed) {
+                addSample(thread, start);
+            }/* end if */
+        }/* end for */
+    }/* end for */
+}/* end runPasses */
+
+static void* benchThread(void* arg)
+{
+    BenchThread*         thread = (BenchThread*)arg;
+    BenchRun*            run = thread->run;
+    const BenchCase&     bc = *run->pCase;
+    FontScalerInfo       desc;
+    FontScaler*          scaler;
+    uint16_t             glyphs[LAST_CHAR - FIRST_CHAR + 1];
+    GlyphMetrics         metrics[LAST_CHAR - FIRST_CHAR + 1];
+    uint32_t             glyphCount = 0;
+    uint32_t             imageSize = 0;
+    uint8_t*             image = NULL;
+    bool                 failed = false;
+
+    fillScalerInfo(bc, &desc);
+
+    /* every thread works with a scaler of its own, as Skia threads do */
+    scaler = FontEngineManager::getInstance().createFontScalerContext(desc);
+    if (scaler == NULL) {
+        failed = true;
+    } else {
+        for (int32_t ch = FIRST_CHAR; ch <= LAST_CHAR; ch++) {
+            uint16_t glyphID = scaler->getCharToGlyphID(ch);
+
+            if (glyphID) {
+                metrics[glyphCount] = scaler->getGlyphMetrics(glyphID, 0, 0);
+                glyphs[glyphCount++] = glyphID;
+
+                uint32_t size = glyphImageSize(desc.maskFormat, metrics[glyphCount - 1].width, metrics[glyphCount - 1].height);
+                if (size > imageSize) {
+                    imageSize = size;
+                }/* end if */
+            }/* end if */
+        }/* end for */
+
+        if (bc.bench == BENCH_CMAP || bc.bench == BENCH_CREATE || bc.bench == BENCH_FONT_METRICS || bc.bench == BENCH_QUERY) {
+            /* these do not depend on the font's glyphs */
+            glyphCount = LAST_CHAR - FIRST_CHAR + 1;
+        }/* end if */
+
+        image = (uint8_t*)malloc(imageSize ? imageSize : 1);
+        thread->sampleCapacity = glyphCount * run->pOptions->iterations;
+        thread->samples = (uint32_t*)malloc(sizeof(uint32_t) * (thread->sampleCapacity ? thread->sampleCapacity : 1));
+
+        failed = glyphCount == 0 || image == NULL || thread->samples == NULL;
+    }/* end else if */
+
+    pthread_mutex_lock(&run->mutex);
+    run->failed |= failed;
+    run->ready++;
+    pthread_cond_broadcast(&run->cond);
+    while (! run->go) {
+        pthread_cond_wait(&run->cond, &run->mutex);
+    }/* end while */
+    failed = run->failed;
+    pthread_mutex_unlock(&run->mutex);
+
+    if (! failed) {
+        runPasses(thread, scaler, desc, glyphs, metrics, glyphCount, image, run->pOptions->warmup, false);
+
+        thread->startNanos = nowNanos();
+        runPasses(thread, scaler, desc, glyphs, metrics, glyphCount, image, run->pOptions->iterations, true);
+        thread->endNanos = nowNanos();
+    }/* end if */
+
+    free(image);
+    delete scaler;
+    return NULL;
+}/* end benchThread */
+
+static bool runCase(const BenchCase& bc, const BenchOptions& options, BenchResult* result)
+{
+    BenchRun        run;
+    BenchThread     threads[MAX_VALUES * 4];
+    pthread_t       ids[MAX_VALUES * 4];
+    int             count = bc.threads;
+    int             started = 0;
+    uint32_t*       samples;
+    uint64_t        total = 0;
+    uint64_t        first = 0;
+    uint64_t        last = 0;
+
+    if (count > (int)(sizeof(ids) / sizeof(ids[0]))) {
+        count = sizeof(ids) / sizeof(ids[0]);
+    }/* end if */
+
+    memset(&run, 0, sizeof(run));
+    memset(threads, 0, sizeof(threads));
+    run.pCase = &bc;
+    run.pOptions = &options;
+    pthread_mutex_init(&run.mutex, NULL);
+    pthread_cond_init(&run.cond, NULL);
+
+    for (int i = 0; i < count; i++) {
+        threads[i].run = &run;
+        if (pthread_create(&ids[i], NULL, benchThread, &threads[i]) != 0) {
+            break;
+        }/* end if */
+        started++;
+    }/* end for */
+
+    /* all threads start timing together */
+    pthread_mutex_lock(&run.mutex);
+    run.failed |= started != count;
+    while (run.ready < started) {
+        pthread_cond_wait(&run.cond, &run.mutex);
+    }/* end while */
+    run.go = true;
+    pthread_cond_broadcast(&run.cond);
+    pthread_mutex_unlock(&run.mutex);
+
+    for (int i = 0; i < started; i++) {
+        pthread_join(ids[i], NULL);
+    }/* end for */
+
+    pthread_cond_destroy(&run.cond);
+    pthread_mutex_destroy(&run.mutex);
+
+    for (int i = 0; i < started; i++) {
+        total += threads[i].sampleCount;
+        if (first == 0 || threads[i].startNanos < first) {
+            first = threads[i].startNanos;
+        }/* end if */
+        if (threads[i].endNanos > last) {
+            last = threads[i].endNanos;
+        }/* end if */
+    }/* end for */
+
+    samples = (uint32_t*)malloc(sizeof(uint32_t) * (total ? total : 1));
+
+    if (! run.failed && samples && total) {
+        uint64_t n = 0;
+
+        for (int i = 0; i < started; i++) {
+            memcpy(&samples[n], threads[i].samples, sizeof(uint32_t) * threads[i].sampleCount);
+            n += threads[i].sampleCount;
+        }/* end for */
+
+        qsort(samples, total, sizeof(uint32_t), compareSamples);
+
+        result->ops = total;
+        result->wallNanos = last - first;
+        result->p50 = samples[total * 50 / 100];
+        result->p90 = samples[total * 90 / 100];
+        result->p99 = samples[total * 99 / 100];
+        result->max = samples[total - 1];
+    }/* end if */
+
+    for (int i = 0; i < started; i++) {
+        free(threads[i].samples);
+    }/* end for */
+
+    free(samples);
+    return ! run.failed && total;
+}/* end runCase */
+
+/* Hashes the images of the glyphs of a case, at each quarter pixel
+   position if it is subpixel positioned; returns 0 if no scaler was made. */
+static uint32_t hashImages(const BenchCase& bc)
+{
+    FontScalerInfo  desc;
+    FontScaler*     scaler;
+    uint32_t        hash = 2166136261u;
+
+    fillScalerInfo(bc, &desc);
+
+    scaler = FontEngineManager::getInstance().createFontScalerContext(desc);
+    if (scaler == NULL) {
+        return 0;
+    }/* end if */
+
+    for (int32_t ch = FIRST_CHAR; ch <= LAST_CHAR; ch++) {
+        uint16_t glyphID = scaler->getCharToGlyphID(ch);
+
+        for (int sub = 0; glyphID && sub < (bc.subpixel ? 4 : 1); sub++) {
+            FEM16Dot16    fracX = (FEM16Dot16)(sub << 14);
+            GlyphMetrics  gm = scaler->getGlyphMetrics(glyphID, fracX, 0);
+            uint32_t      rowBytes = imageRowBytes(desc.maskFormat, gm.width);
+            uint32_t      size = glyphImageSize(desc.maskFormat, gm.width, gm.height);
+            uint8_t*      image = (uint8_t*)calloc(size ? size : 1, 1);
+
+            if (image == NULL) {
+                delete scaler;
+                return 0;
+            }/* end if */
+
+            scaler->getGlyphImage(glyphID, fracX, 0, rowBytes, gm.width, gm.height, image);
+
+            for (uint32_t i = 0; i < size; i++) {
+                hash = (hash ^ image[i]) * 16777619u;
+            }/* end for */
+
+            free(image);
+        }/* end for */
+    }/* end for */
+
+    delete scaler;
+    return hash ? hash : 1;
+}/* end hashImages */
+
+/* True if two glyph metrics are the same. */
+static bool sameMetrics(const GlyphMetrics& a, const GlyphMetrics& b)
+{
+    return a.width == b.width && a.height == b.height && a.left == b.left && a.top == b.top &&
+           a.fAdvanceX == b.fAdvanceX && a.fAdvanceY == b.fAdvanceY &&
+           a.lsbDelta == b.lsbDelta && a.rsbDelta == b.rsbDelta;
+}/* end sameMetrics */
+
+/* True if two glyph outlines, either of which may be NULL, are the same. */
+static bool sameOutline(const GlyphOutline* a, const GlyphOutline* b)
+{
+    if (a == NULL || b == NULL) {
+        return a == b;
+    }/* end if */
+
+    return a->pointCount == b->pointCount && a->contourCount == b->contourCount &&
+           ! memcmp(a->x, b->x, a->pointCount * sizeof(FEM26Dot6)) &&
+           ! memcmp(a->y, b->y, a->pointCount * sizeof(FEM26Dot6)) &&
+           ! memcmp(a->contours, b->contours, a->contourCount * sizeof(int16_t)) &&
+           ! memcmp(a->flags, b->flags, a->pointCount);
+}/* end sameOutline */
+
+/* Compares getGlyphsAdvance(), getGlyphsMetrics(), getGlyphsImage() and
+   getGlyphsOutline() over the glyphs of a case, at each quarter pixel
+   position if it is subpixel positioned, with the single glyph calls;
+   returns true if they agree. */
+static bool checkBatchedGlyphs(const BenchCase& bc)
+{
+    enum { MAX_GLYPHS = (LAST_CHAR - FIRST_CHAR + 1) * 4 };
+
+    FontScalerInfo  desc;
+    FontScaler*     scaler;
+    uint16_t        glyphs[MAX_GLYPHS];
+    FEM16Dot16      fracX[MAX_GLYPHS];
+    GlyphMetrics    advances[MAX_GLYPHS];
+    GlyphMetrics    metrics[MAX_GLYPHS];
+    GlyphImageSlot  slots[MAX_GLYPHS];
+    GlyphOutline*   outlines[MAX_GLYPHS];
+    uint32_t        count = 0;
+    bool            same = true;
+
+    fillScalerInfo(bc, &desc);
+
+    scaler = FontEngineManager::getInstance().createFontScalerContext(desc);
+    if (scaler == NULL) {
+        return false;
+    }/* end if */
+
+    for (int32_t ch = FIRST_CHAR; ch <= LAST_CHAR; ch++) {
+        uint16_t glyphID = scaler->getCharToGlyphID(ch);
+
+        for (int sub = 0; glyphID && sub < (bc.subpixel ? 4 : 1); sub++) {
+            glyphs[count] = glyphID;
+            fracX[count] = (FEM16Dot16)(sub << 14);
+            count++;
+        }/* end for */
+    }/* end for */
+
+    scaler->getGlyphsAdvance(count, glyphs, fracX, NULL, advances);
+    scaler->getGlyphsMetrics(count, glyphs, fracX, NULL, metrics);
+    scaler->getGlyphsOutline(count, glyphs, fracX, NULL, outlines);
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t size = glyphImageSize(desc.maskFormat, metrics[i].width, metrics[i].height);
+
+        slots[i].rowBytes = imageRowBytes(desc.maskFormat, metrics[i].width);
+        slots[i].width = metrics[i].width;
+        slots[i].height = metrics[i].height;
+        slots[i].buffer = (uint8_t*)calloc(size ? size : 1, 1);
+        same = same && slots[i].buffer != NULL;
+    }/* end for */
+
+    if (same) {
+        scaler->getGlyphsImage(count, glyphs, fracX, NULL, slots);
+    }/* end if */
+
+    for (uint32_t i = 0; i < count && same; i++) {
+        GlyphMetrics   advance = scaler->getGlyphAdvance(glyphs[i], fracX[i], 0);
+        GlyphMetrics   gm = scaler->getGlyphMetrics(glyphs[i], fracX[i], 0);
+        GlyphOutline*  outline = scaler->getGlyphOutline(glyphs[i], fracX[i], 0);
+        uint32_t       size = glyphImageSize(desc.maskFormat, gm.width, gm.height);
+        uint8_t*       image = (uint8_t*)calloc(size ? size : 1, 1);
+
+        same = image != NULL && sameMetrics(advance, advances[i]) && sameMetrics(gm, metrics[i]) &&
+               sameOutline(outline, outlines[i]);
+
+        if (same) {
+            scaler->getGlyphImage(glyphs[i], fracX[i], 0, slots[i].rowBytes, gm.width, gm.height, image);
+            same = ! memcmp(image, slots[i].buffer, size);
+        }/* end if */
+
+        free(image);
+        delete outline;
+    }/* end for */
+
+    for (uint32_t i = 0; i < count; i++) {
+        free(slots[i].buffer);
+        delete outlines[i];
+    }/* end for */
+
+    delete scaler;
+    return same;
+}/* end checkBatchedGlyphs */
+
+/* Fills 'bc' with the image case 'index' of the options; false past the last. */
+static bool imageCase(const BenchOptions& options, int index, BenchCase* bc)
+{
+    memset(bc, 0, sizeof(BenchCase));
+
+    bc->bench = BENCH_IMAGE;
+    bc->threads = 1;
+    bc->mask = options.masks[index % options.maskCount];
+    index /= options.maskCount;
+    bc->embolden = options.emboldens[index % options.emboldenCount] != 0;
+    index /= options.emboldenCount;
+    bc->subpixel = options.subpixels[index % options.subpixelCount] != 0;
+    index /= options.subpixelCount;
+    bc->hinting = options.hintings[index % options.hintingCount];
+    index /= options.hintingCount;
+    bc->size = options.sizes[index % options.sizeCount];
+    index /= options.sizeCount;
+    bc->font = &gFonts[index];
+
+    return index < gFontCount;
+}/* end imageCase */
+
+/* Median nanoseconds of getGlyphMetrics() over the glyphs. */
+static uint32_t timeMetricsPass(FontScaler* scaler, const uint16_t glyphs[], uint32_t glyphCount, uint32_t samples[])
+{
+    for (uint32_t i = 0; i < glyphCount; i++) {
+        uint64_t start = nowNanos();
+
+        scaler->getGlyphMetrics(glyphs[i], 0, 0);
+        samples[i] = (uint32_t)(nowNanos() - start);
+    }/* end for */
+
+    qsort(samples, glyphCount, sizeof(uint32_t), compareSamples);
+    return samples[glyphCount / 2];
+}/* end timeMetricsPass */
+
+/* Checks that the metrics of a run of the ASCII glyphs, asked for a third
+   time, come from the glyph cache of the font instance: the median call
+   has to be several times faster than on the first pass, which loads and
+   hints every glyph. Must run before any other scaler of the fonts is
+   made, so that the first pass finds the cache empty; returns the count of
+   fonts and sizes failing. */
+static int checkMetricsCache(const BenchOptions& options)
+{
+    int failures = 0;
+
+    for (int f = 0; f < gFontCount; f++) {
+        for (int s = 0; s < options.sizeCount; s++) {
+            BenchCase       bc;
+            FontScalerInfo  desc;
+            FontScaler*     scaler;
+            uint16_t        glyphs[LAST_CHAR - FIRST_CHAR + 1];
+            uint32_t        samples[LAST_CHAR - FIRST_CHAR + 1];
+            uint32_t        glyphCount = 0;
+            uint32_t        first;
+            uint32_t        third;
+
+            memset(&bc, 0, sizeof(bc));
+            bc.bench = BENCH_METRICS;
+            bc.font = &gFonts[f];
+            bc.size = options.sizes[s];
+            bc.hinting = options.hintings[0];
+            bc.mask = MASK_GRAY;
+            bc.threads = 1;
+            fillScalerInfo(bc, &desc);
+
+            scaler = FontEngineManager::getInstance().createFontScalerContext(desc);
+            if (scaler == NULL) {
+                continue;
+            }/* end if */
+
+            for (int32_t ch = FIRST_CHAR; ch <= LAST_CHAR; ch++) {
+                uint16_t glyphID = scaler->getCharToGlyphID(ch);
+
+                if (glyphID) {
+                    glyphs[glyphCount++] = glyphID;
+                }/* end if */
+            }/* end for */
+
+            if (glyphCount) {
+                first = timeMetricsPass(scaler, glyphs, glyphCount, samples);
+                timeMetricsPass(scaler, glyphs, glyphCount, samples);
+                third = timeMetricsPass(scaler, glyphs, glyphCount, samples);
+
+                if (third * 4 > first) {
+                    fprintf(stderr, "metrics of %s at size %d missed the glyph cache on a repeated run: %u ns then %u ns\n",
+                            bc.font->pPath, bc.size, first, third);
+                    failures++;
+                }/* end if */
+            }/* end if */
+
+            delete scaler;
+        }/* end for */
+    }/* end for */
+
+    return failures;
+}/* end checkMetricsCache */
+
+/* Compares the images of every image case with those of a child process
+   using the portable bitmap kernels; must run before the font engine
+   manager is first used, so that the child loads the engines itself. */
+static int runCheck(const BenchOptions& options)
+{
+    BenchCase   bc;
+    int         count = 0;
+    int         failures = 0;
+    int         cacheFailures;
+    int         batchFailures = 0;
+    int         fds[2];
+    pid_t       pid;
+    uint32_t*   hashes;
+    uint32_t*   portable;
+
+    while (imageCase(options, count, &bc)) {
+        count++;
+    }/* end while */
+
+    hashes = (uint32_t*)calloc(count, sizeof(uint32_t));
+    portable = (uint32_t*)calloc(count, sizeof(uint32_t));
+    if (hashes == NULL || portable == NULL || pipe(fds) != 0) {
+        free(hashes);
+        free(portable);
+        return 1;
+    }/* end if */
+
+    pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        setenv("FEM_FT_SIMD", "0", 1);
+
+        for (int i = 0; i < count; i++) {
+            imageCase(options, i, &bc);
+            portable[i] = hashImages(bc);
+        }/* end for */
+
+        _exit(write(fds[1], portable, count * sizeof(uint32_t)) == (ssize_t)(count * sizeof(uint32_t)) ? 0 : 1);
+    }/* end if */
+
+    close(fds[1]);
+
+    /* first, while no scaler of the fonts has filled a glyph cache */
+    cacheFailures = checkMetricsCache(options);
+
+    for (int i = 0; i < count; i++) {
+        imageCase(options, i, &bc);
+        hashes[i] = hashImages(bc);
+
+        if (! checkBatchedGlyphs(bc)) {
+            fprintf(stderr, "batched glyph calls differ for %s at size %d, hinting %s, mask %s%s%s\n",
+                    bc.font->pPath, bc.size, gHintingNames[bc.hinting], gMaskNames[bc.mask],
+                    bc.subpixel ? ", subpixel" : "", bc.embolden ? ", emboldened" : "");
+            batchFailures++;
+        }/* end if */
+    }/* end for */
+
+    size_t  length = 0;
+    ssize_t n;
+
+    while (length < count * sizeof(uint32_t) &&
+           (n = read(fds[0], (uint8_t*)portable + length, count * sizeof(uint32_t) - length)) > 0) {
+        length += n;
+    }/* end while */
+
+    close(fds[0]);
+    if (pid > 0) {
+        waitpid(pid, NULL, 0);
+    }/* end if */
+
+    if (pid < 0 || length != count * sizeof(uint32_t)) {
+        fprintf(stderr, "no images from the portable kernels to compare with\n");
+        failures = count;
+    } else {
+        for (int i = 0; i < count; i++) {
+            imageCase(options, i, &bc);
+
+            if (hashes[i] == 0 || hashes[i] != portable[i]) {
+                fprintf(stderr, "images differ for %s at size %d, hinting %s, mask %s%s%s\n",
+                        bc.font->pPath, bc.size, gHintingNames[bc.hinting], gMaskNames[bc.mask],
+                        bc.subpixel ? ", subpixel" : "", bc.embolden ? ", emboldened" : "");
+                failures++;
+            }/* end if */
+        }/* end for */
+    }/* end else if */
+
+    printf("check: %d cases, %d differ\n", count, failures);
+    printf("check: %d metrics cache runs, %d missed\n", gFontCount * options.sizeCount, cacheFailures);
+    printf("check: %d batched glyph cases, %d differ\n", count, batchFailures);
+
+    free(hashes);
+    free(portable);
+    return failures || cacheFailures || batchFailures ? 1 : 0;
+}/* end runCheck */
+
+static void printResult(FILE* fp, const BenchCase& bc, const BenchResult& r, bool json, bool first)
+{
+    double opsPerSec = r.wallNanos ? (double)r.ops * 1e9 / (double)r.wallNanos : 0;
+    const char* name = strrchr(bc.font->pPath, '/');
+
+    name = name ? name + 1 : bc.font->pPath;
+
+    if (json) {
+        fprintf(fp, "%s\n    {\"bench\":\"%s\",\"font\":\"%s\",\"size\":%d,\"hinting\":\"%s\",\"subpixel\":%s,"
+                    "\"embolden\":%s,\"mask\":\"%s\",\"threads\":%d,\"ops\":%llu,\"ops_per_sec\":%.0f,"
+                    "\"p50_ns\":%u,\"p90_ns\":%u,\"p99_ns\":%u,\"max_ns\":%u}",
+                first ? "" : ",", gBenchNames[bc.bench], name, bc.size, gHintingNames[bc.hinting],
+                bc.subpixel ? "true" : "false", bc.embolden ? "true" : "false", gMaskNames[bc.mask],
+                bc.threads, (unsigned long long)r.ops, opsPerSec, r.p50, r.p90, r.p99, r.max);
+    } else {
+        fprintf(fp, "%-11s %-24.24s %4d %-6s %3s %3s %-5s %3d %12.0f %8u %8u %8u %10u\n",
+                gBenchNames[bc.bench], name, bc.size, gHintingNames[bc.hinting],
+                bc.subpixel ? "sub" : "-", bc.embolden ? "emb" : "-", gMaskNames[bc.mask],
+                bc.threads, opsPerSec, r.p50, r.p90, r.p99, r.max);
+    }/* end else if */
+}/* end printResult */
+
+/* Parses a comma separated list of integers or of names. */
+static int parseList(const char arg[], int values[], const char* const names[], int nameCount)
+{
+    char    buffer[256];
+    char*   save = NULL;
+    int     count = 0;
+
+    strncpy(buffer, arg, sizeof(buffer) - 1);
+    buffer[sizeof(buffer) - 1] = 0;
+
+    for (char* token = strtok_r(buffer, ",", &save); token && count < MAX_VALUES; token = strtok_r(NULL, ",", &save)) {
+        if (names == NULL) {
+            values[count++] = atoi(token);
+            continue;
+        }/* end if */
+
+        for (int i = 0; i < nameCount; i++) {
+            if (! strcmp(token, names[i])) {
+                values[count++] = i;
+                break;
+            }/* end if */
+        }/* end for */
+    }/* end for */
+
+    return count;
+}/* end parseList */
+
+static void usage(const char name[])
+{
+    fprintf(stderr,
+            "usage: %s --fonts DIR [options]\n"
+            "  --bench LIST      create,cmap,advance,metrics,image,outline,fontmetrics,query (all)\n"
+            "  --sizes LIST      pixel sizes (12,16,24,48)\n"
+            "  --hinting LIST    none,light,normal,full (normal)\n"
+            "  --subpixel LIST   0,1 (0)\n"
+            "  --embolden LIST   0,1 (0)\n"
+            "  --masks LIST      mono,gray,lcd16,lcd_h,lcd_v for the image benchmark (gray; all with --check)\n"
+            "  --threads LIST    thread counts (1)\n"
+            "  --iterations N    timed passes over the glyphs (20)\n"
+            "  --warmup N        untimed passes before them (1)\n"
+            "  --buffer          open the fonts from memory instead of by path\n"
+            "  --check           compare the images with the portable kernels' instead\n"
+            "  --json FILE       also write the results as JSON; '-' for stdout\n",
+            name);
+}/* end usage */
+
+static bool parseOptions(int argc, char** argv, BenchOptions* options)
+{
+    static const int defaultSizes[] = { 12, 16, 24, 48 };
+    bool masksGiven = false;
+
+    memset(options, 0, sizeof(BenchOptions));
+
+    for (int i = 0; i < BENCH_COUNT; i++) {
+        options->benches[i] = true;
+    }/* end for */
+
+    memcpy(options->sizes, defaultSizes, sizeof(defaultSizes));
+    options->sizeCount = sizeof(defaultSizes) / sizeof(defaultSizes[0]);
+    options->hintings[0] = fem::HINTING_NORMAL;
+    options->hintingCount = 1;
+    options->subpixelCount = 1;
+    options->emboldenCount = 1;
+    options->masks[0] = MASK_GRAY;
+    options->maskCount = 1;
+    options->threads[0] = 1;
+    options->threadCount = 1;
+    options->iterations = 20;
+    options->warmup = 1;
+
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+
+        if (! strcmp(arg, "--buffer")) {
+            options->useBuffer = true;
+            continue;
+        }/* end if */
+
+        if (! strcmp(arg, "--check")) {
+            options->check = true;
+            continue;
+        }/* end if */
+
+        if (value == NULL) {
+            return false;
+        }/* end if */
+
+        i++;
+
+        if (! strcmp(arg, "--fonts")) {
+            options->fontDir = value;
+        } else if (! strcmp(arg, "--bench")) {
+            int benches[MAX_VALUES];
+            int count = parseList(value, benches, gBenchNames, BENCH_COUNT);
+
+            memset(options->benches, 0, sizeof(options->benches));
+            for (int b = 0; b < count; b++) {
+                options->benches[benches[b]] = true;
+            }/* end for */
+        } else if (! strcmp(arg, "--sizes")) {
+            options->sizeCount = parseList(value, options->sizes, NULL, 0);
+        } else if (! strcmp(arg, "--hinting")) {
+            options->hintingCount = parseList(value, options->hintings, gHintingNames, 4);
+        } else if (! strcmp(arg, "--subpixel")) {
+            options->subpixelCount = parseList(value, options->subpixels, NULL, 0);
+        } else if (! strcmp(arg, "--embolden")) {
+            options->emboldenCount = parseList(value, options->emboldens, NULL, 0);
+        } else if (! strcmp(arg, "--masks")) {
+            options->maskCount = parseList(value, options->masks, gMaskNames, MASK_COUNT);
+            masksGiven = true;
+        } else if (! strcmp(arg, "--threads")) {
+            options->threadCount = parseList(value, options->threads, NULL, 0);
+        } else if (! strcmp(arg, "--iterations")) {
+            options->iterations = atoi(value);
+        } else if (! strcmp(arg, "--warmup")) {
+            options->warmup = atoi(value);
+        } else if (! strcmp(arg, "--json")) {
+            options->jsonPath = value;
+        } else {
+            return false;
+        }/* end else if */
+    }/* end for */
+
+    /* the check covers the kernels of every mask format unless told otherwise */
+    if (options->check && ! masksGiven) {
+        for (int m = 0; m < MASK_COUNT; m++) {
+            options->masks[m] = m;
+        }/* end for */
+        options->maskCount = MASK_COUNT;
+    }/* end if */
+
+    return options->fontDir && options->iterations > 0 && options->sizeCount && options->hintingCount &&
+           options->subpixelCount && options->emboldenCount && options->maskCount && options->threadCount;
+}/* end parseOptions */
+
+int main(int argc, char** argv)
+{
+    BenchOptions    options;
+    BenchCase       bc;
+    BenchResult     result;
+    FILE*           json = NULL;
+    bool            first = true;
+    int             failures = 0;
+
+    if (! parseOptions(argc, argv, &options)) {
+        usage(argv[0]);
+        return 1;
+    }/* end if */
+
+    if (! loadFonts(options)) {
+        return 1;
+    }/* end if */
+
+    if (options.check) {
+        return runCheck(options);
+    }/* end if */
+
+    if (FontEngineManager::getInstance().getFontEngineCount() == 0) {
+        fprintf(stderr, "no font engines found; set FEM_FONT_ENGINE_PATH\n");
+        return 1;
+    }/* end if */
+
+    if (options.jsonPath) {
+        json = strcmp(options.jsonPath, "-") ? fopen(options.jsonPath, "w") : stdout;
+        if (json == NULL) {
+            fprintf(stderr, "cannot write %s\n", options.jsonPath);
+            return 1;
+        }/* end if */
+
+        fprintf(json, "{\"iterations\":%d,\"warmup\":%d,\"buffer\":%s,\"results\":[",
+                options.iterations, options.warmup, options.useBuffer ? "true" : "false");
+    }/* end if */
+
+    if (json != stdout) {
+        printf("%-11s %-24s %4s %-6s %3s %3s %-5s %3s %12s %8s %8s %8s %10s\n",
+               "bench", "font", "size", "hint", "sub", "emb", "mask", "thr", "ops/s", "p50 ns", "p90 ns", "p99 ns", "max ns");
+    }/* end if */
+
+    for (int b = 0; b < BENCH_COUNT; b++) {
+        if (! options.benches[b]) {
+            continue;
+        }/* end if */
+
+        for (int f = 0; f < gFontCount; f++)
+        for (int s = 0; s < options.sizeCount; s++)
+        for (int h = 0; h < options.hintingCount; h++)
+        for (int sp = 0; sp < options.subpixelCount; sp++)
+        for (int e = 0; e < options.emboldenCount; e++)
+        for (int m = 0; m < (b == BENCH_IMAGE ? options.maskCount : 1); m++)
+        for (int t = 0; t < options.threadCount; t++) {
+            memset(&bc, 0, sizeof(bc));
+            memset(&result, 0, sizeof(result));
+
+            bc.bench = (BenchId)b;
+            bc.font = &gFonts[f];
+            bc.size = options.sizes[s];
+            bc.hinting = options.hintings[h];
+            bc.subpixel = options.subpixels[sp] != 0;
+            bc.embolden = options.emboldens[e] != 0;
+            bc.mask = b == BENCH_IMAGE ? options.masks[m] : MASK_GRAY;
+            bc.threads = options.threads[t] > 0 ? options.threads[t] : 1;
+
+            if (! runCase(bc, options, &result)) {
+                fprintf(stderr, "%s failed for %s at size %d\n", gBenchNames[b], gFonts[f].pPath, bc.size);
+                failures++;
+                continue;
+            }/* end if */
+
+            if (json != stdout) {
+                printResult(stdout, bc, result, false, false);
+            }/* end if */
+
+            if (json) {
+                printResult(json, bc, result, true, first);
+                first = false;
+            }/* end if */
+        }/* end for */
+    }/* end for */
+
+    if (json) {
+        fprintf(json, "\n]}\n");
+        if (json != stdout) {
+            fclose(json);
+        }/* end if */
+    }/* end if */
+
+    for (int f = 0; f < gFontCount; f++) {
+        free(gFonts[f].pPath);
+        free(gFonts[f].pBuffer);
+    }/* end for */
+
+    return failures ? 1 : 0;
+}/* end main */
@@ -0,0 +1,61 @@
+/* external/skia/fembench/host/utils/Timers.h
+**
+** Copyright (c) 1989-2010, Bitstream Inc. and others. All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+** Redistributions of source code must retain the above copyright notice,
+** this list of conditions and the following disclaimer.
+** Redistributions in binary form must reproduce the above copyright notice,
+** this list of conditions and the following disclaimer in the documentation
+** and/or other materials provided with the distribution.
+** Neither the name of Bitstream Inc. nor the names of its contributors may
+** be used to endorse or promote products derived from this software without
+** specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+** LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+** INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+** CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+** ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+** POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+   Host stand-in for the parts of <utils/Timers.h> used by the font engine
+   manager; see threads.h next to this file.
+*/
+
+#ifndef FEM_HOST_UTILS_TIMERS_H
+#define FEM_HOST_UTILS_TIMERS_H
+
+#include <stdint.h>
+#include <time.h>
+
+typedef int64_t nsecs_t;
+
+enum {
+    SYSTEM_TIME_REALTIME = 0,
+    SYSTEM_TIME_MONOTONIC = 1,
+    SYSTEM_TIME_PROCESS = 2,
+    SYSTEM_TIME_THREAD = 3
+};
+
+inline nsecs_t systemTime(int clock = SYSTEM_TIME_MONOTONIC)
+{
+    static const clockid_t  clocks[] = {
+        CLOCK_REALTIME, CLOCK_MONOTONIC, CLOCK_PROCESS_CPUTIME_ID, CLOCK_THREAD_CPUTIME_ID
+    };
+    struct timespec         t;
+
+    clock_gettime(clocks[clock], &t);
+    return (nsecs_t)t.tv_sec * 1000000000LL + t.tv_nsec;
+}/* end systemTime */
+
+#endif /* FEM_HOST_UTILS_TIMERS_H */
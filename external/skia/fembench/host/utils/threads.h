@@ -0,0 +1,125 @@
+/* external/skia/fembench/host/utils/threads.h
+**
+** Copyright (c) 1989-2010, Bitstream Inc. and others. All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+** Redistributions of source code must retain the above copyright notice,
+** this list of conditions and the following disclaimer.
+** Redistributions in binary form must reproduce the above copyright notice,
+** this list of conditions and the following disclaimer in the documentation
+** and/or other materials provided with the distribution.
+** Neither the name of Bitstream Inc. nor the names of its contributors may
+** be used to endorse or promote products derived from this software without
+** specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+** LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+** INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+** CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+** ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+** POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+   Host stand-in for the parts of <utils/threads.h> used by the font engine
+   manager and its plugins, so that they and fem_bench build on a Linux host
+   without the Android tree; see FontEngineBench.cpp. Not used on a device.
+*/
+
+#ifndef FEM_HOST_UTILS_THREADS_H
+#define FEM_HOST_UTILS_THREADS_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <pthread.h>
+
+namespace android
+{
+
+typedef int (*thread_func_t)(void*);
+
+typedef struct
+{
+    thread_func_t  entry;
+    void*          arg;
+} HostThreadStart;
+
+inline void* hostThreadEntry(void* arg)
+{
+    HostThreadStart  start = *(HostThreadStart*)arg;
+
+    delete (HostThreadStart*)arg;
+    start.entry(start.arg);
+    return NULL;
+}/* end hostThreadEntry */
+
+/* Starts a detached thread; returns false if it could not be started. */
+inline bool createThread(thread_func_t entry, void* arg)
+{
+    HostThreadStart*  start = new HostThreadStart;
+    pthread_attr_t    attr;
+    pthread_t         thread;
+    bool              retVal;
+
+    start->entry = entry;
+    start->arg = arg;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    retVal = pthread_create(&thread, &attr, hostThreadEntry, start) == 0;
+    pthread_attr_destroy(&attr);
+
+    if (! retVal) {
+        delete start;
+    }/* end if */
+
+    return retVal;
+}/* end createThread */
+
+class Mutex
+{
+public:
+    enum {
+        PRIVATE = 0,
+        SHARED = 1
+    };
+
+    Mutex()                                  { pthread_mutex_init(&mMutex, NULL); }
+    Mutex(const char*)                       { pthread_mutex_init(&mMutex, NULL); }
+    Mutex(int, const char* = NULL)           { pthread_mutex_init(&mMutex, NULL); }
+    ~Mutex()                                 { pthread_mutex_destroy(&mMutex); }
+
+    int32_t lock()                           { return -pthread_mutex_lock(&mMutex); }
+    void unlock()                            { pthread_mutex_unlock(&mMutex); }
+    int32_t tryLock()                        { return -pthread_mutex_trylock(&mMutex); }
+
+    class Autolock
+    {
+    public:
+        inline Autolock(Mutex& mutex) : mLock(mutex)  { mLock.lock(); }
+        inline Autolock(Mutex* mutex) : mLock(*mutex) { mLock.lock(); }
+        inline ~Autolock()                            { mLock.unlock(); }
+
+    private:
+        Mutex&  mLock;
+    };/* end class Autolock */
+
+private:
+    Mutex(const Mutex&);
+    Mutex& operator = (const Mutex&);
+
+    pthread_mutex_t  mMutex;
+};/* end class Mutex */
+
+typedef Mutex::Autolock AutoMutex;
+
+}/* end namespace android */
+
+#endif /* FEM_HOST_UTILS_THREADS_H */
@@ -18,13 +18,24 @@
 */
 
 #include <assert.h>
+/* fopen, fread */
+#include <stdio.h>
+#include <stdlib.h>
+/* open, mmap, madvise */
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
 #include <utils/threads.h>
 #include <utils/FontEngineManager.h>
+#include <utils/FontEngineAtomics.h>
 
 #include <ft2build.h>
 #include FT_FREETYPE_H
 #include FT_OUTLINE_H
 #include FT_SIZES_H
+#include FT_MODULE_H
 #include FT_TRUETYPE_TABLES_H
 #include FT_TYPE1_TABLES_H
 #include FT_BITMAP_H
@@ -40,8 +51,44 @@
 #include FT_ADVANCES_H
 #endif
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#include <cpuid.h>
+#elif defined(__ARM_HAVE_NEON)
+#include <arm_neon.h>
+#endif
+
 //#define ENABLE_GLYPH_SPEW     // for tracing calls
 
+/* If the following macro is enabled; each font has a lock of its own for
+   its face and font instances, and glyph calls on different fonts run at
+   once. A single glyph lock is shared by every font otherwise.
+*/
+#define ENABLE_FACE_LOCK
+
+/* Different faces of one FT_Library may only be used from different threads
+   since FreeType 2.6; before that the raster pool and the TrueType bytecode
+   interpreter belong to the library and are shared by all its faces. With
+   older versions every face glyph calls use, the face replicas included, is
+   opened in an FT_Library of its own, which costs the modules and the raster
+   pool of a library per face.
+*/
+#if defined(ENABLE_FACE_LOCK) && (FREETYPE_MAJOR == 2 && FREETYPE_MINOR < 6)
+#define ENABLE_FACE_LIBRARY
+#endif
+
+/* With per face locks a font opened by path or from a buffer gets up to
+   FT_FACE_REPLICAS_MAX extra FT_Face objects over the same font bytes, opened
+   when a glyph call finds the font's own face busy; with ENABLE_FACE_LIBRARY
+   each in an FT_Library of its own. The environment variable
+   FT_FACE_REPLICAS_ENV overrides the cap; 0 disables the replicas.
+*/
+#define FT_FACE_REPLICAS_MAX    3
+#define FT_FACE_REPLICAS_ENV    "FEM_FT_FACE_REPLICAS"
+
+/* FT_Size objects kept by a replica, one per recently used font instance. */
+#define FACE_REPLICA_SIZES      4
+
 /* If the following macro is enabled; then list of font instance will be
    maintained by every font object. While creating an font instance this list
    will be searched. If similar font instance found while searching than that
@@ -50,12 +97,96 @@
 */
 #define ENABLE_FONTINSTLIST
 
+/* The mono to gray expansion of embedded bitmaps and the LCD16 packing run
+   SSE2 or NEON row kernels when the CPU has them; the environment variable
+   FT_SIMD_ENV set to 0 keeps the portable ones; fem_bench --check compares
+   the glyph images of both.
+*/
+#define FT_SIMD_ENV             "FEM_FT_SIMD"
+
+/* If the following macro is enabled; font files given by path are mapped
+   read only and opened from memory instead of through FreeType's stdio
+   stream. The fonts and query faces of one file share a single mapping, so
+   glyph loads read the page cache directly and the pages are shared with
+   the other processes mapping the file.
+
+   Only files under FT_FONT_MMAP_DIRS are mapped, as a file truncated while
+   mapped raises SIGBUS on the next glyph load; the system font directory is
+   read only, while the fonts an application passes may be rewritten under
+   it. Other files go through FT_New_Face. The environment variable
+   FT_FONT_MMAP_DIRS_ENV overrides the directories, separated by ':'.
+*/
+#define ENABLE_FONT_MMAP
+#define FT_FONT_MMAP_DIRS       "/system/fonts/"
+#define FT_FONT_MMAP_DIRS_ENV   "FEM_FT_MMAP_DIRS"
+
+/* FreeType's heap is counted by the allocator of the library, and each
+   FT_Face and FT_Size is charged with the bytes its creation took. Over
+   FT_MEMORY_BUDGET_KB the least recently used idle font instances, each
+   with its FT_Size, are deleted and a font goes with its last instance,
+   closing its FT_Face. Nothing else is done on the budget, as the face
+   replicas and sizes in use would be opened again on their next use; they
+   are left to trimMemory(), which closes the idle replicas too and, with
+   TRIM_MEMORY_COMPLETE, drops the FT_Size and glyph caches of the
+   instances in use whose font is not busy. The environment variable
+   FT_MEMORY_BUDGET_ENV overrides the budget, in KB; 0 disables it.
+*/
+#define FT_MEMORY_BUDGET_KB     4096
+#define FT_MEMORY_BUDGET_ENV    "FEM_FT_MEMORY_BUDGET"
+
+/* Number of hash buckets of the engine's font index. */
+#define FONT_INDEX_BUCKETS      64
+
+/* Bytes at most read from the start of a font file for its content key. */
+#define FONT_CONTENT_HASH_LEN   4096
+
+/* The cmap cache of a font covers the first three Unicode planes, in pages
+   of CMAP_PAGE_SIZE characters filled on first use. Other characters are
+   looked up in the face. */
+#define CMAP_PAGE_BITS          8
+#define CMAP_PAGE_SIZE          (1 << CMAP_PAGE_BITS)
+#define CMAP_PAGE_COUNT         (0x30000 >> CMAP_PAGE_BITS)
+
+#ifdef ENABLE_FONTINSTLIST
+/* Number of hash buckets indexing the font instances of a font. */
+#define FONTINST_BUCKETS        16
+
+/* Font instances left without scalers are kept, up to this many over all
+   fonts, so that a new scaler at a recently used size finds its instance
+   (and FT_Size) ready. Only fonts FreeType opened from their file are kept
+   this way: the buffer or stream of any other font belongs to the client,
+   which may free it once its last scaler is gone.
+*/
+#define FONTINST_IDLE_MAX       16
+#endif /* ENABLE_FONTINSTLIST */
+
+/* Glyph cache of a font instance: the metrics of recent glyphs, direct
+   mapped by glyph and subpixel offset, and hinted outlines direct mapped by
+   glyph, so that the image following a metrics request does not load and
+   hint the glyph again. A subpixel instance keeps more outlines, as each
+   subpixel offset of a glyph is the same outline translated. A metrics
+   slot is taken from the top bits of the key's Fibonacci hash, so that a
+   run of consecutive glyph IDs spreads over the whole cache. */
+#define GLYPH_METRICS_CACHE_BITS            7
+#define GLYPH_METRICS_CACHE_SIZE            (1 << GLYPH_METRICS_CACHE_BITS)
+#define GLYPH_HINTED_CACHE_SIZE             2     /* a power of 2 */
+#define GLYPH_SUBPIXEL_HINTED_CACHE_SIZE    64    /* a power of 2 */
+#define GLYPH_KEY_NONE                      0xFFFFFFFF
+
+/* Fonts read through streamRead() get a cache of STREAM_CACHE_BLOCKS
+   aligned blocks of STREAM_BLOCK_SIZE bytes, the least recently used one
+   going first. A miss on the block following the last one loaded fetches
+   up to STREAM_READ_AHEAD_MAX blocks in a single read, the read-ahead
+   doubling while the scan goes on. */
+#define STREAM_BLOCK_BITS       12
+#define STREAM_BLOCK_SIZE       (1 << STREAM_BLOCK_BITS)
+#define STREAM_CACHE_BLOCKS     32    /* 128 KB per font */
+#define STREAM_READ_AHEAD_MAX   8
+#define STREAM_BLOCK_NONE       0xFFFFFFFF
+
 //#define FT_ENABLE_LOG
 
 #ifdef FT_ENABLE_LOG
-/* fprintf, FILE */
-#include <stdio.h>
-
 static FILE * fplog = NULL;
 
 #define FT_STARTLOG fplog = fopen("/data/ftlog.txt", "a");
@@ -111,6 +242,26 @@ static FILE * fplog = NULL;
 #define G16_SHIFT    (B16_BITS)
 #define B16_SHIFT    0
 
+/* Channel shifts of the 32 bit pixels of the LCD_H and LCD_V masks; they
+   must match SkPackARGB32(), which keeps Android pixels in RGBA order. */
+#ifndef LCD_A32_SHIFT
+#ifdef ANDROID
+    #define LCD_R32_SHIFT    0
+    #define LCD_G32_SHIFT    8
+    #define LCD_B32_SHIFT    16
+    #define LCD_A32_SHIFT    24
+#else
+    #define LCD_A32_SHIFT    24
+    #define LCD_R32_SHIFT    16
+    #define LCD_G32_SHIFT    8
+    #define LCD_B32_SHIFT    0
+#endif /* ANDROID */
+#endif /* LCD_A32_SHIFT */
+
+/* The 32 bit plane of an LCD_H or LCD_V mask follows its A8 plane at the
+   next 4 byte boundary. */
+#define LCD_PLANE_OFFSET(rowBytes, height)    (((rowBytes) * (height) + 3) & ~3)
+
 // FREETYPE_LCD_LERP should be 0...256
 // 0 means no color reduction (e.g. just as returned from FreeType)
 // 256 means 100% color reduction (e.g. gray)
@@ -138,7 +289,46 @@ static int lerp(int start, int end);
 
 static uint16_t packTriple(unsigned r, unsigned g, unsigned b);
 
-static void copyFT2LCD16(uint32_t rowBytes, uint16_t width, uint16_t height, uint16_t *buffer, const FT_Bitmap& bitmap);
+/* Fills an LCD16 mask from the bitmap FreeType rendered in 'slot' with
+   FT_RENDER_MODE_LCD, padded for the LCD filter or not. */
+static void copyFT2LCD16(uint32_t rowBytes, uint16_t width, uint16_t height, uint16_t *buffer, const FT_GlyphSlot slot);
+
+#if defined(SUPPORT_LCDTEXT)
+/* Fills an LCD_H or LCD_V mask, both planes, from the bitmap FreeType
+   rendered in 'slot' with FT_RENDER_MODE_LCD or FT_RENDER_MODE_LCD_V. */
+static void copyFT2LCD(uint32_t rowBytes, uint16_t width, uint16_t height, uint8_t *buffer, const FT_GlyphSlot slot, bool vertical, bool bgr);
+#endif
+
+/* Fills the 32 bit plane of an LCD_H or LCD_V mask from its A8 plane. */
+static void expandA8ToLCD(uint32_t rowBytes, uint16_t width, uint16_t height, uint8_t *buffer, bool vertical);
+
+/* Returns the bytes of an image of the given mask format. */
+static uint32_t computeImageSize(fem::AliasMode format, uint32_t rowBytes, uint16_t width, uint16_t height);
+
+/* Row kernels of the bitmap conversions: a row of 1 bit pixels, most
+   significant bit first, to 0x00/0xFF coverage; a row of FreeType LCD
+   triples to RGB565 as packTriple() does; a row of FreeType LCD triples to
+   32 bit LCD pixels and, unless 'a8' is NULL, their average coverage (a
+   horizontal triple is 3 bytes of 'src' if 'subRow' is 0, a vertical one
+   is a byte of 'src' and the bytes 'subRow' and 2 * 'subRow' below it); a
+   row of A8 coverage to 32 bit LCD pixels. */
+typedef void (*ExpandMonoRowProc)(uint8_t* dst, const uint8_t* src, int width);
+typedef void (*PackLCD16RowProc)(uint16_t* dst, const uint8_t* src, int width);
+typedef void (*ConvertLCDRowProc)(uint32_t* lcd, uint8_t* a8, const uint8_t* src, int subRow, int width, bool bgr);
+typedef void (*ExpandA8ToLCDRowProc)(uint32_t* dst, const uint8_t* src, int width);
+
+static void expandMonoRow(uint8_t* dst, const uint8_t* src, int width);
+static void packLCD16Row(uint16_t* dst, const uint8_t* src, int width);
+static void convertLCDRow(uint32_t* lcd, uint8_t* a8, const uint8_t* src, int subRow, int width, bool bgr);
+static void expandA8ToLCDRow(uint32_t* dst, const uint8_t* src, int width);
+
+/* Points the kernels below at the fastest versions the CPU runs. */
+static void InitBitmapKernelsFT();
+
+static ExpandMonoRowProc     gExpandMonoRowFT = expandMonoRow;
+static PackLCD16RowProc      gPackLCD16RowFT = packLCD16Row;
+static ConvertLCDRowProc     gConvertLCDRowFT = convertLCDRow;
+static ExpandA8ToLCDRowProc  gExpandA8ToLCDRowFT = expandA8ToLCDRow;
 
 inline int32_t FEM16Dot16Abs(int32_t value)
 {
@@ -243,24 +433,482 @@ uint16_t packTriple(unsigned r, unsigned g, unsigned b) {
     return packRGB16(r >> 3, g >> 2, b >> 3);
 }/* end method packTriple */
 
-void copyFT2LCD16(uint32_t rowBytes, uint16_t width, uint16_t height, uint16_t *buffer, const FT_Bitmap& bitmap) {
-    assert(width * 3 == bitmap.width - 6);
-    assert(height == bitmap.rows);
+void copyFT2LCD16(uint32_t rowBytes, uint16_t width, uint16_t height, uint16_t *buffer, const FT_GlyphSlot slot) {
+    const FT_Bitmap&  bitmap = slot->bitmap;
 
-    const uint8_t* src = bitmap.buffer + 3;
-    uint16_t* dst = buffer;
-    size_t dstRB = rowBytes;
+    /* the glyph origin is at the lower left of the mask; the padding of the
+       LCD filter, if any, lies left of it and is cut off */
+    const int   pixels = bitmap.width / 3;
+    const int   left = slot->bitmap_left;
+    const int   top = height - slot->bitmap_top;
+    const int   x0 = left < 0 ? 0 : left;
+    const int   x1 = left + pixels > width ? width : left + pixels;
 
     for (int y = 0; y < height; y++) {
-        const uint8_t* triple = src;
-        for (int x = 0; x < width; x++) {
-            dst[x] = packTriple(triple[0], triple[1], triple[2]);
-            triple += 3;
-        }/* end for */
-        src += bitmap.pitch;
-        dst = (uint16_t*)((char*)dst + dstRB);
+        uint16_t*   dst = (uint16_t*)((char*)buffer + y * rowBytes);
+        const int   row = y - top;
+
+        if (row < 0 || row >= (int)bitmap.rows || x0 >= x1) {
+            memset(dst, 0, width * sizeof(uint16_t));
+            continue;
+        }/* end if */
+
+        memset(dst, 0, x0 * sizeof(uint16_t));
+        gPackLCD16RowFT(dst + x0, bitmap.buffer + row * bitmap.pitch + (x0 - left) * 3, x1 - x0);
+        memset(dst + x1, 0, (width - x1) * sizeof(uint16_t));
     }/* end for */
 }/* end method copyFT2LCD16 */
+
+void expandMonoRow(uint8_t* dst, const uint8_t* src, int width) {
+    for (int x = 0; x < width; x++) {
+        dst[x] = src[x >> 3] & (0x80 >> (x & 7)) ? 0xff : 0;
+    }/* end for */
+}/* end method expandMonoRow */
+
+void packLCD16Row(uint16_t* dst, const uint8_t* src, int width) {
+    for (int x = 0; x < width; x++) {
+        dst[x] = packTriple(src[0], src[1], src[2]);
+        src += 3;
+    }/* end for */
+}/* end method packLCD16Row */
+
+static inline uint32_t packLCD32(unsigned r, unsigned g, unsigned b) {
+    unsigned a = r > g ? r : g;
+    a = a > b ? a : b;
+    return (a << LCD_A32_SHIFT) | (r << LCD_R32_SHIFT) | (g << LCD_G32_SHIFT) | (b << LCD_B32_SHIFT);
+}/* end method packLCD32 */
+
+void convertLCDRow(uint32_t* lcd, uint8_t* a8, const uint8_t* src, int subRow, int width, bool bgr) {
+    const int step = subRow ? 1 : 3;
+    const int next = subRow ? subRow : 1;
+
+    for (int x = 0; x < width; x++) {
+        unsigned c0 = src[0], c1 = src[next], c2 = src[2 * next];
+
+        lcd[x] = bgr ? packLCD32(c2, c1, c0) : packLCD32(c0, c1, c2);
+        if (a8) {
+            a8[x] = (uint8_t)((c0 + c1 + c2 + 1) / 3);
+        }/* end if */
+        src += step;
+    }/* end for */
+}/* end method convertLCDRow */
+
+void expandA8ToLCDRow(uint32_t* dst, const uint8_t* src, int width) {
+    for (int x = 0; x < width; x++) {
+        dst[x] = src[x] * 0x01010101u;
+    }/* end for */
+}/* end method expandA8ToLCDRow */
+
+#if defined(SUPPORT_LCDTEXT)
+/* Copies the triples of lcd columns [x0, x1) of a bitmap row placed at
+   column 'left', with their average for the A8 columns [a0, a1). */
+static void convertLCDSpan(uint32_t* lcdRow, uint8_t* a8Row, const uint8_t* src, int subRow, int left,
+                           int x0, int x1, int a0, int a1, bool bgr) {
+    const int step = subRow ? 1 : 3;
+    int m0 = x0, m1 = x0;
+
+    if (a8Row) {
+        m0 = a0 < x0 ? x0 : (a0 > x1 ? x1 : a0);
+        m1 = a1 < m0 ? m0 : (a1 > x1 ? x1 : a1);
+    }/* end if */
+
+    if (m0 > x0) {
+        gConvertLCDRowFT(lcdRow + x0, NULL, src + (x0 - left) * step, subRow, m0 - x0, bgr);
+    }/* end if */
+    if (m1 > m0) {
+        gConvertLCDRowFT(lcdRow + m0, a8Row + (m0 - a0), src + (m0 - left) * step, subRow, m1 - m0, bgr);
+    }/* end if */
+    if (x1 > m1) {
+        gConvertLCDRowFT(lcdRow + m1, NULL, src + (m1 - left) * step, subRow, x1 - m1, bgr);
+    }/* end if */
+}/* end method convertLCDSpan */
+
+void copyFT2LCD(uint32_t rowBytes, uint16_t width, uint16_t height, uint8_t *buffer, const FT_GlyphSlot slot, bool vertical, bool bgr) {
+    const FT_Bitmap&  bitmap = slot->bitmap;
+    uint32_t*         lcd = (uint32_t*)(buffer + LCD_PLANE_OFFSET(rowBytes, height));
+
+    /* the 32 bit plane has an extra column (row) on both sides */
+    const int   lcdWidth = vertical ? width : width + 2;
+    const int   lcdHeight = vertical ? height + 2 : height;
+    const int   a0 = vertical ? 0 : 1;  /* first lcd column of the A8 plane */
+
+    /* a vertical LCD pixel is three bitmap rows high */
+    const int   pixels = vertical ? bitmap.width : bitmap.width / 3;
+    const int   rows = vertical ? bitmap.rows / 3 : bitmap.rows;
+    const int   subRow = vertical ? bitmap.pitch : 0;
+
+    /* the bitmap in the 32 bit plane; the glyph origin is at the lower left
+       of the A8 plane */
+    const int   left = slot->bitmap_left + a0;
+    const int   top = height - slot->bitmap_top + (vertical ? 1 : 0);
+    const int   x0 = left < 0 ? 0 : left;
+    const int   x1 = left + pixels > lcdWidth ? lcdWidth : left + pixels;
+
+    memset(buffer, 0, computeImageSize(vertical ? fem::ALIAS_LCD_V : fem::ALIAS_LCD_H, rowBytes, width, height));
+
+    for (int y = 0; y < rows && x0 < x1; y++) {
+        const int   ly = top + y;
+        const int   ay = vertical ? ly - 1 : ly;
+
+        if (ly < 0 || ly >= lcdHeight) {
+            continue;
+        }/* end if */
+
+        convertLCDSpan(lcd + ly * lcdWidth, (ay >= 0 && ay < height) ? buffer + ay * rowBytes : NULL,
+                       bitmap.buffer + y * (vertical ? 3 : 1) * bitmap.pitch, subRow, left,
+                       x0, x1, a0, a0 + width, bgr);
+    }/* end for */
+}/* end method copyFT2LCD */
+#endif
+
+void expandA8ToLCD(uint32_t rowBytes, uint16_t width, uint16_t height, uint8_t *buffer, bool vertical) {
+    uint32_t*   lcd = (uint32_t*)(buffer + LCD_PLANE_OFFSET(rowBytes, height));
+    const int   lcdWidth = vertical ? width : width + 2;
+    const int   lcdHeight = vertical ? height + 2 : height;
+    uint32_t*   dst = lcd + (vertical ? lcdWidth : 1);
+
+    memset(lcd, 0, lcdWidth * lcdHeight * sizeof(uint32_t));
+
+    for (int y = 0; y < height; y++) {
+        gExpandA8ToLCDRowFT(dst, buffer, width);
+        buffer += rowBytes;
+        dst += lcdWidth;
+    }/* end for */
+}/* end method expandA8ToLCD */
+
+uint32_t computeImageSize(fem::AliasMode format, uint32_t rowBytes, uint16_t width, uint16_t height) {
+    if (format == fem::ALIAS_LCD_H) {
+        return LCD_PLANE_OFFSET(rowBytes, height) + (width + 2) * height * sizeof(uint32_t);
+    } else if (format == fem::ALIAS_LCD_V) {
+        return LCD_PLANE_OFFSET(rowBytes, height) + width * (height + 2) * sizeof(uint32_t);
+    }/* end else if */
+
+    return rowBytes * height;
+}/* end method computeImageSize */
+
+#if defined(__SSE2__)
+/* 16 pixels at a time: each source byte is spread over 8 lanes and every
+   lane tests its own bit. */
+static void expandMonoRowSSE2(uint8_t* dst, const uint8_t* src, int width) {
+    const __m128i bits = _mm_setr_epi8((char)0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01,
+                                       (char)0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01);
+    int x = 0;
+
+    for (; x + 16 <= width; x += 16) {
+        __m128i v = _mm_cvtsi32_si128(src[0] | (src[1] << 8));
+        v = _mm_unpacklo_epi8(v, v);
+        v = _mm_unpacklo_epi16(v, v);
+        v = _mm_unpacklo_epi32(v, v);
+        _mm_storeu_si128((__m128i*)(dst + x), _mm_cmpeq_epi8(_mm_and_si128(v, bits), bits));
+        src += 2;
+    }/* end for */
+
+    expandMonoRow(dst + x, src, width - x);
+}/* end method expandMonoRowSSE2 */
+
+/* (ave - v) * FREETYPE_LCD_LERP must fit 16 bits */
+#if FREETYPE_LCD_LERP <= 128
+/* Packs the two pixels of 'rgb', 16 bit r, g, b, 0 lanes each, as
+   packTriple() does; returns 32 bit lanes p0, p0, p1, p1. */
+static inline __m128i packTwoTriplesSSE2(__m128i rgb) {
+    if (FREETYPE_LCD_LERP) {
+        /* ave = (5 * (r + g + b) + b) >> 4, then spread over the pixel's lanes */
+        __m128i ave = _mm_madd_epi16(rgb, _mm_setr_epi16(5, 5, 6, 0, 5, 5, 6, 0));
+        ave = _mm_add_epi32(ave, _mm_shuffle_epi32(ave, _MM_SHUFFLE(2, 3, 0, 1)));
+        ave = _mm_srli_epi32(ave, 4);
+        ave = _mm_packs_epi32(ave, ave);
+        ave = _mm_unpacklo_epi16(ave, ave);
+
+        /* lerp(v, ave) */
+        __m128i delta = _mm_mullo_epi16(_mm_sub_epi16(ave, rgb), _mm_set1_epi16(FREETYPE_LCD_LERP));
+        rgb = _mm_add_epi16(rgb, _mm_srai_epi16(delta, 8));
+    }/* end if */
+
+    /* r >> 3, g >> 2, b >> 3 and 0, then r << 11 | g << 5 | b */
+    rgb = _mm_mulhi_epu16(rgb, _mm_setr_epi16(8192, 16384, 8192, 0, 8192, 16384, 8192, 0));
+    rgb = _mm_madd_epi16(rgb, _mm_setr_epi16(2048, 32, 1, 0, 2048, 32, 1, 0));
+    return _mm_add_epi32(rgb, _mm_shuffle_epi32(rgb, _MM_SHUFFLE(2, 3, 0, 1)));
+}/* end method packTwoTriplesSSE2 */
+
+/* 4 pixels at a time, from 16 byte loads; the pixels whose load would
+   pass the end of the row are left to the portable kernel. */
+static void packLCD16RowSSE2(uint16_t* dst, const uint8_t* src, int width) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i mask = _mm_set1_epi32(0x00FFFFFF);
+    int x = 0;
+
+    for (; x + 6 <= width; x += 4) {
+        /* one triple per 32 bit lane */
+        __m128i v = _mm_loadu_si128((const __m128i*)src);
+        __m128i v01 = _mm_unpacklo_epi32(v, _mm_srli_si128(v, 3));
+        __m128i v23 = _mm_unpacklo_epi32(_mm_srli_si128(v, 6), _mm_srli_si128(v, 9));
+        v = _mm_and_si128(_mm_unpacklo_epi64(v01, v23), mask);
+
+        __m128i lo = packTwoTriplesSSE2(_mm_unpacklo_epi8(v, zero));
+        __m128i hi = packTwoTriplesSSE2(_mm_unpackhi_epi8(v, zero));
+        __m128i p = _mm_unpacklo_epi64(_mm_shuffle_epi32(lo, _MM_SHUFFLE(3, 3, 2, 0)),
+                                       _mm_shuffle_epi32(hi, _MM_SHUFFLE(3, 3, 2, 0)));
+
+        /* unsigned 32 to 16 bits through the signed saturating pack */
+        p = _mm_packs_epi32(_mm_sub_epi32(p, _mm_set1_epi32(0x8000)), zero);
+        p = _mm_xor_si128(p, _mm_set1_epi16((short)0x8000));
+        _mm_storel_epi64((__m128i*)(dst + x), p);
+        src += 12;
+    }/* end for */
+
+    packLCD16Row(dst + x, src, width - x);
+}/* end method packLCD16RowSSE2 */
+#endif /* FREETYPE_LCD_LERP <= 128 */
+
+static inline __m128i packLCD32SSE2(__m128i r, __m128i g, __m128i b) {
+    __m128i a = _mm_max_epi16(_mm_max_epi16(r, g), b);
+    return _mm_or_si128(_mm_or_si128(_mm_slli_epi32(a, LCD_A32_SHIFT), _mm_slli_epi32(r, LCD_R32_SHIFT)),
+                        _mm_or_si128(_mm_slli_epi32(g, LCD_G32_SHIFT), _mm_slli_epi32(b, LCD_B32_SHIFT)));
+}/* end method packLCD32SSE2 */
+
+/* 'sum' / 3 for 16 bit lanes up to 766 */
+static inline __m128i divideBy3SSE2(__m128i sum) {
+    return _mm_srli_epi16(_mm_mulhi_epu16(sum, _mm_set1_epi16((short)43691)), 1);
+}/* end method divideBy3SSE2 */
+
+/* 4 horizontal triples at a time, one per 32 bit lane, from 16 byte
+   loads; 16 vertical ones at a time. */
+static void convertLCDRowSSE2(uint32_t* lcd, uint8_t* a8, const uint8_t* src, int subRow, int width, bool bgr) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi16(1);
+    int x = 0;
+
+    if (subRow == 0) {
+        const __m128i mask = _mm_set1_epi32(0xFF);
+
+        for (; x + 6 <= width; x += 4) {
+            __m128i v = _mm_loadu_si128((const __m128i*)src);
+            __m128i v01 = _mm_unpacklo_epi32(v, _mm_srli_si128(v, 3));
+            __m128i v23 = _mm_unpacklo_epi32(_mm_srli_si128(v, 6), _mm_srli_si128(v, 9));
+            v = _mm_unpacklo_epi64(v01, v23);
+
+            __m128i c0 = _mm_and_si128(v, mask);
+            __m128i c1 = _mm_and_si128(_mm_srli_epi32(v, 8), mask);
+            __m128i c2 = _mm_and_si128(_mm_srli_epi32(v, 16), mask);
+
+            _mm_storeu_si128((__m128i*)(lcd + x), bgr ? packLCD32SSE2(c2, c1, c0) : packLCD32SSE2(c0, c1, c2));
+
+            if (a8) {
+                __m128i sum = _mm_add_epi32(_mm_add_epi32(c0, c1), c2);
+                sum = _mm_add_epi16(_mm_packs_epi32(sum, sum), one);
+                int32_t avg = _mm_cvtsi128_si32(_mm_packus_epi16(divideBy3SSE2(sum), zero));
+                memcpy(a8 + x, &avg, sizeof(avg));
+            }/* end if */
+            src += 12;
+        }/* end for */
+    } else {
+        for (; x + 16 <= width; x += 16) {
+            __m128i c0 = _mm_loadu_si128((const __m128i*)src);
+            __m128i c1 = _mm_loadu_si128((const __m128i*)(src + subRow));
+            __m128i c2 = _mm_loadu_si128((const __m128i*)(src + 2 * subRow));
+            __m128i ch[4];
+
+            ch[LCD_R32_SHIFT >> 3] = bgr ? c2 : c0;
+            ch[LCD_G32_SHIFT >> 3] = c1;
+            ch[LCD_B32_SHIFT >> 3] = bgr ? c0 : c2;
+            ch[LCD_A32_SHIFT >> 3] = _mm_max_epu8(_mm_max_epu8(c0, c1), c2);
+
+            __m128i lo01 = _mm_unpacklo_epi8(ch[0], ch[1]);
+            __m128i hi01 = _mm_unpackhi_epi8(ch[0], ch[1]);
+            __m128i lo23 = _mm_unpacklo_epi8(ch[2], ch[3]);
+            __m128i hi23 = _mm_unpackhi_epi8(ch[2], ch[3]);
+            _mm_storeu_si128((__m128i*)(lcd + x), _mm_unpacklo_epi16(lo01, lo23));
+            _mm_storeu_si128((__m128i*)(lcd + x + 4), _mm_unpackhi_epi16(lo01, lo23));
+            _mm_storeu_si128((__m128i*)(lcd + x + 8), _mm_unpacklo_epi16(hi01, hi23));
+            _mm_storeu_si128((__m128i*)(lcd + x + 12), _mm_unpackhi_epi16(hi01, hi23));
+
+            if (a8) {
+                __m128i lo = _mm_add_epi16(_mm_add_epi16(_mm_unpacklo_epi8(c0, zero), _mm_unpacklo_epi8(c1, zero)),
+                                           _mm_add_epi16(_mm_unpacklo_epi8(c2, zero), one));
+                __m128i hi = _mm_add_epi16(_mm_add_epi16(_mm_unpackhi_epi8(c0, zero), _mm_unpackhi_epi8(c1, zero)),
+                                           _mm_add_epi16(_mm_unpackhi_epi8(c2, zero), one));
+                _mm_storeu_si128((__m128i*)(a8 + x), _mm_packus_epi16(divideBy3SSE2(lo), divideBy3SSE2(hi)));
+            }/* end if */
+            src += 16;
+        }/* end for */
+    }/* end else if */
+
+    convertLCDRow(lcd + x, a8 ? a8 + x : NULL, src, subRow, width - x, bgr);
+}/* end method convertLCDRowSSE2 */
+
+/* 16 pixels at a time. */
+static void expandA8ToLCDRowSSE2(uint32_t* dst, const uint8_t* src, int width) {
+    int x = 0;
+
+    for (; x + 16 <= width; x += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + x));
+        __m128i lo = _mm_unpacklo_epi8(v, v);
+        __m128i hi = _mm_unpackhi_epi8(v, v);
+        _mm_storeu_si128((__m128i*)(dst + x), _mm_unpacklo_epi16(lo, lo));
+        _mm_storeu_si128((__m128i*)(dst + x + 4), _mm_unpackhi_epi16(lo, lo));
+        _mm_storeu_si128((__m128i*)(dst + x + 8), _mm_unpacklo_epi16(hi, hi));
+        _mm_storeu_si128((__m128i*)(dst + x + 12), _mm_unpackhi_epi16(hi, hi));
+    }/* end for */
+
+    expandA8ToLCDRow(dst + x, src + x, width - x);
+}/* end method expandA8ToLCDRowSSE2 */
+
+static bool cpuHasSSE2() {
+    unsigned int eax, ebx, ecx, edx;
+    return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (edx & bit_SSE2);
+}/* end method cpuHasSSE2 */
+
+#elif defined(__ARM_HAVE_NEON)
+/* 8 pixels, a source byte, at a time. */
+static void expandMonoRowNEON(uint8_t* dst, const uint8_t* src, int width) {
+    static const uint8_t kBits[8] = { 0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01 };
+    const uint8x8_t bits = vld1_u8(kBits);
+    int x = 0;
+
+    for (; x + 8 <= width; x += 8) {
+        vst1_u8(dst + x, vtst_u8(vdup_n_u8(*src++), bits));
+    }/* end for */
+
+    expandMonoRow(dst + x, src, width - x);
+}/* end method expandMonoRowNEON */
+
+/* (ave - v) * FREETYPE_LCD_LERP must fit 16 bits */
+#if FREETYPE_LCD_LERP <= 128
+/* 8 pixels at a time, deinterleaved by vld3. */
+static void packLCD16RowNEON(uint16_t* dst, const uint8_t* src, int width) {
+    int x = 0;
+
+    for (; x + 8 <= width; x += 8) {
+        uint8x8x3_t rgb = vld3_u8(src);
+        int16x8_t   r = vreinterpretq_s16_u16(vmovl_u8(rgb.val[0]));
+        int16x8_t   g = vreinterpretq_s16_u16(vmovl_u8(rgb.val[1]));
+        int16x8_t   b = vreinterpretq_s16_u16(vmovl_u8(rgb.val[2]));
+
+        if (FREETYPE_LCD_LERP) {
+            int16x8_t ave = vaddq_s16(vmulq_n_s16(vaddq_s16(vaddq_s16(r, g), b), 5), b);
+            ave = vshrq_n_s16(ave, 4);
+            r = vaddq_s16(r, vshrq_n_s16(vmulq_n_s16(vsubq_s16(ave, r), FREETYPE_LCD_LERP), 8));
+            g = vaddq_s16(g, vshrq_n_s16(vmulq_n_s16(vsubq_s16(ave, g), FREETYPE_LCD_LERP), 8));
+            b = vaddq_s16(b, vshrq_n_s16(vmulq_n_s16(vsubq_s16(ave, b), FREETYPE_LCD_LERP), 8));
+        }/* end if */
+
+        uint16x8_t p = vshlq_n_u16(vshrq_n_u16(vreinterpretq_u16_s16(r), 3), R16_SHIFT);
+        p = vorrq_u16(p, vshlq_n_u16(vshrq_n_u16(vreinterpretq_u16_s16(g), 2), G16_SHIFT));
+        p = vorrq_u16(p, vshrq_n_u16(vreinterpretq_u16_s16(b), 3));
+        vst1q_u16(dst + x, p);
+        src += 24;
+    }/* end for */
+
+    packLCD16Row(dst + x, src, width - x);
+}/* end method packLCD16RowNEON */
+#endif /* FREETYPE_LCD_LERP <= 128 */
+
+/* 8 triples at a time, horizontal ones deinterleaved by vld3. */
+static void convertLCDRowNEON(uint32_t* lcd, uint8_t* a8, const uint8_t* src, int subRow, int width, bool bgr) {
+    int x = 0;
+
+    for (; x + 8 <= width; x += 8) {
+        uint8x8_t   c0, c1, c2;
+        uint8x8x4_t px;
+
+        if (subRow == 0) {
+            uint8x8x3_t rgb = vld3_u8(src);
+            c0 = rgb.val[0];
+            c1 = rgb.val[1];
+            c2 = rgb.val[2];
+            src += 24;
+        } else {
+            c0 = vld1_u8(src);
+            c1 = vld1_u8(src + subRow);
+            c2 = vld1_u8(src + 2 * subRow);
+            src += 8;
+        }/* end else if */
+
+        /* vst4 stores lane k of each pixel k bytes in, at shift 8 * k */
+        px.val[LCD_R32_SHIFT >> 3] = bgr ? c2 : c0;
+        px.val[LCD_G32_SHIFT >> 3] = c1;
+        px.val[LCD_B32_SHIFT >> 3] = bgr ? c0 : c2;
+        px.val[LCD_A32_SHIFT >> 3] = vmax_u8(vmax_u8(c0, c1), c2);
+        vst4_u8((uint8_t*)(lcd + x), px);
+
+        if (a8) {
+            /* (c0 + c1 + c2 + 1) / 3 as (sum * 43691) >> 17 */
+            uint16x8_t sum = vaddq_u16(vaddw_u8(vaddl_u8(c0, c1), c2), vdupq_n_u16(1));
+            uint16x4_t lo = vshrn_n_u32(vmull_u16(vget_low_u16(sum), vdup_n_u16(43691)), 16);
+            uint16x4_t hi = vshrn_n_u32(vmull_u16(vget_high_u16(sum), vdup_n_u16(43691)), 16);
+            vst1_u8(a8 + x, vmovn_u16(vshrq_n_u16(vcombine_u16(lo, hi), 1)));
+        }/* end if */
+    }/* end for */
+
+    convertLCDRow(lcd + x, a8 ? a8 + x : NULL, src, subRow, width - x, bgr);
+}/* end method convertLCDRowNEON */
+
+/* 8 pixels at a time. */
+static void expandA8ToLCDRowNEON(uint32_t* dst, const uint8_t* src, int width) {
+    int x = 0;
+
+    for (; x + 8 <= width; x += 8) {
+        uint8x8x4_t px;
+        px.val[0] = px.val[1] = px.val[2] = px.val[3] = vld1_u8(src + x);
+        vst4_u8((uint8_t*)(dst + x), px);
+    }/* end for */
+
+    expandA8ToLCDRow(dst + x, src + x, width - x);
+}/* end method expandA8ToLCDRowNEON */
+
+/* The kernel may be running on an ARMv7 without NEON. */
+static bool cpuHasNEON() {
+    char    line[512];
+    bool    found = false;
+    FILE*   fp = fopen("/proc/cpuinfo", "r");
+
+    if (fp == NULL) {
+        return false;
+    }/* end if */
+
+    while (!found && fgets(line, sizeof(line), fp)) {
+        if (strncmp(line, "Features", 8) == 0) {
+            found = strstr(line, " neon") != NULL || strstr(line, " asimd") != NULL;
+        }/* end if */
+    }/* end while */
+
+    fclose(fp);
+    return found;
+}/* end method cpuHasNEON */
+#endif /* __SSE2__ */
+
+void InitBitmapKernelsFT() {
+    const char* simd = getenv(FT_SIMD_ENV);
+
+    gExpandMonoRowFT = expandMonoRow;
+    gPackLCD16RowFT = packLCD16Row;
+    gConvertLCDRowFT = convertLCDRow;
+    gExpandA8ToLCDRowFT = expandA8ToLCDRow;
+
+    if (simd && atoi(simd) == 0) {
+        return;
+    }/* end if */
+
+#if defined(__SSE2__)
+    if (cpuHasSSE2()) {
+        gExpandMonoRowFT = expandMonoRowSSE2;
+        gConvertLCDRowFT = convertLCDRowSSE2;
+        gExpandA8ToLCDRowFT = expandA8ToLCDRowSSE2;
+#if FREETYPE_LCD_LERP <= 128
+        gPackLCD16RowFT = packLCD16RowSSE2;
+#endif
+    }/* end if */
+#elif defined(__ARM_HAVE_NEON)
+    if (cpuHasNEON()) {
+        gExpandMonoRowFT = expandMonoRowNEON;
+        gConvertLCDRowFT = convertLCDRowNEON;
+        gExpandA8ToLCDRowFT = expandA8ToLCDRowNEON;
+#if FREETYPE_LCD_LERP <= 128
+        gPackLCD16RowFT = packLCD16RowNEON;
+#endif
+    }/* end if */
+#endif /* __SSE2__ */
+}/* end method InitBitmapKernelsFT */
 ////////////////////////////////////////////////////////////////////////
 
 #ifdef FT_ENABLE_LOG
@@ -272,14 +920,40 @@ void copyFT2LCD16(uint32_t rowBytes, uint16_t width, uint16_t height, uint16_t *
 #define FontFTAddAtHead(__l, __r) FT_AddAtHead((BasicNodePtr*)__l, (BasicNodePtr)__r)
 //////////////////////////////////////////////////////////////////////////
 
+/* see FontEngineAtomics.h */
+using fem::acquireLoad;
+using fem::releaseStore;
+
 class FontEngineFT;
 class FontFT;
 class FontInstFT;
 class FontScalerFT;
 
+/* gMutexFT guards the library, the font list and the opening and closing of
+   faces. Everything done with one face, the FT_Size objects of its instances
+   included, is guarded by that font's lock (see FontFT::lock()). When both
+   are needed gMutexFT is taken first. */
 static android::Mutex  gMutexFT;
 static int             gCountFontFT;
 static FT_Library      gLibraryFT;
+static int             gFaceReplicasFT;  /* replica cap per font */
+static volatile int32_t  gMemoryBytesFT;   /* heap held by the libraries of gMemoryFT */
+static size_t          gMemoryBudgetFT;  /* 0 if none */
+static volatile uint32_t gUseClockFT;    /* stamps the last use of font instances */
+
+#ifdef ENABLE_FONTINSTLIST
+/* Idle font instances, most recently used first; guarded by gMutexFT. */
+static FontInstFT*     gIdleInstHeadFT;
+static FontInstFT*     gIdleInstTailFT;
+static int             gIdleInstCountFT;
+#endif /* ENABLE_FONTINSTLIST */
+static volatile int32_t  gIdleReplicasFT;  /* idle face replicas of all fonts */
+
+/* Threads with a MemoryMeterFT, each finding its counter under
+   gMeterKeyFT. */
+static pthread_once_t    gMeterOnceFT = PTHREAD_ONCE_INIT;
+static pthread_key_t     gMeterKeyFT;
+static volatile int32_t  gMetersFT;
 static bool            gLCDSupportValid;  /* true iff |gLCDSupport| has been set. */
 static bool            gLCDSupport;  /* true iff LCD is supported by the runtime. */
 
@@ -297,6 +971,24 @@ struct BasicNode_t
     BasicNodePtr  next;
 };
 
+typedef struct FontMap_t  FontMap;
+typedef FontMap*          FontMapPtr;
+
+/* Read only mapping of a font file, shared by the fonts and query faces
+   opened from it; guarded by gMutexMapFT. */
+struct FontMap_t
+{
+    FontMapPtr      next;
+    dev_t           device;   /* identify the file whatever path named it */
+    ino_t           inode;
+    const uint8_t*  base;
+    size_t          size;
+    int             refCnt;
+};/* end struct FontMap_t */
+
+static android::Mutex  gMutexMapFT;
+static FontMapPtr      gFontMapList;
+
 typedef struct FontNode_t  FontNode;
 typedef FontNode*          FontNodePtr;
 
@@ -307,16 +999,89 @@ struct FontNode_t
     FontFT*      font;
 };/* end struct FontNode_t */
 
+/* The keys a font is indexed by. Path and content keys are only given to
+   fonts which FreeType opened from their file, as a buffer or a stream
+   belongs to the caller that passed it. Sharing a face by content is thus
+   one directional: a buffer naming the data of a font opened by path finds
+   that font, but a path naming the data of a font opened from a buffer
+   gets a face of its own, which must not read a buffer the caller may
+   free. */
+enum FontIndexKind
+{
+    FONT_INDEX_ID,          /* FontScalerInfo::fontID */
+    FONT_INDEX_BUFFER,      /* address of the font file buffer */
+    FONT_INDEX_PATH,        /* system path of the font file */
+    FONT_INDEX_CONTENT      /* size and sfnt table directory of the font file */
+};
+
+typedef struct FontIndexNode_t  FontIndexNode;
+typedef FontIndexNode*          FontIndexNodePtr;
+
+/* font index entry */
+struct FontIndexNode_t
+{
+    FontIndexNodePtr  next;
+    FontFT*           font;
+    uint32_t          hash;
+    uint32_t          kind;
+    uint32_t          fontID;   /* for FONT_INDEX_ID */
+};/* end struct FontIndexNode_t */
+
+/* Identifies font data whatever it was opened from. */
+struct FontContentKey
+{
+    bool      valid;
+    size_t    size;
+    uint32_t  hash;
+};/* end struct FontContentKey */
+
+/* glyph metrics cache entry; key is GLYPH_KEY_NONE when unused */
+struct GlyphMetricsEntryFT
+{
+    uint32_t      key;
+    GlyphMetrics  metrics;
+};/* end struct GlyphMetricsEntryFT */
+
+/* a hinted, and emboldened if asked, outline glyph as loaded in the slot */
+struct HintedGlyphFT
+{
+    bool        valid;
+    uint16_t    glyphID;
+    FT_Outline  outline;    /* allocated with FT_Outline_New() */
+    FT_Vector   advance;
+    FT_Fixed    linearHoriAdvance;
+    FT_Pos      lsbDelta;
+    FT_Pos      rsbDelta;
+};/* end struct HintedGlyphFT */
+
+typedef struct FaceReplica_t  FaceReplica;
+typedef FaceReplica*          FaceReplicaPtr;
+
+/* An extra FT_Face of a font, used by one glyph call at a time. The sizes are
+   kept most recently used first, each tagged with the serial of the font
+   instance it was set up for. */
+struct FaceReplica_t
+{
+    FaceReplicaPtr  next;
+    FT_Library      library;        /* of the face; see OpenFaceLibraryFT() */
+    FT_Face         face;
+    uint32_t        activeSerial;   /* instance whose size and transform are set */
+    uint32_t        serials[FACE_REPLICA_SIZES];
+    FT_Size         sizes[FACE_REPLICA_SIZES];
+    int32_t         bytes;          /* taken by the face and its sizes */
+};/* end struct FaceReplica_t */
+
 class FontEngineFT : public FontEngine
 {
 public:
     FontEngineFT()
         : name("freetype"), pFontList(NULL)
     {
+        memset(fontIndex, 0, sizeof(fontIndex));
         FT_LOG("%s engine instance created\n", name);
     }
 
-    ~FontEngineFT() {}
+    ~FontEngineFT();
 
     /* Return Font engine name */
     const char* getName() const { return name; }
@@ -462,13 +1227,54 @@ public:
     */
     AdvancedTypefaceMetrics* getAdvancedTypefaceMetrics(const void* buffer, const uint32_t bufferLength);
 
+    /** Returns the font formats handled by the engine; the sfnt based
+        formats built into the FreeType library.
+    */
+    uint32_t getSupportedFormats() const
+    {
+        return fem::FORMAT_TRUETYPE | fem::FORMAT_OPENTYPE_CFF | fem::FORMAT_COLLECTION;
+    }
+
+    /** Returns the features of the engine. FreeType is called under the
+        engine's own locks and the batched glyph calls are native.
+    */
+    uint32_t getFeatures() const
+    {
+        return fem::ENGINE_THREAD_SAFE | fem::ENGINE_BATCHED_GLYPHS | fem::ENGINE_DIRECT_RENDER |
+               fem::ENGINE_GLYPH_CACHE;
+    }
+
+    /** Releases FreeType memory: at TRIM_MEMORY_IDLE the idle font
+        instances, fonts and face replicas, and at TRIM_MEMORY_COMPLETE also
+        the sizes and glyph caches of the font instances in use.
+    */
+    void trimMemory(fem::TrimLevel level);
+
 private:
     FontScaler* getFontScaler(const FontScalerInfo& desc);
-    FontFT* getFont(const FontScalerInfo& desc);
+
+    /* Deletes idle font instances, least recently used first, until
+       FreeType holds at most 'limit' bytes or none is left. Called with
+       gMutexFT and no font lock held. */
+    void trimIdleFonts(size_t limit);
+
+    /* Frees memory, least recently used first, until FreeType holds at
+       most 'limit' bytes or only objects in use are left; the font
+       instances in use whose font is not busy are trimmed too if 'inUse'.
+       Called with gMutexFT and no font lock held. */
+    void trimFonts(size_t limit, bool inUse);
+    FontFT* getFont(const FontScalerInfo& desc, FontContentKey& content);
     FontNodePtr getList() { return this->pFontList; }
 
+    /* The font index; called with gMutexFT held. */
+    FontFT* findFont(uint32_t kind, uint32_t hash, const FontScalerInfo& desc, const FontContentKey& content);
+    void indexFont(const FontScalerInfo& desc, const FontContentKey& content, FontFT* font);
+    void addIndex(uint32_t kind, uint32_t hash, uint32_t fontID, FontFT* font);
+    void unindexFont(FontFT* font);
+
     const char* name;
     FontNodePtr  pFontList;
+    FontIndexNodePtr  fontIndex[FONT_INDEX_BUCKETS];
 
     /* Array of supported font formats. */
     static const char* const formats[];
@@ -479,6 +1285,19 @@ private:
 
 const char* const FontEngineFT::formats[] = { "ttf", NULL };
 
+/* Everything that tells the font instances of one font apart; computed
+   once per scaler request. */
+struct FontInstKey
+{
+    FT_Matrix       ftMatrix22;
+    FEM16Dot16      fScaleX, fScaleY;
+    uint32_t        loadGlyphFlags;
+    uint8_t         fontInstFlags;
+    fem::AliasMode  maskFormat;
+    bool            subpixelPositioning;
+    uint32_t        hash;
+};/* end struct FontInstKey */
+
 #ifdef ENABLE_FONTINSTLIST
 typedef struct FontInstNode_t  FontInstNode;
 typedef FontInstNode*          FontInstNodePtr;
@@ -491,6 +1310,40 @@ struct FontInstNode_t
 };/* end struct FontInstNode_t */
 #endif /* ENABLE_FONTINSTLIST */
 
+/* Block cache in front of the stream of one font. It is only read by
+   FreeType through the font's face, so it is guarded by the font's lock
+   like the face itself. */
+class StreamCacheFT
+{
+public:
+    StreamCacheFT(void* stream, unsigned long size);
+    ~StreamCacheFT();
+
+    bool success() { return pBlocks != NULL; }
+
+    /* Reads like an FT_Stream: copies 'count' bytes at 'offset' to
+       'buffer' and returns the number copied; a 'count' of 0 is a seek,
+       returning 0 on success. */
+    unsigned long read(unsigned long offset, unsigned char* buffer, unsigned long count);
+
+private:
+    StreamCacheFT(const StreamCacheFT&);
+    StreamCacheFT& operator = (const StreamCacheFT&);
+
+    int findBlock(uint32_t index);
+    int loadBlocks(uint32_t index);
+
+    void*           pStream;
+    unsigned long   streamSize;
+    uint8_t*        pBlocks;      /* the cached blocks, then the read-ahead buffer */
+    uint32_t        blockIndex[STREAM_CACHE_BLOCKS];  /* STREAM_BLOCK_NONE if unused */
+    uint32_t        blockStamp[STREAM_CACHE_BLOCKS];  /* of the last use */
+    uint32_t        stamp;
+    int             lastSlot;     /* of the last block read */
+    uint32_t        nextIndex;    /* block following the last ones loaded */
+    uint32_t        readAhead;    /* blocks a miss on nextIndex loads */
+};/* end class StreamCacheFT */
+
 class FontFT
 {
 public:
@@ -500,47 +1353,134 @@ public:
     FontScaler* getFontScaler(const FontScalerInfo& desc);
     bool success() { return bInitialized; }
 
+    /* true if FreeType opened the face from the font file itself */
+    bool fromPath() const { return pBuffer == NULL && streamRecFT.descriptor.pointer == NULL; }
+
+    /* Returns the character of each glyph of the face, 0 for glyphs without
+       one; built on first use. Returns NULL if memory ran out. */
+    const int32_t* getGlyphsUnicode();
+
+    /* Returns the glyph of a character, 0 if the face does not cover it.
+       Takes no lock once the cmap page of the character is filled. */
+    uint16_t getCharGlyph(int32_t charUniCode);
+
+    /* Returns the lock guarding pFace and the font instances. */
+    android::Mutex& lock()
+    {
+#ifdef ENABLE_FACE_LOCK
+        return faceLock;
+#else
+        return gMutexGlyphFT;
+#endif /* ENABLE_FACE_LOCK */
+    }
+
 private:
     FontFT(FontFT&);
     FontFT& operator = (FontFT&);
 
 #ifdef ENABLE_FONTINSTLIST
-    FontInstNodePtr searchFontInst(const FontScalerInfo& desc);
-    FontInstNodePtr getList() { return this->pFontInstList; }
+    FontInstFT* searchFontInst(const FontInstKey& key);
 #endif /* ENABLE_FONTINSTLIST */
 
+    void getInstKey(const FontScalerInfo& desc, FontInstKey& key);
     void getTransMatrix(const FontScalerInfo& desc, FT_Matrix& ftMatrix22, FEM16Dot16& fScaleX, FEM16Dot16& fScaleY, uint32_t& loadGlyphFlags);
 
+    /* Hands out an idle replica, opening one while under the cap; returns
+       NULL when there is none to be had. */
+    FaceReplicaPtr takeReplica();
+    void giveReplica(FaceReplicaPtr replica);
+
+    /* Closes the idle replicas; called with gMutexFT held. */
+    void closeReplicas();
+
+    const uint16_t* fillCmapPage(uint32_t page);
+
     FT_StreamRec      streamRecFT;
+    FT_Library        faceLibrary;  /* of pFace; see OpenFaceLibraryFT() */
     FT_Face           pFace;   /* we own this */
 
     uint32_t          fontID;
     const char*       pPath;   /* we own this */
     const uint8_t*    pBuffer; /* font file buffer */
+    FontMapPtr        pMap;    /* shared mapping of pPath; NULL if none */
+    StreamCacheFT*    pStreamCache;  /* in front of the stream; NULL if none */
 
     bool              bInitialized;
-    uint16_t          refCnt;
+    uint16_t          refCnt;  /* guarded by gMutexFT */
+
+    size_t            contentSize;   /* content key, of the buffer for a buffer font; 0 if the font has none */
+    uint32_t          contentHash;
+
+    int32_t           faceBytes;     /* taken by opening pFace */
 
 #ifdef ENABLE_FONTINSTLIST
-    FontInstNodePtr   pFontInstList;
+    FontInstNodePtr   pFontInstBuckets[FONTINST_BUCKETS];
 #endif /* ENABLE_FONTINSTLIST */
 
+#ifdef ENABLE_FACE_LOCK
+    android::Mutex    faceLock;
+#else
+    static android::Mutex  gMutexGlyphFT;
+#endif /* ENABLE_FACE_LOCK */
+
+    uint32_t          instSerial;     /* serial of the last font instance */
+    uint32_t          activeSerial;   /* serial of the font instance whose size
+                                         and transform are set on pFace; 0 if
+                                         none. Guarded by lock() */
+
+    int32_t* volatile pGlyphsUnicode; /* written once under lock() */
+    uint16_t* volatile cmapPages[CMAP_PAGE_COUNT];  /* each written once under lock() */
+
+    android::Mutex    replicaLock;    /* guards the fields below */
+    FaceReplicaPtr    pReplicaList;   /* idle replicas */
+    int32_t           replicaBytes;   /* taken by the idle replicas */
+    int               replicaCount;   /* replicas open or being opened */
+    bool              replicable;
+
     friend class FontScalerFT;
     friend class FontEngineFT;
     friend class FontInstFT;
+    friend class FaceLeaseFT;
 };
 
 class FontInstFT
 {
 public :
-    FontInstFT(const FontScalerInfo& desc, FontFT* font);
+    FontInstFT(const FontInstKey& key, FontFT* font);
     ~FontInstFT();
 
     FT_Error setupSize();
+    FT_Error setupReplica(FaceReplicaPtr replica);
 
     bool success() { return bInitialized; }
 
+    /* Drops the FT_Size and the glyph caches, which are rebuilt on next
+       use; called with pFont->lock() held. */
+    void trim();
+
+#ifdef ENABLE_FONTINSTLIST
+    bool matches(const FontInstKey& key) const;
+
+    /* Moves the instance onto and off the idle list; gMutexFT held. */
+    void enterIdle();
+    void leaveIdle();
+
+    /* Deletes idle instances, least recently used first, until at most
+       'maxCount' are left; called with gMutexFT and no font lock held. */
+    static void trimIdle(int maxCount);
+#endif /* ENABLE_FONTINSTLIST */
+
+    /* Glyph cache; called with cacheLock held. */
+    uint32_t glyphKey(uint16_t glyphID, FEM16Dot16 fracX, FEM16Dot16 fracY) const;
+    bool findMetrics(uint32_t key, GlyphMetrics& gm);
+    void putMetrics(uint32_t key, const GlyphMetrics& gm);
+    HintedGlyphFT* findHinted(uint16_t glyphID);
+    void putHinted(uint16_t glyphID, FT_GlyphSlot slot);
+    void freeCaches();
+
 private:
+    FT_Error newSize();
+
     /* Specify the kerning, hinting, emboldening and embedded-bitmap status
        for the font scaler.
     */
@@ -550,18 +1490,63 @@ private:
     FEM16Dot16       fScaleX, fScaleY;
     FT_Matrix        ftMatrix22;
     FT_Size          ftSize;
+    int32_t          sizeBytes;   /* taken by setting ftSize up; 0 if none */
     uint32_t         loadGlyphFlags;
     fem::AliasMode   maskFormat;  /* mono, gray, lcd */
 
     FontFT          *pFont;
-    uint16_t         refCnt;
+    uint16_t         refCnt;  /* guarded by pFont->lock() */
+    uint32_t         serial;  /* tags the FT_Size objects of the replicas */
+    uint32_t         hash;    /* of the instance key */
+    volatile uint32_t  lastUse;  /* gUseClockFT when last leased a face */
+
+    /* The glyph cache is shared by the scalers of the instance, which may be
+       on different faces at once. It is taken with or without a face
+       leased, never the other way round. */
+    android::Mutex        cacheLock;
+    GlyphMetricsEntryFT  *pMetricsCache;   /* allocated on first use */
+    HintedGlyphFT        *pHintedCache;    /* allocated on first use */
+    uint32_t              hintedCacheSize;
+
+#ifdef ENABLE_FONTINSTLIST
+    FontInstFT      *idlePrev;
+    FontInstFT      *idleNext;
+#endif /* ENABLE_FONTINSTLIST */
 
     bool             bInitialized;
 
     friend class FontFT;
+    friend class FontEngineFT;
     friend class FontScalerFT;
+    friend class FaceLeaseFT;
 };/* end class FontInstFT */
 
+#ifndef ENABLE_FACE_LOCK
+android::Mutex FontFT::gMutexGlyphFT;
+#endif /* ENABLE_FACE_LOCK */
+
+/* Gives a glyph call a face set up for the font instance: the font's own
+   face if its lock is free, otherwise a replica if the font can have one,
+   otherwise the font's own face once its lock is free. */
+class FaceLeaseFT
+{
+public:
+    FaceLeaseFT(FontInstFT* fontInst);
+    ~FaceLeaseFT();
+
+    FT_Face face() const { return ftFace; }
+    FT_Error error() const { return err; }
+
+private:
+    FaceLeaseFT(const FaceLeaseFT&);
+    FaceLeaseFT& operator = (const FaceLeaseFT&);
+
+    FontFT*         pFont;
+    FaceReplicaPtr  pReplica;
+    FT_Face         ftFace;
+    FT_Error        err;
+};/* end class FaceLeaseFT */
+
 class FontScalerFT : public FontScaler
 {
 public:
@@ -578,12 +1563,38 @@ public:
     void getGlyphImage(uint16_t glyphID, FEM16Dot16 fracX, FEM16Dot16 fracY, uint32_t rowBytes, uint16_t width, uint16_t height, uint8_t *buffer);
     void getFontMetrics(FontMetrics* mX, FontMetrics* mY);
     GlyphOutline* getGlyphOutline(uint16_t glyphID, FEM16Dot16 fracX, FEM16Dot16 fracY);
+    bool loadGlyphOutline(uint16_t glyphID, FEM16Dot16 fracX, FEM16Dot16 fracY, GlyphOutlineBuffer* outline);
+    bool decomposeGlyphOutline(uint16_t glyphID, FEM16Dot16 fracX, FEM16Dot16 fracY, GlyphOutlineSink* sink);
+    bool getGlyphMetricsAndImage(uint16_t glyphID, FEM16Dot16 fracX, FEM16Dot16 fracY, GlyphMetrics* metrics, GlyphImageBuffer* image);
+
+    /* Batched glyph methods; lease a face and set the size up once. */
+    void getGlyphsAdvance(uint32_t count, const uint16_t glyphIDs[], const FEM16Dot16 fracX[], const FEM16Dot16 fracY[], GlyphMetrics metrics[]);
+    void getGlyphsMetrics(uint32_t count, const uint16_t glyphIDs[], const FEM16Dot16 fracX[], const FEM16Dot16 fracY[], GlyphMetrics metrics[]);
+    void getGlyphsImage(uint32_t count, const uint16_t glyphIDs[], const FEM16Dot16 fracX[], const FEM16Dot16 fracY[], const GlyphImageSlot slots[]);
+    void getGlyphsOutline(uint32_t count, const uint16_t glyphIDs[], const FEM16Dot16 fracX[], const FEM16Dot16 fracY[], GlyphOutline* outlines[]);
 
 private:
-    void emboldenOutline(FT_Outline* outline);
+    /* Per glyph work; called with a face leased and set up for the instance. */
+    GlyphMetrics generateAdvance(FT_Face ftFace, uint16_t glyphID, FEM16Dot16 fracX, FEM16Dot16 fracY);
+    GlyphMetrics generateMetrics(FT_Face ftFace, uint16_t glyphID, FEM16Dot16 fracX, FEM16Dot16 fracY);
+    void generateImage(FT_Face ftFace, uint16_t glyphID, FEM16Dot16 fracX, FEM16Dot16 fracY, uint32_t rowBytes, uint16_t width, uint16_t height, uint8_t *buffer);
+    GlyphOutline* generateOutline(FT_Face ftFace, uint16_t glyphID, FEM16Dot16 fracX, FEM16Dot16 fracY);
+
+    /* Fill in 'gm' from a hinted glyph. */
+    void setBounds(const FT_Outline* outline, FEM16Dot16 fracX, FEM16Dot16 fracY, GlyphMetrics& gm);
+    void setAdvance(const FT_Vector& advance, FT_Fixed linearHoriAdvance, FT_Pos lsbDelta, FT_Pos rsbDelta, GlyphMetrics& gm);
+
+    /* Moves the outline to its place in the image for the subpixel offset. */
+    void translateOutline(FT_Outline* outline, FEM16Dot16 fracX, FEM16Dot16 fracY);
+    void renderOutline(FT_Face ftFace, FT_Outline* outline, FEM16Dot16 fracX, FEM16Dot16 fracY, uint32_t rowBytes, uint16_t width, uint16_t height, uint8_t *buffer);
+
+    /* Loads the glyph into the slot; the outline is valid until the next load. */
+    FT_Outline* loadOutline(FT_Face ftFace, uint16_t glyphID);
+    static void copyOutline(const FT_Outline* ftOtln, GlyphOutline* pGO);
+
+    void emboldenOutline(FT_Face ftFace, FT_Outline* outline);
 
     FontInstFT*  pFontInst;
-    FT_Face      ftFace;        /* convinence pointer */
 
     bool         bInitialized;
 
@@ -591,6 +1602,62 @@ private:
     friend class FontInstFT;
 };/* end class FontScalerFT */
 
+/*
+   The path and buffer query APIs of FontEngineFT open their faces in
+   gLibraryFT and keep a small LRU pool of them, keyed by font path or by
+   buffer length and its content key (see QueryHashFT()), so that a buffer
+   freed and reallocated at the same address is not mistaken for the old
+   one. The key hashes only the sfnt table directory, or the first
+   FONT_CONTENT_HASH_LEN bytes of other formats, not the whole buffer: two
+   fonts of the same length sharing those bytes share a pooled face. Each
+   pooled face counts in gCountFontFT like an open font.
+
+   Faces in the pool are only used with gMutexFT held, which the QueryFaceFT
+   object takes for its lifetime.
+*/
+#define QUERY_FACE_POOL_SIZE      8
+
+typedef struct QueryFace_t
+{
+    struct QueryFace_t*  next;          /* most recently used first */
+    char*                pPath;         /* we own this; NULL for buffer faces */
+    const void*          pBuffer;
+    uint32_t             bufferLength;
+    uint32_t             hash;          /* content key of the buffer */
+    FontMapPtr           pMap;          /* mapping of the path, if any */
+    FT_Face              face;
+} QueryFace;
+
+static QueryFace*      gQueryFaceList = NULL;
+
+class QueryFaceFT
+{
+public:
+    QueryFaceFT(const char path[]);
+    QueryFaceFT(const void* buffer, uint32_t bufferLength);
+
+    /* Returns the pooled face; NULL on error. */
+    FT_Face getFace() const { return pFace; }
+
+    /* Returns the error of opening the face; 0 on success. */
+    FT_Error getError() const { return error; }
+
+    /* Closes every pooled face. */
+    static void purge();
+
+private:
+    QueryFaceFT(const QueryFaceFT&);
+    QueryFaceFT& operator = (const QueryFaceFT&);
+
+    void acquire(const char path[], const void* buffer, uint32_t bufferLength);
+    static void close(QueryFace* entry);
+
+    uint32_t                  hash;     /* of the buffer; hashed before locking */
+    android::Mutex::Autolock  lock;
+    FT_Face                   pFace;
+    FT_Error                  error;
+};/* end class QueryFaceFT */
+
 /**
  * Global Methods.
  */
@@ -612,55 +1679,678 @@ static void FT_AddAtHead(BasicNodePtr *list,  BasicNodePtr r)
     *list = r;
 }/* end method FT_AddAtHead */
 
-static bool InitFreetype()
+/* Each block FreeType allocates is preceded by its size, so that the
+   bytes it holds can be counted. */
+union MemoryHeaderFT
 {
-    FT_Error err = FT_Init_FreeType(&gLibraryFT);
-    if (err) {
-        FT_LOG("failed to initalized FreeType\n");
-        return false;
-    }/* end if */
-
-#if defined(SUPPORT_LCDTEXT)
-    /* Setup LCD filtering. This reduces colour fringes for LCD rendered glyphs. */
-    err = FT_Library_SetLcdFilter(gLibraryFT, FT_LCD_FILTER_DEFAULT);
-    gLCDSupport = err == 0;
-#endif
-    gLCDSupportValid = true;
+    size_t  size;
+    double  align;
+};/* end union MemoryHeaderFT */
 
-    return true;
-}/* end method InitFreetype */
-
-/**
- * FontEngineFT
- */
-fem::EngineCapability FontEngineFT::getCapabilities(FontScalerInfo& desc) const
+static void CreateMeterKeyFT()
 {
-    FT_UNUSED(desc);
-    return fem::EngineCapability(fem::CAN_RENDER_MONO | fem::CAN_RENDER_GRAY);
-}/* end method getCapabilities */
+    pthread_key_create(&gMeterKeyFT, NULL);
+}/* end method CreateMeterKeyFT */
 
-/*
- * Given system path to font file; return font's name and style. It also
- * return a flag which tells about whether the font fixed width.
- */
-size_t FontEngineFT::getFontNameAndAttribute(const char path[], char name[], size_t length, fem::FontStyle* style, bool* isFixedWidth)
+/* Counts the bytes FreeType allocates, net of those it frees, on the calling
+   thread while it lives, so that a face or a size can be charged with what
+   its creation took. */
+class MemoryMeterFT
 {
-    FT_Library  library;
-    size_t count = 0;
+public:
+    MemoryMeterFT() : netBytes(0)
+    {
+        pthread_once(&gMeterOnceFT, CreateMeterKeyFT);
+        pthread_setspecific(gMeterKeyFT, &netBytes);
+        __sync_fetch_and_add(&gMetersFT, 1);
+    }/* end constructor MemoryMeterFT */
 
-    assert(path);
+    ~MemoryMeterFT()
+    {
+        __sync_fetch_and_sub(&gMetersFT, 1);
+        pthread_setspecific(gMeterKeyFT, NULL);
+    }/* end destructor MemoryMeterFT */
 
-    if (path) {
-        FT_Face face;
+    int32_t bytes() const { return netBytes; }
 
-        if (FT_Init_FreeType(&library)) {
-            FT_LOG("failed to initalized FreeType\n");
-            return 0;
+private:
+    MemoryMeterFT(MemoryMeterFT&);
+    MemoryMeterFT& operator = (MemoryMeterFT&);
+
+    int32_t  netBytes;
+};/* end class MemoryMeterFT */
+
+/* Adds 'bytes' to the meter of the calling thread, if it has one. */
+static inline void MeterBytesFT(int32_t bytes)
+{
+    if (acquireLoad(&gMetersFT) > 0) {
+        int32_t* netBytes = (int32_t*)pthread_getspecific(gMeterKeyFT);
+
+        if (netBytes) {
+            *netBytes += bytes;
+        }/* end if */
+    }/* end if */
+}/* end method MeterBytesFT */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+    static void* ft_memory_alloc(FT_Memory memory, long size)
+    {
+        MemoryHeaderFT* header = (MemoryHeaderFT*)malloc(sizeof(MemoryHeaderFT) + size);
+        FT_UNUSED(memory);
+
+        if (header == NULL) {
+            return NULL;
+        }/* end if */
+
+        header->size = (size_t)size;
+        __sync_fetch_and_add(&gMemoryBytesFT, (int32_t)size);
+        MeterBytesFT((int32_t)size);
+        return header + 1;
+    }/* end method ft_memory_alloc */
+
+    static void ft_memory_free(FT_Memory memory, void* block)
+    {
+        MemoryHeaderFT* header = (MemoryHeaderFT*)block - 1;
+        FT_UNUSED(memory);
+
+        __sync_fetch_and_sub(&gMemoryBytesFT, (int32_t)header->size);
+        MeterBytesFT(-(int32_t)header->size);
+        free(header);
+    }/* end method ft_memory_free */
+
+    static void* ft_memory_realloc(FT_Memory memory, long curSize, long newSize, void* block)
+    {
+        MemoryHeaderFT* header = (MemoryHeaderFT*)block - 1;
+        size_t          oldSize = header->size;
+        FT_UNUSED(memory);
+        FT_UNUSED(curSize);
+
+        header = (MemoryHeaderFT*)realloc(header, sizeof(MemoryHeaderFT) + newSize);
+        if (header == NULL) {
+            return NULL;
+        }/* end if */
+
+        header->size = (size_t)newSize;
+        __sync_fetch_and_add(&gMemoryBytesFT, (int32_t)((size_t)newSize - oldSize));
+        MeterBytesFT((int32_t)((size_t)newSize - oldSize));
+        return header + 1;
+    }/* end method ft_memory_realloc */
+#ifdef __cplusplus
+}/* end extern "C" */
+#endif
+
+static struct FT_MemoryRec_  gMemoryFT = { NULL, ft_memory_alloc, ft_memory_free, ft_memory_realloc };
+
+/* true if FreeType holds more than 'limit' bytes */
+static bool OverMemoryBudget(size_t limit)
+{
+    return (size_t)acquireLoad(&gMemoryBytesFT) > limit;
+}/* end method OverMemoryBudget */
+
+static bool InitFreetype()
+{
+    /* the library is not made with FT_Init_FreeType() so that its memory
+       is counted; it is released with FT_Done_Library() */
+    FT_Error err = FT_New_Library(&gMemoryFT, &gLibraryFT);
+    if (err) {
+        FT_LOG("failed to initalized FreeType\n");
+        return false;
+    }/* end if */
+
+    FT_Add_Default_Modules(gLibraryFT);
+
+#if defined(SUPPORT_LCDTEXT)
+    /* Setup LCD filtering. This reduces colour fringes for LCD rendered glyphs. */
+    err = FT_Library_SetLcdFilter(gLibraryFT, FT_LCD_FILTER_DEFAULT);
+    gLCDSupport = err == 0;
+#endif
+    gLCDSupportValid = true;
+
+    InitBitmapKernelsFT();
+
+#ifdef ENABLE_FACE_LOCK
+    const char* replicas = getenv(FT_FACE_REPLICAS_ENV);
+    gFaceReplicasFT = replicas ? atoi(replicas) : FT_FACE_REPLICAS_MAX;
+#else
+    /* faces can not be used concurrently */
+    gFaceReplicasFT = 0;
+#endif /* ENABLE_FACE_LOCK */
+
+    const char* budget = getenv(FT_MEMORY_BUDGET_ENV);
+    gMemoryBudgetFT = (size_t)(budget ? atoi(budget) : FT_MEMORY_BUDGET_KB) * 1024;
+
+    return true;
+}/* end method InitFreetype */
+
+static void DoneFreetype()
+{
+    FT_LOG("FT_Done_Library\n");
+    FT_Done_Library(gLibraryFT);
+    gLibraryFT = NULL;
+}/* end method DoneFreetype */
+
+/* Returns in 'library' the FT_Library to open a face for glyph calls in:
+   one of its own, set up as gLibraryFT is, with ENABLE_FACE_LIBRARY, and
+   gLibraryFT otherwise. Called with gMutexFT held. */
+static FT_Error OpenFaceLibraryFT(FT_Library* library)
+{
+#ifdef ENABLE_FACE_LIBRARY
+    FT_Error err = FT_New_Library(&gMemoryFT, library);
+    if (err) {
+        FT_LOG("failed to create the FreeType library of a face, error num : '%d'\n", err);
+        return err;
+    }/* end if */
+
+    FT_Add_Default_Modules(*library);
+
+#if defined(SUPPORT_LCDTEXT)
+    FT_Library_SetLcdFilter(*library, FT_LCD_FILTER_DEFAULT);
+#endif
+#else
+    *library = gLibraryFT;
+#endif /* ENABLE_FACE_LIBRARY */
+
+    return 0;
+}/* end method OpenFaceLibraryFT */
+
+/* Releases a library of OpenFaceLibraryFT() once its face is closed. */
+static void CloseFaceLibraryFT(FT_Library library)
+{
+#ifdef ENABLE_FACE_LIBRARY
+    FT_Done_Library(library);
+#else
+    (void)library;
+#endif /* ENABLE_FACE_LIBRARY */
+}/* end method CloseFaceLibraryFT */
+
+#ifdef ENABLE_FONT_MMAP
+static uint32_t ReadU32FT(const uint8_t* p)
+{
+    return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}/* end method ReadU32FT */
+
+/* Glyph outlines are fetched from all over glyf and loca, so read-ahead
+   only wastes page cache; the cmap and the horizontal metrics are needed
+   by every scaler and are asked for up front. */
+static void AdviseFontMapFT(const uint8_t* base, size_t size)
+{
+    const size_t  pageMask = (size_t)sysconf(_SC_PAGESIZE) - 1;
+    uint32_t      directories[4];
+    uint32_t      directoryCount = 1;
+
+    madvise((void*)base, size, MADV_RANDOM);
+
+    directories[0] = 0;
+    if (size >= 16 && ReadU32FT(base) == 0x74746366 /* ttcf */) {
+        directoryCount = ReadU32FT(base + 8);
+        if (directoryCount > sizeof(directories) / sizeof(directories[0])) {
+            directoryCount = sizeof(directories) / sizeof(directories[0]);
+        }/* end if */
+
+        for (uint32_t i = 0; i < directoryCount; i++) {
+            directories[i] = 12 + 4 * i + 4 <= size ? ReadU32FT(base + 12 + 4 * i) : size;
+        }/* end for */
+    }/* end if */
+
+    for (uint32_t i = 0; i < directoryCount; i++) {
+        const uint8_t*  directory = base + directories[i];
+        uint32_t        numTables;
+
+        if ((size_t)directories[i] + 12 > size) {
+            continue;
+        }/* end if */
+
+        numTables = (directory[4] << 8) | directory[5];
+        for (uint32_t t = 0; t < numTables && (size_t)directories[i] + 12 + 16 * (t + 1) <= size; t++) {
+            const uint8_t*  record = directory + 12 + 16 * t;
+            uint32_t        tag = ReadU32FT(record);
+            size_t          offset = ReadU32FT(record + 8);
+            size_t          length = ReadU32FT(record + 12);
+
+            if ((tag == 0x636D6170 /* cmap */ || tag == 0x686D7478 /* hmtx */) &&
+                offset < size && length <= size - offset) {
+                size_t start = offset & ~pageMask;
+                madvise((void*)(base + start), offset + length - start, MADV_WILLNEED);
+            }/* end if */
+        }/* end for */
+    }/* end for */
+}/* end method AdviseFontMapFT */
+
+/* Returns true if the font file at 'path' is in one of the directories
+   whose files are mapped; see ENABLE_FONT_MMAP. */
+static bool IsFontMapDirFT(const char path[])
+{
+    const char* dirs = getenv(FT_FONT_MMAP_DIRS_ENV);
+
+    if (dirs == NULL) {
+        dirs = FT_FONT_MMAP_DIRS;
+    }/* end if */
+
+    /* a path can not climb out of the directory */
+    if (strstr(path, "/../") != NULL) {
+        return false;
+    }/* end if */
+
+    while (*dirs) {
+        const char* end = strchr(dirs, ':');
+        size_t      length = end ? (size_t)(end - dirs) : strlen(dirs);
+
+        if (length > 0 && strncmp(path, dirs, length) == 0 &&
+            (dirs[length - 1] == '/' || path[length] == '/')) {
+            return true;
+        }/* end if */
+
+        dirs += end ? length + 1 : length;
+    }/* end while */
+
+    return false;
+}/* end method IsFontMapDirFT */
+
+/* Returns the mapping of the font file at 'path', mapping it if no font
+   holds it yet; NULL if the file can not be mapped. */
+static FontMapPtr AcquireFontMapFT(const char path[])
+{
+    struct stat  st;
+    FontMapPtr   map = NULL;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }/* end if */
+
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return NULL;
+    }/* end if */
+
+    android::Mutex::Autolock am(gMutexMapFT);
+
+    for (map = gFontMapList; map != NULL; map = map->next) {
+        if (map->device == st.st_dev && map->inode == st.st_ino && map->size == (size_t)st.st_size) {
+            map->refCnt++;
+            close(fd);
+            return map;
+        }/* end if */
+    }/* end for */
+
+    void* base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        FT_LOG("unable to map font file '%s'\n", path);
+        return NULL;
+    }/* end if */
+
+    map = (FontMapPtr)malloc(sizeof(FontMap));
+    if (map == NULL) {
+        munmap(base, (size_t)st.st_size);
+        return NULL;
+    }/* end if */
+
+    map->device = st.st_dev;
+    map->inode = st.st_ino;
+    map->base = (const uint8_t*)base;
+    map->size = (size_t)st.st_size;
+    map->refCnt = 1;
+    map->next = gFontMapList;
+    gFontMapList = map;
+
+    AdviseFontMapFT(map->base, map->size);
+
+    return map;
+}/* end method AcquireFontMapFT */
+#endif /* ENABLE_FONT_MMAP */
+
+static void ReleaseFontMapFT(FontMapPtr map)
+{
+#ifdef ENABLE_FONT_MMAP
+    if (map == NULL) {
+        return;
+    }/* end if */
+
+    android::Mutex::Autolock am(gMutexMapFT);
+
+    if (--map->refCnt == 0) {
+        FontMapPtr* link = &gFontMapList;
+
+        while (*link != map) {
+            link = &(*link)->next;
+        }/* end while */
+        *link = map->next;
+
+        munmap((void*)map->base, map->size);
+        free(map);
+    }/* end if */
+#else
+    FT_UNUSED(map);
+#endif /* ENABLE_FONT_MMAP */
+}/* end method ReleaseFontMapFT */
+
+/* Opens face 0 of the font file at 'path' from its shared mapping, or with
+   FT_New_Face when the file is not mapped. '*map' is set to the mapping
+   the face reads, NULL if none; it is released after the face is done. */
+static FT_Error NewFaceFT(FT_Library library, const char path[], FontMapPtr* map, FT_Face* face)
+{
+    *map = NULL;
+
+#ifdef ENABLE_FONT_MMAP
+    if (IsFontMapDirFT(path)) {
+        *map = AcquireFontMapFT(path);
+    }/* end if */
+
+    if (*map) {
+        FT_Error err = FT_New_Memory_Face(library, (*map)->base, (FT_Long)(*map)->size, 0, face);
+        if (err) {
+            ReleaseFontMapFT(*map);
+            *map = NULL;
+        }/* end if */
+        return err;
+    }/* end if */
+#endif /* ENABLE_FONT_MMAP */
+
+    return FT_New_Face(library, path, 0, face);
+}/* end method NewFaceFT */
+
+static uint32_t FontIndexHash(uint32_t kind, const void* data, size_t length)
+{
+    const uint8_t*  p = (const uint8_t*)data;
+    uint32_t        h = 2166136261u ^ kind;
+
+    for (size_t i = 0; i < length; i++) {
+        h = (h ^ p[i]) * 16777619u;
+    }/* end for */
+
+    return h ^ (h >> 16);
+}/* end FontIndexHash */
+
+/* Computes the content key of 'length' bytes of font data from the start
+   of a font file of 'size' bytes. The sfnt header and table directory are
+   hashed, as the table checksums in the directory stand for the rest of the
+   file; collections and other formats have the first FONT_CONTENT_HASH_LEN
+   bytes hashed instead. */
+static void FontContentKeyFT(const uint8_t* data, size_t length, size_t size, FontContentKey& content)
+{
+    content.valid = false;
+    content.size = size;
+
+    if (length < 12) {
+        return;
+    }/* end if */
+
+    uint32_t version = (data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+    if (version == 0x00010000 || version == 0x4F54544F /* OTTO */ || version == 0x74727565 /* true */) {
+        size_t directory = 12 + 16 * ((data[4] << 8) | data[5]);
+        if (directory < length) {
+            length = directory;
+        }/* end if */
+    }/* end if */
+
+    content.hash = FontIndexHash(FONT_INDEX_CONTENT, data, length);
+    content.hash = FontIndexHash(content.hash, &content.size, sizeof(content.size));
+    content.valid = true;
+}/* end FontContentKeyFT */
+
+/* Hashes a font buffer for the query face pool by its content key, which
+   reads at most FONT_CONTENT_HASH_LEN bytes of it. */
+static uint32_t QueryHashFT(const void* buffer, uint32_t bufferLength)
+{
+    FontContentKey  content;
+
+    FontContentKeyFT((const uint8_t*)buffer, bufferLength < FONT_CONTENT_HASH_LEN ? bufferLength : FONT_CONTENT_HASH_LEN,
+                     bufferLength, content);
+
+    return content.valid ? content.hash : 0;
+}/* end method QueryHashFT */
+
+/**
+ * QueryFaceFT
+ */
+QueryFaceFT::QueryFaceFT(const char path[])
+    : hash(0), lock(gMutexFT), pFace(NULL), error(0)
+{
+    acquire(path, NULL, 0);
+}/* end method constructor */
+
+QueryFaceFT::QueryFaceFT(const void* buffer, uint32_t bufferLength)
+    : hash(QueryHashFT(buffer, bufferLength)), lock(gMutexFT), pFace(NULL), error(0)
+{
+    acquire(NULL, buffer, bufferLength);
+}/* end method constructor */
+
+/* Closes a face taken out of the pool; called with gMutexFT held. */
+void QueryFaceFT::close(QueryFace* entry)
+{
+    FT_Done_Face(entry->face);
+    ReleaseFontMapFT(entry->pMap);
+    free(entry->pPath);
+    free(entry);
+
+    if (--gCountFontFT == 0) {
+        DoneFreetype();
+    }/* end if */
+}/* end method close */
+
+/* Finds the face in the pool or opens it; called with gMutexFT held. */
+void QueryFaceFT::acquire(const char path[], const void* buffer, uint32_t bufferLength)
+{
+    QueryFace**  link = &gQueryFaceList;
+    QueryFace*   entry;
+    int          count = 0;
+
+    while ((entry = *link) != NULL) {
+        bool match = path ? (entry->pPath && ! strcmp(entry->pPath, path))
+                          : (entry->pPath == NULL && entry->pBuffer == buffer &&
+                             entry->bufferLength == bufferLength && entry->hash == hash);
+
+        if (match) {
+            /* move to front */
+            *link = entry->next;
+            entry->next = gQueryFaceList;
+            gQueryFaceList = entry;
+
+            pFace = entry->face;
+            return;
+        }/* end if */
+
+        if (path == NULL && entry->pPath == NULL && entry->pBuffer == buffer) {
+            /* same address, other font: the old buffer is gone */
+            *link = entry->next;
+            close(entry);
+            continue;
+        }/* end if */
+
+        count++;
+        link = &entry->next;
+    }/* end while */
+
+    if (gCountFontFT == 0 && ! InitFreetype()) {
+        error = FT_Err_Cannot_Open_Resource;
+        return;
+    }/* end if */
+
+    entry = (QueryFace*)calloc(1, sizeof(QueryFace));
+    if (entry == NULL) {
+        error = FT_Err_Out_Of_Memory;
+    } else if (path) {
+        entry->pPath = strdup(path);
+        error = entry->pPath ? NewFaceFT(gLibraryFT, path, &entry->pMap, &entry->face) : FT_Err_Out_Of_Memory;
+    } else {
+        FT_Open_Args  args;
+
+        memset(&args, 0, sizeof(args));
+
+        args.flags = FT_OPEN_MEMORY;
+        args.memory_base = (const FT_Byte*)buffer;
+        args.memory_size = bufferLength;
+
+        entry->pBuffer = buffer;
+        entry->bufferLength = bufferLength;
+        entry->hash = hash;
+        error = FT_Open_Face(gLibraryFT, &args, 0, &entry->face);
+    }/* end else if */
+
+    if (error) {
+        if (entry) {
+            free(entry->pPath);
+            free(entry);
+        }/* end if */
+
+        if (gCountFontFT == 0) {
+            /* required as no font was opened */
+            DoneFreetype();
+        }/* end if */
+        return;
+    }/* end if */
+
+    ++gCountFontFT;
+    entry->next = gQueryFaceList;
+    gQueryFaceList = entry;
+    pFace = entry->face;
+
+    /* drop the least recently used face beyond the pool size */
+    if (++count >= QUERY_FACE_POOL_SIZE) {
+        for (link = &gQueryFaceList; (*link)->next != NULL; link = &(*link)->next) {
+        }/* end for */
+
+        entry = *link;
+        *link = NULL;
+        close(entry);
+    }/* end if */
+}/* end method acquire */
+
+void QueryFaceFT::purge()
+{
+    android::Mutex::Autolock ac(gMutexFT);
+
+    while (gQueryFaceList) {
+        QueryFace* entry = gQueryFaceList;
+        gQueryFaceList = entry->next;
+        close(entry);
+    }/* end while */
+}/* end method purge */
+
+/**
+ * FontEngineFT
+ */
+FontEngineFT::~FontEngineFT()
+{
+#ifdef ENABLE_FONTINSTLIST
+    {
+        android::Mutex::Autolock ac(gMutexFT);
+        FontInstFT::trimIdle(0);
+    }
+#endif /* ENABLE_FONTINSTLIST */
+
+    QueryFaceFT::purge();
+}/* end method destructor */
+
+void FontEngineFT::trimMemory(fem::TrimLevel level)
+{
+    {
+        android::Mutex::Autolock ac(gMutexFT);
+        this->trimFonts(0, level == fem::TRIM_MEMORY_COMPLETE);
+    }
+
+    /* the query faces only save opening a font again */
+    QueryFaceFT::purge();
+}/* end method trimMemory */
+
+void FontEngineFT::trimIdleFonts(size_t limit)
+{
+#ifdef ENABLE_FONTINSTLIST
+    while (gIdleInstCountFT > 0 && OverMemoryBudget(limit)) {
+        FontInstFT::trimIdle(gIdleInstCountFT - 1);
+    }/* end while */
+#else
+    FT_UNUSED(limit);
+#endif /* ENABLE_FONTINSTLIST */
+}/* end method trimIdleFonts */
+
+void FontEngineFT::trimFonts(size_t limit, bool inUse)
+{
+    this->trimIdleFonts(limit);
+
+    if (! OverMemoryBudget(limit)) {
+        return;
+    }/* end if */
+
+    /* only objects in use are left when no replica is idle */
+    if (acquireLoad(&gIdleReplicasFT) > 0) {
+        for (FontNodePtr node = this->pFontList; node != NULL; node = node->next) {
+            node->font->closeReplicas();
+        }/* end for */
+    }/* end if */
+
+#ifdef ENABLE_FONTINSTLIST
+    /* A font busy with a glyph is skipped rather than waited for with
+       gMutexFT held. Font instances are only deleted with gMutexFT held, so
+       the one found is still there when its font is locked again. */
+    while (inUse && OverMemoryBudget(limit)) {
+        FontInstFT* victim = NULL;
+
+        for (FontNodePtr node = this->pFontList; node != NULL; node = node->next) {
+            FontFT* font = node->font;
+
+            if (font->lock().tryLock() != 0) {
+                continue;
+            }/* end if */
+
+            for (int i = 0; i < FONTINST_BUCKETS; i++) {
+                for (FontInstNodePtr instNode = font->pFontInstBuckets[i]; instNode != NULL; instNode = instNode->next) {
+                    FontInstFT* inst = instNode->inst;
+
+                    if (inst->ftSize && (victim == NULL || (int32_t)(inst->lastUse - victim->lastUse) < 0)) {
+                        victim = inst;
+                    }/* end if */
+                }/* end for */
+            }/* end for */
+
+            font->lock().unlock();
+        }/* end for */
+
+        if (victim == NULL || victim->pFont->lock().tryLock() != 0) {
+            break;
         }/* end if */
 
-        if (FT_New_Face(library, path, 0, &face)) {
+        FT_LOG("trimming font instance %x of font %d, %d bytes\n", victim, victim->pFont->fontID, victim->sizeBytes);
+
+        victim->trim();
+        victim->pFont->lock().unlock();
+    }/* end while */
+#else
+    FT_UNUSED(inUse);
+#endif /* ENABLE_FONTINSTLIST */
+}/* end method trimFonts */
+
+fem::EngineCapability FontEngineFT::getCapabilities(FontScalerInfo& desc) const
+{
+    FT_UNUSED(desc);
+
+    /* LCD masks get gray coverage unless FreeType renders subpixels */
+    if (gLCDSupport) {
+        return fem::EngineCapability(fem::CAN_RENDER_MONO | fem::CAN_RENDER_GRAY | fem::CAN_RENDER_LCD);
+    }/* end if */
+
+    return fem::EngineCapability(fem::CAN_RENDER_MONO | fem::CAN_RENDER_GRAY);
+}/* end method getCapabilities */
+
+/*
+ * Given system path to font file; return font's name and style. It also
+ * return a flag which tells about whether the font fixed width.
+ */
+size_t FontEngineFT::getFontNameAndAttribute(const char path[], char name[], size_t length, fem::FontStyle* style, bool* isFixedWidth)
+{
+    size_t count = 0;
+
+    assert(path);
+
+    if (path) {
+        QueryFaceFT  query(path);
+        FT_Face      face = query.getFace();
+
+        if (face == NULL) {
             FT_LOG("failed to create FT_Face\n");
-            FT_Done_FreeType(library);
             return 0;
         }/* end if */
 
@@ -710,9 +2400,6 @@ size_t FontEngineFT::getFontNameAndAttribute(const char path[], char name[], siz
 
             *isFixedWidth = FT_IS_FIXED_WIDTH(face);
         }/* end if */
-
-        FT_Done_Face(face);
-        FT_Done_FreeType(library);
     }/* end if */
 
     FT_LOG("length : %lu\n", (unsigned long)count);
@@ -726,29 +2413,16 @@ size_t FontEngineFT::getFontNameAndAttribute(const char path[], char name[], siz
  */
 size_t FontEngineFT::getFontNameAndAttribute(const void* buffer, const uint32_t bufferLength, char name[], size_t length, fem::FontStyle* style, bool* isFixedWidth)
 {
-    FT_Library  library;
     size_t count = 0;
 
     assert(buffer && bufferLength);
 
     if (buffer && bufferLength) {
-        FT_Open_Args  args;
-        FT_Face  face;
-
-        if (FT_Init_FreeType(&library)) {
-            FT_LOG("failed to initalized FreeType\n");
-            return 0;
-        }/* end if */
-
-        memset(&args, 0, sizeof(args));
+        QueryFaceFT  query(buffer, bufferLength);
+        FT_Face      face = query.getFace();
 
-        args.flags = FT_OPEN_MEMORY;
-        args.memory_base = (const FT_Byte*)buffer;
-        args.memory_size = bufferLength;
-
-        if (FT_Open_Face(library, &args, 0, &face)) {
+        if (face == NULL) {
             FT_LOG("failed to create FT_Face\n");
-            FT_Done_FreeType(library);
             return 0;
         }/* end if */
 
@@ -798,9 +2472,6 @@ size_t FontEngineFT::getFontNameAndAttribute(const void* buffer, const uint32_t
 
             *isFixedWidth = FT_IS_FIXED_WIDTH(face);
         }/* end if */
-
-        FT_Done_Face(face);
-        FT_Done_FreeType(library);
     }/* end if */
 
     FT_LOG("length : %lu\n", (unsigned long)count);
@@ -817,36 +2488,24 @@ size_t FontEngineFT::getFontNameAndAttribute(const void* buffer, const uint32_t
  */
 bool FontEngineFT::isFontSupported(const char path[], bool isLoad)
 {
-    FT_Library  library;
     bool        retVal = false;
 
     assert(path);
 
     if (path) {
-        if (FT_Init_FreeType(&library)) {
-            FT_LOG("failed to initalized FreeType\n");
-            goto RETURN;
-        }/* end if */
-
         if (isLoad) {
-            FT_Face   face;
-            FT_Error  error;
+            QueryFaceFT  query(path);
+            FT_Error     error = query.getError();
 
-            error = FT_New_Face(library, path, 0, &face);
             if (error == FT_Err_Unknown_File_Format) {
-                FT_Done_FreeType(library);
                 FT_LOG("unsupported font format\n");
                 goto RETURN;
             } else if (error) {
-                FT_Done_FreeType(library);
                 FT_LOG("failed to create FT_Face\n");
                 goto RETURN;
             }/* end else if */
 
             retVal = true;
-
-            FT_Done_Face(face);
-            FT_Done_FreeType(library);
         } else {
             unsigned int len = strlen(path);
             unsigned int idx = len - 3;
@@ -877,42 +2536,23 @@ RETURN:
  */
 bool FontEngineFT::isFontSupported(const void* buffer, const uint32_t bufferLength)
 {
-    FT_Library    library;
     bool          retVal = false;
 
     assert(buffer && bufferLength);
 
     if (buffer && bufferLength) {
-        FT_Open_Args  args;
-        FT_Face       face;
-        FT_Error      error;
-
-        if (FT_Init_FreeType(&library)) {
-            FT_LOG("failed to initalized FreeType\n");
-            goto RETURN;
-        }/* end if */
-
-        memset(&args, 0, sizeof(args));
+        QueryFaceFT  query(buffer, bufferLength);
+        FT_Error     error = query.getError();
 
-        args.flags = FT_OPEN_MEMORY;
-        args.memory_base = (const FT_Byte*)buffer;
-        args.memory_size = bufferLength;
-
-        error = FT_Open_Face(library, &args, 0, &face);
         if (error == FT_Err_Unknown_File_Format) {
-            FT_Done_FreeType(library);
             FT_LOG("unsupported font format\n");
             goto RETURN;
         } else if (error) {
-            FT_Done_FreeType(library);
             FT_LOG("failed to create FT_Face\n");
             goto RETURN;
         }/* end else if */
 
         retVal = true;
-
-        FT_Done_Face(face);
-        FT_Done_FreeType(library);
     }/* end if */
 
 RETURN:
@@ -926,30 +2566,21 @@ RETURN:
 */
 uint32_t FontEngineFT::getFontUnitsPerEm(const char path[])
 {
-    FT_Library  library;
     uint32_t    unitsPerEm = 0;
 
     assert(path);
 
     if (path) {
-        FT_Face  face;
-
-        if (FT_Init_FreeType(&library)) {
-            FT_LOG("failed to initalized FreeType\n");
-            goto RETURN;
-        }/* end if */
+        QueryFaceFT  query(path);
+        FT_Face      face = query.getFace();
 
-        if (FT_New_Face(library, path, 0, &face)) {
+        if (face == NULL) {
             FT_LOG("failed to create FT_Face\n");
-            FT_Done_FreeType(library);
             goto RETURN;
         }/* end if */
 
         unitsPerEm = face->units_per_EM;
         FT_LOG("units per em : %u\n", unitsPerEm);
-
-        FT_Done_Face(face);
-        FT_Done_FreeType(library);
     }/* end if */
 
 RETURN:
@@ -963,37 +2594,21 @@ RETURN:
 */
 uint32_t FontEngineFT::getFontUnitsPerEm(const void* buffer, const uint32_t bufferLength)
 {
-    FT_Library  library;
     uint32_t    unitsPerEm = 0;
 
     assert(buffer && bufferLength);
 
     if (buffer && bufferLength) {
-        FT_Open_Args  args;
-        FT_Face       face;
-
-        if (FT_Init_FreeType(&library)) {
-            FT_LOG("failed to initalized FreeType\n");
-            goto RETURN;
-        }/* end if */
-
-        memset(&args, 0, sizeof(args));
+        QueryFaceFT  query(buffer, bufferLength);
+        FT_Face      face = query.getFace();
 
-        args.flags = FT_OPEN_MEMORY;
-        args.memory_base = (const FT_Byte*)buffer;
-        args.memory_size = bufferLength;
-
-        if (FT_Open_Face(library, &args, 0, &face)) {
+        if (face == NULL) {
             FT_LOG("failed to create FT_Face\n");
-            FT_Done_FreeType(library);
             goto RETURN;
         }/* end if */
 
         unitsPerEm = face->units_per_EM;
         FT_LOG("units per em : %u\n", unitsPerEm);
-
-        FT_Done_Face(face);
-        FT_Done_FreeType(library);
     }/* end if */
 
 RETURN:
@@ -1009,36 +2624,28 @@ bool FontEngineFT::canEmbed(const char path[])
 #if defined(SK_BUILD_FOR_MAC) || defined(ANDROID)
     return false;
 #else
-    FT_Library  library;
     bool        retVal = false;
 
     assert(path);
 
     if (path) {
-        FT_Face  face;
+        QueryFaceFT  query(path);
+        FT_Face      face = query.getFace();
 
-        if (FT_Init_FreeType(&library)) {
-            FT_LOG("failed to initalized FreeType\n");
+        if (face == NULL) {
+            FT_LOG("failed to create FT_Face\n");
         } else {
-            if (FT_New_Face(library, path, 0, &face)) {
-                FT_LOG("failed to create FT_Face\n");
-            } else {
 #ifdef FT_FSTYPE_RESTRICTED_LICENSE_EMBEDDING
-                FT_UShort  fsType = FT_Get_FSType_Flags(face);
-                retVal = ((fsType & (FT_FSTYPE_RESTRICTED_LICENSE_EMBEDDING | FT_FSTYPE_BITMAP_EMBEDDING_ONLY)) == 0) ? true : false;
+            FT_UShort  fsType = FT_Get_FSType_Flags(face);
+            retVal = ((fsType & (FT_FSTYPE_RESTRICTED_LICENSE_EMBEDDING | FT_FSTYPE_BITMAP_EMBEDDING_ONLY)) == 0) ? true : false;
 #else
-                // No embedding is 0x2 and bitmap embedding only is 0x200.
-                TT_OS2* os2_table;
-                if ((os2_table = (TT_OS2*)FT_Get_Sfnt_Table(face, ft_sfnt_os2)) != NULL) {
-                    retVal = ((os2_table->fsType & 0x202) == 0) ? true : false;
-                }/* end if */
+            // No embedding is 0x2 and bitmap embedding only is 0x200.
+            TT_OS2* os2_table;
+            if ((os2_table = (TT_OS2*)FT_Get_Sfnt_Table(face, ft_sfnt_os2)) != NULL) {
+                retVal = ((os2_table->fsType & 0x202) == 0) ? true : false;
+            }/* end if */
 #endif
-                FT_LOG("canEmbed: %s\n", retVal ? "yes" : "no");
-
-                FT_Done_Face(face);
-            }/* end else if */
-
-            FT_Done_FreeType(library);
+            FT_LOG("canEmbed: %s\n", retVal ? "yes" : "no");
         }/* end else if */
     }/* end if */
 
@@ -1057,44 +2664,28 @@ bool FontEngineFT::canEmbed(const void* buffer, const uint32_t bufferLength)
 #if defined(SK_BUILD_FOR_MAC) || defined(ANDROID)
     return false;
 #else
-    FT_Library  library;
     bool        retVal = false;
 
     assert(buffer && bufferLength);
 
     if (buffer && bufferLength) {
-        FT_Open_Args  args;
-        FT_Face       face;
+        QueryFaceFT  query(buffer, bufferLength);
+        FT_Face      face = query.getFace();
 
-        retVal = FT_Init_FreeType(&library);
-        if (retVal) {
-            FT_LOG("failed to initalized FreeType\n");
+        if (face == NULL) {
+            FT_LOG("failed to create FT_Face\n");
         } else {
-            memset(&args, 0, sizeof(args));
-
-            args.flags = FT_OPEN_MEMORY;
-            args.memory_base = (const FT_Byte*)buffer;
-            args.memory_size = bufferLength;
-
-            if (FT_Open_Face(library, &args, 0, &face)) {
-                FT_LOG("failed to create FT_Face\n");
-            } else {
 #ifdef FT_FSTYPE_RESTRICTED_LICENSE_EMBEDDING
-                FT_UShort  fsType = FT_Get_FSType_Flags(face);
-                retVal = ((fsType & (FT_FSTYPE_RESTRICTED_LICENSE_EMBEDDING | FT_FSTYPE_BITMAP_EMBEDDING_ONLY)) == 0) ? true : false;
+            FT_UShort  fsType = FT_Get_FSType_Flags(face);
+            retVal = ((fsType & (FT_FSTYPE_RESTRICTED_LICENSE_EMBEDDING | FT_FSTYPE_BITMAP_EMBEDDING_ONLY)) == 0) ? true : false;
 #else
-                // No embedding is 0x2 and bitmap embedding only is 0x200.
-                TT_OS2* os2_table;
-                if ((os2_table = (TT_OS2*)FT_Get_Sfnt_Table(face, ft_sfnt_os2)) != NULL) {
-                    retVal = ((os2_table->fsType & 0x202) == 0) ? true : false;
-                }/* end if */
+            // No embedding is 0x2 and bitmap embedding only is 0x200.
+            TT_OS2* os2_table;
+            if ((os2_table = (TT_OS2*)FT_Get_Sfnt_Table(face, ft_sfnt_os2)) != NULL) {
+                retVal = ((os2_table->fsType & 0x202) == 0) ? true : false;
+            }/* end if */
 #endif
-                FT_LOG("canEmbed: %s\n", retVal ? "yes" : "no");
-
-                FT_Done_Face(face);
-            }/* end else if */
-
-            FT_Done_FreeType(library);
+            FT_LOG("canEmbed: %s\n", retVal ? "yes" : "no");
         }/* end else if */
     }/* end if */
 
@@ -1114,44 +2705,35 @@ bool FontEngineFT::canEmbed(const void* buffer, const uint32_t bufferLength)
 */
 uint32_t FontEngineFT::getGlyphsAdvance(const char path[], uint32_t start, uint32_t count, FEM16Dot16* pGlyphsAdvance)
 {
-    FT_Library  library;
     uint32_t    retVal = 0;
 
     assert(path && pGlyphsAdvance);
 
     if (path && pGlyphsAdvance) {
-        FT_Face  face;
+        QueryFaceFT  query(path);
+        FT_Face      face = query.getFace();
 
-        retVal = FT_Init_FreeType(&library);
+        retVal = query.getError();
         if (retVal) {
-            FT_LOG("failed to initalized FreeType\n");
+            FT_LOG("failed to create FT_Face\n");
         } else {
-            retVal = FT_New_Face(library, path, 0, &face);
-            if (retVal) {
-                FT_LOG("failed to create FT_Face\n");
-            } else {
 #ifdef FT_ADVANCES_H
-                retVal = FT_Get_Advances(face, start, count, FT_LOAD_NO_SCALE, (FT_Fixed*)pGlyphsAdvance);
+            retVal = FT_Get_Advances(face, start, count, FT_LOAD_NO_SCALE, (FT_Fixed*)pGlyphsAdvance);
 #else
-                if (!face || start >= face->num_glyphs ||
-                        start + count > face->num_glyphs) {
-                    retVal = 6;  // "Invalid argument."
-                } else {
-                    for (uint32_t i = 0; i < count; i++) {
-                        FT_Error err = FT_Load_Glyph(face, i + start, FT_LOAD_NO_SCALE);
-                        if (err) {
-                            retVal = err;
-                            break;
-                        }/* end if */
-                        pGlyphsAdvance[i] = face->glyph->advance.x;
-                    }/* end for */
-                }/* end else if */
-#endif
-
-                FT_Done_Face(face);
+            if (!face || start >= face->num_glyphs ||
+                    start + count > face->num_glyphs) {
+                retVal = 6;  // "Invalid argument."
+            } else {
+                for (uint32_t i = 0; i < count; i++) {
+                    FT_Error err = FT_Load_Glyph(face, i + start, FT_LOAD_NO_SCALE);
+                    if (err) {
+                        retVal = err;
+                        break;
+                    }/* end if */
+                    pGlyphsAdvance[i] = face->glyph->advance.x;
+                }/* end for */
             }/* end else if */
-
-            FT_Done_FreeType(library);
+#endif
         }/* end else if */
     }/* end if */
 
@@ -1170,51 +2752,35 @@ uint32_t FontEngineFT::getGlyphsAdvance(const char path[], uint32_t start, uint3
 */
 uint32_t FontEngineFT::getGlyphsAdvance(const void* buffer, const uint32_t bufferLength, uint32_t start, uint32_t count, FEM16Dot16* pGlyphsAdvance)
 {
-    FT_Library  library;
     uint32_t    retVal = 0;
 
     assert(buffer && bufferLength && pGlyphsAdvance);
 
     if (buffer && bufferLength && pGlyphsAdvance) {
-        FT_Open_Args  args;
-        FT_Face       face;
+        QueryFaceFT  query(buffer, bufferLength);
+        FT_Face      face = query.getFace();
 
-        retVal = FT_Init_FreeType(&library);
+        retVal = query.getError();
         if (retVal) {
-            FT_LOG("failed to initalized FreeType\n");
+            FT_LOG("failed to create FT_Face\n");
         } else {
-            memset(&args, 0, sizeof(args));
-
-            args.flags = FT_OPEN_MEMORY;
-            args.memory_base = (const FT_Byte*)buffer;
-            args.memory_size = bufferLength;
-
-            retVal = FT_Open_Face(library, &args, 0, &face);
-            if (retVal) {
-                FT_LOG("failed to create FT_Face\n");
-            } else {
 #ifdef FT_ADVANCES_H
-                retVal = FT_Get_Advances(face, start, count, FT_LOAD_NO_SCALE, (FT_Fixed*)pGlyphsAdvance);
+            retVal = FT_Get_Advances(face, start, count, FT_LOAD_NO_SCALE, (FT_Fixed*)pGlyphsAdvance);
 #else
-                if (!face || start >= face->num_glyphs ||
-                        start + count > face->num_glyphs) {
-                    retVal = 6;  // "Invalid argument."
-                } else {
-                    for (uint32_t i = 0; i < count; i++) {
-                        FT_Error err = FT_Load_Glyph(face, i + start, FT_LOAD_NO_SCALE);
-                        if (err) {
-                            retVal = err;
-                            break;
-                        }/* end if */
-                        pGlyphsAdvance[i] = face->glyph->advance.x;
-                    }/* end for */
-                }/* end else if */
-#endif
-
-                FT_Done_Face(face);
+            if (!face || start >= face->num_glyphs ||
+                    start + count > face->num_glyphs) {
+                retVal = 6;  // "Invalid argument."
+            } else {
+                for (uint32_t i = 0; i < count; i++) {
+                    FT_Error err = FT_Load_Glyph(face, i + start, FT_LOAD_NO_SCALE);
+                    if (err) {
+                        retVal = err;
+                        break;
+                    }/* end if */
+                    pGlyphsAdvance[i] = face->glyph->advance.x;
+                }/* end for */
             }/* end else if */
-
-            FT_Done_FreeType(library);
+#endif
         }/* end else if */
     }/* end if */
 
@@ -1232,34 +2798,25 @@ uint32_t FontEngineFT::getGlyphsAdvance(const void* buffer, const uint32_t buffe
 */
 uint32_t FontEngineFT::getGlyphsName(const char path[], uint32_t start, uint32_t count, char** pGlyphsName)
 {
-    FT_Library  library;
     uint32_t    retVal = 0;
 
     assert(path && pGlyphsName);
 
     if (path && pGlyphsName) {
-        FT_Face  face;
+        QueryFaceFT  query(path);
+        FT_Face      face = query.getFace();
 
-        retVal = FT_Init_FreeType(&library);
+        retVal = query.getError();
         if (retVal) {
-            FT_LOG("failed to initalized FreeType\n");
+            FT_LOG("failed to create FT_Face\n");
         } else {
-            retVal = FT_New_Face(library, path, 0, &face);
-            if (retVal) {
-                FT_LOG("failed to create FT_Face\n");
-            } else {
-                for (uint32_t i = 0; i < count; i++) {
-                    FT_Error err = FT_Get_Glyph_Name(face, i + start, pGlyphsName[i], 128);
-                    if (err) {
-                        retVal = err;
-                        break;
-                    }/* end if */
-                }/* end for */
-
-                FT_Done_Face(face);
-            }/* end else if */
-
-            FT_Done_FreeType(library);
+            for (uint32_t i = 0; i < count; i++) {
+                FT_Error err = FT_Get_Glyph_Name(face, i + start, pGlyphsName[i], 128);
+                if (err) {
+                    retVal = err;
+                    break;
+                }/* end if */
+            }/* end for */
         }/* end else if */
     }/* end if */
 
@@ -1278,47 +2835,89 @@ uint32_t FontEngineFT::getGlyphsName(const char path[], uint32_t start, uint32_t
 */
 uint32_t FontEngineFT::getGlyphsName(const void* buffer, const uint32_t bufferLength, uint32_t start, uint32_t count, char** pGlyphsName)
 {
-    FT_Library  library;
     uint32_t    retVal = 0;
 
     assert(buffer && bufferLength && pGlyphsName);
 
     if (buffer && bufferLength && pGlyphsName) {
-        FT_Open_Args  args;
-        FT_Face       face;
+        QueryFaceFT  query(buffer, bufferLength);
+        FT_Face      face = query.getFace();
 
-        retVal = FT_Init_FreeType(&library);
+        retVal = query.getError();
         if (retVal) {
-            FT_LOG("failed to initalized FreeType\n");
+            FT_LOG("failed to create FT_Face\n");
         } else {
-            memset(&args, 0, sizeof(args));
-
-            args.flags = FT_OPEN_MEMORY;
-            args.memory_base = (const FT_Byte*)buffer;
-            args.memory_size = bufferLength;
-
-            retVal = FT_Open_Face(library, &args, 0, &face);
-            if (retVal) {
-                FT_LOG("failed to create FT_Face\n");
-            } else {
-                for (uint32_t i = 0; i < count; i++) {
-                    FT_Error err = FT_Get_Glyph_Name(face, i + start, pGlyphsName[i], 128);
-                    if (err) {
-                        retVal = err;
-                        break;
-                    }/* end if */
-                }/* end for */
-
-                FT_Done_Face(face);
-            }/* end else if */
-
-            FT_Done_FreeType(library);
+            for (uint32_t i = 0; i < count; i++) {
+                FT_Error err = FT_Get_Glyph_Name(face, i + start, pGlyphsName[i], 128);
+                if (err) {
+                    retVal = err;
+                    break;
+                }/* end if */
+            }/* end for */
         }/* end else if */
     }/* end if */
 
     return retVal;
 }/* end method getGlyphsName */
 
+/* Fills pGlyphsUnicode[0..count) with the characters of glyphs start to
+   start + count - 1 found in the Unicode cmaps of 'face'; the preferred
+   cmaps take precedence. Entries without a character are left alone. */
+static void FillGlyphsUnicodeFT(FT_Face face, uint32_t start, uint32_t count, int32_t* pGlyphsUnicode)
+{
+    /* the face may be shared; leave its charmap as found */
+    FT_CharMap  savedCharmap = face->charmap;
+
+    // Check and see if we have Unicode cmaps.
+    for (int i = 0; i < face->num_charmaps; ++i) {
+        // CMaps known to support Unicode:
+        // Platform ID   Encoding ID   Name
+        // -----------   -----------   -----------------------------------
+        // 0             0,1           Apple Unicode
+        // 0             3             Apple Unicode 2.0 (preferred)
+        // 3             1             Microsoft Unicode UCS-2
+        // 3             10            Microsoft Unicode UCS-4 (preferred)
+        //
+        // See Apple TrueType Reference Manual
+        // http://developer.apple.com/fonts/TTRefMan/RM06/Chap6cmap.html
+        // http://developer.apple.com/fonts/TTRefMan/RM06/Chap6name.html#ID
+        // Microsoft OpenType Specification
+        // http://www.microsoft.com/typography/otspec/cmap.htm
+
+        FT_UShort platformId = face->charmaps[i]->platform_id;
+        FT_UShort encodingId = face->charmaps[i]->encoding_id;
+
+        if (platformId != 0 && platformId != 3) {
+            continue;
+        }/* end if */
+
+        if (platformId == 3 && encodingId != 1 && encodingId != 10) {
+            continue;
+        }/* end if */
+
+        bool preferredMap = ((platformId == 3 && encodingId == 10) ||
+                                    (platformId == 0 && encodingId == 3));
+
+        FT_Set_Charmap(face, face->charmaps[i]);
+
+        // Iterate through each cmap entry.
+        FT_UInt glyphIndex;
+        for (int32_t charCode = FT_Get_First_Char(face, &glyphIndex);
+                glyphIndex != 0;
+                charCode = FT_Get_Next_Char(face, charCode, &glyphIndex)) {
+            if ((glyphIndex >= start) &&  (glyphIndex <= (start + count - 1)))
+            {
+                if (charCode && (pGlyphsUnicode[glyphIndex - start] == 0 || preferredMap)) {
+                    pGlyphsUnicode[glyphIndex - start] = charCode;
+                }/* end if */
+            }/* end if */
+        }/* end if */
+    }/* end for */
+
+    FT_Set_Charmap(face, savedCharmap);
+}/* end FillGlyphsUnicodeFT */
+
+
 /** Given system path of the font file; returns the glyph unicodes.
 	@param path              The system path to font file.
 	@param start             The first glyph index.
@@ -1329,72 +2928,19 @@ uint32_t FontEngineFT::getGlyphsName(const void* buffer, const uint32_t bufferLe
 */
 uint32_t FontEngineFT::getGlyphsUnicode(const char path[], uint32_t start, uint32_t count, int32_t* pGlyphsUnicode)
 {
-    FT_Library  library;
     uint32_t    retVal = 0;
 
     assert(path && pGlyphsUnicode);
 
     if (path && pGlyphsUnicode) {
-        FT_Face  face;
+        QueryFaceFT  query(path);
+        FT_Face      face = query.getFace();
 
-        retVal = FT_Init_FreeType(&library);
+        retVal = query.getError();
         if (retVal) {
-            FT_LOG("failed to initalized FreeType\n");
+            FT_LOG("failed to create FT_Face\n");
         } else {
-            retVal = FT_New_Face(library, path, 0, &face);
-            if (retVal) {
-                FT_LOG("failed to create FT_Face\n");
-            } else {
-                // Check and see if we have Unicode cmaps.
-                for (int i = 0; i < face->num_charmaps; ++i) {
-                    // CMaps known to support Unicode:
-                    // Platform ID   Encoding ID   Name
-                    // -----------   -----------   -----------------------------------
-                    // 0             0,1           Apple Unicode
-                    // 0             3             Apple Unicode 2.0 (preferred)
-                    // 3             1             Microsoft Unicode UCS-2
-                    // 3             10            Microsoft Unicode UCS-4 (preferred)
-                    //
-                    // See Apple TrueType Reference Manual
-                    // http://developer.apple.com/fonts/TTRefMan/RM06/Chap6cmap.html
-                    // http://developer.apple.com/fonts/TTRefMan/RM06/Chap6name.html#ID
-                    // Microsoft OpenType Specification
-                    // http://www.microsoft.com/typography/otspec/cmap.htm
-
-                    FT_UShort platformId = face->charmaps[i]->platform_id;
-                    FT_UShort encodingId = face->charmaps[i]->encoding_id;
-
-                    if (platformId != 0 && platformId != 3) {
-                        continue;
-                    }/* end if */
-
-                    if (platformId == 3 && encodingId != 1 && encodingId != 10) {
-                        continue;
-                    }/* end if */
-
-                    bool preferredMap = ((platformId == 3 && encodingId == 10) ||
-                                                (platformId == 0 && encodingId == 3));
-
-                    FT_Set_Charmap(face, face->charmaps[i]);
-
-                    // Iterate through each cmap entry.
-                    FT_UInt glyphIndex;
-                    for (int32_t charCode = FT_Get_First_Char(face, &glyphIndex);
-                            glyphIndex != 0;
-                            charCode = FT_Get_Next_Char(face, charCode, &glyphIndex)) {
-                        if ((glyphIndex >= start) &&  (glyphIndex <= (start + count - 1)))
-                        {
-                            if (charCode && (pGlyphsUnicode[glyphIndex - start] == 0 || preferredMap)) {
-                                pGlyphsUnicode[glyphIndex - start] = charCode;
-                            }/* end if */
-                        }/* end if */
-                    }/* end if */
-                }/* end for */
-
-                FT_Done_Face(face);
-            }/* end else if */
-
-            FT_Done_FreeType(library);
+            FillGlyphsUnicodeFT(face, start, count, pGlyphsUnicode);
         }/* end else if */
     }/* end if */
 
@@ -1413,79 +2959,19 @@ uint32_t FontEngineFT::getGlyphsUnicode(const char path[], uint32_t start, uint3
 */
 uint32_t FontEngineFT::getGlyphsUnicode(const void* buffer, const uint32_t bufferLength, uint32_t start, uint32_t count, int32_t* pGlyphsUnicode)
 {
-    FT_Library  library;
     uint32_t    retVal = 0;
 
     assert(buffer && bufferLength && pGlyphsUnicode);
 
     if (buffer && bufferLength && pGlyphsUnicode) {
-        FT_Open_Args  args;
-        FT_Face       face;
+        QueryFaceFT  query(buffer, bufferLength);
+        FT_Face      face = query.getFace();
 
-        retVal = FT_Init_FreeType(&library);
+        retVal = query.getError();
         if (retVal) {
-            FT_LOG("failed to initalized FreeType\n");
+            FT_LOG("failed to create FT_Face\n");
         } else {
-            memset(&args, 0, sizeof(args));
-
-            args.flags = FT_OPEN_MEMORY;
-            args.memory_base = (const FT_Byte*)buffer;
-            args.memory_size = bufferLength;
-
-            retVal = FT_Open_Face(library, &args, 0, &face);
-            if (retVal) {
-                FT_LOG("failed to create FT_Face\n");
-            } else {
-                // Check and see if we have Unicode cmaps.
-                for (int i = 0; i < face->num_charmaps; ++i) {
-                    // CMaps known to support Unicode:
-                    // Platform ID   Encoding ID   Name
-                    // -----------   -----------   -----------------------------------
-                    // 0             0,1           Apple Unicode
-                    // 0             3             Apple Unicode 2.0 (preferred)
-                    // 3             1             Microsoft Unicode UCS-2
-                    // 3             10            Microsoft Unicode UCS-4 (preferred)
-                    //
-                    // See Apple TrueType Reference Manual
-                    // http://developer.apple.com/fonts/TTRefMan/RM06/Chap6cmap.html
-                    // http://developer.apple.com/fonts/TTRefMan/RM06/Chap6name.html#ID
-                    // Microsoft OpenType Specification
-                    // http://www.microsoft.com/typography/otspec/cmap.htm
-
-                    FT_UShort platformId = face->charmaps[i]->platform_id;
-                    FT_UShort encodingId = face->charmaps[i]->encoding_id;
-
-                    if (platformId != 0 && platformId != 3) {
-                        continue;
-                    }/* end if */
-
-                    if (platformId == 3 && encodingId != 1 && encodingId != 10) {
-                        continue;
-                    }/* end if */
-
-                    bool preferredMap = ((platformId == 3 && encodingId == 10) ||
-                                                (platformId == 0 && encodingId == 3));
-
-                    FT_Set_Charmap(face, face->charmaps[i]);
-
-                    // Iterate through each cmap entry.
-                    FT_UInt glyphIndex;
-                    for (int32_t charCode = FT_Get_First_Char(face, &glyphIndex);
-                            glyphIndex != 0;
-                            charCode = FT_Get_Next_Char(face, charCode, &glyphIndex)) {
-                        if ((glyphIndex >= start) &&  (glyphIndex <= (start + count - 1)))
-                        {
-                            if (charCode && (pGlyphsUnicode[glyphIndex - start] == 0 || preferredMap)) {
-                                pGlyphsUnicode[glyphIndex - start] = charCode;
-                            }/* end if */
-                        }/* end if */
-                    }/* end if */
-                }/* end for */
-
-                FT_Done_Face(face);
-            }/* end else if */
-
-            FT_Done_FreeType(library);
+            FillGlyphsUnicodeFT(face, start, count, pGlyphsUnicode);
         }/* end else if */
     }/* end if */
 
@@ -1511,127 +2997,119 @@ AdvancedTypefaceMetrics* FontEngineFT::getAdvancedTypefaceMetrics(const char pat
 #if defined(SK_BUILD_FOR_MAC) || defined(ANDROID)
     return NULL;
 #else
-    FT_Library               library;
     AdvancedTypefaceMetrics*  pAdvancedTypefaceMetricsObj = NULL;
 
     assert(path);
 
     if (path) {
-        FT_Face  face;
+        QueryFaceFT  query(path);
+        FT_Face      face = query.getFace();
 
-        if (FT_Init_FreeType(&library)) {
-            FT_LOG("failed to initalized FreeType\n");
+        if (face == NULL) {
+            FT_LOG("failed to create FT_Face\n");
         } else {
-            if (FT_New_Face(library, path, 0, &face)) {
-                FT_LOG("failed to create FT_Face\n");
+            pAdvancedTypefaceMetricsObj = new AdvancedTypefaceMetrics;
+
+            pAdvancedTypefaceMetricsObj->pFontName = strdup(FT_Get_Postscript_Name(face));
+            pAdvancedTypefaceMetricsObj->isMultiMaster = FT_HAS_MULTIPLE_MASTERS(face) ? true : false;
+            pAdvancedTypefaceMetricsObj->fNumGlyphs = face->num_glyphs;
+            pAdvancedTypefaceMetricsObj->fNumCharmaps = face->num_charmaps;
+            pAdvancedTypefaceMetricsObj->fEmSize = 1000;
+
+            bool cid = false;
+            const char* fontType = FT_Get_X11_Font_Format(face);
+            if (strcmp(fontType, "Type 1") == 0) {
+                pAdvancedTypefaceMetricsObj->fType = fem::TYPE1_FONT;
+            } else if (strcmp(fontType, "CID Type 1") == 0) {
+                pAdvancedTypefaceMetricsObj->fType = fem::TYPE1CID_FONT;
+                cid = true;
+            } else if (strcmp(fontType, "CFF") == 0) {
+                pAdvancedTypefaceMetricsObj->fType = fem::CFF_FONT;
+            } else if (strcmp(fontType, "TrueType") == 0) {
+                pAdvancedTypefaceMetricsObj->fType = fem::TRUETYPE_FONT;
+                cid = true;
+                TT_Header* ttHeader;
+                if ((ttHeader = (TT_Header*)FT_Get_Sfnt_Table(face, ft_sfnt_head)) != NULL) {
+                    pAdvancedTypefaceMetricsObj->fEmSize = ttHeader->Units_Per_EM;
+                }/* end if */
+            }/* end else if */
+
+            pAdvancedTypefaceMetricsObj->fStyle = 0;
+            if (FT_IS_FIXED_WIDTH(face)) {
+                pAdvancedTypefaceMetricsObj->fStyle |= fem::FIXEDPITCH_STYLE;
+            }/* end if */
+            if (face->style_flags & FT_STYLE_FLAG_ITALIC) {
+                pAdvancedTypefaceMetricsObj->fStyle |= fem::ITALIC_STYLE;
+            }/* end if */
+            // We should set either Symbolic or Nonsymbolic; Nonsymbolic if the font's
+            // character set is a subset of 'Adobe standard Latin.'
+            pAdvancedTypefaceMetricsObj->fStyle |= fem::SYMBOLIC_STYLE;
+
+            PS_FontInfoRec ps_info;
+            TT_Postscript* tt_info;
+            if (FT_Get_PS_Font_Info(face, &ps_info) == 0) {
+                pAdvancedTypefaceMetricsObj->fItalicAngle = (int16_t)ps_info.italic_angle;
+            } else if ((tt_info = (TT_Postscript*)FT_Get_Sfnt_Table(face, ft_sfnt_post)) != NULL) {
+                pAdvancedTypefaceMetricsObj->fItalicAngle = (int16_t)(tt_info->italicAngle >> 16);
             } else {
-                pAdvancedTypefaceMetricsObj = new AdvancedTypefaceMetrics;
-
-                pAdvancedTypefaceMetricsObj->pFontName = strdup(FT_Get_Postscript_Name(face));
-                pAdvancedTypefaceMetricsObj->isMultiMaster = FT_HAS_MULTIPLE_MASTERS(face) ? true : false;
-                pAdvancedTypefaceMetricsObj->fNumGlyphs = face->num_glyphs;
-                pAdvancedTypefaceMetricsObj->fNumCharmaps = face->num_charmaps;
-                pAdvancedTypefaceMetricsObj->fEmSize = 1000;
-
-                bool cid = false;
-                const char* fontType = FT_Get_X11_Font_Format(face);
-                if (strcmp(fontType, "Type 1") == 0) {
-                    pAdvancedTypefaceMetricsObj->fType = fem::TYPE1_FONT;
-                } else if (strcmp(fontType, "CID Type 1") == 0) {
-                    pAdvancedTypefaceMetricsObj->fType = fem::TYPE1CID_FONT;
-                    cid = true;
-                } else if (strcmp(fontType, "CFF") == 0) {
-                    pAdvancedTypefaceMetricsObj->fType = fem::CFF_FONT;
-                } else if (strcmp(fontType, "TrueType") == 0) {
-                    pAdvancedTypefaceMetricsObj->fType = fem::TRUETYPE_FONT;
-                    cid = true;
-                    TT_Header* ttHeader;
-                    if ((ttHeader = (TT_Header*)FT_Get_Sfnt_Table(face, ft_sfnt_head)) != NULL) {
-                        pAdvancedTypefaceMetricsObj->fEmSize = ttHeader->Units_Per_EM;
-                    }/* end if */
-                }/* end else if */
+                pAdvancedTypefaceMetricsObj->fItalicAngle = 0;
+            }/* end else if */
 
-                pAdvancedTypefaceMetricsObj->fStyle = 0;
-                if (FT_IS_FIXED_WIDTH(face)) {
-                    pAdvancedTypefaceMetricsObj->fStyle |= fem::FIXEDPITCH_STYLE;
-                }/* end if */
-                if (face->style_flags & FT_STYLE_FLAG_ITALIC) {
-                    pAdvancedTypefaceMetricsObj->fStyle |= fem::ITALIC_STYLE;
+            pAdvancedTypefaceMetricsObj->fAscent = face->ascender;
+            pAdvancedTypefaceMetricsObj->fDescent = face->descender;
+
+            // Figure out a good guess for StemV - Min width of i, I, !, 1.
+            // This probably isn't very good with an italic font.
+            int16_t min_width = SHRT_MAX;
+            pAdvancedTypefaceMetricsObj->fStemV = 0;
+            char stem_chars[] = {'i', 'I', '!', '1'};
+            for (size_t i = 0; i < sizeof(stem_chars)/sizeof(stem_chars[0]); i++) {
+                FT_BBox bbox;
+                if (GetLetterCBox(face, stem_chars[i], &bbox)) {
+                    int16_t width = bbox.xMax - bbox.xMin;
+                    if (width > 0 && width < min_width) {
+                        min_width = width;
+                        pAdvancedTypefaceMetricsObj->fStemV = min_width;
+                    }/* end if */
                 }/* end if */
-                // We should set either Symbolic or Nonsymbolic; Nonsymbolic if the font's
-                // character set is a subset of 'Adobe standard Latin.'
-                pAdvancedTypefaceMetricsObj->fStyle |= fem::SYMBOLIC_STYLE;
-
-                PS_FontInfoRec ps_info;
-                TT_Postscript* tt_info;
-                if (FT_Get_PS_Font_Info(face, &ps_info) == 0) {
-                    pAdvancedTypefaceMetricsObj->fItalicAngle = (int16_t)ps_info.italic_angle;
-                } else if ((tt_info = (TT_Postscript*)FT_Get_Sfnt_Table(face, ft_sfnt_post)) != NULL) {
-                    pAdvancedTypefaceMetricsObj->fItalicAngle = (int16_t)(tt_info->italicAngle >> 16);
-                } else {
-                    pAdvancedTypefaceMetricsObj->fItalicAngle = 0;
+            }/* end for */
+
+            TT_PCLT* pclt_info;
+            TT_OS2* os2_table;
+            if ((pclt_info = (TT_PCLT*)FT_Get_Sfnt_Table(face, ft_sfnt_pclt)) != NULL) {
+                pAdvancedTypefaceMetricsObj->fCapHeight = pclt_info->CapHeight;
+                uint8_t serif_style = pclt_info->SerifStyle & 0x3F;
+                if (serif_style >= 2 && serif_style <= 6) {
+                    pAdvancedTypefaceMetricsObj->fStyle |= fem::SERIF_STYLE;
+                } else if (serif_style >= 9 && serif_style <= 12) {
+                    pAdvancedTypefaceMetricsObj->fStyle |= fem::SCRIPT_STYLE;
                 }/* end else if */
-
-                pAdvancedTypefaceMetricsObj->fAscent = face->ascender;
-                pAdvancedTypefaceMetricsObj->fDescent = face->descender;
-
-                // Figure out a good guess for StemV - Min width of i, I, !, 1.
-                // This probably isn't very good with an italic font.
-                int16_t min_width = SHRT_MAX;
-                pAdvancedTypefaceMetricsObj->fStemV = 0;
-                char stem_chars[] = {'i', 'I', '!', '1'};
-                for (size_t i = 0; i < sizeof(stem_chars)/sizeof(stem_chars[0]); i++) {
-                    FT_BBox bbox;
-                    if (GetLetterCBox(face, stem_chars[i], &bbox)) {
-                        int16_t width = bbox.xMax - bbox.xMin;
-                        if (width > 0 && width < min_width) {
-                            min_width = width;
-                            pAdvancedTypefaceMetricsObj->fStemV = min_width;
-                        }/* end if */
-                    }/* end if */
-                }/* end for */
-
-                TT_PCLT* pclt_info;
-                TT_OS2* os2_table;
-                if ((pclt_info = (TT_PCLT*)FT_Get_Sfnt_Table(face, ft_sfnt_pclt)) != NULL) {
-                    pAdvancedTypefaceMetricsObj->fCapHeight = pclt_info->CapHeight;
-                    uint8_t serif_style = pclt_info->SerifStyle & 0x3F;
-                    if (serif_style >= 2 && serif_style <= 6) {
-                        pAdvancedTypefaceMetricsObj->fStyle |= fem::SERIF_STYLE;
-                    } else if (serif_style >= 9 && serif_style <= 12) {
-                        pAdvancedTypefaceMetricsObj->fStyle |= fem::SCRIPT_STYLE;
-                    }/* end else if */
-                } else if ((os2_table = (TT_OS2*)FT_Get_Sfnt_Table(face, ft_sfnt_os2)) != NULL) {
-                    pAdvancedTypefaceMetricsObj->fCapHeight = os2_table->sCapHeight;
-                } else {
-                    // Figure out a good guess for CapHeight: average the height of M and X.
-                    FT_BBox m_bbox, x_bbox;
-                    bool got_m, got_x;
-                    got_m = GetLetterCBox(face, 'M', &m_bbox);
-                    got_x = GetLetterCBox(face, 'X', &x_bbox);
-                    if (got_m && got_x) {
-                        pAdvancedTypefaceMetricsObj->fCapHeight = (m_bbox.yMax - m_bbox.yMin + x_bbox.yMax - x_bbox.yMin) / 2;
-                    } else if (got_m && !got_x) {
-                        pAdvancedTypefaceMetricsObj->fCapHeight = m_bbox.yMax - m_bbox.yMin;
-                    } else if (!got_m && got_x) {
-                        pAdvancedTypefaceMetricsObj->fCapHeight = x_bbox.yMax - x_bbox.yMin;
-                    }/* end else if */
+            } else if ((os2_table = (TT_OS2*)FT_Get_Sfnt_Table(face, ft_sfnt_os2)) != NULL) {
+                pAdvancedTypefaceMetricsObj->fCapHeight = os2_table->sCapHeight;
+            } else {
+                // Figure out a good guess for CapHeight: average the height of M and X.
+                FT_BBox m_bbox, x_bbox;
+                bool got_m, got_x;
+                got_m = GetLetterCBox(face, 'M', &m_bbox);
+                got_x = GetLetterCBox(face, 'X', &x_bbox);
+                if (got_m && got_x) {
+                    pAdvancedTypefaceMetricsObj->fCapHeight = (m_bbox.yMax - m_bbox.yMin + x_bbox.yMax - x_bbox.yMin) / 2;
+                } else if (got_m && !got_x) {
+                    pAdvancedTypefaceMetricsObj->fCapHeight = m_bbox.yMax - m_bbox.yMin;
+                } else if (!got_m && got_x) {
+                    pAdvancedTypefaceMetricsObj->fCapHeight = x_bbox.yMax - x_bbox.yMin;
                 }/* end else if */
+            }/* end else if */
 
-                pAdvancedTypefaceMetricsObj->fMaxAdvWidth = face->max_advance_width;
-
-                pAdvancedTypefaceMetricsObj->fXMin = face->bbox.xMin;
-                pAdvancedTypefaceMetricsObj->fYMin = face->bbox.yMin;
-                pAdvancedTypefaceMetricsObj->fXMax = face->bbox.xMax;
-                pAdvancedTypefaceMetricsObj->fYMax = face->bbox.yMax;
-
-                pAdvancedTypefaceMetricsObj->isScalable = FT_IS_SCALABLE(face) ? true : false;
-                pAdvancedTypefaceMetricsObj->hasVerticalMetrics = FT_HAS_VERTICAL(face) ? true : false;
+            pAdvancedTypefaceMetricsObj->fMaxAdvWidth = face->max_advance_width;
 
-                FT_Done_Face(face);
-            }/* end else if */
+            pAdvancedTypefaceMetricsObj->fXMin = face->bbox.xMin;
+            pAdvancedTypefaceMetricsObj->fYMin = face->bbox.yMin;
+            pAdvancedTypefaceMetricsObj->fXMax = face->bbox.xMax;
+            pAdvancedTypefaceMetricsObj->fYMax = face->bbox.yMax;
 
-            FT_Done_FreeType(library);
+            pAdvancedTypefaceMetricsObj->isScalable = FT_IS_SCALABLE(face) ? true : false;
+            pAdvancedTypefaceMetricsObj->hasVerticalMetrics = FT_HAS_VERTICAL(face) ? true : false;
         }/* end else if */
     }/* end if */
 
@@ -1650,134 +3128,119 @@ AdvancedTypefaceMetrics* FontEngineFT::getAdvancedTypefaceMetrics(const void* bu
 #if defined(SK_BUILD_FOR_MAC) || defined(ANDROID)
     return NULL;
 #else
-    FT_Library  library;
     AdvancedTypefaceMetrics*  pAdvancedTypefaceMetricsObj = NULL;
 
     assert(buffer && bufferLength);
 
     if (buffer && bufferLength) {
-        FT_Open_Args  args;
-        FT_Face       face;
+        QueryFaceFT  query(buffer, bufferLength);
+        FT_Face      face = query.getFace();
 
-        if (FT_Init_FreeType(&library)) {
-            FT_LOG("failed to initalized FreeType\n");
+        if (face == NULL) {
+            FT_LOG("failed to create FT_Face\n");
         } else {
-            memset(&args, 0, sizeof(args));
-
-            args.flags = FT_OPEN_MEMORY;
-            args.memory_base = (const FT_Byte*)buffer;
-            args.memory_size = bufferLength;
+            pAdvancedTypefaceMetricsObj = new AdvancedTypefaceMetrics;
+
+            pAdvancedTypefaceMetricsObj->pFontName = strdup(FT_Get_Postscript_Name(face));
+            pAdvancedTypefaceMetricsObj->isMultiMaster = FT_HAS_MULTIPLE_MASTERS(face) ? true : false;
+            pAdvancedTypefaceMetricsObj->fNumGlyphs = face->num_glyphs;
+            pAdvancedTypefaceMetricsObj->fNumCharmaps = face->num_charmaps;
+            pAdvancedTypefaceMetricsObj->fEmSize = 1000;
+
+            bool cid = false;
+            const char* fontType = FT_Get_X11_Font_Format(face);
+            if (strcmp(fontType, "Type 1") == 0) {
+                pAdvancedTypefaceMetricsObj->fType = fem::TYPE1_FONT;
+            } else if (strcmp(fontType, "CID Type 1") == 0) {
+                pAdvancedTypefaceMetricsObj->fType = fem::TYPE1CID_FONT;
+                cid = true;
+            } else if (strcmp(fontType, "CFF") == 0) {
+                pAdvancedTypefaceMetricsObj->fType = fem::CFF_FONT;
+            } else if (strcmp(fontType, "TrueType") == 0) {
+                pAdvancedTypefaceMetricsObj->fType = fem::TRUETYPE_FONT;
+                cid = true;
+                TT_Header* ttHeader;
+                if ((ttHeader = (TT_Header*)FT_Get_Sfnt_Table(face, ft_sfnt_head)) != NULL) {
+                    pAdvancedTypefaceMetricsObj->fEmSize = ttHeader->Units_Per_EM;
+                }/* end if */
+            }/* end else if */
 
-            if (FT_Open_Face(library, &args, 0, &face)) {
-                FT_LOG("failed to create FT_Face\n");
-            } else {
-                pAdvancedTypefaceMetricsObj = new AdvancedTypefaceMetrics;
-
-                pAdvancedTypefaceMetricsObj->pFontName = strdup(FT_Get_Postscript_Name(face));
-                pAdvancedTypefaceMetricsObj->isMultiMaster = FT_HAS_MULTIPLE_MASTERS(face) ? true : false;
-                pAdvancedTypefaceMetricsObj->fNumGlyphs = face->num_glyphs;
-                pAdvancedTypefaceMetricsObj->fNumCharmaps = face->num_charmaps;
-                pAdvancedTypefaceMetricsObj->fEmSize = 1000;
-
-                bool cid = false;
-                const char* fontType = FT_Get_X11_Font_Format(face);
-                if (strcmp(fontType, "Type 1") == 0) {
-                    pAdvancedTypefaceMetricsObj->fType = fem::TYPE1_FONT;
-                } else if (strcmp(fontType, "CID Type 1") == 0) {
-                    pAdvancedTypefaceMetricsObj->fType = fem::TYPE1CID_FONT;
-                    cid = true;
-                } else if (strcmp(fontType, "CFF") == 0) {
-                    pAdvancedTypefaceMetricsObj->fType = fem::CFF_FONT;
-                } else if (strcmp(fontType, "TrueType") == 0) {
-                    pAdvancedTypefaceMetricsObj->fType = fem::TRUETYPE_FONT;
-                    cid = true;
-                    TT_Header* ttHeader;
-                    if ((ttHeader = (TT_Header*)FT_Get_Sfnt_Table(face, ft_sfnt_head)) != NULL) {
-                        pAdvancedTypefaceMetricsObj->fEmSize = ttHeader->Units_Per_EM;
-                    }/* end if */
-                }/* end else if */
+            pAdvancedTypefaceMetricsObj->fStyle = 0;
+            if (FT_IS_FIXED_WIDTH(face)) {
+                pAdvancedTypefaceMetricsObj->fStyle |= fem::FIXEDPITCH_STYLE;
+            }/* end if */
+            if (face->style_flags & FT_STYLE_FLAG_ITALIC) {
+                pAdvancedTypefaceMetricsObj->fStyle |= fem::ITALIC_STYLE;
+            }/* end if */
+            // We should set either Symbolic or Nonsymbolic; Nonsymbolic if the font's
+            // character set is a subset of 'Adobe standard Latin.'
+            pAdvancedTypefaceMetricsObj->fStyle |= fem::SYMBOLIC_STYLE;
+
+            PS_FontInfoRec ps_info;
+            TT_Postscript* tt_info;
+            if (FT_Get_PS_Font_Info(face, &ps_info) == 0) {
+                pAdvancedTypefaceMetricsObj->fItalicAngle = (int16_t)ps_info.italic_angle;
+            } else if ((tt_info = (TT_Postscript*)FT_Get_Sfnt_Table(face, ft_sfnt_post)) != NULL) {
+                pAdvancedTypefaceMetricsObj->fItalicAngle = (int16_t)(tt_info->italicAngle >> 16);
+            } else {
+                pAdvancedTypefaceMetricsObj->fItalicAngle = 0;
+            }/* end else if */
 
-                pAdvancedTypefaceMetricsObj->fStyle = 0;
-                if (FT_IS_FIXED_WIDTH(face)) {
-                    pAdvancedTypefaceMetricsObj->fStyle |= fem::FIXEDPITCH_STYLE;
-                }/* end if */
-                if (face->style_flags & FT_STYLE_FLAG_ITALIC) {
-                    pAdvancedTypefaceMetricsObj->fStyle |= fem::ITALIC_STYLE;
+            pAdvancedTypefaceMetricsObj->fAscent = face->ascender;
+            pAdvancedTypefaceMetricsObj->fDescent = face->descender;
+
+            // Figure out a good guess for StemV - Min width of i, I, !, 1.
+            // This probably isn't very good with an italic font.
+            int16_t min_width = SHRT_MAX;
+            pAdvancedTypefaceMetricsObj->fStemV = 0;
+            char stem_chars[] = {'i', 'I', '!', '1'};
+            for (size_t i = 0; i < sizeof(stem_chars)/sizeof(stem_chars[0]); i++) {
+                FT_BBox bbox;
+                if (GetLetterCBox(face, stem_chars[i], &bbox)) {
+                    int16_t width = bbox.xMax - bbox.xMin;
+                    if (width > 0 && width < min_width) {
+                        min_width = width;
+                        pAdvancedTypefaceMetricsObj->fStemV = min_width;
+                    }/* end if */
                 }/* end if */
-                // We should set either Symbolic or Nonsymbolic; Nonsymbolic if the font's
-                // character set is a subset of 'Adobe standard Latin.'
-                pAdvancedTypefaceMetricsObj->fStyle |= fem::SYMBOLIC_STYLE;
-
-                PS_FontInfoRec ps_info;
-                TT_Postscript* tt_info;
-                if (FT_Get_PS_Font_Info(face, &ps_info) == 0) {
-                    pAdvancedTypefaceMetricsObj->fItalicAngle = (int16_t)ps_info.italic_angle;
-                } else if ((tt_info = (TT_Postscript*)FT_Get_Sfnt_Table(face, ft_sfnt_post)) != NULL) {
-                    pAdvancedTypefaceMetricsObj->fItalicAngle = (int16_t)(tt_info->italicAngle >> 16);
-                } else {
-                    pAdvancedTypefaceMetricsObj->fItalicAngle = 0;
+            }/* end for */
+
+            TT_PCLT* pclt_info;
+            TT_OS2* os2_table;
+            if ((pclt_info = (TT_PCLT*)FT_Get_Sfnt_Table(face, ft_sfnt_pclt)) != NULL) {
+                pAdvancedTypefaceMetricsObj->fCapHeight = pclt_info->CapHeight;
+                uint8_t serif_style = pclt_info->SerifStyle & 0x3F;
+                if (serif_style >= 2 && serif_style <= 6) {
+                    pAdvancedTypefaceMetricsObj->fStyle |= fem::SERIF_STYLE;
+                } else if (serif_style >= 9 && serif_style <= 12) {
+                    pAdvancedTypefaceMetricsObj->fStyle |= fem::SCRIPT_STYLE;
                 }/* end else if */
-
-                pAdvancedTypefaceMetricsObj->fAscent = face->ascender;
-                pAdvancedTypefaceMetricsObj->fDescent = face->descender;
-
-                // Figure out a good guess for StemV - Min width of i, I, !, 1.
-                // This probably isn't very good with an italic font.
-                int16_t min_width = SHRT_MAX;
-                pAdvancedTypefaceMetricsObj->fStemV = 0;
-                char stem_chars[] = {'i', 'I', '!', '1'};
-                for (size_t i = 0; i < sizeof(stem_chars)/sizeof(stem_chars[0]); i++) {
-                    FT_BBox bbox;
-                    if (GetLetterCBox(face, stem_chars[i], &bbox)) {
-                        int16_t width = bbox.xMax - bbox.xMin;
-                        if (width > 0 && width < min_width) {
-                            min_width = width;
-                            pAdvancedTypefaceMetricsObj->fStemV = min_width;
-                        }/* end if */
-                    }/* end if */
-                }/* end for */
-
-                TT_PCLT* pclt_info;
-                TT_OS2* os2_table;
-                if ((pclt_info = (TT_PCLT*)FT_Get_Sfnt_Table(face, ft_sfnt_pclt)) != NULL) {
-                    pAdvancedTypefaceMetricsObj->fCapHeight = pclt_info->CapHeight;
-                    uint8_t serif_style = pclt_info->SerifStyle & 0x3F;
-                    if (serif_style >= 2 && serif_style <= 6) {
-                        pAdvancedTypefaceMetricsObj->fStyle |= fem::SERIF_STYLE;
-                    } else if (serif_style >= 9 && serif_style <= 12) {
-                        pAdvancedTypefaceMetricsObj->fStyle |= fem::SCRIPT_STYLE;
-                    }/* end else if */
-                } else if ((os2_table = (TT_OS2*)FT_Get_Sfnt_Table(face, ft_sfnt_os2)) != NULL) {
-                    pAdvancedTypefaceMetricsObj->fCapHeight = os2_table->sCapHeight;
-                } else {
-                    // Figure out a good guess for CapHeight: average the height of M and X.
-                    FT_BBox m_bbox, x_bbox;
-                    bool got_m, got_x;
-                    got_m = GetLetterCBox(face, 'M', &m_bbox);
-                    got_x = GetLetterCBox(face, 'X', &x_bbox);
-                    if (got_m && got_x) {
-                        pAdvancedTypefaceMetricsObj->fCapHeight = (m_bbox.yMax - m_bbox.yMin + x_bbox.yMax - x_bbox.yMin) / 2;
-                    } else if (got_m && !got_x) {
-                        pAdvancedTypefaceMetricsObj->fCapHeight = m_bbox.yMax - m_bbox.yMin;
-                    } else if (!got_m && got_x) {
-                        pAdvancedTypefaceMetricsObj->fCapHeight = x_bbox.yMax - x_bbox.yMin;
-                    }/* end else if */
+            } else if ((os2_table = (TT_OS2*)FT_Get_Sfnt_Table(face, ft_sfnt_os2)) != NULL) {
+                pAdvancedTypefaceMetricsObj->fCapHeight = os2_table->sCapHeight;
+            } else {
+                // Figure out a good guess for CapHeight: average the height of M and X.
+                FT_BBox m_bbox, x_bbox;
+                bool got_m, got_x;
+                got_m = GetLetterCBox(face, 'M', &m_bbox);
+                got_x = GetLetterCBox(face, 'X', &x_bbox);
+                if (got_m && got_x) {
+                    pAdvancedTypefaceMetricsObj->fCapHeight = (m_bbox.yMax - m_bbox.yMin + x_bbox.yMax - x_bbox.yMin) / 2;
+                } else if (got_m && !got_x) {
+                    pAdvancedTypefaceMetricsObj->fCapHeight = m_bbox.yMax - m_bbox.yMin;
+                } else if (!got_m && got_x) {
+                    pAdvancedTypefaceMetricsObj->fCapHeight = x_bbox.yMax - x_bbox.yMin;
                 }/* end else if */
+            }/* end else if */
 
-                pAdvancedTypefaceMetricsObj->fMaxAdvWidth = face->max_advance_width;
-
-                pAdvancedTypefaceMetricsObj->fXMin = face->bbox.xMin;
-                pAdvancedTypefaceMetricsObj->fYMin = face->bbox.yMin;
-                pAdvancedTypefaceMetricsObj->fXMax = face->bbox.xMax;
-                pAdvancedTypefaceMetricsObj->fYMax = face->bbox.yMax;
-
-                pAdvancedTypefaceMetricsObj->isScalable = FT_IS_SCALABLE(face) ? true : false;
-                pAdvancedTypefaceMetricsObj->hasVerticalMetrics = FT_HAS_VERTICAL(face) ? true : false;
+            pAdvancedTypefaceMetricsObj->fMaxAdvWidth = face->max_advance_width;
 
-                FT_Done_Face(face);
-            }/* end else if */
+            pAdvancedTypefaceMetricsObj->fXMin = face->bbox.xMin;
+            pAdvancedTypefaceMetricsObj->fYMin = face->bbox.yMin;
+            pAdvancedTypefaceMetricsObj->fXMax = face->bbox.xMax;
+            pAdvancedTypefaceMetricsObj->fYMax = face->bbox.yMax;
 
-            FT_Done_FreeType(library);
+            pAdvancedTypefaceMetricsObj->isScalable = FT_IS_SCALABLE(face) ? true : false;
+            pAdvancedTypefaceMetricsObj->hasVerticalMetrics = FT_HAS_VERTICAL(face) ? true : false;
         }/* end else if */
     }/* end if */
 
@@ -1788,14 +3251,39 @@ AdvancedTypefaceMetrics* FontEngineFT::getAdvancedTypefaceMetrics(const void* bu
 FontScaler* FontEngineFT::createFontScalerContext(const FontScalerInfo& desc)
 {
     android::Mutex::Autolock ac(gMutexFT);
-    return this->getFontScaler(desc);
+    FontScaler* pFontScaler = this->getFontScaler(desc);
+
+    if (gMemoryBudgetFT && OverMemoryBudget(gMemoryBudgetFT)) {
+        this->trimIdleFonts(gMemoryBudgetFT);
+    }/* end if */
+
+    return pFontScaler;
 }/* end method createFontScalerContext */
 
+/* Computes the content key of the file a font was opened from, reading its
+   start through the stream FreeType already has open on it. */
+static void FontContentKeyFT(FT_Face face, FontContentKey& content)
+{
+    FT_Stream  stream = face->stream;
+    uint8_t    header[FONT_CONTENT_HASH_LEN];
+    size_t     length = stream->size < FONT_CONTENT_HASH_LEN ? stream->size : FONT_CONTENT_HASH_LEN;
+
+    content.valid = false;
+
+    if (stream->read) {
+        length = stream->read(stream, 0, header, length);
+        FontContentKeyFT(header, length, stream->size, content);
+    } else if (stream->base) {
+        FontContentKeyFT(stream->base, length, stream->size, content);
+    }/* end else if */
+}/* end FontContentKeyFT */
+
 FontScaler* FontEngineFT::getFontScaler(const FontScalerInfo& desc)
 {
     FontScaler*  pFontScaler = NULL;
+    FontContentKey  content;
 
-    FontFT*  pFont = this->getFont(desc);
+    FontFT*  pFont = this->getFont(desc, content);
     if (pFont == NULL) {
         pFont = new FontFT(desc);
         if (! pFont->success()) {
@@ -1803,10 +3291,7 @@ FontScaler* FontEngineFT::getFontScaler(const FontScalerInfo& desc)
 
             if (gCountFontFT == 0) {
                 /* required as font was not initialized */
-                FT_LOG("FT_Done_FreeType\n");
-                FT_Done_FreeType(gLibraryFT);
-
-                assert(gLibraryFT = NULL);
+                DoneFreetype();
             }/* end if */
 
             return NULL;
@@ -1823,13 +3308,21 @@ FontScaler* FontEngineFT::getFontScaler(const FontScalerInfo& desc)
         fontNode->next = NULL;
         fontNode->font = pFont;
 
+        if (pFont->fromPath()) {
+            FontContentKeyFT(pFont->pFace, content);
+        }/* end if */
+
         pFontScaler = pFont->getFontScaler(desc);
         if (pFontScaler == NULL) {
             free(fontNode);
+            if (pFont->refCnt == 0) {
+                delete pFont;
+            }/* end if */
             return NULL;
         }/* end if */
 
         FontFTAddAtHead(&this->pFontList, fontNode);
+        this->indexFont(desc, content, pFont);
     } else {
         pFontScaler = pFont->getFontScaler(desc);
     }/* end else if */
@@ -1837,28 +3330,159 @@ FontScaler* FontEngineFT::getFontScaler(const FontScalerInfo& desc)
     return pFontScaler;
 }/* end method getFontScaler */
 
-FontFT* FontEngineFT::getFont(const FontScalerInfo& desc)
+FontFT* FontEngineFT::findFont(uint32_t kind, uint32_t hash, const FontScalerInfo& desc, const FontContentKey& content)
 {
-    FontNodePtr node = this->pFontList;
-    FontFT* pFontFT = NULL;
+    FontIndexNodePtr node = this->fontIndex[hash % FONT_INDEX_BUCKETS];
 
     while (node != NULL) {
-        if (desc.pBuffer && node->font->pBuffer) {
-            FT_LOG("[%x:%x]->", node, node->font->pBuffer);
-            if ( desc.pBuffer == node->font->pBuffer ) {
-                pFontFT = node->font;
+        if (node->kind == kind && node->hash == hash) {
+            FontFT* font = node->font;
+            bool    match = false;
+
+            switch (kind) {
+            case FONT_INDEX_ID:
+                match = node->fontID == desc.fontID;
                 break;
-            }/* end if */
-        } else {
-            FT_LOG("[%x:%s]->", node, node->font->pPath);
-            if ( ! strcmp(desc.pPath, node->font->pPath) ) {
-                pFontFT = node->font;
+            case FONT_INDEX_BUFFER:
+                /* the address may have been freed and reused for another
+                   font since, so the content has to match too */
+                match = font->pBuffer == desc.pBuffer && content.valid &&
+                        font->contentSize == content.size && font->contentHash == content.hash;
                 break;
+            case FONT_INDEX_PATH:
+                match = font->pPath != NULL && ! strcmp(desc.pPath, font->pPath);
+                break;
+            case FONT_INDEX_CONTENT:
+                match = font->contentSize == content.size && font->contentHash == content.hash;
+                break;
+            }/* end switch */
+
+            if (match) {
+                return font;
             }/* end if */
-        }/* end else if */
+        }/* end if */
+
         node = node->next;
     }/* end while */
 
+    return NULL;
+}/* end method findFont */
+
+void FontEngineFT::addIndex(uint32_t kind, uint32_t hash, uint32_t fontID, FontFT* font)
+{
+    FontIndexNodePtr node = (FontIndexNodePtr)malloc(sizeof(FontIndexNode));
+    if (node == NULL) {
+        /* the font will not be found by this key */
+        FT_LOG("malloc failed to allocate memory for FontIndexNode\n");
+        return;
+    }/* end if */
+
+    node->font = font;
+    node->hash = hash;
+    node->kind = kind;
+    node->fontID = fontID;
+    node->next = this->fontIndex[hash % FONT_INDEX_BUCKETS];
+    this->fontIndex[hash % FONT_INDEX_BUCKETS] = node;
+}/* end method addIndex */
+
+/* Gives 'font' the keys of 'desc' it does not have yet. */
+void FontEngineFT::indexFont(const FontScalerInfo& desc, const FontContentKey& content, FontFT* font)
+{
+    uint32_t hash;
+
+    if (desc.fontID) {
+        hash = FontIndexHash(FONT_INDEX_ID, &desc.fontID, sizeof(desc.fontID));
+        if (findFont(FONT_INDEX_ID, hash, desc, content) == NULL) {
+            addIndex(FONT_INDEX_ID, hash, desc.fontID, font);
+        }/* end if */
+    }/* end if */
+
+    /* only the buffer the face reads from; another buffer may be freed and
+       its address reused for other data */
+    if (desc.pBuffer && font->pBuffer == desc.pBuffer && content.valid) {
+        if (font->contentSize == 0) {
+            font->contentSize = content.size;
+            font->contentHash = content.hash;
+        }/* end if */
+
+        hash = FontIndexHash(FONT_INDEX_BUFFER, &desc.pBuffer, sizeof(desc.pBuffer));
+        if (font->contentSize == content.size && font->contentHash == content.hash &&
+            findFont(FONT_INDEX_BUFFER, hash, desc, content) == NULL) {
+            addIndex(FONT_INDEX_BUFFER, hash, 0, font);
+        }/* end if */
+    }/* end if */
+
+    if (! font->fromPath()) {
+        return;
+    }/* end if */
+
+    if (desc.pPath && font->pPath && ! strcmp(desc.pPath, font->pPath)) {
+        hash = FontIndexHash(FONT_INDEX_PATH, desc.pPath, strlen(desc.pPath));
+        if (findFont(FONT_INDEX_PATH, hash, desc, content) == NULL) {
+            addIndex(FONT_INDEX_PATH, hash, 0, font);
+        }/* end if */
+    }/* end if */
+
+    if (content.valid && font->contentSize == 0) {
+        font->contentSize = content.size;
+        font->contentHash = content.hash;
+        addIndex(FONT_INDEX_CONTENT, content.hash, 0, font);
+    }/* end if */
+}/* end method indexFont */
+
+void FontEngineFT::unindexFont(FontFT* font)
+{
+    for (int i = 0; i < FONT_INDEX_BUCKETS; i++) {
+        FontIndexNodePtr* link = &this->fontIndex[i];
+
+        while (*link) {
+            FontIndexNodePtr node = *link;
+
+            if (node->font == font) {
+                *link = node->next;
+                free(node);
+            } else {
+                link = &node->next;
+            }/* end else if */
+        }/* end while */
+    }/* end for */
+}/* end method unindexFont */
+
+/* Looks the font up by fontID, then buffer, then path and then content. The
+   content key is left in 'content' when it was computed. */
+FontFT* FontEngineFT::getFont(const FontScalerInfo& desc, FontContentKey& content)
+{
+    FontFT* pFontFT = NULL;
+
+    content.valid = false;
+
+    if (desc.fontID) {
+        pFontFT = findFont(FONT_INDEX_ID, FontIndexHash(FONT_INDEX_ID, &desc.fontID, sizeof(desc.fontID)), desc, content);
+        if (pFontFT) {
+            return pFontFT;
+        }/* end if */
+    }/* end if */
+
+    /* a buffer is keyed by its content too, which costs no I/O */
+    if (desc.pBuffer) {
+        FontContentKeyFT(desc.pBuffer, desc.size < FONT_CONTENT_HASH_LEN ? desc.size : FONT_CONTENT_HASH_LEN, desc.size, content);
+        pFontFT = findFont(FONT_INDEX_BUFFER, FontIndexHash(FONT_INDEX_BUFFER, &desc.pBuffer, sizeof(desc.pBuffer)), desc, content);
+    }/* end if */
+
+    if (pFontFT == NULL && desc.pPath) {
+        pFontFT = findFont(FONT_INDEX_PATH, FontIndexHash(FONT_INDEX_PATH, desc.pPath, strlen(desc.pPath)), desc, content);
+    }/* end if */
+
+    /* a path missing its key is a new font whose content is keyed once open */
+    if (pFontFT == NULL && content.valid) {
+        pFontFT = findFont(FONT_INDEX_CONTENT, content.hash, desc, content);
+    }/* end if */
+
+    if (pFontFT) {
+        FT_LOG("font %x found for fontID %d\n", pFontFT, desc.fontID);
+        this->indexFont(desc, content, pFontFT);
+    }/* end if */
+
     return pFontFT;
 }/* end method getFont */
 
@@ -1873,19 +3497,176 @@ extern "C" {
         return streamRead((void*)stream->descriptor.pointer, offset, buffer, count);
     }/* end method ft_stream_read */
 
+    static unsigned long ft_stream_read_cached(FT_Stream       stream,
+                                               unsigned long   offset,
+                                               unsigned char*  buffer,
+                                               unsigned long   count )
+    {
+        return ((StreamCacheFT*)stream->descriptor.pointer)->read(offset, buffer, count);
+    }/* end method ft_stream_read_cached */
+
     static void ft_stream_close(FT_Stream  stream) { FT_UNUSED(stream); }/* end method ft_stream_close */
 #ifdef __cplusplus
 }/* end extern "C" */
 #endif
 
+/**
+ * StreamCacheFT
+ */
+StreamCacheFT::StreamCacheFT(void* stream, unsigned long size)
+    : pStream(stream), streamSize(size), stamp(0), lastSlot(0), nextIndex(STREAM_BLOCK_NONE), readAhead(1)
+{
+    pBlocks = (uint8_t*)malloc((STREAM_CACHE_BLOCKS + STREAM_READ_AHEAD_MAX) * STREAM_BLOCK_SIZE);
+
+    for (int i = 0; i < STREAM_CACHE_BLOCKS; i++) {
+        blockIndex[i] = STREAM_BLOCK_NONE;
+        blockStamp[i] = 0;
+    }/* end for */
+}/* end constructor StreamCacheFT */
+
+StreamCacheFT::~StreamCacheFT()
+{
+    free(pBlocks);
+}/* end destructor StreamCacheFT */
+
+/* Returns the slot of the block, -1 if it is not cached. */
+int StreamCacheFT::findBlock(uint32_t index)
+{
+    if (blockIndex[lastSlot] == index) {
+        blockStamp[lastSlot] = ++stamp;
+        return lastSlot;
+    }/* end if */
+
+    for (int i = 0; i < STREAM_CACHE_BLOCKS; i++) {
+        if (blockIndex[i] == index) {
+            blockStamp[i] = ++stamp;
+            return i;
+        }/* end if */
+    }/* end for */
+
+    return -1;
+}/* end method findBlock */
+
+/* Reads the block, and the blocks following it when the reads run through
+   the stream, into the least recently used slots; returns the slot of the
+   block, -1 if the stream failed. */
+int StreamCacheFT::loadBlocks(uint32_t index)
+{
+    const uint32_t  lastIndex = (uint32_t)((streamSize - 1) >> STREAM_BLOCK_BITS);
+    uint32_t        count = 1;
+
+    if (index == nextIndex) {
+        count = readAhead;
+        readAhead = readAhead * 2 < STREAM_READ_AHEAD_MAX ? readAhead * 2 : STREAM_READ_AHEAD_MAX;
+    } else {
+        readAhead = 2;
+    }/* end else if */
+
+    /* stop at the end of the stream or at a block already cached */
+    if (count > lastIndex - index + 1) {
+        count = lastIndex - index + 1;
+    }/* end if */
+
+    for (uint32_t i = 1; i < count; i++) {
+        if (findBlock(index + i) >= 0) {
+            count = i;
+            break;
+        }/* end if */
+    }/* end for */
+
+    uint8_t*        readBuffer = pBlocks + STREAM_CACHE_BLOCKS * STREAM_BLOCK_SIZE;
+    unsigned long   offset = (unsigned long)index << STREAM_BLOCK_BITS;
+    unsigned long   length = (unsigned long)count << STREAM_BLOCK_BITS;
+
+    if (length > streamSize - offset) {
+        length = streamSize - offset;
+    }/* end if */
+
+    if (streamRead(pStream, offset, readBuffer, length) != length) {
+        FT_LOG("stream read of %lu bytes at %lu failed\n", length, offset);
+        nextIndex = STREAM_BLOCK_NONE;
+        return -1;
+    }/* end if */
+
+    /* the block asked for is placed last, as the most recently used */
+    int slot = -1;
+    for (uint32_t i = count; i-- > 0; ) {
+        slot = 0;
+        for (int j = 1; j < STREAM_CACHE_BLOCKS; j++) {
+            if (blockStamp[j] < blockStamp[slot]) {
+                slot = j;
+            }/* end if */
+        }/* end for */
+
+        unsigned long blockLength = length - (i << STREAM_BLOCK_BITS);
+        memcpy(pBlocks + slot * STREAM_BLOCK_SIZE, readBuffer + (i << STREAM_BLOCK_BITS),
+               blockLength < STREAM_BLOCK_SIZE ? blockLength : STREAM_BLOCK_SIZE);
+        blockIndex[slot] = index + i;
+        blockStamp[slot] = ++stamp;
+    }/* end for */
+
+    nextIndex = index + count;
+    return slot;
+}/* end method loadBlocks */
+
+unsigned long StreamCacheFT::read(unsigned long offset, unsigned char* buffer, unsigned long count)
+{
+    if (count == 0) {
+        return offset <= streamSize ? 0 : 1;
+    }/* end if */
+
+    if (offset >= streamSize) {
+        return 0;
+    }/* end if */
+
+    if (count > streamSize - offset) {
+        count = streamSize - offset;
+    }/* end if */
+
+    /* large reads would only flush the cache */
+    if (count > STREAM_READ_AHEAD_MAX * STREAM_BLOCK_SIZE) {
+        return streamRead(pStream, offset, buffer, count);
+    }/* end if */
+
+    unsigned long copied = 0;
+    while (copied < count) {
+        unsigned long   position = offset + copied;
+        uint32_t        index = (uint32_t)(position >> STREAM_BLOCK_BITS);
+        int             slot = findBlock(index);
+
+        if (slot < 0) {
+            slot = loadBlocks(index);
+            if (slot < 0) {
+                break;
+            }/* end if */
+        }/* end if */
+        lastSlot = slot;
+
+        unsigned long   start = position & (STREAM_BLOCK_SIZE - 1);
+        unsigned long   length = STREAM_BLOCK_SIZE - start;
+
+        if (length > count - copied) {
+            length = count - copied;
+        }/* end if */
+
+        memcpy(buffer + copied, pBlocks + slot * STREAM_BLOCK_SIZE + start, length);
+        copied += length;
+    }/* end while */
+
+    return copied;
+}/* end method read */
+
 FontFT::FontFT(const FontScalerInfo& desc)
-    : pPath(NULL), bInitialized(false), refCnt(0)
+    : faceLibrary(NULL), pFace(NULL), pPath(NULL), pMap(NULL), pStreamCache(NULL), bInitialized(false), refCnt(0), contentSize(0), contentHash(0), faceBytes(0), instSerial(0), activeSerial(0),
+      pGlyphsUnicode(NULL), pReplicaList(NULL), replicaBytes(0), replicaCount(0), replicable(false)
 {
+    memset((void*)cmapPages, 0, sizeof(cmapPages));
+
     FT_Error    err;
     int flag = 0;
 
 #ifdef ENABLE_FONTINSTLIST
-    pFontInstList = NULL;
+    memset(pFontInstBuckets, 0, sizeof(pFontInstBuckets));
 #endif /* ENABLE_FONTINSTLIST */
 
     if (gCountFontFT == 0) {
@@ -1917,24 +3698,54 @@ FontFT::FontFT(const FontScalerInfo& desc)
         args.flags = FT_OPEN_STREAM;
         args.stream = &streamRecFT;
 
+        if (desc.size) {
+            pStreamCache = new StreamCacheFT(desc.pStream, desc.size);
+            if (pStreamCache->success()) {
+                streamRecFT.descriptor.pointer = pStreamCache;
+                streamRecFT.read = ft_stream_read_cached;
+            } else {
+                delete pStreamCache;
+                pStreamCache = NULL;
+            }/* end else if */
+        }/* end if */
+
         flag = 2;
         FT_LOG("flag : %d\n", flag);
     }/* end else if */
 
-    if (flag) {
-        err = FT_Open_Face(gLibraryFT, &args, 0, &pFace);
-    } else {
-        err = FT_New_Face(gLibraryFT, desc.pPath, 0, &pFace);
-    }/* end else if */
+    {
+        MemoryMeterFT meter;
+
+        err = OpenFaceLibraryFT(&faceLibrary);
+        if (err) {
+            faceLibrary = NULL;
+        } else if (flag) {
+            err = FT_Open_Face(faceLibrary, &args, 0, &pFace);
+        } else {
+            err = NewFaceFT(faceLibrary, desc.pPath, &pMap, &pFace);
+        }/* end else if */
+
+        if (err && faceLibrary) {
+            CloseFaceLibraryFT(faceLibrary);
+            faceLibrary = NULL;
+        }/* end if */
+
+        faceBytes = meter.bytes();
+    }
 
     if (err) {
         FT_LOG("unable to create FT_Face for font '%d', error num : '%d' \n", fontID, err);
+        delete pStreamCache;
+        pStreamCache = NULL;
         return;
     } else {
         if (desc.pPath) {
             pPath = strdup(desc.pPath);
         }/* end if */
 
+        /* a stream can not be shared by several faces */
+        replicable = gFaceReplicasFT > 0 && (pBuffer || pPath);
+
         ++gCountFontFT;
         bInitialized = true;
     }/* end else if */
@@ -1944,6 +3755,7 @@ FontScaler* FontFT::getFontScaler(const FontScalerInfo& desc)
 {
     FontScaler* pFontScaler = NULL;
     FontInstFT* fontInst = NULL;
+    FontInstKey key;
 
 #ifdef ENABLE_FONTINSTLIST
     FontInstNodePtr fontInstNode = NULL;
@@ -1951,17 +3763,21 @@ FontScaler* FontFT::getFontScaler(const FontScalerInfo& desc)
 
     FTEnginePrintList;
 
+    this->getInstKey(desc, key);
+
+    android::Mutex::Autolock al(this->lock());
+
 #ifndef ENABLE_FONTINSTLIST
-    fontInst = new FontInstFT(desc, this);
+    fontInst = new FontInstFT(key, this);
     if (! fontInst->success()) {
         delete fontInst;
         return NULL;
     }/* end if */
 #else
-    fontInstNode = searchFontInst(desc);
-    if (NULL == fontInstNode)
+    fontInst = searchFontInst(key);
+    if (NULL == fontInst)
     {
-        fontInst = new FontInstFT(desc, this);
+        fontInst = new FontInstFT(key, this);
         if (! fontInst->success()) {
             delete fontInst;
             return NULL;
@@ -1976,10 +3792,11 @@ FontScaler* FontFT::getFontScaler(const FontScalerInfo& desc)
 
         fontInstNode->inst = fontInst;
         fontInstNode->next = NULL;
-        FontFTAddAtHead(&this->pFontInstList, fontInstNode);
+        FontFTAddAtHead(&this->pFontInstBuckets[key.hash % FONTINST_BUCKETS], fontInstNode);
         FT_LOG("Font: %x, Font instance: %x\n", fontInst, fontInstNode);
-    } else {
-        fontInst = fontInstNode->inst;
+    } else if (fontInst->refCnt == 0) {
+        /* an idle instance is in use again */
+        fontInst->leaveIdle();
     }/* end else if */
 #endif /* ENABLE_FONTINSTLIST */
 
@@ -1990,51 +3807,63 @@ FontScaler* FontFT::getFontScaler(const FontScalerInfo& desc)
 }/* end method getFontScaler */
 
 #ifdef ENABLE_FONTINSTLIST
-FontInstNodePtr FontFT::searchFontInst(const FontScalerInfo& desc)
-{
-  FT_Matrix  ftMatrix22;
-  FT_Matrix  ftMatrix22Temp;
-  FEM16Dot16 fScaleX;
-  FEM16Dot16 fScaleY;
-  uint32_t   loadGlyphFlags;
-
-  FontInstNodePtr node = this->pFontInstList;
-  FontInstFT* inst;
-
-  this->getTransMatrix(desc, ftMatrix22, fScaleX, fScaleY, loadGlyphFlags);
-
-  FT_LOG("FontScalerInfo -- fontID : %d, loadFlags : %d\n", desc.fontID, loadGlyphFlags);
-  FT_LOG("FontScalerInfo -- xx  : %d, xy : %d, yx : %d, yy : %d, scaleX : %d, scaleY : %d\n", ftMatrix22.xx >> 16, ftMatrix22.xy >> 16, ftMatrix22.yx >> 16, ftMatrix22.yy >> 16, fScaleX >> 16, fScaleY >> 16);
-
-  while(node)
-  {
-    inst = node->inst;
-    ftMatrix22Temp = inst->ftMatrix22;
-    if( (ftMatrix22Temp.xx == ftMatrix22.xx) &&
-        (ftMatrix22Temp.xy == ftMatrix22.xy) &&
-        (ftMatrix22Temp.yx == ftMatrix22.yx) &&
-        (ftMatrix22Temp.yy == ftMatrix22.yy) &&
-        (inst->fScaleX == fScaleX) &&
-        (inst->fScaleY == fScaleY) &&
-        (inst->loadGlyphFlags == loadGlyphFlags) &&
-        (inst->fontInstFlags == desc.flags) )
-    {
-        FT_LOG("font instance -- fontID : %d, loadFlags : %d\n", fontID, inst->loadGlyphFlags);
-        FT_LOG("font instance -- xx  : %d, xy : %d, yx : %d, yy : %d, scaleX : %d, scaleY : %d\n", ftMatrix22Temp.xx >> 16, ftMatrix22Temp.xy >> 16, ftMatrix22Temp.yx >> 16, ftMatrix22Temp.yy >> 16, inst->fScaleX >> 16, inst->fScaleY >> 16);
-
-        FT_LOG("font instance found!!\n");
+FontInstFT* FontFT::searchFontInst(const FontInstKey& key)
+{
+    FontInstNodePtr* bucket = &this->pFontInstBuckets[key.hash % FONTINST_BUCKETS];
+    FontInstNodePtr  node = *bucket;
+    FontInstNodePtr  prev = NULL;
+
+    FT_LOG("FontScalerInfo -- fontID : %d, loadFlags : %d\n", fontID, key.loadGlyphFlags);
+    FT_LOG("FontScalerInfo -- xx  : %d, xy : %d, yx : %d, yy : %d, scaleX : %d, scaleY : %d\n", key.ftMatrix22.xx >> 16, key.ftMatrix22.xy >> 16, key.ftMatrix22.yx >> 16, key.ftMatrix22.yy >> 16, key.fScaleX >> 16, key.fScaleY >> 16);
+
+    while (node) {
+        if (node->inst->matches(key)) {
+            FT_LOG("font instance found!!\n");
+
+            /* keep the most recently used instance first in its bucket */
+            if (prev) {
+                prev->next = node->next;
+                node->next = *bucket;
+                *bucket = node;
+            }/* end if */
 
-        return node;
-    }/* end if */
+            return node->inst;
+        }/* end if */
 
-    node = node->next;
-  }/* end while */
+        prev = node;
+        node = node->next;
+    }/* end while */
 
-  FT_LOG("could not found font instance!!\n");
-  return NULL;
+    FT_LOG("could not found font instance!!\n");
+    return NULL;
 }/* end method searchFontInst */
 #endif /* ENABLE_FONTINSTLIST */
 
+void FontFT::getInstKey(const FontScalerInfo& desc, FontInstKey& key)
+{
+    this->getTransMatrix(desc, key.ftMatrix22, key.fScaleX, key.fScaleY, key.loadGlyphFlags);
+
+    key.fontInstFlags = desc.flags;
+    key.maskFormat = desc.maskFormat;
+    key.subpixelPositioning = desc.subpixelPositioning;
+
+    /* FNV-1a over the fields */
+    uint32_t values[9] = {
+        (uint32_t)key.ftMatrix22.xx, (uint32_t)key.ftMatrix22.xy,
+        (uint32_t)key.ftMatrix22.yx, (uint32_t)key.ftMatrix22.yy,
+        (uint32_t)key.fScaleX, (uint32_t)key.fScaleY,
+        key.loadGlyphFlags, key.fontInstFlags,
+        ((uint32_t)key.maskFormat << 1) | (key.subpixelPositioning ? 1 : 0)
+    };
+    uint32_t h = 2166136261u;
+
+    for (int i = 0; i < 9; i++) {
+        h = (h ^ values[i]) * 16777619u;
+    }/* end for */
+
+    key.hash = h ^ (h >> 16);
+}/* end method getInstKey */
+
 void FontFT::getTransMatrix(const FontScalerInfo& desc, FT_Matrix& ftMatrix22, FEM16Dot16& fScaleX, FEM16Dot16& fScaleY, uint32_t& loadGlyphFlags)
 {
     /* compute our scale factors */
@@ -2147,91 +3976,358 @@ FontFT::~FontFT()
             curr = next;
         }/* end while */
 
-        if ( pPath ) {
-            free((char*)pPath);
-        }/* end if */
+        gFontEngineInstFT->unindexFont(this);
+
+        if ( pPath ) {
+            free((char*)pPath);
+        }/* end if */
+
+        free(pGlyphsUnicode);
+
+        for (int i = 0; i < CMAP_PAGE_COUNT; i++) {
+            free(cmapPages[i]);
+        }/* end for */
+
+        /* no scaler is left, so every replica is idle */
+        while (pReplicaList) {
+            FaceReplicaPtr next = pReplicaList->next;
+
+            __sync_fetch_and_sub(&gIdleReplicasFT, 1);
+            FT_Done_Face(pReplicaList->face);
+            CloseFaceLibraryFT(pReplicaList->library);
+            free(pReplicaList);
+            pReplicaList = next;
+        }/* end while */
+
+        FT_Done_Face(pFace);
+        pFace = NULL;
+        CloseFaceLibraryFT(faceLibrary);
+        faceLibrary = NULL;
+
+        ReleaseFontMapFT(pMap);
+        delete pStreamCache;
+
+        if (--gCountFontFT == 0) {
+            DoneFreetype();
+        }/* end if */
+    }/* end if */
+}/* end destructor FontFT */
+
+const int32_t* FontFT::getGlyphsUnicode()
+{
+    int32_t* glyphsUnicode = acquireLoad(&pGlyphsUnicode);
+
+    if (glyphsUnicode == NULL) {
+        /* the charmap of pFace is switched while the map is built */
+        android::Mutex::Autolock al(this->lock());
+
+        glyphsUnicode = pGlyphsUnicode;
+        if (glyphsUnicode == NULL && pFace->num_glyphs > 0) {
+            glyphsUnicode = (int32_t*)calloc(pFace->num_glyphs, sizeof(int32_t));
+            if (glyphsUnicode == NULL) {
+                FT_LOG("calloc failed to allocate the glyph to unicode map of %d glyphs\n", pFace->num_glyphs);
+                return NULL;
+            }/* end if */
+
+            FillGlyphsUnicodeFT(pFace, 0, pFace->num_glyphs, glyphsUnicode);
+            releaseStore(&pGlyphsUnicode, glyphsUnicode);
+        }/* end if */
+    }/* end if */
+
+    return glyphsUnicode;
+}/* end method getGlyphsUnicode */
+
+uint16_t FontFT::getCharGlyph(int32_t charUniCode)
+{
+    uint32_t charCode = (uint32_t)charUniCode;
+
+    if (charCode < (CMAP_PAGE_COUNT << CMAP_PAGE_BITS)) {
+        const uint16_t* page = acquireLoad(&cmapPages[charCode >> CMAP_PAGE_BITS]);
+
+        if (page == NULL) {
+            page = fillCmapPage(charCode >> CMAP_PAGE_BITS);
+        }/* end if */
+
+        if (page) {
+            return page[charCode & (CMAP_PAGE_SIZE - 1)];
+        }/* end if */
+    }/* end if */
+
+    android::Mutex::Autolock al(this->lock());
+    return (uint16_t)FT_Get_Char_Index(pFace, charCode);
+}/* end method getCharGlyph */
+
+/* Returns the given cmap page, filling it if no other thread did; NULL if
+   memory ran out. */
+const uint16_t* FontFT::fillCmapPage(uint32_t page)
+{
+    android::Mutex::Autolock al(this->lock());
+
+    uint16_t* glyphs = cmapPages[page];
+    if (glyphs) {
+        return glyphs;
+    }/* end if */
+
+    glyphs = (uint16_t*)calloc(CMAP_PAGE_SIZE, sizeof(uint16_t));
+    if (glyphs == NULL) {
+        FT_LOG("calloc failed to allocate cmap page %d\n", page);
+        return NULL;
+    }/* end if */
+
+    /* one walk over the characters of the page the face covers */
+    FT_ULong  first = page << CMAP_PAGE_BITS;
+    FT_ULong  charCode;
+    FT_UInt   glyphIndex;
+
+    glyphs[0] = (uint16_t)FT_Get_Char_Index(pFace, first);
+    charCode = FT_Get_Next_Char(pFace, first, &glyphIndex);
+
+    while (glyphIndex != 0 && charCode < first + CMAP_PAGE_SIZE) {
+        glyphs[charCode - first] = (uint16_t)glyphIndex;
+        charCode = FT_Get_Next_Char(pFace, charCode, &glyphIndex);
+    }/* end while */
+
+    releaseStore(&cmapPages[page], glyphs);
+
+    return glyphs;
+}/* end method fillCmapPage */
+
+FaceReplicaPtr FontFT::takeReplica()
+{
+    FaceReplicaPtr replica;
+
+    {
+        android::Mutex::Autolock al(replicaLock);
+
+        replica = pReplicaList;
+        if (replica) {
+            pReplicaList = replica->next;
+            replicaBytes -= replica->bytes;
+            __sync_fetch_and_sub(&gIdleReplicasFT, 1);
+            return replica;
+        }/* end if */
+
+        if (! replicable || replicaCount >= gFaceReplicasFT) {
+            return NULL;
+        }/* end if */
+
+        /* hold the place while the face is opened */
+        replicaCount++;
+    }
+
+    FT_Error err = FT_Err_Out_Of_Memory;
+
+    replica = (FaceReplicaPtr)malloc(sizeof(FaceReplica));
+    if (replica) {
+        memset(replica, 0, sizeof(FaceReplica));
+
+        /* opening a face changes the library */
+        android::Mutex::Autolock ac(gMutexFT);
+        MemoryMeterFT meter;
+
+        err = OpenFaceLibraryFT(&replica->library);
+        if (err) {
+            replica->library = NULL;
+        } else if (pBuffer) {
+            err = FT_New_Memory_Face(replica->library, (const FT_Byte*)pBuffer, streamRecFT.size, 0, &replica->face);
+        } else if (pMap) {
+            /* replicas read the mapping of the font's own face */
+            err = FT_New_Memory_Face(replica->library, pMap->base, (FT_Long)pMap->size, 0, &replica->face);
+        } else {
+            err = FT_New_Face(replica->library, pPath, 0, &replica->face);
+        }/* end else if */
+
+        replica->bytes = meter.bytes();
+    }/* end if */
+
+    if (err) {
+        FT_LOG("unable to create FT_Face replica for font '%d', error num : '%d' \n", fontID, err);
+        if (replica && replica->library) {
+            CloseFaceLibraryFT(replica->library);
+        }/* end if */
+        free(replica);
+
+        /* do not try again on every busy call */
+        android::Mutex::Autolock al(replicaLock);
+        replicaCount--;
+        replicable = false;
+        return NULL;
+    }/* end if */
+
+    FT_LOG("FT_Face replica %d created for font '%d', %d bytes\n", replicaCount, fontID, replica->bytes);
+    return replica;
+}/* end method takeReplica */
+
+void FontFT::giveReplica(FaceReplicaPtr replica)
+{
+    android::Mutex::Autolock al(replicaLock);
+
+    replica->next = pReplicaList;
+    pReplicaList = replica;
+    replicaBytes += replica->bytes;
+    __sync_fetch_and_add(&gIdleReplicasFT, 1);
+}/* end method giveReplica */
 
-        FT_Done_Face(pFace);
-        pFace = NULL;
+void FontFT::closeReplicas()
+{
+    FaceReplicaPtr replica;
 
-        if (--gCountFontFT == 0) {
-            FT_LOG("FT_Done_FreeType\n");
-            FT_Done_FreeType(gLibraryFT);
-            assert(gLibraryFT = NULL);
+    {
+        android::Mutex::Autolock al(replicaLock);
+
+        replica = pReplicaList;
+        pReplicaList = NULL;
+
+        for (FaceReplicaPtr r = replica; r != NULL; r = r->next) {
+            replicaCount--;
+            __sync_fetch_and_sub(&gIdleReplicasFT, 1);
+        }/* end for */
+
+        if (replica) {
+            FT_LOG("closing the idle replicas of font '%d', %d bytes\n", fontID, replicaBytes);
         }/* end if */
-    }/* end if */
-}/* end destructor FontFT */
+        replicaBytes = 0;
+    }
+
+    while (replica) {
+        FaceReplicaPtr next = replica->next;
 
-FontInstFT::FontInstFT(const FontScalerInfo& desc, FontFT* font)
-    : ftSize( NULL), pFont(font), refCnt(0), bInitialized(false)
+        FT_Done_Face(replica->face);
+        CloseFaceLibraryFT(replica->library);
+        free(replica);
+        replica = next;
+    }/* end while */
+}/* end method closeReplicas */
+
+FontInstFT::FontInstFT(const FontInstKey& key, FontFT* font)
+    : fontInstFlags(key.fontInstFlags), subpixelPositioning(key.subpixelPositioning),
+      fScaleX(key.fScaleX), fScaleY(key.fScaleY), ftMatrix22(key.ftMatrix22),
+      ftSize( NULL), sizeBytes(0), loadGlyphFlags(key.loadGlyphFlags), maskFormat(key.maskFormat),
+      pFont(font), refCnt(0), hash(key.hash), pMetricsCache(NULL), pHintedCache(NULL),
+      hintedCacheSize(key.subpixelPositioning ? GLYPH_SUBPIXEL_HINTED_CACHE_SIZE : GLYPH_HINTED_CACHE_SIZE),
+      bInitialized(false)
 {
-    pFont->getTransMatrix(desc, ftMatrix22, fScaleX, fScaleY, loadGlyphFlags);
+
+#ifdef ENABLE_FONTINSTLIST
+    idlePrev = idleNext = NULL;
+#endif /* ENABLE_FONTINSTLIST */
 
     FT_LOG("getTransMatrix returned, xx  : %d, xy : %d, yx : %d, yy : %d, scaleX : %d, scaleY : %d\n",
               ftMatrix22.xx >> 16, ftMatrix22.xy >> 16, ftMatrix22.yx >> 16,
               ftMatrix22.yy >> 16, fScaleX >> 16, fScaleY >> 16);
 
-    subpixelPositioning = desc.subpixelPositioning;
-    fontInstFlags = desc.flags;
-    maskFormat = desc.maskFormat;
+    serial = ++pFont->instSerial;
+    lastUse = __sync_add_and_fetch(&gUseClockFT, 1);
 
-    /* now create the FT_Size */
-    {
-        FT_Error    err;
+    if (newSize() != 0) {
+        return;
+    }/* end if */
 
-        err = FT_New_Size(pFont->pFace, &ftSize);
-        if (err != 0) {
-            FT_LOG("FT_New_Size(%d): FT_Set_Char_Size(%x, %x) returned %x\n",
-                      desc.fontID, fScaleX, fScaleY, err);
-            return;
-        }
+    bInitialized = true;
+    this->pFont->refCnt++;
+}/* end constructor FontInstFT */
 
-        err = FT_Activate_Size(ftSize);
-        if (err != 0) {
-            FT_LOG("FT_Activate_Size(%d, %x, %x) returned %x\n",
-                      desc.fontID, fScaleX, fScaleY, err);
+/* Creates the FT_Size of the instance on the font's face and sets the face
+   up for it; called with pFont->lock() held.
 
-            FT_Done_Size(ftSize);
-            ftSize = NULL;
+   Return : 0 on success; non zero value otherwise.
+*/
+FT_Error FontInstFT::newSize()
+{
+    FT_Error    err;
+    MemoryMeterFT meter;
 
-            return;
-        }
+    /* the size of the face changes here, even on failure */
+    pFont->activeSerial = 0;
 
-        err = FT_Set_Char_Size(pFont->pFace,
-                                  FEM16Dot16ToFEM26Dot6(fScaleX),
-                                  FEM16Dot16ToFEM26Dot6(fScaleY),
-                                  72, 72);
-        if (err != 0) {
-            FT_LOG("FT_Set_Char_Size(%d, %x, %x) returned %x\n",
-                      desc.fontID, fScaleX, fScaleY, err);
+    err = FT_New_Size(pFont->pFace, &ftSize);
+    if (err != 0) {
+        FT_LOG("FT_New_Size(%d): FT_Set_Char_Size(%x, %x) returned %x\n",
+                  pFont->fontID, fScaleX, fScaleY, err);
+        ftSize = NULL;
+        return err;
+    }/* end if */
 
-            FT_Done_Size(ftSize);
-            ftSize = NULL;
+    err = FT_Activate_Size(ftSize);
+    if (err != 0) {
+        FT_LOG("FT_Activate_Size(%d, %x, %x) returned %x\n",
+                  pFont->fontID, fScaleX, fScaleY, err);
 
-            return;
-        }
+        FT_Done_Size(ftSize);
+        ftSize = NULL;
 
-        FT_Set_Transform(pFont->pFace, &ftMatrix22, NULL);
-    }
+        return err;
+    }/* end if */
 
-    bInitialized = true;
-    this->pFont->refCnt++;
-}/* end constructor FontInstFT */
+    err = FT_Set_Char_Size(pFont->pFace,
+                              FEM16Dot16ToFEM26Dot6(fScaleX),
+                              FEM16Dot16ToFEM26Dot6(fScaleY),
+                              72, 72);
+    if (err != 0) {
+        FT_LOG("FT_Set_Char_Size(%d, %x, %x) returned %x\n",
+                  pFont->fontID, fScaleX, fScaleY, err);
 
-FontInstFT::~FontInstFT()
+        FT_Done_Size(ftSize);
+        ftSize = NULL;
+
+        return err;
+    }/* end if */
+
+    FT_Set_Transform(pFont->pFace, &ftMatrix22, NULL);
+    pFont->activeSerial = serial;
+    sizeBytes = meter.bytes();
+
+    return 0;
+}/* end method newSize */
+
+void FontInstFT::trim()
 {
-    if (bInitialized) {
-#ifndef ENABLE_FONTINSTLIST
+    if (ftSize) {
+        /* FT_Done_Size may activate any size of the face */
+        pFont->activeSerial = 0;
+
         FT_Done_Size(ftSize);
         ftSize = NULL;
+        sizeBytes = 0;
+    }/* end if */
+
+    android::Mutex::Autolock al(cacheLock);
+    freeCaches();
+}/* end method trim */
+
+/* Frees the glyph caches; called with cacheLock held or by the destructor. */
+void FontInstFT::freeCaches()
+{
+    free(pMetricsCache);
+    pMetricsCache = NULL;
 
-        if( (-- this->pFont->refCnt) == 0 ) {
-            delete this->pFont;
+    if (pHintedCache) {
+        for (uint32_t i = 0; i < hintedCacheSize; i++) {
+            if (pHintedCache[i].valid) {
+                FT_Outline_Done(gLibraryFT, &pHintedCache[i].outline);
+            }/* end if */
+        }/* end for */
+
+        free(pHintedCache);
+        pHintedCache = NULL;
+    }/* end if */
+}/* end method freeCaches */
+
+FontInstFT::~FontInstFT()
+{
+    if (bInitialized) {
+#ifndef ENABLE_FONTINSTLIST
+        if (ftSize) {
+            FT_Done_Size(ftSize);
+            ftSize = NULL;
         }/* end if */
 
+        -- this->pFont->refCnt;
+
         FT_LOG("font instance %x destroyed\n", this);
 #else
-        FontInstNodePtr curr = this->pFont->pFontInstList;
+        FontInstNodePtr* bucket = &this->pFont->pFontInstBuckets[hash % FONTINST_BUCKETS];
+        FontInstNodePtr curr = *bucket;
         FontInstNodePtr prev = NULL;
         FontInstNodePtr next = NULL;
 
@@ -2241,7 +4337,7 @@ FontInstFT::~FontInstFT()
                 if (prev) {
                     prev->next = next;
                 } else {
-                    this->pFont->pFontInstList = next;
+                    *bucket = next;
                 }/* end else if */
 
                 free(curr);
@@ -2251,24 +4347,210 @@ FontInstFT::~FontInstFT()
             curr = next;
         }/* end while */
 
-        FT_Done_Size(ftSize);
-        ftSize = NULL;
-
-        if( (-- this->pFont->refCnt) == 0 ) {
-            delete this->pFont;
+        if (ftSize) {
+            FT_Done_Size(ftSize);
+            ftSize = NULL;
         }/* end if */
 
+        -- this->pFont->refCnt;
+
         FT_LOG("font instance %x destroyed\n", this);
 #endif /* ENABLE_FONTINSTLIST */
-    } else {
-        if( (this->pFont->refCnt) == 0 ) {
-            delete this->pFont;
-        }/* end if */
     }/* end if */
+
+    freeCaches();
+
+    /* the font is deleted by the owner of the last reference, once its
+       lock has been released */
 }/* end destructor FontInstFT */
 
+/* Returns the metrics cache key of a glyph; GLYPH_KEY_NONE if the offset is
+   not one the key can hold. The bounds only depend on the 26.6 offset (see
+   FontScalerFT::setBounds()). */
+uint32_t FontInstFT::glyphKey(uint16_t glyphID, FEM16Dot16 fracX, FEM16Dot16 fracY) const
+{
+    if (! subpixelPositioning) {
+        return glyphID;
+    }/* end if */
+
+    uint32_t dx = (uint32_t)(fracX >> 10);
+    uint32_t dy = (uint32_t)(fracY >> 10);
+
+    if (dx > 63 || dy > 63) {
+        return GLYPH_KEY_NONE;
+    }/* end if */
+
+    return glyphID | (dx << 16) | (dy << 22);
+}/* end method glyphKey */
+
+static inline uint32_t metricsSlot(uint32_t key)
+{
+    return (key * 2654435761u) >> (32 - GLYPH_METRICS_CACHE_BITS);
+}/* end method metricsSlot */
+
+bool FontInstFT::findMetrics(uint32_t key, GlyphMetrics& gm)
+{
+    if (pMetricsCache == NULL || key == GLYPH_KEY_NONE) {
+        return false;
+    }/* end if */
+
+    GlyphMetricsEntryFT* entry = &pMetricsCache[metricsSlot(key)];
+    if (entry->key != key) {
+        return false;
+    }/* end if */
+
+    gm = entry->metrics;
+    return true;
+}/* end method findMetrics */
+
+void FontInstFT::putMetrics(uint32_t key, const GlyphMetrics& gm)
+{
+    if (key == GLYPH_KEY_NONE) {
+        return;
+    }/* end if */
+
+    if (pMetricsCache == NULL) {
+        pMetricsCache = (GlyphMetricsEntryFT*)malloc(GLYPH_METRICS_CACHE_SIZE * sizeof(GlyphMetricsEntryFT));
+        if (pMetricsCache == NULL) {
+            FT_LOG("malloc failed to allocate the glyph metrics cache\n");
+            return;
+        }/* end if */
+
+        for (int i = 0; i < GLYPH_METRICS_CACHE_SIZE; i++) {
+            pMetricsCache[i].key = GLYPH_KEY_NONE;
+        }/* end for */
+    }/* end if */
+
+    GlyphMetricsEntryFT* entry = &pMetricsCache[metricsSlot(key)];
+    entry->key = key;
+    entry->metrics = gm;
+}/* end method putMetrics */
+
+HintedGlyphFT* FontInstFT::findHinted(uint16_t glyphID)
+{
+    if (pHintedCache == NULL) {
+        return NULL;
+    }/* end if */
+
+    HintedGlyphFT* glyph = &pHintedCache[glyphID & (hintedCacheSize - 1)];
+    if (!glyph->valid || glyph->glyphID != glyphID) {
+        return NULL;
+    }/* end if */
+
+    return glyph;
+}/* end method findHinted */
+
+/* Keeps a copy of the outline glyph loaded in 'slot', in place of the glyph
+   kept in its entry. */
+void FontInstFT::putHinted(uint16_t glyphID, FT_GlyphSlot slot)
+{
+    if (pHintedCache == NULL) {
+        pHintedCache = (HintedGlyphFT*)calloc(hintedCacheSize, sizeof(HintedGlyphFT));
+        if (pHintedCache == NULL) {
+            FT_LOG("calloc failed to allocate the hinted glyph cache\n");
+            return;
+        }/* end if */
+    }/* end if */
+
+    HintedGlyphFT* glyph = &pHintedCache[glyphID & (hintedCacheSize - 1)];
+
+    if (glyph->valid) {
+        FT_Outline_Done(gLibraryFT, &glyph->outline);
+        glyph->valid = false;
+    }/* end if */
+
+    if (FT_Outline_New(gLibraryFT, slot->outline.n_points, slot->outline.n_contours, &glyph->outline) != 0) {
+        FT_LOG("FT_Outline_New(%d points, %d contours) failed\n", slot->outline.n_points, slot->outline.n_contours);
+        return;
+    }/* end if */
+
+    FT_Outline_Copy(&slot->outline, &glyph->outline);
+
+    glyph->glyphID = glyphID;
+    glyph->advance = slot->advance;
+    glyph->linearHoriAdvance = slot->linearHoriAdvance;
+    glyph->lsbDelta = slot->lsb_delta;
+    glyph->rsbDelta = slot->rsb_delta;
+    glyph->valid = true;
+}/* end method putHinted */
+
+#ifdef ENABLE_FONTINSTLIST
+bool FontInstFT::matches(const FontInstKey& key) const
+{
+    return hash == key.hash &&
+           ftMatrix22.xx == key.ftMatrix22.xx &&
+           ftMatrix22.xy == key.ftMatrix22.xy &&
+           ftMatrix22.yx == key.ftMatrix22.yx &&
+           ftMatrix22.yy == key.ftMatrix22.yy &&
+           fScaleX == key.fScaleX &&
+           fScaleY == key.fScaleY &&
+           loadGlyphFlags == key.loadGlyphFlags &&
+           fontInstFlags == key.fontInstFlags &&
+           maskFormat == key.maskFormat &&
+           subpixelPositioning == key.subpixelPositioning;
+}/* end method matches */
+
+void FontInstFT::enterIdle()
+{
+    idlePrev = NULL;
+    idleNext = gIdleInstHeadFT;
+
+    if (gIdleInstHeadFT) {
+        gIdleInstHeadFT->idlePrev = this;
+    } else {
+        gIdleInstTailFT = this;
+    }/* end else if */
+
+    gIdleInstHeadFT = this;
+    gIdleInstCountFT++;
+}/* end method enterIdle */
+
+void FontInstFT::leaveIdle()
+{
+    if (idlePrev) {
+        idlePrev->idleNext = idleNext;
+    } else {
+        gIdleInstHeadFT = idleNext;
+    }/* end else if */
+
+    if (idleNext) {
+        idleNext->idlePrev = idlePrev;
+    } else {
+        gIdleInstTailFT = idlePrev;
+    }/* end else if */
+
+    idlePrev = idleNext = NULL;
+    gIdleInstCountFT--;
+}/* end method leaveIdle */
+
+void FontInstFT::trimIdle(int maxCount)
+{
+    while (gIdleInstCountFT > maxCount) {
+        FontInstFT* inst = gIdleInstTailFT;
+        FontFT*     pFont = inst->pFont;
+        bool        fontUnused;
+
+        inst->leaveIdle();
+
+        {
+            android::Mutex::Autolock al(pFont->lock());
+
+            FT_LOG("deleting idle font instance %x of font %d, %d bytes\n", inst, pFont->fontID, inst->sizeBytes);
+            delete inst;
+            fontUnused = pFont->refCnt == 0;
+        }
+
+        if (fontUnused) {
+            FT_LOG("deleting font %d, %d bytes\n", pFont->fontID, pFont->faceBytes);
+            delete pFont;
+        }/* end if */
+    }/* end while */
+}/* end method trimIdle */
+#endif /* ENABLE_FONTINSTLIST */
+
 /*  We call this before each use of the fFace, since we may be sharing
-    this face with other context (at different sizes).
+    this face with other context (at different sizes). Nothing is done when
+    this instance was the last to set the face up.
 
     Return : 0 on success; non zero value otherwise.
 */
@@ -2278,22 +4560,148 @@ FT_Error FontInstFT::setupSize()
 
     assert(bInitialized);
 
+    if (pFont->activeSerial == serial) {
+        return 0;
+    }/* end if */
+
+    if (ftSize == NULL) {
+        /* dropped by FontInstFT::trim() */
+        return newSize();
+    }/* end if */
+
     FT_LOG("this : %x, xx  : %d, xy : %d, yx : %d, yy : %d, scaleX : %d, scaleY : %d\n", this, ftMatrix22.xx >> 16, ftMatrix22.xy >> 16, ftMatrix22.yx >> 16, ftMatrix22.yy >> 16, fScaleX >> 16, fScaleY >> 16);
 
+    pFont->activeSerial = 0;
+
     err = FT_Activate_Size(ftSize);
     if (err != 0) {
         FT_LOG("FT_Activate_Size(%s, %x, %x) returned %x\n",
                   pFont->pPath, fScaleX, fScaleY, err);
     } else {
-        /* seems we need to reset this every time (not sure why, but without it
-         * I get random italics from some other fFTSize) */
+        /* the transform belongs to the face, not to the FT_Size, so it is
+         * set again whenever another instance had the face */
         FT_Set_Transform(pFont->pFace, &ftMatrix22, NULL);
+        pFont->activeSerial = serial;
     }/* end else if */
 
     FT_LOG("successfully set transformation for font instance: %x\n", this);
     return err;
 }/* end method setupSize */
 
+/*  The replica counterpart of setupSize(); the replica keeps an FT_Size for
+    each of the font instances it was last used with.
+
+    Return : 0 on success; non zero value otherwise.
+*/
+FT_Error FontInstFT::setupReplica(FaceReplicaPtr replica)
+{
+    FT_Error    err = 0;
+    FT_Size     size;
+    int         i;
+
+    assert(bInitialized);
+
+    if (replica->activeSerial == serial) {
+        return 0;
+    }/* end if */
+
+    /* FT_Done_Size below may activate any size of the face */
+    replica->activeSerial = 0;
+
+    /* the replica is leased, so its bytes are ours to change */
+    MemoryMeterFT meter;
+
+    for (i = 0; i < FACE_REPLICA_SIZES - 1; i++) {
+        if (replica->sizes[i] == NULL || replica->serials[i] == serial) {
+            break;
+        }/* end if */
+    }/* end for */
+
+    size = replica->sizes[i];
+    if (size && replica->serials[i] != serial) {
+        /* drop the least recently used size */
+        FT_Done_Size(size);
+        replica->sizes[i] = size = NULL;
+    }/* end if */
+
+    if (size == NULL) {
+        err = FT_New_Size(replica->face, &size);
+        if (err != 0) {
+            FT_LOG("FT_New_Size(%s, %x, %x) returned %x\n",
+                      pFont->pPath, fScaleX, fScaleY, err);
+            replica->bytes += meter.bytes();
+            return err;
+        }/* end if */
+
+        err = FT_Activate_Size(size);
+        if (err == 0) {
+            err = FT_Set_Char_Size(replica->face,
+                                      FEM16Dot16ToFEM26Dot6(fScaleX),
+                                      FEM16Dot16ToFEM26Dot6(fScaleY),
+                                      72, 72);
+        }/* end if */
+    } else {
+        err = FT_Activate_Size(size);
+    }/* end else if */
+
+    if (err != 0) {
+        FT_LOG("replica FT_Activate_Size(%s, %x, %x) returned %x\n",
+                  pFont->pPath, fScaleX, fScaleY, err);
+        FT_Done_Size(size);
+        replica->sizes[i] = NULL;
+        replica->bytes += meter.bytes();
+        return err;
+    }/* end if */
+
+    /* move the size to the front */
+    memmove(&replica->sizes[1], &replica->sizes[0], i * sizeof(FT_Size));
+    memmove(&replica->serials[1], &replica->serials[0], i * sizeof(uint32_t));
+    replica->sizes[0] = size;
+    replica->serials[0] = serial;
+
+    FT_Set_Transform(replica->face, &ftMatrix22, NULL);
+    replica->activeSerial = serial;
+    replica->bytes += meter.bytes();
+
+    return err;
+}/* end method setupReplica */
+
+FaceLeaseFT::FaceLeaseFT(FontInstFT* fontInst)
+    : pFont(fontInst->pFont), pReplica(NULL), ftFace(NULL), err(0)
+{
+    bool locked = false;
+
+    fontInst->lastUse = __sync_add_and_fetch(&gUseClockFT, 1);
+
+    if (pFont->replicable) {
+        locked = pFont->lock().tryLock() == 0;
+        if (! locked) {
+            pReplica = pFont->takeReplica();
+        }/* end if */
+    }/* end if */
+
+    if (pReplica) {
+        ftFace = pReplica->face;
+        err = fontInst->setupReplica(pReplica);
+    } else {
+        if (! locked) {
+            pFont->lock().lock();
+        }/* end if */
+
+        ftFace = pFont->pFace;
+        err = fontInst->setupSize();
+    }/* end else if */
+}/* end constructor FaceLeaseFT */
+
+FaceLeaseFT::~FaceLeaseFT()
+{
+    if (pReplica) {
+        pFont->giveReplica(pReplica);
+    } else {
+        pFont->lock().unlock();
+    }/* end else if */
+}/* end destructor FaceLeaseFT */
+
 /**
  * FontScalerFT.
  */
@@ -2301,7 +4709,6 @@ FontScalerFT::FontScalerFT(FontInstFT* fontInst) : pFontInst(fontInst), bInitial
 {
     assert(pFontInst);
 
-    ftFace = fontInst->pFont->pFace;
     bInitialized = true;
     this->pFontInst->refCnt++;
 
@@ -2310,17 +4717,55 @@ FontScalerFT::FontScalerFT(FontInstFT* fontInst) : pFontInst(fontInst), bInitial
 
 FontScalerFT::~FontScalerFT()
 {
-    android::Mutex::Autolock ac(gMutexFT);
-
     if (bInitialized) {
-        if (ftFace) {
-            ftFace = NULL;
-        }/* end if */
+        FontFT* pFont = this->pFontInst->pFont;
+
+        {
+            android::Mutex::Autolock al(pFont->lock());
+
+            if (this->pFontInst->refCnt > 1) {
+                /* other scalers still use the font instance */
+                -- this->pFontInst->refCnt;
+                FT_LOG("strike %x destroyed\n", this);
+                return;
+            }/* end if */
+        }
+
+        /* The font instance, and perhaps the font, goes away with the last
+           reference; that changes the font list so gMutexFT is needed. A
+           new scaler may have taken a reference meanwhile, hence the count
+           is checked again. */
+        android::Mutex::Autolock ac(gMutexFT);
+        bool fontUnused = false;
+
+        {
+            android::Mutex::Autolock al(pFont->lock());
+
+            if( (-- this->pFontInst->refCnt) == 0 ) {
+#ifdef ENABLE_FONTINSTLIST
+                if (pFont->fromPath()) {
+                    /* keep the font instance for the next scaler at its size */
+                    this->pFontInst->enterIdle();
+                } else {
+                    /* the client may free the font data now */
+                    delete this->pFontInst;
+                    fontUnused = pFont->refCnt == 0;
+                }/* end else if */
+#else
+                /* delete font instance */
+                delete this->pFontInst;
+                fontUnused = pFont->refCnt == 0;
+#endif /* ENABLE_FONTINSTLIST */
+            }/* end if */
+        }
 
-        if( (-- this->pFontInst->refCnt) == 0 ) {
-            /* delete font instance */
-            delete this->pFontInst;
+        if (fontUnused) {
+            delete pFont;
         }/* end if */
+
+#ifdef ENABLE_FONTINSTLIST
+        FontInstFT::trimIdle(FONTINST_IDLE_MAX);
+#endif /* ENABLE_FONTINSTLIST */
     }/* end if */
 
     FT_LOG("strike %x destroyed\n", this);
@@ -2328,38 +4773,44 @@ FontScalerFT::~FontScalerFT()
 
 uint16_t FontScalerFT::getCharToGlyphID(int32_t charUniCode)
 {
-    android::Mutex::Autolock ac(gMutexFT);
+    uint16_t glyphID = this->pFontInst->pFont->getCharGlyph(charUniCode);
 
-    FT_LOG("unicode : %d, glyph : %d\n", charUniCode, (uint16_t)FT_Get_Char_Index(ftFace, (FT_ULong)charUniCode));
-    return (uint16_t)FT_Get_Char_Index(ftFace, (FT_ULong)charUniCode);
+    FT_LOG("unicode : %d, glyph : %d\n", charUniCode, glyphID);
+    return glyphID;
 }/* end method getCharToGlyphID */
 
 int32_t FontScalerFT::getGlyphIDToChar(uint16_t glyphID)
 {
-    android::Mutex::Autolock ac(gMutexFT);
+    FontFT*         pFont = this->pFontInst->pFont;
+    const int32_t*  glyphsUnicode = pFont->getGlyphsUnicode();
+    int32_t         charCode = 0;
 
-    /* iterate through each cmap entry, looking for matching glyph indices */
-    FT_UInt glyphIndex;
-    int32_t charCode = FT_Get_First_Char(ftFace, &glyphIndex);
-
-    while (glyphIndex != 0) {
-        if (glyphIndex == glyphID) {
-            FT_LOG("glyph : %d, unicode : %d\n", glyphID, charCode);
-            return charCode;
-        }/* end if */
-        charCode = FT_Get_Next_Char(ftFace, charCode, &glyphIndex);
-    }/* end while */
+    if (glyphsUnicode && glyphID < pFont->pFace->num_glyphs) {
+        charCode = glyphsUnicode[glyphID];
+    }/* end if */
 
-    FT_LOG("glyph : %d, unicode : 0\n", glyphID);
-    return 0;
-}/* end method getCharToGlyphID */
+    FT_LOG("glyph : %d, unicode : %d\n", glyphID, charCode);
+    return charCode;
+}/* end method getGlyphIDToChar */
 
 uint16_t FontScalerFT::getGlyphCount() const
 {
-    return (uint16_t)ftFace->num_glyphs;
+    return (uint16_t)this->pFontInst->pFont->pFace->num_glyphs;
 }/* end method getGlyphCount */
 
 GlyphMetrics FontScalerFT::getGlyphAdvance(uint16_t glyphID, FEM16Dot16 fracX, FEM16Dot16 fracY)
+{
+    FaceLeaseFT   lease(this->pFontInst);
+    GlyphMetrics  gm;
+
+    if (lease.error() == 0) {
+        gm = generateAdvance(lease.face(), glyphID, fracX, fracY);
+    }/* end if */
+
+    return gm;
+}/* end method getGlyphAdvance */
+
+GlyphMetrics FontScalerFT::generateAdvance(FT_Face ftFace, uint16_t glyphID, FEM16Dot16 fracX, FEM16Dot16 fracY)
 {
     GlyphMetrics  gm;
 #ifdef FT_ADVANCES_H
@@ -2367,15 +4818,9 @@ GlyphMetrics FontScalerFT::getGlyphAdvance(uint16_t glyphID, FEM16Dot16 fracX, F
      * which are very cheap to compute with some font formats...
      */
     {
-        android::Mutex::Autolock ac(gMutexFT);
-
         FT_UNUSED(fracX);
         FT_UNUSED(fracY);
 
-        if (this->pFontInst->setupSize()) {
-            return gm;
-        }
-
         FT_Error  error;
         FT_Fixed  advance;
 
@@ -2393,69 +4838,80 @@ GlyphMetrics FontScalerFT::getGlyphAdvance(uint16_t glyphID, FEM16Dot16 fracX, F
     }
 #else
     /* otherwise, we need to load/hint the glyph, which is slower */
-    gm  = this->getGlyphMetrics(glyphID, fracX, fracY);
+    gm  = generateMetrics(ftFace, glyphID, fracX, fracY);
 #endif/* FT_ADVANCES_H */
 
     return gm;
-}/* end method getGlyphAdvance */
+}/* end method generateAdvance */
 
 GlyphMetrics FontScalerFT::getGlyphMetrics(uint16_t glyphID, FEM16Dot16 fracX, FEM16Dot16 fracY)
 {
-    android::Mutex::Autolock ac(gMutexFT);
     GlyphMetrics  gm;
 
-    FT_Error    err;
+    {
+        /* a cached glyph needs no face */
+        android::Mutex::Autolock al(this->pFontInst->cacheLock);
 
-    if (this->pFontInst->setupSize()) {
-        goto ERROR;
+        if (this->pFontInst->findMetrics(this->pFontInst->glyphKey(glyphID, fracX, fracY), gm)) {
+            return gm;
+        }/* end if */
+    }
+
+    FaceLeaseFT   lease(this->pFontInst);
+
+    if (lease.error() == 0) {
+        gm = generateMetrics(lease.face(), glyphID, fracX, fracY);
     }/* end if */
 
-    err = FT_Load_Glyph(ftFace, glyphID, this->pFontInst->loadGlyphFlags);
+    return gm;
+}/* end method getGlyphMetrics */
+
+GlyphMetrics FontScalerFT::generateMetrics(FT_Face ftFace, uint16_t glyphID, FEM16Dot16 fracX, FEM16Dot16 fracY)
+{
+    GlyphMetrics  gm;
+    FontInstFT*   inst = this->pFontInst;
+    uint32_t      key = inst->glyphKey(glyphID, fracX, fracY);
+
+    {
+        android::Mutex::Autolock al(inst->cacheLock);
+
+        if (inst->findMetrics(key, gm)) {
+            return gm;
+        }/* end if */
+
+        HintedGlyphFT* glyph = inst->findHinted(glyphID);
+        if (glyph) {
+            setBounds(&glyph->outline, fracX, fracY, gm);
+            setAdvance(glyph->advance, glyph->linearHoriAdvance, glyph->lsbDelta, glyph->rsbDelta, gm);
+            inst->putMetrics(key, gm);
+            return gm;
+        }/* end if */
+    }
+
+    FT_Error    err;
+
+    err = FT_Load_Glyph(ftFace, glyphID, inst->loadGlyphFlags);
     if (err != 0) {
         FT_LOG("FT_Load_Glyph(glyph:%d flags:%d) returned %x\n",
-                 glyphID, this->pFontInst->loadGlyphFlags, err);
+                 glyphID, inst->loadGlyphFlags, err);
     ERROR:
         gm.clear(); /* or memset(&gm, 0, sizeof(GlyphMetrics)); */
         return gm;
     }/* end if */
 
     switch ( ftFace->glyph->format ) {
-        case FT_GLYPH_FORMAT_OUTLINE: {
-            FT_BBox bbox;
-
-            if (this->pFontInst->fontInstFlags & fem::Embolden_Flag) {
-                emboldenOutline(&ftFace->glyph->outline);
-            }/* end if */
-
-            FT_Outline_Get_CBox(&ftFace->glyph->outline, &bbox);
-
-            if (this->pFontInst->subpixelPositioning) {
-                int dx = fracX >> 10;
-                int dy = fracY >> 10;
-
-                /* negate dy since freetype-y-goes-up and skia-y-goes-down */
-                bbox.xMin += dx;
-                bbox.yMin -= dy;
-                bbox.xMax += dx;
-                bbox.yMax -= dy;
+        case FT_GLYPH_FORMAT_OUTLINE:
+            if (inst->fontInstFlags & fem::Embolden_Flag) {
+                emboldenOutline(ftFace, &ftFace->glyph->outline);
             }/* end if */
 
-            bbox.xMin &= ~63;
-            bbox.yMin &= ~63;
-            bbox.xMax  = (bbox.xMax + 63) & ~63;
-            bbox.yMax  = (bbox.yMax + 63) & ~63;
-
-            gm.width   = (uint16_t)((bbox.xMax - bbox.xMin) >> 6);
-            gm.height  = (uint16_t)((bbox.yMax - bbox.yMin) >> 6);
-            gm.top     = -(int16_t)(bbox.yMax >> 6);
-            gm.left    = (int16_t)(bbox.xMin >> 6);
+            setBounds(&ftFace->glyph->outline, fracX, fracY, gm);
             break;
-        }
 
         case FT_GLYPH_FORMAT_BITMAP:
-            if (this->pFontInst->fontInstFlags & fem::Embolden_Flag) {
+            if (inst->fontInstFlags & fem::Embolden_Flag) {
                 FT_GlyphSlot_Own_Bitmap(ftFace->glyph);
-                FT_Bitmap_Embolden(gLibraryFT, &ftFace->glyph->bitmap, kBitmapEmboldenStrength, 0);
+                FT_Bitmap_Embolden(ftFace->glyph->library, &ftFace->glyph->bitmap, kBitmapEmboldenStrength, 0);
             }/* end if */
 
             gm.width   = (uint16_t)(ftFace->glyph->bitmap.width);
@@ -2469,41 +4925,86 @@ GlyphMetrics FontScalerFT::getGlyphMetrics(uint16_t glyphID, FEM16Dot16 fracX, F
             goto ERROR;
     }/* end switch */
 
-    if (!this->pFontInst->subpixelPositioning) {
-        gm.fAdvanceX = FEM26Dot6ToFEM16Dot16(ftFace->glyph->advance.x);
-        gm.fAdvanceY = -FEM26Dot6ToFEM16Dot16(ftFace->glyph->advance.y);
+    setAdvance(ftFace->glyph->advance, ftFace->glyph->linearHoriAdvance,
+               ftFace->glyph->lsb_delta, ftFace->glyph->rsb_delta, gm);
 
-        if (this->pFontInst->fontInstFlags & fem::DevKernText_Flag) {
-            gm.rsbDelta = (int8_t)(ftFace->glyph->rsb_delta);
-            gm.lsbDelta = (int8_t)(ftFace->glyph->lsb_delta);
+    {
+        android::Mutex::Autolock al(inst->cacheLock);
+
+        if (ftFace->glyph->format == FT_GLYPH_FORMAT_OUTLINE) {
+            /* the image is likely asked for next */
+            inst->putHinted(glyphID, ftFace->glyph);
         }/* end if */
-    } else {
-        gm.fAdvanceX = FT_MulFix(this->pFontInst->ftMatrix22.xx, ftFace->glyph->linearHoriAdvance);
-        gm.fAdvanceY = -FT_MulFix(this->pFontInst->ftMatrix22.yx, ftFace->glyph->linearHoriAdvance);
-    }/* end else if */
+        inst->putMetrics(key, gm);
+    }
 
 #ifdef ENABLE_GLYPH_SPEW
     FT_LOG("FT_Set_Char_Size(this:%p sx:%x sy:%x ", this, fracX, fracY);
-    FT_LOG("Metrics(glyph:%d flags:%x) w:%d\n", glyphID, this->pFontInst->loadGlyphFlags, gm.width);
+    FT_LOG("Metrics(glyph:%d flags:%x) w:%d\n", glyphID, inst->loadGlyphFlags, gm.width);
 #endif
 
     FT_LOG("glyph : %d, width : %d, height : %d, top : %d, left : %d, advanceX : %d, advanceY : %d, rsbdelta : %d, lsbdelta : %d\n", glyphID, gm.width, gm.height, gm.top, gm.left, gm.fAdvanceX >> 16, gm.fAdvanceY >> 16, gm.rsbDelta, gm.lsbDelta);
 
     return gm;
-}/* end method getGlyphMetrics */
+}/* end method generateMetrics */
 
-GlyphOutline* FontScalerFT::getGlyphOutline(uint16_t glyphID, FEM16Dot16 fracX, FEM16Dot16 fracY)
+void FontScalerFT::setBounds(const FT_Outline* outline, FEM16Dot16 fracX, FEM16Dot16 fracY, GlyphMetrics& gm)
 {
-    android::Mutex::Autolock ac(gMutexFT);
-    GlyphOutline* pGO = NULL;
+    FT_BBox bbox;
 
-    FT_UNUSED(fracX);
-    FT_UNUSED(fracY);
+    FT_Outline_Get_CBox(outline, &bbox);
 
-    if (this->pFontInst->setupSize()) {
-        return pGO;
+    if (this->pFontInst->subpixelPositioning) {
+        int dx = fracX >> 10;
+        int dy = fracY >> 10;
+
+        /* negate dy since freetype-y-goes-up and skia-y-goes-down */
+        bbox.xMin += dx;
+        bbox.yMin -= dy;
+        bbox.xMax += dx;
+        bbox.yMax -= dy;
+    }/* end if */
+
+    bbox.xMin &= ~63;
+    bbox.yMin &= ~63;
+    bbox.xMax  = (bbox.xMax + 63) & ~63;
+    bbox.yMax  = (bbox.yMax + 63) & ~63;
+
+    gm.width   = (uint16_t)((bbox.xMax - bbox.xMin) >> 6);
+    gm.height  = (uint16_t)((bbox.yMax - bbox.yMin) >> 6);
+    gm.top     = -(int16_t)(bbox.yMax >> 6);
+    gm.left    = (int16_t)(bbox.xMin >> 6);
+}/* end method setBounds */
+
+void FontScalerFT::setAdvance(const FT_Vector& advance, FT_Fixed linearHoriAdvance, FT_Pos lsbDelta, FT_Pos rsbDelta, GlyphMetrics& gm)
+{
+    if (!this->pFontInst->subpixelPositioning) {
+        gm.fAdvanceX = FEM26Dot6ToFEM16Dot16(advance.x);
+        gm.fAdvanceY = -FEM26Dot6ToFEM16Dot16(advance.y);
+
+        if (this->pFontInst->fontInstFlags & fem::DevKernText_Flag) {
+            gm.rsbDelta = (int8_t)(rsbDelta);
+            gm.lsbDelta = (int8_t)(lsbDelta);
+        }/* end if */
+    } else {
+        gm.fAdvanceX = FT_MulFix(this->pFontInst->ftMatrix22.xx, linearHoriAdvance);
+        gm.fAdvanceY = -FT_MulFix(this->pFontInst->ftMatrix22.yx, linearHoriAdvance);
+    }/* end else if */
+}/* end method setAdvance */
+
+GlyphOutline* FontScalerFT::getGlyphOutline(uint16_t glyphID, FEM16Dot16 fracX, FEM16Dot16 fracY)
+{
+    FaceLeaseFT lease(this->pFontInst);
+
+    if (lease.error()) {
+        return NULL;
     }/* end if */
 
+    return generateOutline(lease.face(), glyphID, fracX, fracY);
+}/* end method getGlyphOutline */
+
+FT_Outline* FontScalerFT::loadOutline(FT_Face ftFace, uint16_t glyphID)
+{
     uint32_t flags = this->pFontInst->loadGlyphFlags;
     flags |= FT_LOAD_NO_BITMAP; // ignore embedded bitmaps so we're sure to get the outline
     flags &= ~FT_LOAD_RENDER;   // don't scan convert (we just want the outline)
@@ -2512,51 +5013,162 @@ GlyphOutline* FontScalerFT::getGlyphOutline(uint16_t glyphID, FEM16Dot16 fracX,
     if (err != 0) {
         FT_LOG("FT_Load_Glyph(glyph:%d flags:%d) returned %x\n",
                     glyphID, flags, err);
-        return pGO;
+        return NULL;
     }/* end if */
 
     if (this->pFontInst->fontInstFlags & fem::Embolden_Flag) {
-        emboldenOutline(&ftFace->glyph->outline);
+        emboldenOutline(ftFace, &ftFace->glyph->outline);
     }/* end if */
 
-    FT_GlyphSlot ftGS = ftFace->glyph;
-    if (ftGS)
-    {
-        FEM26Dot6* x;
-        FEM26Dot6* y;
-        int16_t* contours;
-        uint8_t* tags;
-
-        FT_Outline& ftOtln = ftGS->outline;
-        int nOtlnPts = ftOtln.n_points;
-        int nContours = ftOtln.n_contours;
-        FT_Vector* sOtlnPts = ftOtln.points;
-        char* sOtlnTags = ftOtln.tags;
-        int16_t* sCntrEndPts = ftOtln.contours;
-
-        pGO = new GlyphOutline(nOtlnPts, nContours);
-        if (NULL == pGO) {
-            return pGO;
-        }/* end if */
-
-        x = pGO->x;
-        y = pGO->y;
-        tags = pGO->flags;
-        contours = pGO->contours;
-
-        for (int i = 0; i < nOtlnPts; ++i) {
-            x[i] = sOtlnPts[i].x;
-            y[i] = sOtlnPts[i].y;
-            tags[i] = sOtlnTags[i] & 0x03;
-        }/* end for */
+    return &ftFace->glyph->outline;
+}/* end method loadOutline */
 
-        for (int i = 0; i < nContours; ++i) {
-            contours[i] = sCntrEndPts[i];
-        }/* end for */
+void FontScalerFT::copyOutline(const FT_Outline* ftOtln, GlyphOutline* pGO)
+{
+    FEM26Dot6* x = pGO->x;
+    FEM26Dot6* y = pGO->y;
+    uint8_t* tags = pGO->flags;
+    int16_t* contours = pGO->contours;
+
+    int nOtlnPts = ftOtln->n_points;
+    int nContours = ftOtln->n_contours;
+    FT_Vector* sOtlnPts = ftOtln->points;
+    char* sOtlnTags = ftOtln->tags;
+    int16_t* sCntrEndPts = ftOtln->contours;
+
+    for (int i = 0; i < nOtlnPts; ++i) {
+        x[i] = sOtlnPts[i].x;
+        y[i] = sOtlnPts[i].y;
+        tags[i] = sOtlnTags[i] & 0x03;
+    }/* end for */
+
+    for (int i = 0; i < nContours; ++i) {
+        contours[i] = sCntrEndPts[i];
+    }/* end for */
+}/* end method copyOutline */
+
+GlyphOutline* FontScalerFT::generateOutline(FT_Face ftFace, uint16_t glyphID, FEM16Dot16 fracX, FEM16Dot16 fracY)
+{
+    GlyphOutline* pGO = NULL;
+
+    FT_UNUSED(fracX);
+    FT_UNUSED(fracY);
+
+    FT_Outline* ftOtln = loadOutline(ftFace, glyphID);
+    if (NULL == ftOtln) {
+        return pGO;
     }/* end if */
 
+    pGO = new GlyphOutline(ftOtln->n_points, ftOtln->n_contours);
+    if (NULL == pGO) {
+        return pGO;
+    }/* end if */
+
+    copyOutline(ftOtln, pGO);
+
     return pGO;
-}/* end method getGlyphOutline */
+}/* end method generateOutline */
+
+bool FontScalerFT::loadGlyphOutline(uint16_t glyphID, FEM16Dot16 fracX, FEM16Dot16 fracY, GlyphOutlineBuffer* outline)
+{
+    FaceLeaseFT lease(this->pFontInst);
+
+    FT_UNUSED(fracX);
+    FT_UNUSED(fracY);
+
+    if (lease.error()) {
+        return false;
+    }/* end if */
+
+    FT_Outline* ftOtln = loadOutline(lease.face(), glyphID);
+    if (NULL == ftOtln || !outline->reserve(ftOtln->n_points, ftOtln->n_contours)) {
+        return false;
+    }/* end if */
+
+    copyOutline(ftOtln, outline);
+
+    return true;
+}/* end method loadGlyphOutline */
+
+/* Hands the segments FT_Outline_Decompose() finds on to a GlyphOutlineSink.
+   FreeType does not report the end of a contour, so a contour is closed
+   when the next one is started and once the whole outline is done. */
+struct OutlineSinkFT
+{
+    GlyphOutlineSink*  sink;
+    bool               open;
+};
+
+static int sinkMoveTo(const FT_Vector* to, void* user)
+{
+    OutlineSinkFT* s = (OutlineSinkFT*)user;
+
+    if (s->open) {
+        s->sink->close();
+    }/* end if */
+
+    s->sink->moveTo(to->x, to->y);
+    s->open = true;
+    return 0;
+}/* end sinkMoveTo */
+
+static int sinkLineTo(const FT_Vector* to, void* user)
+{
+    ((OutlineSinkFT*)user)->sink->lineTo(to->x, to->y);
+    return 0;
+}/* end sinkLineTo */
+
+static int sinkConicTo(const FT_Vector* control, const FT_Vector* to, void* user)
+{
+    ((OutlineSinkFT*)user)->sink->quadTo(control->x, control->y, to->x, to->y);
+    return 0;
+}/* end sinkConicTo */
+
+static int sinkCubicTo(const FT_Vector* control1, const FT_Vector* control2, const FT_Vector* to, void* user)
+{
+    ((OutlineSinkFT*)user)->sink->cubicTo(control1->x, control1->y, control2->x, control2->y, to->x, to->y);
+    return 0;
+}/* end sinkCubicTo */
+
+bool FontScalerFT::decomposeGlyphOutline(uint16_t glyphID, FEM16Dot16 fracX, FEM16Dot16 fracY, GlyphOutlineSink* sink)
+{
+    FaceLeaseFT lease(this->pFontInst);
+
+    FT_UNUSED(fracX);
+    FT_UNUSED(fracY);
+
+    if (lease.error()) {
+        return false;
+    }/* end if */
+
+    FT_Outline* ftOtln = loadOutline(lease.face(), glyphID);
+    if (NULL == ftOtln) {
+        return false;
+    }/* end if */
+
+    static const FT_Outline_Funcs funcs = {
+        sinkMoveTo,
+        sinkLineTo,
+        sinkConicTo,
+        sinkCubicTo,
+        0,          /* shift */
+        0           /* delta */
+    };
+
+    OutlineSinkFT user;
+    user.sink = sink;
+    user.open = false;
+
+    if (FT_Outline_Decompose(ftOtln, &funcs, &user) != 0) {
+        return false;
+    }/* end if */
+
+    if (user.open) {
+        sink->close();
+    }/* end if */
+
+    return true;
+}/* end method decomposeGlyphOutline */
 
 void FontScalerFT::getFontMetrics(FontMetrics* mX, FontMetrics* mY)
 {
@@ -2564,9 +5176,9 @@ void FontScalerFT::getFontMetrics(FontMetrics* mX, FontMetrics* mY)
         return;
     }/* end if */
 
-    android::Mutex::Autolock ac(gMutexFT);
+    FaceLeaseFT lease(this->pFontInst);
 
-    if (this->pFontInst->setupSize()) {
+    if (lease.error()) {
         ERROR:
         if (mX) {
             memset(mX, 0, sizeof(FontMetrics));
@@ -2577,6 +5189,7 @@ void FontScalerFT::getFontMetrics(FontMetrics* mX, FontMetrics* mY)
         return;
     }/* end if */
 
+    FT_Face ftFace = lease.face();
     int upem = ftFace->units_per_EM;
     if (upem <= 0) {
         goto ERROR;
@@ -2616,7 +5229,7 @@ void FontScalerFT::getFontMetrics(FontMetrics* mX, FontMetrics* mY)
             FT_BBox bbox;
             FT_Load_Glyph(ftFace, x_glyph, this->pFontInst->loadGlyphFlags);
             if (this->pFontInst->fontInstFlags & fem::Embolden_Flag) {
-                emboldenOutline(&ftFace->glyph->outline);
+                emboldenOutline(ftFace, &ftFace->glyph->outline);
             }/* end if */
             FT_Outline_Get_CBox(&ftFace->glyph->outline, &bbox);
             x_height = (bbox.yMax << 16) / 64;
@@ -2678,98 +5291,197 @@ static FT_Pixel_Mode compute_pixel_mode(fem::AliasMode format) {
 
 void FontScalerFT::getGlyphImage(uint16_t glyphID, FEM16Dot16 fracX, FEM16Dot16 fracY, uint32_t rowBytes, uint16_t width, uint16_t height, uint8_t *buffer)
 {
-    android::Mutex::Autolock ac(gMutexFT);
+    FaceLeaseFT lease(this->pFontInst);
 
-    FT_Error    err;
+    if (lease.error()) {
+        memset(buffer, 0, computeImageSize(this->pFontInst->maskFormat, rowBytes, width, height));
+        return;
+    }/* end if */
 
-    if (this->pFontInst->setupSize()) {
-        goto ERROR;
+    generateImage(lease.face(), glyphID, fracX, fracY, rowBytes, width, height, buffer);
+}/* end method getGlyphImage */
+
+bool FontScalerFT::getGlyphMetricsAndImage(uint16_t glyphID, FEM16Dot16 fracX, FEM16Dot16 fracY, GlyphMetrics* metrics, GlyphImageBuffer* image)
+{
+    FaceLeaseFT lease(this->pFontInst);
+    uint32_t    rowBytes;
+
+    if (lease.error()) {
+        metrics->clear();
+        return false;
+    }/* end if */
+
+    /* generateMetrics() leaves the hinted outline cached for generateImage() */
+    *metrics = generateMetrics(lease.face(), glyphID, fracX, fracY);
+
+    if (metrics->width == 0 || metrics->height == 0 || image->buffer == NULL) {
+        return false;
+    }/* end if */
+
+    rowBytes = image->computeRowBytes(metrics->width);
+    if (image->computeImageSize(metrics->width, metrics->height) > image->size) {
+        return false;
+    }/* end if */
+
+    generateImage(lease.face(), glyphID, fracX, fracY, rowBytes, metrics->width, metrics->height, image->buffer);
+    image->rowBytes = rowBytes;
+
+    return true;
+}/* end method getGlyphMetricsAndImage */
+
+void FontScalerFT::translateOutline(FT_Outline* outline, FEM16Dot16 fracX, FEM16Dot16 fracY)
+{
+    FT_BBox     bbox;
+    int dx = 0, dy = 0;
+
+    if (this->pFontInst->subpixelPositioning) {
+        dx = fracX >> 10;
+        dy = fracY >> 10;
+        /* negate dy since freetype-y-goes-up and skia-y-goes-down */
+        dy = -dy;
     }/* end if */
 
+    FT_Outline_Get_CBox(outline, &bbox);
+
+    /*
+       what we really want to do for subpixel is
+           offset(dx, dy)
+           compute_bounds
+           offset(bbox & !63)
+       but that is two calls to offset, so we do the following, which
+       achieves the same thing with only one offset call.
+    */
+    FT_Outline_Translate(outline, dx - ((bbox.xMin + dx) & ~63),
+                                  dy - ((bbox.yMin + dy) & ~63));
+}/* end method translateOutline */
+
+void FontScalerFT::renderOutline(FT_Face ftFace, FT_Outline* outline, FEM16Dot16 fracX, FEM16Dot16 fracY, uint32_t rowBytes, uint16_t width, uint16_t height, uint8_t *buffer)
+{
+    FT_Bitmap   target;
+
+    translateOutline(outline, fracX, fracY);
+
+    target.width = width;
+    target.rows = height;
+    target.pitch = rowBytes;
+    target.buffer = buffer;
+    target.pixel_mode = compute_pixel_mode(this->pFontInst->maskFormat);
+    target.num_grays = 256;
+
+    memset(buffer, 0, rowBytes * height);
+    FT_Outline_Get_Bitmap(ftFace->glyph->library, outline, &target);
+}/* end method renderOutline */
+
+void FontScalerFT::generateImage(FT_Face ftFace, uint16_t glyphID, FEM16Dot16 fracX, FEM16Dot16 fracY, uint32_t rowBytes, uint16_t width, uint16_t height, uint8_t *buffer)
+{
+    FT_Error    err;
+
     FT_LOG("glyph : %d width : %d height : %d rowBytes : %d\n", glyphID, width, height, rowBytes);
 
+    const bool lcdRenderMode = this->pFontInst->maskFormat == fem::ALIAS_LCD_H ||
+                               this->pFontInst->maskFormat == fem::ALIAS_LCD_V;
+    const bool lcdMask = lcdRenderMode || this->pFontInst->maskFormat == fem::ALIAS_LCD16;
+
+    if (! lcdMask) {
+        /* render the glyph hinted for its metrics, if it is still there */
+        FT_Outline  outline;
+        bool        cached = false;
+
+        {
+            android::Mutex::Autolock al(this->pFontInst->cacheLock);
+
+            HintedGlyphFT* glyph = this->pFontInst->findHinted(glyphID);
+            if (glyph && FT_Outline_New(gLibraryFT, glyph->outline.n_points, glyph->outline.n_contours, &outline) == 0) {
+                FT_Outline_Copy(&glyph->outline, &outline);
+                cached = true;
+            }/* end if */
+        }
+
+        if (cached) {
+            renderOutline(ftFace, &outline, fracX, fracY, rowBytes, width, height, buffer);
+            FT_Outline_Done(gLibraryFT, &outline);
+            return;
+        }/* end if */
+    }/* end if */
+
     err = FT_Load_Glyph(ftFace, glyphID, this->pFontInst->loadGlyphFlags);
     if (err != 0) {
         FT_LOG("FT_Load_Glyph(glyph:%d width:%d height:%d rb:%d flags:%d) returned %x\n",
                   glyphID, width, height, rowBytes, this->pFontInst->loadGlyphFlags, err);
     ERROR:
-        memset(buffer, 0, rowBytes * height);
+        memset(buffer, 0, computeImageSize(this->pFontInst->maskFormat, rowBytes, width, height));
         return;
     }/* end if */
 
-    const bool lcdRenderMode = this->pFontInst->maskFormat == fem::ALIAS_LCD_H ||
-                               this->pFontInst->maskFormat == fem::ALIAS_LCD_V;
-
     switch ( ftFace->glyph->format ) {
         case FT_GLYPH_FORMAT_OUTLINE: {
             FT_Outline* outline = &ftFace->glyph->outline;
-            FT_BBox     bbox;
-            FT_Bitmap   target;
-            int dx = 0, dy = 0;
 
             if (this->pFontInst->fontInstFlags & fem::Embolden_Flag) {
-                emboldenOutline(outline);
+                emboldenOutline(ftFace, outline);
             }/* end if */
 
-            if (this->pFontInst->subpixelPositioning) {
-                dx = fracX >> 10;
-                dy = fracY >> 10;
-                /* negate dy since freetype-y-goes-up and skia-y-goes-down */
-                dy = -dy;
-            }/* end if */
+            if (! lcdMask) {
+                {
+                    /* for the metrics of other subpixel offsets */
+                    android::Mutex::Autolock al(this->pFontInst->cacheLock);
+                    this->pFontInst->putHinted(glyphID, ftFace->glyph);
+                }
 
-            FT_Outline_Get_CBox(outline, &bbox);
+                renderOutline(ftFace, outline, fracX, fracY, rowBytes, width, height, buffer);
+                break;
+            }/* end if */
 
-            /*
-               what we really want to do for subpixel is
-                   offset(dx, dy)
-                   compute_bounds
-                   offset(bbox & !63)
-               but that is two calls to offset, so we do the following, which
-               achieves the same thing with only one offset call.
-            */
-            FT_Outline_Translate(outline, dx - ((bbox.xMin + dx) & ~63),
-                                          dy - ((bbox.yMin + dy) & ~63));
+            translateOutline(outline, fracX, fracY);
 
 #if defined(SUPPORT_LCDTEXT)
-            if (lcdRenderMode) {
+            if (lcdRenderMode && gLCDSupport) {
                 /* FT_Outline_Get_Bitmap cannot render LCD glyphs. In this case
                  * we have to call FT_Render_Glyph and memcpy the image out. */
                 const bool isVertical = this->pFontInst->maskFormat == fem::ALIAS_LCD_V;
                 FT_Render_Mode mode = isVertical ? FT_RENDER_MODE_LCD_V : FT_RENDER_MODE_LCD;
 
-                /* TODO:
-                 * FT_Render_Glyph(ftFace->glyph, mode);
-                 *
-                 * if (isVertical)
-                 *     CopyFreetypeBitmapToVerticalLCDMask(glyph, ftFace->glyph->bitmap);
-                 * else
-                 *     CopyFreetypeBitmapToLCDMask(glyph, ftFace->glyph->bitmap);
-                 */
+                err = FT_Render_Glyph(ftFace->glyph, mode);
+                if (err != 0) {
+                    FT_LOG("FT_Render_Glyph(glyph:%d mode:%d) returned %x\n", glyphID, mode, err);
+                    goto ERROR;
+                }/* end if */
+
+                copyFT2LCD(rowBytes, width, height, buffer, ftFace->glyph, isVertical,
+                           (this->pFontInst->fontInstFlags & fem::LCDBGROrder_Flag) != 0);
                 break;
             }/* end if */
 #endif
 
             if (this->pFontInst->maskFormat == fem::ALIAS_LCD16) {
                 FT_Render_Glyph(ftFace->glyph, FT_RENDER_MODE_LCD);
-                copyFT2LCD16(rowBytes, width, height, (uint16_t*)buffer, ftFace->glyph->bitmap);
+                copyFT2LCD16(rowBytes, width, height, (uint16_t*)buffer, ftFace->glyph);
             } else {
+                /* LCD_H and LCD_V without FreeType's LCD rendering */
+                FT_Bitmap   target;
+
                 target.width = width;
                 target.rows = height;
                 target.pitch = rowBytes;
                 target.buffer = buffer;
-                target.pixel_mode = compute_pixel_mode(this->pFontInst->maskFormat);
+                target.pixel_mode = FT_PIXEL_MODE_GRAY;
                 target.num_grays = 256;
 
                 memset(buffer, 0, rowBytes * height);
-                FT_Outline_Get_Bitmap(gLibraryFT, outline, &target);
+                FT_Outline_Get_Bitmap(ftFace->glyph->library, outline, &target);
+
+                /* gray coverage in the LCD layout */
+                expandA8ToLCD(rowBytes, width, height, buffer, this->pFontInst->maskFormat == fem::ALIAS_LCD_V);
             }/* end else if */
         } break;
 
         case FT_GLYPH_FORMAT_BITMAP: {
+            /* the bitmap may not cover the whole buffer */
+            memset(buffer, 0, rowBytes * height);
+
             if (this->pFontInst->fontInstFlags & fem::Embolden_Flag) {
                 FT_GlyphSlot_Own_Bitmap(ftFace->glyph);
-                FT_Bitmap_Embolden(gLibraryFT, &ftFace->glyph->bitmap, kBitmapEmboldenStrength, 0);
+                FT_Bitmap_Embolden(ftFace->glyph->library, &ftFace->glyph->bitmap, kBitmapEmboldenStrength, 0);
             }/* end if */
 
             FT_ASSERT_CONTINUE(width == ftFace->glyph->bitmap.width);
@@ -2796,23 +5508,8 @@ void FontScalerFT::getGlyphImage(uint16_t glyphID, FEM16Dot16 fracX, FEM16Dot16
                         (this->pFontInst->maskFormat == fem::ALIAS_GRAYSCALE ||
                         this->pFontInst->maskFormat == fem::ALIAS_LCD_H ||
                         this->pFontInst->maskFormat == fem::ALIAS_LCD_V)) {
-                for (int y = 0; y < ftFace->glyph->bitmap.rows; ++y) {
-                    uint8_t byte = 0;
-                    int bits = 0;
-                    const uint8_t* src_row = src;
-                    uint8_t* dst_row = dst;
-
-                    for (int x = 0; x < ftFace->glyph->bitmap.width; ++x) {
-                        if (!bits) {
-                            byte = *src_row++;
-                            bits = 8;
-                        }/* end if */
-
-                        *dst_row++ = byte & 0x80 ? 0xff : 0;
-                        bits--;
-                        byte <<= 1;
-                    }/* end for */
-
+                for (int y = 0; y < (int)ftFace->glyph->bitmap.rows; ++y) {
+                    gExpandMonoRowFT(dst, src, ftFace->glyph->bitmap.width);
                     src += ftFace->glyph->bitmap.pitch;
                     dst += rowBytes;
                 }/* end for */
@@ -2821,7 +5518,7 @@ void FontScalerFT::getGlyphImage(uint16_t glyphID, FEM16Dot16 fracX, FEM16Dot16
             }/* end else if */
 
             if (lcdRenderMode) {
-                /* TODO: glyph.expandA8ToLCD(); */
+                expandA8ToLCD(rowBytes, width, height, buffer, this->pFontInst->maskFormat == fem::ALIAS_LCD_V);
             }/* end if */
         } break;
 
@@ -2831,7 +5528,66 @@ void FontScalerFT::getGlyphImage(uint16_t glyphID, FEM16Dot16 fracX, FEM16Dot16
     }/* end switch */
 }/* end method generateImage */
 
-void FontScalerFT::emboldenOutline(FT_Outline* outline) {
+void FontScalerFT::getGlyphsAdvance(uint32_t count, const uint16_t glyphIDs[], const FEM16Dot16 fracX[], const FEM16Dot16 fracY[], GlyphMetrics metrics[])
+{
+    FaceLeaseFT lease(this->pFontInst);
+
+    if (lease.error()) {
+        for (uint32_t i = 0; i < count; i++) {
+            metrics[i].clear();
+        }/* end for */
+        return;
+    }/* end if */
+
+    for (uint32_t i = 0; i < count; i++) {
+        metrics[i] = generateAdvance(lease.face(), glyphIDs[i], fracX ? fracX[i] : 0, fracY ? fracY[i] : 0);
+    }/* end for */
+}/* end method getGlyphsAdvance */
+
+void FontScalerFT::getGlyphsMetrics(uint32_t count, const uint16_t glyphIDs[], const FEM16Dot16 fracX[], const FEM16Dot16 fracY[], GlyphMetrics metrics[])
+{
+    FaceLeaseFT lease(this->pFontInst);
+
+    if (lease.error()) {
+        for (uint32_t i = 0; i < count; i++) {
+            metrics[i].clear();
+        }/* end for */
+        return;
+    }/* end if */
+
+    for (uint32_t i = 0; i < count; i++) {
+        metrics[i] = generateMetrics(lease.face(), glyphIDs[i], fracX ? fracX[i] : 0, fracY ? fracY[i] : 0);
+    }/* end for */
+}/* end method getGlyphsMetrics */
+
+void FontScalerFT::getGlyphsImage(uint32_t count, const uint16_t glyphIDs[], const FEM16Dot16 fracX[], const FEM16Dot16 fracY[], const GlyphImageSlot slots[])
+{
+    FaceLeaseFT lease(this->pFontInst);
+
+    if (lease.error()) {
+        for (uint32_t i = 0; i < count; i++) {
+            memset(slots[i].buffer, 0, computeImageSize(this->pFontInst->maskFormat, slots[i].rowBytes, slots[i].width, slots[i].height));
+        }/* end for */
+        return;
+    }/* end if */
+
+    for (uint32_t i = 0; i < count; i++) {
+        generateImage(lease.face(), glyphIDs[i], fracX ? fracX[i] : 0, fracY ? fracY[i] : 0,
+                      slots[i].rowBytes, slots[i].width, slots[i].height, slots[i].buffer);
+    }/* end for */
+}/* end method getGlyphsImage */
+
+void FontScalerFT::getGlyphsOutline(uint32_t count, const uint16_t glyphIDs[], const FEM16Dot16 fracX[], const FEM16Dot16 fracY[], GlyphOutline* outlines[])
+{
+    FaceLeaseFT lease(this->pFontInst);
+    bool sizeReady = lease.error() == 0;
+
+    for (uint32_t i = 0; i < count; i++) {
+        outlines[i] = sizeReady ? generateOutline(lease.face(), glyphIDs[i], fracX ? fracX[i] : 0, fracY ? fracY[i] : 0) : NULL;
+    }/* end for */
+}/* end method getGlyphsOutline */
+
+void FontScalerFT::emboldenOutline(FT_Face ftFace, FT_Outline* outline) {
     FT_Pos strength;
     strength = FT_MulFix(ftFace->units_per_EM, ftFace->size->metrics.y_scale) / 24;
     FT_Outline_Embolden(outline, strength);
@@ -2848,6 +5604,17 @@ extern "C" {
         gFontEngineInstFT = new FontEngineFT();
         return (FontEngine*)gFontEngineInstFT;
     }/* getFontEngineInstance() */
+
+    FontEngine* getFontEngineInstanceV2(uint32_t abiVersion)
+    {
+        FT_LOG("abiVersion : %d\n", abiVersion);
+
+        if (abiVersion != FEM_ABI_VERSION) {
+            return NULL;
+        }/* end if */
+
+        return getFontEngineInstance();
+    }/* getFontEngineInstanceV2() */
 #ifdef __cplusplus
 }/* end extern "C" */
 #endif
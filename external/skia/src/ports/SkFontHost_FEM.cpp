@@ -38,6 +38,22 @@
 
 #include <utils/FontEngineManager.h>
 
+/* Renders each glyph generateMetrics() measures along with its metrics,
+   with one getGlyphMetricsAndImage() call. That pays off only where most
+   glyphs measured are drawn right after: measuring text alone, glyphs
+   clipped out, or a run measured before it is drawn would render images
+   nobody asks for, the last twice as the pending image holds one glyph.
+   Leave it off until the glyph cache tells generateMetrics() that it is
+   filling in a glyph it will ask the image of next. */
+/* #define SK_FEM_FUSED_METRICS */
+
+#ifdef SK_FEM_FUSED_METRICS
+/* Size of the buffer keeping the image rendered along with the metrics of
+   a glyph until the glyph cache asks for it; larger glyphs are rendered
+   when asked for. */
+#define PENDING_IMAGE_SIZE  4096
+#endif /* SK_FEM_FUSED_METRICS */
+
 /* #define SK_ENABLE_LOG */
 
 #ifdef SK_ENABLE_LOG
@@ -133,7 +149,7 @@ private:
 class SkScalerContextFEM : public SkScalerContext
 {
 public:
-    SkScalerContextFEM(const SkDescriptor* desc, uint32_t fntId, FontScaler * fs);
+    SkScalerContextFEM(const SkDescriptor* desc, uint32_t fntId, FontScaler * fs, uint32_t features);
     virtual ~SkScalerContextFEM();
 
 protected:
@@ -149,11 +165,50 @@ protected:
 private:
     FontScaler* pFontScaler;
     uint32_t fontID;
+    uint32_t engineFeatures;  /* fem::EngineFeature values of the engine behind pFontScaler */
+
+#ifdef SK_FEM_FUSED_METRICS
+    /* Image of the last glyph measured, rendered by the same
+       getGlyphMetricsAndImage() call; see generateMetrics(). */
+    uint8_t*  pPendingImage;
+    uint32_t  pendingID;        /* SkGlyph::fID of the image; valid if pendingRowBytes is set */
+    uint16_t  pendingWidth;
+    uint16_t  pendingHeight;
+    uint32_t  pendingRowBytes;
+
+    bool takePendingImage(const SkGlyph& glyph);
+#endif /* SK_FEM_FUSED_METRICS */
 };/* end class SkScalerContextFEM */
 
 static SkMutex       gMutexSkFEM;
 static SkStreamRec*  gStreamRecHead = NULL;
 
+/* Serializes the calls into font engines which are not thread-safe: into
+   their scalers and, unless every engine is thread-safe, into the manager.
+   gMutexSkFEM only guards the stream list and is never held meanwhile. */
+static SkMutex       gMutexSkEngineFEM;
+
+class SkAutoEngineLockFEM
+{
+public:
+    SkAutoEngineLockFEM(uint32_t features) : fLocked(!(features & fem::ENGINE_THREAD_SAFE))
+    {
+        if (fLocked) {
+            gMutexSkEngineFEM.acquire();
+        }/* end if */
+    }
+
+    ~SkAutoEngineLockFEM()
+    {
+        if (fLocked) {
+            gMutexSkEngineFEM.release();
+        }/* end if */
+    }
+
+private:
+    bool  fLocked;
+};/* end class SkAutoEngineLockFEM */
+
 /* Returns NULL on failure; a valid instance of SkStreamRec otherwise. */
 SkStreamRec* SkStreamRec::ref(uint32_t fontID) {
     SkStreamRec* rec = gStreamRecHead;
@@ -229,35 +284,51 @@ void SkStreamRec::unRef(uint32_t fontID)
     SkASSERT("shouldn't get here, stream not in list");
 }/* end method unRef */
 
-SkScalerContextFEM::SkScalerContextFEM(const SkDescriptor* desc, uint32_t fntId, FontScaler * fs)
-    : SkScalerContext(desc), fontID(fntId)
+SkScalerContextFEM::SkScalerContextFEM(const SkDescriptor* desc, uint32_t fntId, FontScaler * fs, uint32_t features)
+    : SkScalerContext(desc), fontID(fntId), engineFeatures(features)
+#ifdef SK_FEM_FUSED_METRICS
+      , pPendingImage(NULL), pendingID(0), pendingWidth(0), pendingHeight(0), pendingRowBytes(0)
+#endif /* SK_FEM_FUSED_METRICS */
 {
     pFontScaler = fs;
 }/* end method constructor */
 
 SkScalerContextFEM::~SkScalerContextFEM()
 {
-    delete pFontScaler;
+#ifdef SK_FEM_FUSED_METRICS
+    if (pPendingImage) {
+        free(pPendingImage);
+    }/* end if */
+#endif /* SK_FEM_FUSED_METRICS */
+
+    {
+        SkAutoEngineLockFEM  lock(engineFeatures);
+        delete pFontScaler;
+    }
     SkStreamRec::unRef(fontID);
 }/* end method destructor */
 
 unsigned SkScalerContextFEM::generateGlyphCount()
 {
+    SkAutoEngineLockFEM  lock(engineFeatures);
     return (unsigned)pFontScaler->getGlyphCount();
 }/* end method generateGlyphCount */
 
 uint16_t SkScalerContextFEM::generateCharToGlyph(SkUnichar uni)
 {
+    SkAutoEngineLockFEM  lock(engineFeatures);
     return pFontScaler->getCharToGlyphID(uni);
 }/* end method generateCharToGlyph */
 
 SkUnichar SkScalerContextFEM::generateGlyphToChar(uint16_t glyphID)
 {
+    SkAutoEngineLockFEM  lock(engineFeatures);
     return pFontScaler->getGlyphIDToChar(glyphID);
 }/* end method generateGlyphToChar */
 
 void SkScalerContextFEM::generateAdvance(SkGlyph* glyph)
 {
+    SkAutoEngineLockFEM  lock(engineFeatures);
     FEM16Dot16 fracX = 0, fracY = 0;
     GlyphMetrics gm;
 
@@ -269,6 +340,8 @@ void SkScalerContextFEM::generateAdvance(SkGlyph* glyph)
 
     SK_LOG("pFontScaler->getGlyphAdvance for id :%d\n", glyph->getGlyphID(fBaseGlyphCount));
 
+    /* the glyph cache asks for one glyph at a time, so there is no run of
+       glyphs known to be needed to hand to getGlyphsAdvance() */
     gm = pFontScaler->getGlyphAdvance(glyph->getGlyphID(fBaseGlyphCount), fracX, fracY);
 
     glyph->fRsbDelta = (int8_t)gm.rsbDelta;
@@ -281,6 +354,7 @@ void SkScalerContextFEM::generateAdvance(SkGlyph* glyph)
 
 void SkScalerContextFEM::generateMetrics(SkGlyph* glyph)
 {
+    SkAutoEngineLockFEM  lock(engineFeatures);
     FEM16Dot16 fracX = 0, fracY = 0;
     GlyphMetrics gm;
 
@@ -292,7 +366,36 @@ void SkScalerContextFEM::generateMetrics(SkGlyph* glyph)
 
     SK_LOG("pFontScaler->getGlyphMetrics for id :%d\n", glyph->getGlyphID(fBaseGlyphCount));
 
-    gm = pFontScaler->getGlyphMetrics(glyph->getGlyphID(fBaseGlyphCount), fracX, fracY);
+#ifdef SK_FEM_FUSED_METRICS
+    pendingRowBytes = 0;
+
+    /* the glyph is taken to be drawn next; render it now, while the engine
+       has it loaded, and keep the image for generateImage(). Not for LCD
+       masks, which the engine renders from a fresh load of the glyph
+       anyway. */
+    if (SkMask::kBW_Format == fRec.fMaskFormat || SkMask::kA8_Format == fRec.fMaskFormat) {
+        GlyphImageBuffer image;
+
+        if (NULL == pPendingImage) {
+            pPendingImage = (uint8_t*)malloc(PENDING_IMAGE_SIZE);
+        }/* end if */
+
+        image.buffer = pPendingImage;
+        image.size = pPendingImage ? PENDING_IMAGE_SIZE : 0;
+        image.format = (SkMask::kBW_Format == fRec.fMaskFormat) ? fem::ALIAS_MONOCHROME : fem::ALIAS_GRAYSCALE;
+        image.rowBytes = 0;
+
+        if (pFontScaler->getGlyphMetricsAndImage(glyph->getGlyphID(fBaseGlyphCount), fracX, fracY, &gm, &image)) {
+            pendingID = glyph->fID;
+            pendingWidth = gm.width;
+            pendingHeight = gm.height;
+            pendingRowBytes = image.rowBytes;
+        }/* end if */
+    } else
+#endif /* SK_FEM_FUSED_METRICS */
+    {
+        gm = pFontScaler->getGlyphMetrics(glyph->getGlyphID(fBaseGlyphCount), fracX, fracY);
+    }
 
     glyph->fWidth   = (uint16_t)gm.width;
     glyph->fHeight  = (uint16_t)gm.height;
@@ -309,6 +412,7 @@ void SkScalerContextFEM::generateMetrics(SkGlyph* glyph)
 
 void SkScalerContextFEM::generateImage(const SkGlyph& glyph)
 {
+    SkAutoEngineLockFEM  lock(engineFeatures);
     FEM16Dot16 fracX = 0, fracY = 0;
 
     if (fRec.fFlags & SkScalerContext::kSubpixelPositioning_Flag)
@@ -318,143 +422,111 @@ void SkScalerContextFEM::generateImage(const SkGlyph& glyph)
     }/* end if */
 
     SK_LOG("glyph : %d, fracX : %d, fracY : %d, width : %d height : %d rowBytes : %d\n", (uint16_t)glyph.getGlyphID(fBaseGlyphCount), fracX >> 16, fracY >> 16, glyph.fWidth, glyph.fHeight, (uint32_t)glyph.rowBytes());
+
+#ifdef SK_FEM_FUSED_METRICS
+    if (takePendingImage(glyph)) {
+        return;
+    }/* end if */
+#endif /* SK_FEM_FUSED_METRICS */
+
+    /* the glyph cache hands out uncleared memory */
+    if (!(engineFeatures & fem::ENGINE_DIRECT_RENDER)) {
+        memset(glyph.fImage, 0, glyph.computeImageSize());
+    }/* end if */
+
     pFontScaler->getGlyphImage((uint16_t)glyph.getGlyphID(fBaseGlyphCount), fracX, fracY, (uint32_t)glyph.rowBytes(), glyph.fWidth, glyph.fHeight, reinterpret_cast<uint8_t*>(glyph.fImage));
 }/* end method generateImage */
 
-void SkScalerContextFEM::generatePath(const SkGlyph& glyph, SkPath* path)
+#ifdef SK_FEM_FUSED_METRICS
+/* Copies the image rendered by generateMetrics() into 'glyph' if it is the
+   image of that glyph; the glyph rows may be longer than the image rows. */
+bool SkScalerContextFEM::takePendingImage(const SkGlyph& glyph)
 {
-    FEM16Dot16 fracX = 0, fracY = 0;
-    GlyphOutline* go = NULL;
-    int i = 0;
-    FEM26Dot6* x;
-    FEM26Dot6* y;
-    int16_t* contours;
-    uint8_t* onCurve;
-    uint8_t*  flags;  /* the points flags */
-    FEM26Dot6 startX, startY;
-    int16_t contourCount;  /* number of contours in glyph */
+    uint32_t  dstRowBytes = (uint32_t)glyph.rowBytes();
+    uint8_t*  dst = reinterpret_cast<uint8_t*>(glyph.fImage);
+    uint8_t*  src = pPendingImage;
+
+    if (0 == pendingRowBytes || glyph.fID != pendingID ||
+        glyph.fWidth != pendingWidth || glyph.fHeight != pendingHeight ||
+        dstRowBytes < pendingRowBytes) {
+        return false;
+    }/* end if */
 
-    if (fRec.fFlags & SkScalerContext::kSubpixelPositioning_Flag)
+    for (uint16_t y = 0; y < pendingHeight; y++) {
+        memcpy(dst, src, pendingRowBytes);
+        memset(dst + pendingRowBytes, 0, dstRowBytes - pendingRowBytes);
+        dst += dstRowBytes;
+        src += pendingRowBytes;
+    }/* end for */
+
+    pendingRowBytes = 0;
+    return true;
+}/* end method takePendingImage */
+#endif /* SK_FEM_FUSED_METRICS */
+
+/* Builds an SkPath from the segments of a glyph outline; the outline is
+   in 26.6 with y up, the path in SkScalar with y down. */
+class SkPathOutlineSink : public GlyphOutlineSink
+{
+public:
+    SkPathOutlineSink(SkPath* path) : fPath(path) {}
+
+    virtual void moveTo(FEM26Dot6 x, FEM26Dot6 y)
     {
-        fracX = glyph.getSubXFixed();
-        fracY = glyph.getSubYFixed();
-    }/* end if */
+        fPath->moveTo(toScalar(x), toScalar(-y));
+    }
 
-    go = pFontScaler->getGlyphOutline(glyph.getGlyphID(fBaseGlyphCount), fracX, fracY);
+    virtual void lineTo(FEM26Dot6 x, FEM26Dot6 y)
+    {
+        fPath->lineTo(toScalar(x), toScalar(-y));
+    }
 
-    x = go->x;
-    y = go->y;
-    contours = go->contours;
-    flags = go->flags;
-    contourCount = go->contourCount;
+    virtual void quadTo(FEM26Dot6 cx, FEM26Dot6 cy, FEM26Dot6 x, FEM26Dot6 y)
+    {
+        fPath->quadTo(toScalar(cx), toScalar(-cy), toScalar(x), toScalar(-y));
+    }
 
-    /* convert the outline to a path */
-    for (int j = 0; j < contourCount; ++j) {
-    int last_point = contours[j];
-    FEM26Dot6 cX[4], cY[4];
-    int n = 1;
+    virtual void cubicTo(FEM26Dot6 cx1, FEM26Dot6 cy1, FEM26Dot6 cx2, FEM26Dot6 cy2, FEM26Dot6 x, FEM26Dot6 y)
+    {
+        fPath->cubicTo(toScalar(cx1), toScalar(-cy1), toScalar(cx2), toScalar(-cy2), toScalar(x), toScalar(-y));
+    }
 
-        startX = x[i];
-        startY = -y[i];
+    virtual void close()
+    {
+        fPath->close();
+    }
 
-        if(! (flags[i] & 1) ) {
-            startX = (startX + x[last_point]) >> 1;
-            startY = (startY + (-y[last_point]) ) >> 1;
-        }/* end if */
+private:
+    static SkScalar toScalar(FEM26Dot6 v)
+    {
+        return SkFixedToScalar(v << 10);
+    }
 
-        /* Reach the first point */
-        path->moveTo(SkFixedToScalar(startX << 10), SkFixedToScalar(startY << 10));
-
-        cX[0] = startX;
-        cY[0] = startY;
-        while (i < last_point) {
-            ++i;
-            cX[n] = x[i];
-            cY[n] = -y[i];
-            n++;
-
-            switch (flags[i] & 3) {
-            case 2:
-                /* cubic bezier element */
-                if (n < 4) {
-                    continue;
-                }/* end if */
+    SkPath*  fPath;
+};/* end class SkPathOutlineSink */
 
-                cX[3] = (cX[3] + cX[2])/2;
-                cY[3] = (cY[3] + cY[2])/2;
+void SkScalerContextFEM::generatePath(const SkGlyph& glyph, SkPath* path)
+{
+    SkAutoEngineLockFEM  lock(engineFeatures);
+    FEM16Dot16 fracX = 0, fracY = 0;
 
-                --i;
-                break;
-            case 0:
-                /* quadratic bezier element */
-                if (n < 3) {
-                    continue;
-                }/* end if */
+    if (fRec.fFlags & SkScalerContext::kSubpixelPositioning_Flag)
+    {
+        fracX = glyph.getSubXFixed();
+        fracY = glyph.getSubYFixed();
+    }/* end if */
 
-                cX[3] = (cX[1] + cX[2])/2;
-                cY[3] = (cY[1] + cY[2])/2;
-
-                cX[2] = (2*cX[1] + cX[3])/3;
-                cY[2] = (2*cY[1] + cY[3])/3;
-
-                cX[1] = (2*cX[1] + cX[0])/3;
-                cY[1] = (2*cY[1] + cY[0])/3;
-
-                --i;
-                break;
-            case 1:
-            case 3:
-                if (n == 2) {
-                    path->lineTo(SkFixedToScalar(cX[1] << 10), SkFixedToScalar(cY[1] << 10));
-
-                    cX[0] = cX[1];
-                    cY[0] = cY[1];
-
-                    n = 1;
-                    continue;
-                } else if (n == 3) {
-                    cX[3] = cX[2];
-                    cY[3] = cY[2];
-
-                    cX[2] = (2*cX[1] + cX[3])/3;
-                    cY[2] = (2*cY[1] + cY[3])/3;
-
-                    cX[1] = (2*cX[1] + cX[0])/3;
-                    cX[1] = (2*cY[1] + cY[0])/3;
-                }/* end else if*/
-                break;
-            }/* end switch */
-            path->cubicTo(SkFixedToScalar(cX[1] << 10), SkFixedToScalar(cY[1] << 10), SkFixedToScalar(cX[2] << 10), SkFixedToScalar(cY[2] << 10), SkFixedToScalar(cX[3] << 10), SkFixedToScalar(cY[3] << 10));
-            cX[0] = cX[3];
-            cY[0] = cY[3];
-            n = 1;
-        }/* end while */
-
-        if (n == 1) {
-            path->close();
-        } else {
-            cX[3] = startX;
-            cY[3] = startY;
-            if (n == 2) {
-                cX[2] = (2*cX[1] + cX[3])/3;
-                cY[2] = (2*cY[1] + cY[3])/3;
-
-                cX[1] = (2*cX[1] + cX[0])/3;
-                cY[1] = (2*cY[1] + cY[0])/3;
-            }/* end if */
-            path->cubicTo(SkFixedToScalar(cX[1] << 10), SkFixedToScalar(cY[1] << 10), SkFixedToScalar(cX[2] << 10), SkFixedToScalar(cY[2] << 10), SkFixedToScalar(cX[3] << 10), SkFixedToScalar(cY[3] << 10));
-        }/* end else if */
-        ++i;
-    }/* end for */
+    SkPathOutlineSink sink(path);
 
-    if (go) {
-        delete go;
+    if (!pFontScaler->decomposeGlyphOutline(glyph.getGlyphID(fBaseGlyphCount), fracX, fracY, &sink)) {
+        path->reset();
     }/* end if */
 }/* end method generatePath */
 
 void SkScalerContextFEM::generateFontMetrics(SkPaint::FontMetrics* mx,
                                              SkPaint::FontMetrics* my)
 {
+    SkAutoEngineLockFEM  lock(engineFeatures);
     FontMetrics fmX, fmY;
 
     FEM16Dot16 fracX = 0, fracY = 0;
@@ -501,7 +573,7 @@ void SkScalerContextFEM::generateFontMetrics(SkPaint::FontMetrics* mx,
 */
 SkTypeface::Style find_name_and_attributes(SkStream* stream, SkString* name, bool* isFixedWidth)
 {
-    SkAutoMutexAcquire  ac(gMutexSkFEM);
+    SkAutoEngineLockFEM  lock(FontEngineManager::getInstance().getFontEngineFeatures());
     fem::FontStyle fontStyle = fem::STYLE_NORMAL;
     int style = SkTypeface::kNormal;
     size_t fontNameLength = 0;
@@ -543,12 +615,23 @@ SkTypeface::Style find_name_and_attributes(SkStream* stream, SkString* name, boo
     return (SkTypeface::Style)style;
 }/* end method find_name_and_attributes */
 
+/*  Export this so that our FontHost port can pass a low memory signal of
+    the process on to the font engines; 'complete' also drops what the font
+    scalers can rebuild on their next use.
+*/
+void trim_font_engine_memory(bool complete)
+{
+    SkAutoEngineLockFEM  lock(FontEngineManager::getInstance().getFontEngineFeatures());
+
+    FontEngineManager::getInstance().trimMemory(complete ? fem::TRIM_MEMORY_COMPLETE : fem::TRIM_MEMORY_IDLE);
+}/* end method trim_font_engine_memory */
+
 SkScalerContext* SkFontHost::CreateScalerContext(const SkDescriptor* desc)
 {
-    SkAutoMutexAcquire  ac(gMutexSkFEM);
     FontScalerInfo fsInfo;
     FontScaler* fs = NULL;
     SkScalerContext* ctx = NULL;
+    uint32_t features = 0;
 
     SK_LOG("\n");
 
@@ -558,7 +641,12 @@ SkScalerContext* SkFontHost::CreateScalerContext(const SkDescriptor* desc)
     SkMatrix m;
 
     /* load the font file */
-    SkStreamRec* fStreamRec = SkStreamRec::ref(fRec->fFontID);
+    SkStreamRec* fStreamRec;
+    {
+        /* only the stream list needs this lock; see gMutexSkEngineFEM */
+        SkAutoMutexAcquire  ac(gMutexSkFEM);
+        fStreamRec = SkStreamRec::ref(fRec->fFontID);
+    }
 
         if (fStreamRec) {
             fsInfo.fontID = fRec->fFontID;
@@ -569,6 +657,10 @@ SkScalerContext* SkFontHost::CreateScalerContext(const SkDescriptor* desc)
             fsInfo.pBuffer = fStreamRec->memoryBase;
             fsInfo.size = fStreamRec->size;
 
+            /* fonts with neither a buffer nor a path are read through
+               streamRead() */
+            fsInfo.pStream = (fsInfo.pBuffer == NULL && fsInfo.pPath == NULL) ? fStreamRec->fSkStream : NULL;
+
             fsInfo.subpixelPositioning = fRec->fFlags & SkScalerContext::kSubpixelPositioning_Flag;
 
             if(SkMask::kBW_Format == fRec->fMaskFormat) {
@@ -608,12 +700,19 @@ SkScalerContext* SkFontHost::CreateScalerContext(const SkDescriptor* desc)
                 fsInfo.flags |= fem::DevKernText_Flag;
             }
 
-            fs = FontEngineManager::getInstance().createFontScalerContext(fsInfo);
+            if (SkMask::FormatIsLCD((SkMask::Format)fRec->fMaskFormat) &&
+                SkFontHost::GetSubpixelOrder() == SkFontHost::kBGR_LCDOrder) {
+                fsInfo.flags |= fem::LCDBGROrder_Flag;
+            }/* end if */
+
+            SkAutoEngineLockFEM  lock(FontEngineManager::getInstance().getFontEngineFeatures());
+
+            fs = FontEngineManager::getInstance().createFontScalerContext(fsInfo, &features);
             if (fs) {
                 SK_LOG("font scaler instance created\n");
 
                 /* passing 'fFontID' as to unref it when we are done with scaler context */
-                ctx = new SkScalerContextFEM(desc, fStreamRec->fFontID, fs);
+                ctx = new SkScalerContextFEM(desc, fStreamRec->fFontID, fs, features);
 
                 SK_LOG("returning SkScalerContextFEM instance\n");
             } else {
@@ -629,7 +728,7 @@ SkScalerContext* SkFontHost::CreateScalerContext(const SkDescriptor* desc)
 #ifdef ANDROID
 uint32_t SkFontHost::GetUnitsPerEm(SkFontID fontID)
 {
-    SkAutoMutexAcquire  ac(gMutexSkFEM);
+    SkAutoEngineLockFEM  lock(FontEngineManager::getInstance().getFontEngineFeatures());
     uint32_t unitsPerEm = 0;
     SkStream* stream = SkFontHost::OpenStream(fontID);
 
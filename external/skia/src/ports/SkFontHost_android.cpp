@@ -39,6 +39,10 @@
 SkTypeface::Style find_name_and_attributes(SkStream* stream, SkString* name,
                                            bool* isFixedWidth);
 
+#ifdef SK_FONTHOST_FEM
+void trim_font_engine_memory(bool complete);
+#endif
+
 static SkTypeface* gDefaultFont[4] = { NULL };
 
 static void GetFullPathForSysFonts(SkString* full, const char name[]) {
@@ -1042,3 +1046,20 @@ bool SkFontManager::reset() {
 
     return ret;
 }
+
+/** 
+ *  trim_font_memory()
+ *
+ *  Releases the memory the font engines can do without, on a low memory
+ *  signal of the process. Not for the font cache purge, which runs on
+ *  every draw over the cache budget.
+ *  
+ *  @param  complete        true - also what the font scalers can rebuild /
+ *                          false - only what no font scaler uses
+ *  @return -
+ */
+void trim_font_memory(bool complete) {
+#ifdef SK_FONTHOST_FEM
+    trim_font_engine_memory(complete);
+#endif
+}
@@ -3270,6 +3270,7 @@ public final class ActivityThread {
 
         // Ask graphics to free up as much as possible (font/image caches)
         Canvas.freeCaches();
+        FontManager.trimMemory(true);
 
         BinderInternal.forceGc("mem");
     }
@@ -69,6 +69,17 @@ public class FontManager {
         return nativeReset();
     }
 
+    /**
+     * Release the memory the font engines can do without; for low memory
+     * signals only, the font engines keep to their own budget otherwise.
+     * 
+     * @param complete true to also release what the fonts in use can
+     *                 rebuild, false for only what no font in use needs
+     */
+    public static void trimMemory(boolean complete) {
+        nativeTrimMemory(complete);
+    }
+
     /**
      * Font infomation class.
      */
@@ -136,4 +147,5 @@ public class FontManager {
     private static native String  nativeGetSelectedDefaultFontName();
     private static native boolean nativeSetSelectedDefaultFontName(String name);
     private static native boolean nativeReset();
+    private static native void    nativeTrimMemory(boolean complete);
 }
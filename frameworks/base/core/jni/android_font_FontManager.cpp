@@ -20,6 +20,9 @@
 #include "SkFontHost.h"
 #include "SkString.h"
 
+// defined by the Android font host of Skia
+void trim_font_memory(bool complete);
+
 namespace android {
 
 /** 
@@ -112,6 +115,20 @@ static jboolean FontManager_reset(JNIEnv* env, jobject obj) {
     return SkFontManager::reset();
 }
 
+/** 
+ *  FontManager_trimMemory()
+ *  
+ *  Release the memory the font engines can do without.
+ *  
+ *  @param  env
+ *  @param  obj
+ *  @param  complete        true - also what the font scalers can rebuild
+ *  @return -
+ */
+static void FontManager_trimMemory(JNIEnv* env, jobject obj, jboolean complete) {
+    trim_font_memory(complete);
+}
+
 /**
  * JNI registration.
  */
@@ -127,7 +144,10 @@ static JNINativeMethod gFontManagerMethods[] = {
        (void*)FontManager_setSelectedDefaultFontName },
     { "nativeReset",
       "()Z",
-       (void*)FontManager_reset }
+       (void*)FontManager_reset },
+    { "nativeTrimMemory",
+      "(Z)V",
+       (void*)FontManager_trimMemory }
 };
 
 int register_android_font_FontManager(JNIEnv* env)
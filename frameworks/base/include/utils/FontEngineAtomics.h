@@ -0,0 +1,57 @@
+/* frameworks/base/include/utils/FontEngineAtomics.h
+**
+** Copyright (c) 1989-2010, Bitstream Inc. and others. All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+** Redistributions of source code must retain the above copyright notice,
+** this list of conditions and the following disclaimer.
+** Redistributions in binary form must reproduce the above copyright notice,
+** this list of conditions and the following disclaimer in the documentation
+** and/or other materials provided with the distribution.
+** Neither the name of Bitstream Inc. nor the names of its contributors may
+** be used to endorse or promote products derived from this software without
+** specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+** LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+** INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+** CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+** ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+** POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef __FONTENGINEATOMICS_HEADER__
+#define __FONTENGINEATOMICS_HEADER__
+
+namespace fem
+{
+    /*
+       Loads and stores publishing data to threads which take no lock:
+       whatever was written before a releaseStore() is visible after the
+       acquireLoad() reading the stored value. Shared by the font engine
+       manager and the font engines it loads.
+    */
+    template <typename T>
+    static inline T acquireLoad(T const volatile* addr)
+    {
+        T value = *addr;
+        __sync_synchronize();
+        return value;
+    }/* end acquireLoad */
+
+    template <typename T>
+    static inline void releaseStore(T volatile* addr, T value)
+    {
+        __sync_synchronize();
+        *addr = value;
+    }/* end releaseStore */
+};/* end namespace fem */
+
+#endif /* __FONTENGINEATOMICS_HEADER__ */
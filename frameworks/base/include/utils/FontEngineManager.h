@@ -79,6 +79,42 @@ typedef int32_t FEM26Dot6;
 typedef FontEngine* (*getFontEngineInstanceType)();
 typedef void (*releaseFontEngineInstanceType)(FontEngine*);
 
+/* Version of the font engine plugin interface described by this header. A
+   plugin exporting getFontEngineInstanceV2() is handed the version the font
+   engine manager was built with and returns NULL if it does not implement
+   that version; the manager then offers each older version down to 2 in
+   turn. Plugins exporting only getFontEngineInstance() are treated as
+   version 1.
+
+   The manager makes a call only on plugins of the version which introduced
+   it or later; see the FEM_ABI_* versions below.
+
+   Version 3 adds FontScaler::loadGlyphOutline() and decomposeGlyphOutline().
+
+   Version 4 adds FontScaler::getGlyphMetricsAndImage().
+
+   Version 5 adds FontEngine::trimMemory().
+*/
+#define FEM_ABI_VERSION    5
+
+/* FontEngine::getSupportedFormats() and FontEngine::getFeatures() */
+#define FEM_ABI_FORMATS    2
+
+/* FontScaler::getGlyphsAdvance(), getGlyphsMetrics(), getGlyphsImage() and
+   getGlyphsOutline() */
+#define FEM_ABI_BATCHED    2
+
+/* FontScaler::loadGlyphOutline() and decomposeGlyphOutline() */
+#define FEM_ABI_OUTLINES   3
+
+/* FontScaler::getGlyphMetricsAndImage() */
+#define FEM_ABI_FUSED      4
+
+/* FontEngine::trimMemory() */
+#define FEM_ABI_TRIM       5
+
+typedef FontEngine* (*getFontEngineInstanceV2Type)(uint32_t abiVersion);
+
 namespace fem
 {
     /** FontStyle specifies the intrinsic style attributes of a given typeface */
@@ -168,13 +204,17 @@ namespace fem
         the font scaler. A FontEngine will increases weight by applying a
         widening algorithm to the glyph outline This may be used to simulate
         a bold weight where no designed bold weight is available.
+
+        LCD BGR order flag indicates that the subpixels of the screen are in
+        blue, green, red order; the LCD masks are then rendered for it.
     */
     enum Flags
     {
         DevKernText_Flag        = 0x01, /* mask for querying the status of a kerning bit  */
         Hinting_Flag            = 0x06, /* mask for querying the status of a hinting bits */
         EmbeddedBitmapText_Flag = 0x08, /* mask for querying the status of an embedded bitmap bit */
-        Embolden_Flag           = 0x10  /* mask for querying the status of an emboldening bit */
+        Embolden_Flag           = 0x10, /* mask for querying the status of an emboldening bit */
+        LCDBGROrder_Flag        = 0x20  /* mask for querying the status of the LCD subpixel order bit */
     };
 
     /** Specifies the different types of font format */
@@ -188,6 +228,62 @@ namespace fem
         NOTEMBEDDABLE_FONT = 5
     }FontType;
 
+    /** Specifies the font file formats. A font engine declares the formats
+        it handles as a bitwise OR of these values; the font engine manager
+        recognizes the format of a font from the first bytes of its data.
+    */
+    typedef enum
+    {
+        FORMAT_UNKNOWN      = 0,
+        FORMAT_TRUETYPE     = 0x01,  /* sfnt version 0x00010000 or 'true' */
+        FORMAT_OPENTYPE_CFF = 0x02,  /* sfnt version 'OTTO' */
+        FORMAT_COLLECTION   = 0x04,  /* 'ttcf' font collection */
+        FORMAT_WOFF         = 0x08,  /* 'wOFF' web open font format */
+        FORMAT_TYPE1        = 0x10   /* PostScript Type1, PFA or PFB */
+    }FontFormat;
+
+    /** Specifies the features a font engine declares through
+        FontEngine::getFeatures(), as a bitwise OR of these values. The font
+        engine manager and its clients take the faster paths these allow
+        and assume none for engines declaring nothing.
+    */
+    typedef enum
+    {
+        ENGINE_THREAD_SAFE    = 0x01,  /* the engine and its scalers may be called from any thread at once; no external locking is needed */
+        ENGINE_BATCHED_GLYPHS = 0x02,  /* the batched FontScaler methods are implemented natively */
+        ENGINE_DIRECT_RENDER  = 0x04,  /* getGlyphImage() writes every pixel of the caller's buffer; it need not be cleared first */
+        ENGINE_GLYPH_CACHE    = 0x08   /* the engine caches glyphs itself */
+    }EngineFeature;
+
+    /** Specifies the font engine APIs the font engine manager keeps
+        statistics for (see FontEngineManager::getFontEngineStats()).
+    */
+    typedef enum
+    {
+        API_CREATE_SCALER = 0,  /* FontEngine::createFontScalerContext() */
+        API_FONT_METRICS  = 1,  /* FontScaler::getFontMetrics() */
+        API_GLYPH_ADVANCE = 2,  /* FontScaler::getGlyphAdvance(), getGlyphsAdvance() */
+        API_GLYPH_METRICS = 3,  /* FontScaler::getGlyphMetrics(), getGlyphsMetrics() */
+        API_GLYPH_IMAGE   = 4,  /* FontScaler::getGlyphImage(), getGlyphsImage(), getGlyphMetricsAndImage() */
+        API_GLYPH_OUTLINE = 5,  /* FontScaler::getGlyphOutline(), getGlyphsOutline() */
+        API_FONT_QUERY    = 6,  /* the path and buffer queries of FontEngine */
+        API_COUNT         = 7
+    }StatsApi;
+
+    /** Specifies the output format of FontEngineManager::dumpStats(). */
+    typedef enum
+    {
+        STATS_TEXT = 0,
+        STATS_JSON = 1
+    }StatsFormat;
+
+    /** Specifies how much memory FontEngine::trimMemory() releases. */
+    typedef enum
+    {
+        TRIM_MEMORY_IDLE     = 0,  /* what no font scaler uses, e.g. the faces and sizes of fonts without scalers */
+        TRIM_MEMORY_COMPLETE = 1   /* also what the font scalers can rebuild on their next use, e.g. their sizes and glyph caches */
+    }TrimLevel;
+
 
     /** These enum values match the values used in the PDF file format. */
     typedef enum
@@ -500,9 +596,11 @@ struct FontScalerInfo
     (which uses  26 bits for the integer part, and 6 bits for the fractional
     part).
 */
+class GlyphOutlineSink;
+
 class GlyphOutline
 {
-private:
+protected:
     GlyphOutline();
 
 public:
@@ -540,8 +638,62 @@ public:
        if unset.
     */
     uint8_t*    flags;         /* the points flags */
+
+    /** Walks the contours of the outline, turning the on and off points
+        into segments (see the rules above).
+        @param sink    receives the segments.
+        @return false if the outline is malformed; true otherwise.
+    */
+    bool decompose(GlyphOutlineSink* sink) const;
 }; /* end class GlyphOutline */
 
+/** \class GlyphOutlineBuffer
+
+    A caller owned glyph outline which is reused from glyph to glyph; its
+    arrays only grow when a glyph needs more room than any glyph before.
+    Pass it to FontScaler::loadGlyphOutline(). It must not be deleted
+    through a GlyphOutline pointer.
+*/
+class GlyphOutlineBuffer : public GlyphOutline
+{
+public:
+    GlyphOutlineBuffer();
+    ~GlyphOutlineBuffer();
+
+    /** Makes room for an outline and sets the counts and arrays; the array
+        contents are undefined afterwards.
+        @param nOtlnPts    number of outline's points in the glyph.
+        @param nContours   number of contours in glyph.
+        @return false if out of memory; true otherwise.
+    */
+    bool reserve(int16_t nOtlnPts, int16_t nContours);
+
+private:
+    size_t  capacity;   /* bytes allocated at x */
+
+    GlyphOutlineBuffer(const GlyphOutlineBuffer&);
+    GlyphOutlineBuffer& operator = (const GlyphOutlineBuffer&);
+}; /* end class GlyphOutlineBuffer */
+
+/** \class GlyphOutlineSink
+
+    Receives the segments of a glyph outline, contour by contour. Each
+    contour starts with moveTo() and ends with close(). Coordinates are in
+    device pixels in the 26.6 fixed point format, with y going up as in
+    GlyphOutline.
+*/
+class GlyphOutlineSink
+{
+public:
+    virtual ~GlyphOutlineSink() {}
+
+    virtual void moveTo(FEM26Dot6 x, FEM26Dot6 y) = 0;
+    virtual void lineTo(FEM26Dot6 x, FEM26Dot6 y) = 0;
+    virtual void quadTo(FEM26Dot6 cx, FEM26Dot6 cy, FEM26Dot6 x, FEM26Dot6 y) = 0;
+    virtual void cubicTo(FEM26Dot6 cx1, FEM26Dot6 cy1, FEM26Dot6 cx2, FEM26Dot6 cy2, FEM26Dot6 x, FEM26Dot6 y) = 0;
+    virtual void close() = 0;
+}; /* end class GlyphOutlineSink */
+
 /** \class AdvancedTypefaceMetrics
 
     The AdvancedTypefaceMetrics will be used to used by the PDF backend to
@@ -581,6 +733,66 @@ public:
     bool       hasVerticalMetrics;
 };
 
+/** \struct GlyphImageSlot
+
+    This struct describes a user allocated buffer receiving one glyph image
+    of a batched image request (see FontScaler::getGlyphsImage()).
+*/
+struct GlyphImageSlot
+{
+    uint32_t    rowBytes;   /* buffer's row bytes. */
+    uint16_t    width;      /* buffer's width. */
+    uint16_t    height;     /* buffer's height. */
+    uint8_t*    buffer;     /* user allocated buffer. */
+};/* end struct GlyphImageSlot */
+
+/** \struct GlyphImageBuffer
+
+    This struct describes a user allocated buffer receiving the image of
+    FontScaler::getGlyphMetricsAndImage(). The image size is only known once
+    the glyph is measured, so its rows are packed as computeRowBytes() says
+    and the image is rendered only if it fits.
+*/
+struct GlyphImageBuffer
+{
+    uint8_t*        buffer;     /* user allocated buffer. */
+    uint32_t        size;       /* buffer's size in bytes. */
+    fem::AliasMode  format;     /* the mask format the font scaler was created with. */
+    uint32_t        rowBytes;   /* set to the image's row bytes when an image is rendered. */
+
+    /** Returns the row bytes of an image 'width' pixels wide: a bit per
+        pixel for ALIAS_MONOCHROME, two bytes for ALIAS_LCD16 and a byte for
+        the other formats.
+    */
+    uint32_t computeRowBytes(uint16_t width) const
+    {
+        if (format == fem::ALIAS_MONOCHROME) {
+            return (width + 7) >> 3;
+        } else if (format == fem::ALIAS_LCD16) {
+            return width << 1;
+        }/* end else if */
+
+        return width;
+    }
+
+    /** Returns the bytes of an image 'width' by 'height' pixels: its rows
+        and, for ALIAS_LCD_H and ALIAS_LCD_V, the 32 bit plane following
+        them at the next 4 byte boundary (see fem::AliasMode).
+    */
+    uint32_t computeImageSize(uint16_t width, uint16_t height) const
+    {
+        uint32_t size = computeRowBytes(width) * height;
+
+        if (format == fem::ALIAS_LCD_H) {
+            return ((size + 3) & ~3) + (width + 2) * height * 4;
+        } else if (format == fem::ALIAS_LCD_V) {
+            return ((size + 3) & ~3) + width * (height + 2) * 4;
+        }/* end else if */
+
+        return size;
+    }
+};/* end struct GlyphImageBuffer */
+
 /** \class FontScaler
 
     Font Scaler Interface; each plugin will provide its own implementation.
@@ -666,7 +878,9 @@ public:
         @param rowBytes   buffer's row bytes.
         @param width      buffer's width.
         @param height     buffer height.
-        @param buffer     user allocated buffer.
+        @param buffer     user allocated buffer; for ALIAS_LCD_H and
+                          ALIAS_LCD_V it also holds the 32 bit plane (see
+                          fem::AliasMode) after the rows.
     */
     virtual void getGlyphImage(uint16_t glyphID, FEM16Dot16 fracX, FEM16Dot16 fracY, uint32_t rowBytes, uint16_t width, uint16_t height, uint8_t *buffer) = 0;
 
@@ -697,6 +911,100 @@ public:
         @return the outline for the given glyph.
     */
     virtual GlyphOutline* getGlyphOutline(uint16_t glyphID, FEM16Dot16 fracX, FEM16Dot16 fracY) = 0;
+
+    /** Batched getGlyphAdvance(); returns the advances of 'count' glyphs in
+        one call. The default implementation calls getGlyphAdvance() for
+        each glyph; font scalers should override it to set the font scaler
+        up only once per batch.
+        @param count       number of glyphs.
+        @param glyphIDs    glyph indices; 'count' elements.
+        @param fracX       horizontal factional pen deltas; 'count' elements
+                           or NULL if all are zero.
+        @param fracY       vertical factional pen deltas; 'count' elements
+                           or NULL if all are zero.
+        @param metrics     returns the GlyphMetrics of each glyph, as
+                           getGlyphAdvance() does; 'count' elements.
+    */
+    virtual void getGlyphsAdvance(uint32_t count, const uint16_t glyphIDs[], const FEM16Dot16 fracX[], const FEM16Dot16 fracY[], GlyphMetrics metrics[]);
+
+    /** Batched getGlyphMetrics(); returns the metrics of 'count' glyphs in
+        one call. The default implementation calls getGlyphMetrics() for
+        each glyph.
+        @param count       number of glyphs.
+        @param glyphIDs    glyph indices; 'count' elements.
+        @param fracX       horizontal factional pen deltas; 'count' elements
+                           or NULL if all are zero.
+        @param fracY       vertical factional pen deltas; 'count' elements
+                           or NULL if all are zero.
+        @param metrics     returns the GlyphMetrics of each glyph, as
+                           getGlyphMetrics() does; 'count' elements.
+    */
+    virtual void getGlyphsMetrics(uint32_t count, const uint16_t glyphIDs[], const FEM16Dot16 fracX[], const FEM16Dot16 fracY[], GlyphMetrics metrics[]);
+
+    /** Batched getGlyphImage(); renders 'count' glyphs in one call. The
+        default implementation calls getGlyphImage() for each glyph.
+        @param count       number of glyphs.
+        @param glyphIDs    glyph indices; 'count' elements.
+        @param fracX       horizontal factional pen deltas; 'count' elements
+                           or NULL if all are zero.
+        @param fracY       vertical factional pen deltas; 'count' elements
+                           or NULL if all are zero.
+        @param slots       the buffer receiving each glyph image, as
+                           getGlyphImage() does; 'count' elements.
+    */
+    virtual void getGlyphsImage(uint32_t count, const uint16_t glyphIDs[], const FEM16Dot16 fracX[], const FEM16Dot16 fracY[], const GlyphImageSlot slots[]);
+
+    /** Batched getGlyphOutline(); returns the outlines of 'count' glyphs in
+        one call. User should delete each GlyphOutline object when done. The
+        default implementation calls getGlyphOutline() for each glyph.
+        @param count       number of glyphs.
+        @param glyphIDs    glyph indices; 'count' elements.
+        @param fracX       horizontal factional pen deltas; 'count' elements
+                           or NULL if all are zero.
+        @param fracY       vertical factional pen deltas; 'count' elements
+                           or NULL if all are zero.
+        @param outlines    returns the outline of each glyph or NULL on
+                           failure; 'count' elements.
+    */
+    virtual void getGlyphsOutline(uint32_t count, const uint16_t glyphIDs[], const FEM16Dot16 fracX[], const FEM16Dot16 fracY[], GlyphOutline* outlines[]);
+
+    /** Like getGlyphOutline() but writes the outline into a caller owned
+        buffer, which avoids allocating an outline per glyph. The default
+        implementation copies the result of getGlyphOutline().
+        @param glyphID    glyph index.
+        @param fracX      horizontal factional pen delta; see getGlyphOutline().
+        @param fracY      vertical factional pen delta; see getGlyphOutline().
+        @param outline    receives the outline.
+        @return true on success; false otherwise.
+    */
+    virtual bool loadGlyphOutline(uint16_t glyphID, FEM16Dot16 fracX, FEM16Dot16 fracY, GlyphOutlineBuffer* outline);
+
+    /** Streams the outline of a glyph to a sink as move, line, quadratic
+        and cubic segments, without building an outline at all. The default
+        implementation decomposes the result of getGlyphOutline().
+        @param glyphID    glyph index.
+        @param fracX      horizontal factional pen delta; see getGlyphOutline().
+        @param fracY      vertical factional pen delta; see getGlyphOutline().
+        @param sink       receives the segments.
+        @return true on success; false otherwise.
+    */
+    virtual bool decomposeGlyphOutline(uint16_t glyphID, FEM16Dot16 fracX, FEM16Dot16 fracY, GlyphOutlineSink* sink);
+
+    /** Measures a glyph and renders its image in the same call, so that the
+        glyph is loaded and hinted once; for callers which draw the glyph
+        right after measuring it. The default implementation calls
+        getGlyphMetrics() and then getGlyphImage().
+        @param glyphID    glyph index.
+        @param fracX      horizontal factional pen delta; see getGlyphImage().
+        @param fracY      vertical factional pen delta; see getGlyphImage().
+        @param metrics    receives the glyph metrics, as getGlyphMetrics()
+                          returns them.
+        @param image      receives the image, 'metrics->width' by
+                          'metrics->height' pixels, unless it is empty or
+                          does not fit.
+        @return true if the image was rendered; false otherwise.
+    */
+    virtual bool getGlyphMetricsAndImage(uint16_t glyphID, FEM16Dot16 fracX, FEM16Dot16 fracY, GlyphMetrics* metrics, GlyphImageBuffer* image);
 };/* end class FontScaler */
 
 /** \class FontEngine
@@ -896,6 +1204,28 @@ public:
         the font is not found.
     */
     virtual AdvancedTypefaceMetrics* getAdvancedTypefaceMetrics(const void* buffer, const uint32_t bufferLength) = 0;
+
+    /** Returns the font formats handled by the font engine as a bitwise OR
+        of fem::FontFormat values. Requests for a font whose format is
+        recognized are routed only to the engines declaring that format;
+        engines returning FORMAT_UNKNOWN are asked for every font, after the
+        engines declaring its format.
+    */
+    virtual uint32_t getSupportedFormats() const { return fem::FORMAT_UNKNOWN; }
+
+    /** Returns the features of the engine as a bitwise OR of
+        fem::EngineFeature values. Only asked of engines created through
+        getFontEngineInstanceV2().
+    */
+    virtual uint32_t getFeatures() const { return 0; }
+
+    /** Releases memory the engine can do without, e.g. when the process is
+        asked to trim its memory. Font scalers keep working; what they lose
+        is rebuilt when next needed. Only called on engines created through
+        getFontEngineInstanceV2().
+        @param level    How much to release.
+    */
+    virtual void trimMemory(fem::TrimLevel) {}
 };
 
 /** \struct FontEngineInfo
@@ -907,6 +1237,39 @@ struct FontEngineInfo
     const char*  name;
 }; /* end struct FontEngineInfo */
 
+/* No. of buckets of a latency histogram. */
+#define FEM_STATS_LATENCY_BUCKETS   16
+
+/** \struct FontApiStats
+
+    This struct provides the statistics of one API of a font engine. A batched
+    glyph call counts as one call of all its glyphs.
+*/
+struct FontApiStats
+{
+    uint32_t    calls;          /* calls made to the engine */
+    uint32_t    glyphs;         /* glyphs requested by the glyph calls */
+    uint32_t    failures;       /* calls the engine answered with an error */
+    uint32_t    fallthroughs;   /* calls the engine declined; the next engine was asked */
+    uint64_t    totalNanos;     /* time spent in the engine */
+
+    /* Latency of the calls; bucket 0 counts calls under 1 microsecond,
+       bucket i those from 2^(i-1) up to 2^i microseconds and the last
+       bucket every longer call.
+    */
+    uint32_t    latency[FEM_STATS_LATENCY_BUCKETS];
+};/* end struct FontApiStats */
+
+/** \struct FontEngineStats
+
+    This struct provides the statistics of a font engine.
+*/
+struct FontEngineStats
+{
+    const char*   name;                   /* engine name; owned by the engine */
+    FontApiStats  apis[fem::API_COUNT];   /* indexed by fem::StatsApi */
+};/* end struct FontEngineStats */
+
 typedef FontEngineInfo*         FontEngineInfoPtr;
 typedef FontEngineInfo**        FontEngineInfoArrPtr;
 typedef FontEngineInfo** const  FontEngineInfoArrCPtr;
@@ -923,18 +1286,97 @@ public:
     */
     FontScaler* createFontScalerContext(const FontScalerInfo& desc);
 
+    /** Returns font scaler instance.
+        @param desc        The information about the font scaler.
+        @param features    If not null, returns the features (see
+                           fem::EngineFeature) of the font engine which
+                           created the scaler.
+    */
+    FontScaler* createFontScalerContext(const FontScalerInfo& desc, uint32_t* features);
+
     /** Returns the count of available font engines.
     */
-    size_t getFontEngineCount() const { return engineCount; }
+    size_t getFontEngineCount() const;
+
+    /** Returns the features (see fem::EngineFeature) every available font
+        engine declares; an engine not loaded yet counts as declaring those
+        the manifest lists for it, none if it lists none, and never
+        fem::ENGINE_THREAD_SAFE.
+        The manager serializes its own calls into engines which do not
+        declare fem::ENGINE_THREAD_SAFE, but not the calls to their font
+        scalers: a client serializes those (see createFontScalerContext()),
+        and its calls into the manager under the same lock unless this
+        includes fem::ENGINE_THREAD_SAFE.
+    */
+    uint32_t getFontEngineFeatures() const;
 
     /** Given a font engine name; returns its instance.
     */
     FontEngine* getFontEngine(const char name[]);
 
     /** Returns a list all available font engines. Font engine manager is
-        resposible to free it.
+        resposible to free it. Every font engine not loaded yet is loaded
+        by this call.
+    */
+    FontEngineInfoArrCPtr listFontEngines();
+
+    /** Loads every font engine not loaded yet. Font engines are otherwise
+        loaded only when a request first needs them.
+        @param background    If 'true' the engines are loaded on a
+                             background thread and the call returns at once.
+    */
+    void warmFontEngines(bool background);
+
+    /** Adds a font engine plugin, e.g. one installed at runtime, after the
+        already available font engines. The plugin is loaded by this call.
+        Requests being dispatched concurrently keep using the font engines
+        available when they started.
+        @param libPath    The system path to the plugin library.
+        @return true if the plugin was loaded and added; false otherwise.
+    */
+    bool addFontEngine(const char libPath[]);
+
+    /** Turns the dispatch statistics on or off. They are off unless the
+        FEM_STATS environment variable is set to a non-zero value, so that
+        calls into font engines are not timed. Font scalers created while
+        they are off are not counted.
+        @param enabled    'true' to count calls from now on.
+    */
+    void setStatsEnabled(bool enabled);
+
+    /** Returns the statistics of the loaded font engines. Every thread keeps
+        its own counters; they are merged by this call, so counts of calls
+        in progress on other threads may be off by one.
+        @param stats       Receives the statistics of up to 'maxCount'
+                           engines.
+        @param maxCount    The number of elements of 'stats'.
+        @return the number of engines filled in.
+    */
+    size_t getFontEngineStats(FontEngineStats stats[], size_t maxCount);
+
+    /** Asks every loaded font engine to release the memory it can do
+        without (see FontEngine::trimMemory()), e.g. when the process goes
+        to the background or the system runs low on memory. Skia's font
+        host calls it on the low memory signal of the process, through
+        android.font.FontManager.trimMemory(); nothing in this library
+        calls it.
+        @param level    How much to release.
     */
-    FontEngineInfoArrCPtr listFontEngines() { return (FontEngineInfoArrCPtr)pFontEngineInfoArr; }
+    void trimMemory(fem::TrimLevel level);
+
+    /** Returns the number of requests of the given API no font engine
+        could handle.
+    */
+    uint32_t getUnhandledCount(fem::StatsApi api);
+
+    /** Clears the statistics of every font engine. */
+    void resetStats();
+
+    /** Writes the statistics of every font engine to a file descriptor.
+        @param fd        The file descriptor, e.g. of a dumpsys request.
+        @param format    STATS_TEXT for people or STATS_JSON for tools.
+    */
+    void dumpStats(int fd, fem::StatsFormat format);
 
     /** Given system path of the font file; returns the fone name, name's
         length and style. It also return a flag which tells about whether the
@@ -1102,19 +1544,115 @@ public:
     AdvancedTypefaceMetrics* getAdvancedTypefaceMetrics(const void* buffer, const uint32_t bufferLength);
 
 private:
+    /* A discovered font engine plugin. The plugin library is opened and the
+       engine created only when a request first needs it. Only 'state' ever
+       changes once the node is published; 'inst', 'engineFormats',
+       'features' and 'abiVersion' are set before the state becomes
+       NODE_LOADED.
+    */
     typedef struct FontEngineNode_t
     {
-        struct FontEngineNode_t*  next;
-        FontEngine*               inst;
+        struct FontEngineNode_t*  next;              /* all nodes ever created */
+        volatile int32_t          state;             /* NODE_UNLOADED, NODE_LOADED or NODE_FAILED */
+        FontEngine*               inst;              /* valid once loaded */
+        uint32_t                  engineFormats;     /* formats declared by the engine; valid once loaded */
+        uint32_t                  features;          /* fem::EngineFeature values; valid once loaded */
+        uint32_t                  abiVersion;        /* plugin interface version; valid once loaded */
+        uint32_t                  manifestFormats;   /* formats declared by the manifest */
+        bool                      hasManifestFormats;
+        uint32_t                  manifestFeatures;  /* features declared by the manifest but fem::ENGINE_THREAD_SAFE; 0 if none */
+        char*                     pLibPath;          /* plugin library path; we own this */
+        char*                     pName;             /* engine name from the manifest or NULL; we own this */
+        void*                     handle;            /* plugin library handle */
     } FontEngineNode;
 
-    size_t                     engineCount;         /* No. of available font engines */
-    FontEngineNode*            pFontEngineList;     /* All available font engines */
+    enum
+    {
+        NODE_UNLOADED = 0,
+        NODE_LOADED   = 1,
+        NODE_FAILED   = 2
+    };
 
-    FontEngineInfoArrPtr       pFontEngineInfoArr;  /* All available font engines info */
+    /* An immutable snapshot of the font engines in dispatch order. A new
+       registry replaces the current one when engines are added or fail to
+       load; the replaced ones are kept until the manager goes away since
+       dispatching threads may still walk them.
+    */
+    typedef struct FontEngineRegistry_t
+    {
+        struct FontEngineRegistry_t*  retired;     /* previously published registry */
+        FontEngineInfoArrPtr          pInfoArr;    /* built by listFontEngines() */
+        size_t                        count;
+        FontEngineNode*               nodes[1];    /* 'count' entries */
+    } FontEngineRegistry;
+
+    /* Identifies a font; any combination of the members may be set. A font
+       scaler request usually carries the fontID, the buffer and the path of
+       the same font, the per-font queries carry either a path or a buffer.
+    */
+    struct FontKey
+    {
+        FontKey(const FontScalerInfo& desc);
+        FontKey(const char path[]);
+        FontKey(const void* buffer, const uint32_t bufferLength);
+
+        uint32_t        fontID;        /* zero if not known */
+        const char*     pPath;         /* NULL if not known */
+        const void*     pBuffer;       /* NULL if not known */
+        uint32_t        bufferLength;
+
+        /* Returns the font format recognized from the font data. */
+        fem::FontFormat sniffFormat() const;
+    };
+
+    /* An entry of the font to engine table. Every entry holds exactly one
+       identity of a font: a fontID, a buffer or a path.
+    */
+    typedef struct FontBinding_t
+    {
+        struct FontBinding_t*  next;
+        uint32_t               hash;
+        uint32_t               fontID;        /* non zero for a fontID entry */
+        const void*            pBuffer;       /* non null for a buffer entry */
+        uint32_t               bufferLength;
+        char*                  pPath;         /* non null for a path entry; we own this */
+        FontEngine*            inst;          /* engine which handled the font */
+    } FontBinding;
+
+    enum
+    {
+        FONT_BINDING_BUCKETS = 64,    /* size of the font to engine table, a power of two */
+        FONT_BINDING_MAX     = 1024   /* fonts beyond this count are not remembered */
+    };
+
+    FontEngineRegistry* volatile  pRegistry;        /* published font engines; see getRegistry() */
+    FontEngineNode*            pFontEngineList;     /* All font engine nodes ever created */
+
+    FontBinding* volatile      pFontBindings[FONT_BINDING_BUCKETS];  /* font to engine table; read without lock */
+    size_t                     fontBindingCount;    /* No. of entries in the font to engine table */
 
     static FontEngineManager*  pFEMInst;            /* Pointer to singleton font engine manager's instance */
 
+    static void createInstance();
+
+    void discoverFontEngines(const char dir[]);
+    bool readManifest(const char dir[]);
+    FontEngineNode* newFontEngineNode(const char libPath[], const char name[], uint32_t formats, bool hasFormats);
+    static FontEngineRegistry* allocRegistry(size_t capacity);
+    void publishRegistry(FontEngineNode* added, FontEngineNode* removed);
+    const FontEngineRegistry* getRegistry() const;
+    FontEngine* loadFontEngine(FontEngineNode* node);
+    FontEngine* selectFontEngine(FontEngineNode* node, fem::FontFormat format, int pass);
+    static int warmThread(void* arg);
+
+    FontEngine* findFontEngine(const FontKey& key);
+    void bindFontEngine(const FontKey& key, FontEngine* inst);
+    FontBinding* findBinding(uint32_t hash, uint32_t fontID, const void* buffer, uint32_t bufferLength, const char path[]);
+    void addBinding(uint32_t hash, uint32_t fontID, const void* buffer, uint32_t bufferLength, const char path[], FontEngine* inst);
+
+    class DispatchCursor;
+    friend class DispatchCursor;
+
     FontEngineManager();
     ~FontEngineManager();
 
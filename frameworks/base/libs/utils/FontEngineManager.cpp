@@ -28,197 +28,1950 @@
 */
 
 #include <utils/FontEngineManager.h>
+#include <utils/FontEngineAtomics.h>
+#include <utils/threads.h>
+#include <utils/Timers.h>
 
 #include <dlfcn.h>
 #include <sys/types.h>
 #include <dirent.h>
+#include <pthread.h>
 #include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdarg.h>
+
+/* #define FEM_ENABLE_LOG */
+
+#ifdef FEM_ENABLE_LOG
+/* fprintf, FILE */
+#include <stdio.h>
+
+static FILE * fplog = NULL;
+
+#define FEM_STARTLOG fplog = fopen("/data/femlog.txt", "a");
+#define FEM_LOG(...) \
+        FEM_STARTLOG \
+        fprintf(fplog, __FUNCTION__); \
+        fprintf(fplog, ", "); \
+        fprintf(fplog, __VA_ARGS__); \
+        FEM_ENDLOG
+#define FEM_ENDLOG fclose(fplog);
+#else
+#define FEM_STARTLOG
+#define FEM_LOG(...)
+#define FEM_ENDLOG
+#endif /* FEM_ENABLE_LOG */
+
+#ifdef FEM_UNUSED
+#undef FEM_UNUSED
+#endif
+#define FEM_UNUSED(x) ((void)(x))
+
+#define MAX_PATH_LEN 1024
+
+/* No. of leading bytes of the font data used to recognize its format. */
+#define FONT_SNIFF_LEN 16
+
+/* Font engine libraries are decidedly in the system partition. */
+#define ANDROID_FONT_ENGINE_PATH "/system/lib/fontengines/"
+
+/* Environment variable overriding the font engine directory, e.g. to run
+   the manager on a development host. */
+#define FONT_ENGINE_PATH_ENV "FEM_FONT_ENGINE_PATH"
+
+/*
+   Optional manifest in the font engine directory. Each line names a plugin
+   library, its engine and optionally the formats it handles ('-' for none
+   declared) and the features of its engine, e.g.
+
+       libfem_freetype.so  freetype  truetype,opentype-cff,collection  thread-safe
+
+   Only the listed plugins are used, in the listed order. Without a manifest
+   every '.so' file of the directory is used. Either way a plugin is opened
+   only when a request first needs it; until then the features it declares
+   here stand for those of its engine (see getFontEngineFeatures()), except
+   'thread-safe': only a loaded engine is trusted to skip the locking.
+*/
+#define FONT_ENGINE_MANIFEST "fontengines.conf"
+
+/* Environment variable turning the dispatch statistics on, e.g. FEM_STATS=1;
+   see FontEngineManager::setStatsEnabled(). */
+#define FONT_ENGINE_STATS_ENV "FEM_STATS"
+
+/* No. of font engines statistics are kept for; engines loaded later are
+   listed as untracked by dumpStats(). */
+#define FEM_STATS_ENGINES 8
+
+/* Entry points to font engine plugin; see FEM_ABI_VERSION */
+#define GET_FONT_ENGINE_INSTANCE    "getFontEngineInstance"
+#define GET_FONT_ENGINE_INSTANCE_V2 "getFontEngineInstanceV2"
+
+FontEngineManager* FontEngineManager::pFEMInst = NULL;
+typedef int (*direntAlphaSort)(const dirent**, const dirent**);
+
+/* Guards the font to engine table. */
+static android::Mutex  gMutexFontBindings;
+
+/* Guards the loading of font engine plugins and registry replacement. */
+static android::Mutex  gMutexFontEngines;
+
+/* Serializes the calls into font engines which are not thread-safe. It is
+   recursive, so that such an engine may call back into the manager, e.g.
+   to ask another engine, from within a call. */
+static pthread_mutex_t  gMutexEngineCalls;
+static pthread_once_t   gEngineCallsOnce = PTHREAD_ONCE_INIT;
+
+static pthread_once_t  gFEMOnce = PTHREAD_ONCE_INIT;
+
+/* see FontEngineAtomics.h */
+using fem::acquireLoad;
+using fem::releaseStore;
+
+static void createEngineCallsMutex()
+{
+    pthread_mutexattr_t attr;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&gMutexEngineCalls, &attr);
+    pthread_mutexattr_destroy(&attr);
+}/* end createEngineCallsMutex */
+
+static void lockEngineCalls()
+{
+    pthread_once(&gEngineCallsOnce, createEngineCallsMutex);
+    pthread_mutex_lock(&gMutexEngineCalls);
+}/* end lockEngineCalls */
+
+static void unlockEngineCalls()
+{
+    pthread_mutex_unlock(&gMutexEngineCalls);
+}/* end unlockEngineCalls */
+
+static int dummyMethod(const struct dirent *unused)
+{
+	return 1;
+}/* end dummyMethod */
+
+static bool hasSharedLibSuffix(const char name[])
+{
+    size_t length = strlen(name);
+    return length > 3 && ! strcmp(&name[length - 3], ".so");
+}/* end hasSharedLibSuffix */
+
+/* Parses the manifest's comma separated format list. */
+static uint32_t parseFontFormats(char formats[])
+{
+    static const struct { const char* name; fem::FontFormat format; } formatNames[] = {
+        { "truetype",     fem::FORMAT_TRUETYPE },
+        { "opentype-cff", fem::FORMAT_OPENTYPE_CFF },
+        { "collection",   fem::FORMAT_COLLECTION },
+        { "woff",         fem::FORMAT_WOFF },
+        { "type1",        fem::FORMAT_TYPE1 }
+    };
+    uint32_t  mask = fem::FORMAT_UNKNOWN;
+    char*     savePtr = NULL;
+    char*     token = strtok_r(formats, ",", &savePtr);
+
+    while (token) {
+        for (size_t i = 0; i < sizeof(formatNames) / sizeof(formatNames[0]); i++) {
+            if (! strcmp(token, formatNames[i].name)) {
+                mask |= formatNames[i].format;
+            }/* end if */
+        }/* end for */
+
+        token = strtok_r(NULL, ",", &savePtr);
+    }/* end while */
+
+    return mask;
+}/* end parseFontFormats */
+
+/* Parses the manifest's comma separated feature list. */
+static uint32_t parseFontEngineFeatures(char features[])
+{
+    static const struct { const char* name; fem::EngineFeature feature; } featureNames[] = {
+        { "thread-safe",    fem::ENGINE_THREAD_SAFE },
+        { "batched",        fem::ENGINE_BATCHED_GLYPHS },
+        { "direct-render",  fem::ENGINE_DIRECT_RENDER },
+        { "glyph-cache",    fem::ENGINE_GLYPH_CACHE }
+    };
+    uint32_t  mask = 0;
+    char*     savePtr = NULL;
+    char*     token = strtok_r(features, ",", &savePtr);
+
+    while (token) {
+        for (size_t i = 0; i < sizeof(featureNames) / sizeof(featureNames[0]); i++) {
+            if (! strcmp(token, featureNames[i].name)) {
+                mask |= featureNames[i].feature;
+            }/* end if */
+        }/* end for */
+
+        token = strtok_r(NULL, ",", &savePtr);
+    }/* end while */
+
+    return mask;
+}/* end parseFontEngineFeatures */
+
+/* FNV-1a over the given bytes; used to hash the font to engine table keys. */
+static uint32_t hashBytes(uint32_t hash, const void* data, size_t length)
+{
+    const uint8_t* p = (const uint8_t*)data;
+
+    while (length--) {
+        hash = (hash ^ *p++) * 16777619u;
+    }/* end while */
+
+    return hash;
+}/* end hashBytes */
+
+static uint32_t hashFontID(uint32_t fontID)
+{
+    return hashBytes(2166136261u, &fontID, sizeof(fontID));
+}/* end hashFontID */
+
+static uint32_t hashBuffer(const void* buffer, uint32_t bufferLength)
+{
+    uint32_t hash = hashBytes(2166136261u, &buffer, sizeof(buffer));
+    return hashBytes(hash, &bufferLength, sizeof(bufferLength));
+}/* end hashBuffer */
+
+static uint32_t hashPath(const char path[])
+{
+    return hashBytes(2166136261u, path, strlen(path));
+}/* end hashPath */
+
+static bool startsWith(const uint8_t* data, size_t length, const char prefix[])
+{
+    size_t prefixLength = strlen(prefix);
+    return length >= prefixLength && ! memcmp(data, prefix, prefixLength);
+}/* end startsWith */
+
+/* Recognizes the font format from the first bytes of the font data. */
+static fem::FontFormat sniffFontFormat(const uint8_t* data, size_t length)
+{
+    if (length >= 4) {
+        uint32_t tag = (data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+
+        switch (tag) {
+            case 0x00010000:    /* sfnt version 1.0 */
+            case 0x74727565:    /* 'true' */
+                return fem::FORMAT_TRUETYPE;
+            case 0x4F54544F:    /* 'OTTO' */
+                return fem::FORMAT_OPENTYPE_CFF;
+            case 0x74746366:    /* 'ttcf' */
+                return fem::FORMAT_COLLECTION;
+            case 0x774F4646:    /* 'wOFF' */
+                return fem::FORMAT_WOFF;
+        }/* end switch */
+    }/* end if */
+
+    /* PFB files start with an ASCII segment header, PFA files with the
+       PostScript font header directly. */
+    if (length >= 2 && data[0] == 0x80 && data[1] == 0x01) {
+        return fem::FORMAT_TYPE1;
+    }/* end if */
+
+    if (startsWith(data, length, "%!PS-AdobeFont") || startsWith(data, length, "%!FontType1")) {
+        return fem::FORMAT_TYPE1;
+    }/* end if */
+
+    return fem::FORMAT_UNKNOWN;
+}/* end sniffFontFormat */
+
+FontEngineManager::FontKey::FontKey(const FontScalerInfo& desc)
+    : fontID(desc.fontID), pPath(desc.pPath),
+       pBuffer(desc.pBuffer), bufferLength(desc.pBuffer ? desc.size : 0)
+{
+}
+
+FontEngineManager::FontKey::FontKey(const char path[])
+    : fontID(0), pPath(path), pBuffer(NULL), bufferLength(0)
+{
+}
+
+FontEngineManager::FontKey::FontKey(const void* buffer, const uint32_t bufferLength)
+    : fontID(0), pPath(NULL), pBuffer(buffer), bufferLength(bufferLength)
+{
+}
+
+/*
+   Only the buffer and the path can be sniffed here; stream data is read
+   through the host's streamRead(), which is not available to the manager.
+*/
+fem::FontFormat FontEngineManager::FontKey::sniffFormat() const
+{
+    if (pBuffer) {
+        return sniffFontFormat((const uint8_t*)pBuffer, bufferLength);
+    }/* end if */
+
+    if (pPath) {
+        uint8_t  header[FONT_SNIFF_LEN];
+        ssize_t  count;
+        int      fd = open(pPath, O_RDONLY);
+
+        if (fd < 0) {
+            return fem::FORMAT_UNKNOWN;
+        }/* end if */
+
+        count = read(fd, header, sizeof(header));
+        close(fd);
+
+        return count > 0 ? sniffFontFormat(header, count) : fem::FORMAT_UNKNOWN;
+    }/* end if */
+
+    return fem::FORMAT_UNKNOWN;
+}/* end method sniffFormat */
+
+/*
+   Dispatch statistics, kept only while gStatsEnabled is set. Every thread
+   counts into its own block, so that counting takes neither a lock nor an
+   atomic operation; readers merge the blocks under gMutexStats. The block
+   of an exiting thread is added to gRetiredStats and freed.
+
+   Only its own thread writes a block. resetStats() therefore does not clear
+   the blocks but moves gStatsGeneration on: readers skip the blocks of an
+   older generation and the owning thread clears its block before it counts
+   again.
+
+   Engines are counted by their slot in gStatsEngines, which is filled as
+   engines load and never changes afterwards.
+*/
+typedef struct ThreadStats_t
+{
+    struct ThreadStats_t*  next;
+    volatile uint32_t      generation;  /* gStatsGeneration the counts belong to */
+    FontApiStats           apis[FEM_STATS_ENGINES][fem::API_COUNT];
+    uint32_t               unhandled[fem::API_COUNT];
+} ThreadStats;
+
+static android::Mutex        gMutexStats;
+static ThreadStats*          gThreadStatsList = NULL;   /* blocks of running threads */
+static ThreadStats           gRetiredStats;             /* counts of exited threads */
+static volatile uint32_t     gStatsGeneration = 0;      /* moved on by resetStats() */
+static volatile int32_t      gStatsEnabled = 0;
+static FontEngine* volatile  gStatsEngines[FEM_STATS_ENGINES];
+static pthread_key_t         gStatsKey;
+static pthread_once_t        gStatsOnce = PTHREAD_ONCE_INIT;
+
+static const char* const     gStatsApiNames[fem::API_COUNT] = {
+    "create_scaler", "font_metrics", "glyph_advance", "glyph_metrics",
+    "glyph_image", "glyph_outline", "font_query"
+};
+
+static void addThreadStats(ThreadStats* dst, const ThreadStats* src)
+{
+    for (int slot = 0; slot < FEM_STATS_ENGINES; slot++) {
+        for (int api = 0; api < fem::API_COUNT; api++) {
+            FontApiStats*        d = &dst->apis[slot][api];
+            const FontApiStats*  s = &src->apis[slot][api];
+
+            d->calls += s->calls;
+            d->glyphs += s->glyphs;
+            d->failures += s->failures;
+            d->fallthroughs += s->fallthroughs;
+            d->totalNanos += s->totalNanos;
+
+            for (int bucket = 0; bucket < FEM_STATS_LATENCY_BUCKETS; bucket++) {
+                d->latency[bucket] += s->latency[bucket];
+            }/* end for */
+        }/* end for */
+    }/* end for */
+
+    for (int api = 0; api < fem::API_COUNT; api++) {
+        dst->unhandled[api] += src->unhandled[api];
+    }/* end for */
+}/* end addThreadStats */
+
+/* Runs as a thread exits; keeps the counts of the thread. */
+static void retireThreadStats(void* value)
+{
+    ThreadStats*   stats = (ThreadStats*)value;
+    ThreadStats**  link;
+
+    android::Mutex::Autolock ac(gMutexStats);
+
+    for (link = &gThreadStatsList; *link != NULL; link = &(*link)->next) {
+        if (*link == stats) {
+            *link = stats->next;
+            break;
+        }/* end if */
+    }/* end for */
+
+    if (stats->generation == gStatsGeneration) {
+        addThreadStats(&gRetiredStats, stats);
+    }/* end if */
+
+    free(stats);
+}/* end retireThreadStats */
+
+static void createStatsKey()
+{
+    pthread_key_create(&gStatsKey, retireThreadStats);
+}/* end createStatsKey */
+
+/* Returns the block of the calling thread; NULL if out of memory. */
+static ThreadStats* getThreadStats()
+{
+    ThreadStats*  stats;
+    uint32_t      generation;
+
+    pthread_once(&gStatsOnce, createStatsKey);
+
+    stats = (ThreadStats*)pthread_getspecific(gStatsKey);
+    if (stats == NULL) {
+        stats = (ThreadStats*)calloc(1, sizeof(ThreadStats));
+        if (stats) {
+            android::Mutex::Autolock ac(gMutexStats);
+
+            stats->generation = gStatsGeneration;
+            stats->next = gThreadStatsList;
+            gThreadStatsList = stats;
+            pthread_setspecific(gStatsKey, stats);
+        }/* end if */
+    } else if (stats->generation != (generation = acquireLoad(&gStatsGeneration))) {
+        /* reset since the thread last counted; readers skip the block meanwhile */
+        memset(stats->apis, 0, sizeof(stats->apis));
+        memset(stats->unhandled, 0, sizeof(stats->unhandled));
+        releaseStore(&stats->generation, generation);
+    }/* end else if */
+
+    return stats;
+}/* end getThreadStats */
+
+/* Returns the time a call to an engine starts at; 0 if it is not counted. */
+static inline nsecs_t startCall(int slot)
+{
+    return slot >= 0 ? systemTime() : 0;
+}/* end startCall */
+
+/* Returns the statistics slot of a loaded engine; -1 if it has none. */
+static int findStatsSlot(const FontEngine* inst)
+{
+    for (int slot = 0; slot < FEM_STATS_ENGINES; slot++) {
+        if (acquireLoad(&gStatsEngines[slot]) == inst) {
+            return slot;
+        }/* end if */
+    }/* end for */
+
+    return -1;
+}/* end findStatsSlot */
+
+/* Returns the slot to count the calls of an engine in; -1 if they are not
+   counted. */
+static int getStatsSlot(const FontEngine* inst)
+{
+    return acquireLoad(&gStatsEnabled) ? findStatsSlot(inst) : -1;
+}/* end getStatsSlot */
+
+/* Records a call to an engine which started at 'start'. */
+static void recordCall(int slot, fem::StatsApi api, nsecs_t start, uint32_t glyphs, bool failed, bool declined)
+{
+    nsecs_t       elapsed;
+    ThreadStats*  stats;
+    FontApiStats* apiStats;
+    uint32_t      micros;
+    int           bucket = 0;
+
+    if (slot < 0 || (stats = getThreadStats()) == NULL) {
+        return;
+    }/* end if */
+
+    elapsed = systemTime() - start;
+
+    apiStats = &stats->apis[slot][api];
+    apiStats->calls++;
+    apiStats->glyphs += glyphs;
+    apiStats->totalNanos += elapsed;
+
+    if (failed) {
+        apiStats->failures++;
+    }/* end if */
+
+    if (declined) {
+        apiStats->fallthroughs++;
+    }/* end if */
+
+    for (micros = (uint32_t)(elapsed / 1000); micros && bucket < FEM_STATS_LATENCY_BUCKETS - 1; micros >>= 1) {
+        bucket++;
+    }/* end for */
+
+    apiStats->latency[bucket]++;
+}/* end recordCall */
+
+static void recordUnhandled(fem::StatsApi api)
+{
+    ThreadStats* stats = acquireLoad(&gStatsEnabled) ? getThreadStats() : NULL;
+
+    if (stats) {
+        stats->unhandled[api]++;
+    }/* end if */
+}/* end recordUnhandled */
+
+/* Appends formatted text to a file descriptor. */
+static void writeStats(int fd, const char* format, ...)
+{
+    char     line[256];
+    va_list  args;
+    int      length;
+
+    va_start(args, format);
+    length = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+
+    if (length > (int)sizeof(line) - 1) {
+        length = sizeof(line) - 1;
+    }/* end if */
+
+    if (length > 0) {
+        write(fd, line, length);
+    }/* end if */
+}/* end writeStats */
+
+/*
+   Forwards every call to the font scaler created by an engine and counts
+   the glyph and font metrics calls against that engine. For engines which
+   do not batch glyphs natively, including every version 1 engine, the
+   batched calls are made one glyph at a time instead of being forwarded.
+   Engines older than FEM_ABI_OUTLINES get the outline buffer and sink
+   calls made through getGlyphOutline(), and engines older than
+   FEM_ABI_FUSED get getGlyphMetricsAndImage() made through the two calls
+   it fuses.
+*/
+class FontScalerProxy : public FontScaler
+{
+public:
+    FontScalerProxy(FontScaler* scaler, int statsSlot, uint32_t abiVersion, bool batchedGlyphs)
+        : inst(scaler), slot(statsSlot), outlines(abiVersion >= FEM_ABI_OUTLINES),
+          fused(abiVersion >= FEM_ABI_FUSED),
+          batched(batchedGlyphs && abiVersion >= FEM_ABI_BATCHED)
+    {
+    }
+
+    virtual ~FontScalerProxy()
+    {
+        delete inst;
+    }
+
+    virtual uint16_t getGlyphCount() const
+    {
+        return inst->getGlyphCount();
+    }
+
+    virtual uint16_t getCharToGlyphID(int32_t charUniCode)
+    {
+        return inst->getCharToGlyphID(charUniCode);
+    }
+
+    virtual int32_t getGlyphIDToChar(uint16_t glyphID)
+    {
+        return inst->getGlyphIDToChar(glyphID);
+    }
+
+    virtual GlyphMetrics getGlyphAdvance(uint16_t glyphID, FEM16Dot16 fracX, FEM16Dot16 fracY)
+    {
+        nsecs_t       start = startCall(slot);
+        GlyphMetrics  gm = inst->getGlyphAdvance(glyphID, fracX, fracY);
+
+        recordCall(slot, fem::API_GLYPH_ADVANCE, start, 1, false, false);
+        return gm;
+    }
+
+    virtual GlyphMetrics getGlyphMetrics(uint16_t glyphID, FEM16Dot16 fracX, FEM16Dot16 fracY)
+    {
+        nsecs_t       start = startCall(slot);
+        GlyphMetrics  gm = inst->getGlyphMetrics(glyphID, fracX, fracY);
+
+        recordCall(slot, fem::API_GLYPH_METRICS, start, 1, false, false);
+        return gm;
+    }
+
+    virtual void getGlyphImage(uint16_t glyphID, FEM16Dot16 fracX, FEM16Dot16 fracY, uint32_t rowBytes, uint16_t width, uint16_t height, uint8_t *buffer)
+    {
+        nsecs_t  start = startCall(slot);
+
+        inst->getGlyphImage(glyphID, fracX, fracY, rowBytes, width, height, buffer);
+        recordCall(slot, fem::API_GLYPH_IMAGE, start, 1, false, false);
+    }
+
+    virtual void getFontMetrics(FontMetrics* mX, FontMetrics* mY)
+    {
+        nsecs_t  start = startCall(slot);
+
+        inst->getFontMetrics(mX, mY);
+        recordCall(slot, fem::API_FONT_METRICS, start, 0, false, false);
+    }
+
+    virtual GlyphOutline* getGlyphOutline(uint16_t glyphID, FEM16Dot16 fracX, FEM16Dot16 fracY)
+    {
+        nsecs_t        start = startCall(slot);
+        GlyphOutline*  outline = inst->getGlyphOutline(glyphID, fracX, fracY);
+
+        recordCall(slot, fem::API_GLYPH_OUTLINE, start, 1, outline == NULL, false);
+        return outline;
+    }
+
+    virtual void getGlyphsAdvance(uint32_t count, const uint16_t glyphIDs[], const FEM16Dot16 fracX[], const FEM16Dot16 fracY[], GlyphMetrics metrics[])
+    {
+        nsecs_t  start = startCall(slot);
+
+        if (! batched) {
+            FontScaler::getGlyphsAdvance(count, glyphIDs, fracX, fracY, metrics);
+            return;
+        }/* end if */
+
+        inst->getGlyphsAdvance(count, glyphIDs, fracX, fracY, metrics);
+        recordCall(slot, fem::API_GLYPH_ADVANCE, start, count, false, false);
+    }
+
+    virtual void getGlyphsMetrics(uint32_t count, const uint16_t glyphIDs[], const FEM16Dot16 fracX[], const FEM16Dot16 fracY[], GlyphMetrics metrics[])
+    {
+        nsecs_t  start = startCall(slot);
+
+        if (! batched) {
+            FontScaler::getGlyphsMetrics(count, glyphIDs, fracX, fracY, metrics);
+            return;
+        }/* end if */
+
+        inst->getGlyphsMetrics(count, glyphIDs, fracX, fracY, metrics);
+        recordCall(slot, fem::API_GLYPH_METRICS, start, count, false, false);
+    }
+
+    virtual void getGlyphsImage(uint32_t count, const uint16_t glyphIDs[], const FEM16Dot16 fracX[], const FEM16Dot16 fracY[], const GlyphImageSlot slots[])
+    {
+        nsecs_t  start = startCall(slot);
+
+        if (! batched) {
+            FontScaler::getGlyphsImage(count, glyphIDs, fracX, fracY, slots);
+            return;
+        }/* end if */
+
+        inst->getGlyphsImage(count, glyphIDs, fracX, fracY, slots);
+        recordCall(slot, fem::API_GLYPH_IMAGE, start, count, false, false);
+    }
+
+    virtual void getGlyphsOutline(uint32_t count, const uint16_t glyphIDs[], const FEM16Dot16 fracX[], const FEM16Dot16 fracY[], GlyphOutline* outlines[])
+    {
+        nsecs_t   start = startCall(slot);
+        bool      failed = false;
+
+        if (! batched) {
+            FontScaler::getGlyphsOutline(count, glyphIDs, fracX, fracY, outlines);
+            return;
+        }/* end if */
+
+        inst->getGlyphsOutline(count, glyphIDs, fracX, fracY, outlines);
+
+        for (uint32_t i = 0; i < count && !failed; i++) {
+            failed = outlines[i] == NULL;
+        }/* end for */
+
+        recordCall(slot, fem::API_GLYPH_OUTLINE, start, count, failed, false);
+    }
+
+    virtual bool loadGlyphOutline(uint16_t glyphID, FEM16Dot16 fracX, FEM16Dot16 fracY, GlyphOutlineBuffer* outline)
+    {
+        nsecs_t  start = startCall(slot);
+        bool     retVal;
+
+        if (! outlines) {
+            return FontScaler::loadGlyphOutline(glyphID, fracX, fracY, outline);
+        }/* end if */
+
+        retVal = inst->loadGlyphOutline(glyphID, fracX, fracY, outline);
+        recordCall(slot, fem::API_GLYPH_OUTLINE, start, 1, !retVal, false);
+        return retVal;
+    }
+
+    virtual bool decomposeGlyphOutline(uint16_t glyphID, FEM16Dot16 fracX, FEM16Dot16 fracY, GlyphOutlineSink* sink)
+    {
+        nsecs_t  start = startCall(slot);
+        bool     retVal;
+
+        if (! outlines) {
+            return FontScaler::decomposeGlyphOutline(glyphID, fracX, fracY, sink);
+        }/* end if */
+
+        retVal = inst->decomposeGlyphOutline(glyphID, fracX, fracY, sink);
+        recordCall(slot, fem::API_GLYPH_OUTLINE, start, 1, !retVal, false);
+        return retVal;
+    }
+
+    virtual bool getGlyphMetricsAndImage(uint16_t glyphID, FEM16Dot16 fracX, FEM16Dot16 fracY, GlyphMetrics* metrics, GlyphImageBuffer* image)
+    {
+        nsecs_t  start = startCall(slot);
+        bool     retVal;
+
+        if (! fused) {
+            return FontScaler::getGlyphMetricsAndImage(glyphID, fracX, fracY, metrics, image);
+        }/* end if */
+
+        retVal = inst->getGlyphMetricsAndImage(glyphID, fracX, fracY, metrics, image);
+        recordCall(slot, fem::API_GLYPH_IMAGE, start, 1, false, false);
+        return retVal;
+    }
+
+private:
+    FontScaler*  inst;
+    int          slot;
+    bool         outlines;      /* forward loadGlyphOutline() and decomposeGlyphOutline() */
+    bool         fused;         /* forward getGlyphMetricsAndImage() */
+    bool         batched;       /* forward the batched calls */
+
+    FontScalerProxy(const FontScalerProxy&);
+    FontScalerProxy& operator = (const FontScalerProxy&);
+};/* end class FontScalerProxy */
+
+/*
+   Walks the font engines in dispatch order for a font: the engine which
+   handled the font before (if any) is asked first. Then, if the font format
+   is recognized, the engines declaring that format are asked in list order,
+   followed by the engines which declare no format at all; engines declaring
+   other formats are skipped. If the format is not recognized every other
+   engine is asked in list order. When an engine handles the request,
+   accept() records it in the font to engine table so that later requests
+   for the same font go straight to it.
+
+   With a single engine installed there is nothing to choose from; neither
+   the table nor the font data is looked at.
+
+   Every engine returned is timed until the next call to next() or to
+   accept() and counted against the given API. Engines which do not declare
+   fem::ENGINE_THREAD_SAFE are called with gMutexEngineCalls held over the
+   same span; the calls to the scalers they create are serialized by the
+   clients (see FontEngineManager::getFontEngineFeatures()).
+*/
+class FontEngineManager::DispatchCursor
+{
+public:
+    DispatchCursor(FontEngineManager& fem, const FontKey& fontKey, fem::StatsApi statsApi)
+        : manager(fem), key(fontKey), registry(fem.getRegistry()), index(0),
+           bound(NULL), current(NULL), boundAsked(false),
+           format(fem::FORMAT_UNKNOWN), formatKnown(false), pass(0),
+           api(statsApi), slot(-1), start(0), features(0), abiVersion(1), locked(false)
+    {
+        if (registry->count > 1) {
+            bound = manager.findFontEngine(key);
+        }/* end if */
+    }
+
+    ~DispatchCursor()
+    {
+        end();
+    }
+
+    /* Returns the next engine to ask; NULL once every engine was asked. */
+    FontEngine* next()
+    {
+        if (current) {
+            /* the engine last returned declined */
+            recordCall(slot, api, start, 0, false, true);
+            end();
+        }/* end if */
+
+        if (bound && !boundAsked) {
+            boundAsked = true;
+            return begin(bound);
+        }/* end if */
+
+        /* sniffed only once the remembered engine declined */
+        if (!formatKnown) {
+            if (registry->count > 1) {
+                format = key.sniffFormat();
+            }/* end if */
+            formatKnown = true;
+        }/* end if */
+
+        while (pass < 2) {
+            while (index < registry->count) {
+                FontEngine* inst = manager.selectFontEngine(registry->nodes[index], format, pass);
+                index++;
+
+                if (inst != NULL && inst != bound) {
+                    return begin(inst);
+                }/* end if */
+            }/* end while */
+
+            pass++;
+            index = 0;
+        }/* end while */
+
+        if (pass == 2) {
+            recordUnhandled(api);
+            pass++;
+        }/* end if */
+
+        current = NULL;
+        return current;
+    }/* end method next */
+
+    /* The engine last returned by next() handled the request. */
+    void accept()
+    {
+        recordCall(slot, api, start, 0, false, false);
+        end();
+
+        if (registry->count > 1 && current != bound) {
+            manager.bindFontEngine(key, current);
+        }/* end if */
+
+        current = NULL;
+    }/* end method accept */
+
+    /* Returns the statistics slot of the engine which handled the request. */
+    int getSlot() const
+    {
+        return slot;
+    }/* end method getSlot */
+
+    /* Returns the features of the engine which handled the request. */
+    uint32_t getFeatures() const
+    {
+        return features;
+    }/* end method getFeatures */
+
+    /* Returns the plugin interface version of the engine which handled the request. */
+    uint32_t getAbiVersion() const
+    {
+        return abiVersion;
+    }/* end method getAbiVersion */
+
+private:
+    FontEngineManager&  manager;
+    const FontKey&      key;
+    const FontEngineRegistry*  registry;    /* snapshot walked by this cursor */
+    size_t              index;
+    FontEngine*         bound;       /* engine remembered for the font */
+    FontEngine*         current;     /* engine last returned by next() */
+    bool                boundAsked;
+    fem::FontFormat     format;      /* format sniffed from the font data */
+    bool                formatKnown;
+    int                 pass;        /* see selectFontEngine() */
+    fem::StatsApi       api;
+    int                 slot;        /* statistics slot of 'current' */
+    nsecs_t             start;       /* time 'current' was returned */
+    uint32_t            features;    /* features of 'current' */
+    uint32_t            abiVersion;  /* plugin interface version of 'current' */
+    bool                locked;      /* gMutexEngineCalls is held for 'current' */
+
+    FontEngine* begin(FontEngine* inst)
+    {
+        current = inst;
+        slot = getStatsSlot(inst);
+        features = 0;
+        abiVersion = 1;
+
+        for (size_t i = 0; i < registry->count; i++) {
+            if (registry->nodes[i]->inst == inst) {
+                features = registry->nodes[i]->features;
+                abiVersion = registry->nodes[i]->abiVersion;
+                break;
+            }/* end if */
+        }/* end for */
+
+        if (!(features & fem::ENGINE_THREAD_SAFE)) {
+            lockEngineCalls();
+            locked = true;
+        }/* end if */
+
+        start = startCall(slot);
+        return current;
+    }/* end method begin */
+
+    /* The call into 'current' is over. */
+    void end()
+    {
+        if (locked) {
+            unlockEngineCalls();
+            locked = false;
+        }/* end if */
+    }/* end method end */
+};/* end class DispatchCursor */
+
+GlyphOutline::GlyphOutline(int16_t nOtlnPts, int16_t nContours)
+    : contourCount(nContours), pointCount(nOtlnPts),
+       x(NULL), y(NULL), contours(NULL), flags(NULL)
+{
+
+    x = (FEM26Dot6*)malloc(((pointCount + pointCount) * sizeof(FEM26Dot6)) + (nContours * sizeof(int16_t)) + (pointCount * sizeof(uint8_t)));
+    y = (FEM26Dot6*)&x[pointCount];
+    contours = (int16_t*)&y[pointCount];
+    flags = (uint8_t*)&contours[nContours];
+}
+
+GlyphOutline::GlyphOutline()
+    : contourCount(0), pointCount(0),
+       x(NULL), y(NULL), contours(NULL), flags(NULL)
+{
+}
+
+GlyphOutline::~GlyphOutline()
+{
+    free(x);
+}
+
+/* Returns the point halfway between two points. */
+static inline FEM26Dot6 midPoint(FEM26Dot6 a, FEM26Dot6 b)
+{
+    return (a + b) / 2;
+}/* end midPoint */
+
+/* Follows the decomposition of FreeType's FT_Outline_Decompose(). */
+bool GlyphOutline::decompose(GlyphOutlineSink* sink) const
+{
+    int first = 0;
+
+    for (int n = 0; n < contourCount; n++) {
+        int         last = contours[n];
+        int         p = first;
+        FEM26Dot6   startX, startY;
+
+        if (last < first || last >= pointCount) {
+            return false;
+        }/* end if */
+
+        if (flags[first] & 1) {
+            startX = x[first];
+            startY = y[first];
+        } else if (flags[first] & 2) {
+            /* a contour cannot start with a cubic control point */
+            return false;
+        } else if (flags[last] & 1) {
+            /* start at the last point if it is on the curve */
+            startX = x[last];
+            startY = y[last];
+            last--;
+            p--;
+        } else {
+            /* both ends are off: start halfway between them */
+            startX = midPoint(x[first], x[last]);
+            startY = midPoint(y[first], y[last]);
+            p--;
+        }/* end else if */
+
+        bool        closed = false;
+
+        sink->moveTo(startX, startY);
+
+        while (p < last) {
+            p++;
+
+            if (flags[p] & 1) {
+                sink->lineTo(x[p], y[p]);
+            } else if (!(flags[p] & 2)) {
+                FEM26Dot6 cx = x[p];
+                FEM26Dot6 cy = y[p];
+
+                closed = true;
+
+                while (p < last) {
+                    p++;
+
+                    if (flags[p] & 1) {
+                        sink->quadTo(cx, cy, x[p], y[p]);
+                        closed = false;
+                        break;
+                    }/* end if */
+
+                    if (flags[p] & 2) {
+                        return false;
+                    }/* end if */
+
+                    /* two off points imply an on point halfway */
+                    sink->quadTo(cx, cy, midPoint(cx, x[p]), midPoint(cy, y[p]));
+                    cx = x[p];
+                    cy = y[p];
+                }/* end while */
+
+                if (closed) {
+                    sink->quadTo(cx, cy, startX, startY);
+                }/* end if */
+            } else {
+                if (p + 1 > last || !(flags[p + 1] & 2) || (flags[p + 1] & 1)) {
+                    return false;
+                }/* end if */
+
+                p += 2;
+
+                if (p <= last) {
+                    sink->cubicTo(x[p - 2], y[p - 2], x[p - 1], y[p - 1], x[p], y[p]);
+                } else {
+                    sink->cubicTo(x[p - 2], y[p - 2], x[p - 1], y[p - 1], startX, startY);
+                    closed = true;
+                }/* end else if */
+            }/* end else if */
+        }/* end while */
+
+        if (! closed) {
+            /* close the contour with a line segment */
+            sink->lineTo(startX, startY);
+        }/* end if */
+
+        sink->close();
+        first = contours[n] + 1;
+    }/* end for */
+
+    return true;
+}/* end method decompose */
+
+GlyphOutlineBuffer::GlyphOutlineBuffer()
+    : GlyphOutline(), capacity(0)
+{
+}
+
+GlyphOutlineBuffer::~GlyphOutlineBuffer()
+{
+}
+
+bool GlyphOutlineBuffer::reserve(int16_t nOtlnPts, int16_t nContours)
+{
+    size_t size = ((nOtlnPts + nOtlnPts) * sizeof(FEM26Dot6)) + (nContours * sizeof(int16_t)) + (nOtlnPts * sizeof(uint8_t));
+
+    if (size > capacity) {
+        /* the contents need not survive, so no realloc */
+        free(x);
+
+        x = (FEM26Dot6*)malloc(size);
+        if (x == NULL) {
+            capacity = 0;
+            pointCount = 0;
+            contourCount = 0;
+            return false;
+        }/* end if */
+
+        capacity = size;
+    }/* end if */
+
+    pointCount = nOtlnPts;
+    contourCount = nContours;
+    y = (FEM26Dot6*)&x[pointCount];
+    contours = (int16_t*)&y[pointCount];
+    flags = (uint8_t*)&contours[contourCount];
+
+    return true;
+}/* end method reserve */
+
+/* Default batched glyph methods for font scalers which do not batch. */
+void FontScaler::getGlyphsAdvance(uint32_t count, const uint16_t glyphIDs[], const FEM16Dot16 fracX[], const FEM16Dot16 fracY[], GlyphMetrics metrics[])
+{
+    for (uint32_t i = 0; i < count; i++) {
+        metrics[i] = getGlyphAdvance(glyphIDs[i], fracX ? fracX[i] : 0, fracY ? fracY[i] : 0);
+    }/* end for */
+}/* end method getGlyphsAdvance */
+
+void FontScaler::getGlyphsMetrics(uint32_t count, const uint16_t glyphIDs[], const FEM16Dot16 fracX[], const FEM16Dot16 fracY[], GlyphMetrics metrics[])
+{
+    for (uint32_t i = 0; i < count; i++) {
+        metrics[i] = getGlyphMetrics(glyphIDs[i], fracX ? fracX[i] : 0, fracY ? fracY[i] : 0);
+    }/* end for */
+}/* end method getGlyphsMetrics */
+
+void FontScaler::getGlyphsImage(uint32_t count, const uint16_t glyphIDs[], const FEM16Dot16 fracX[], const FEM16Dot16 fracY[], const GlyphImageSlot slots[])
+{
+    for (uint32_t i = 0; i < count; i++) {
+        getGlyphImage(glyphIDs[i], fracX ? fracX[i] : 0, fracY ? fracY[i] : 0,
+                      slots[i].rowBytes, slots[i].width, slots[i].height, slots[i].buffer);
+    }/* end for */
+}/* end method getGlyphsImage */
+
+void FontScaler::getGlyphsOutline(uint32_t count, const uint16_t glyphIDs[], const FEM16Dot16 fracX[], const FEM16Dot16 fracY[], GlyphOutline* outlines[])
+{
+    for (uint32_t i = 0; i < count; i++) {
+        outlines[i] = getGlyphOutline(glyphIDs[i], fracX ? fracX[i] : 0, fracY ? fracY[i] : 0);
+    }/* end for */
+}/* end method getGlyphsOutline */
+
+bool FontScaler::loadGlyphOutline(uint16_t glyphID, FEM16Dot16 fracX, FEM16Dot16 fracY, GlyphOutlineBuffer* outline)
+{
+    GlyphOutline*  go = getGlyphOutline(glyphID, fracX, fracY);
+    bool           retVal = false;
+
+    if (go && outline->reserve(go->pointCount, go->contourCount)) {
+        memcpy(outline->x, go->x, go->pointCount * sizeof(FEM26Dot6));
+        memcpy(outline->y, go->y, go->pointCount * sizeof(FEM26Dot6));
+        memcpy(outline->contours, go->contours, go->contourCount * sizeof(int16_t));
+        memcpy(outline->flags, go->flags, go->pointCount * sizeof(uint8_t));
+        retVal = true;
+    }/* end if */
+
+    delete go;
+    return retVal;
+}/* end method loadGlyphOutline */
+
+bool FontScaler::decomposeGlyphOutline(uint16_t glyphID, FEM16Dot16 fracX, FEM16Dot16 fracY, GlyphOutlineSink* sink)
+{
+    GlyphOutline*  go = getGlyphOutline(glyphID, fracX, fracY);
+    bool           retVal = go ? go->decompose(sink) : false;
+
+    delete go;
+    return retVal;
+}/* end method decomposeGlyphOutline */
+
+bool FontScaler::getGlyphMetricsAndImage(uint16_t glyphID, FEM16Dot16 fracX, FEM16Dot16 fracY, GlyphMetrics* metrics, GlyphImageBuffer* image)
+{
+    *metrics = getGlyphMetrics(glyphID, fracX, fracY);
+
+    if (metrics->width == 0 || metrics->height == 0 || image->buffer == NULL) {
+        return false;
+    }/* end if */
+
+    uint32_t rowBytes = image->computeRowBytes(metrics->width);
+    uint32_t size = image->computeImageSize(metrics->width, metrics->height);
+    if (size > image->size) {
+        return false;
+    }/* end if */
+
+    /* the engine may not write every pixel; see fem::ENGINE_DIRECT_RENDER */
+    memset(image->buffer, 0, size);
+    getGlyphImage(glyphID, fracX, fracY, rowBytes, metrics->width, metrics->height, image->buffer);
+    image->rowBytes = rowBytes;
+
+    return true;
+}/* end method getGlyphMetricsAndImage */
+
+FontEngineManager::FontEngineManager()
+    : pRegistry(NULL), pFontEngineList(NULL), fontBindingCount(0)
+{
+    const char*          path = getenv(FONT_ENGINE_PATH_ENV);
+    const char*          stats = getenv(FONT_ENGINE_STATS_ENV);
+    FontEngineRegistry*  registry;
+    FontEngineNode*      node;
+    size_t               count = 0;
+
+    memset((void*)pFontBindings, 0, sizeof(pFontBindings));
+
+    if (path == NULL || path[0] == 0) {
+        path = ANDROID_FONT_ENGINE_PATH;
+    }/* end if */
+
+    if (stats && atoi(stats) != 0) {
+        releaseStore(&gStatsEnabled, (int32_t)1);
+    }/* end if */
+
+    discoverFontEngines(path);
+
+    for (node = this->pFontEngineList; node != NULL; node = node->next) {
+        count++;
+    }/* end for */
+
+    registry = allocRegistry(count);
+    assert(registry);
+
+    for (node = this->pFontEngineList; node != NULL; node = node->next) {
+        registry->nodes[registry->count++] = node;
+    }/* end for */
+
+    /* published along with the manager itself, see getInstance() */
+    pRegistry = registry;
+}/* end method constructor */
+
+/* Lists the font engine plugins of the directory without loading them. */
+void FontEngineManager::discoverFontEngines(const char dir[])
+{
+    struct dirent**  eps;
+    int              numEntries;
+
+    if (readManifest(dir)) {
+        return;
+    }/* end if */
+
+    numEntries = scandir(dir, &eps, dummyMethod, (direntAlphaSort)alphasort);
+    if (numEntries >= 0) {
+        char  filePath[MAX_PATH_LEN];
+        int   index;
+
+        /* engines are asked in reverse alphabetical order of their libraries */
+        for (index = numEntries - 1; index >= 0; index--) {
+            if (hasSharedLibSuffix(eps[index]->d_name)) {
+                int length = snprintf(filePath, sizeof(filePath), "%s%s%s", dir,
+                                      dir[strlen(dir) - 1] == '/' ? "" : "/", eps[index]->d_name);
+
+                if (length > 0 && length < MAX_PATH_LEN) {
+                    newFontEngineNode(filePath, NULL, fem::FORMAT_UNKNOWN, false);
+                }/* end if */
+            }/* end if */
+        }/* end for */
+
+        for (index = 0; index < numEntries; index++) {
+            free(eps[index]);
+        }/* end for */
+        free(eps);
+    }/* end if */
+}/* end method discoverFontEngines */
+
+/* Returns 'true' if the directory has a manifest; its plugins are listed. */
+bool FontEngineManager::readManifest(const char dir[])
+{
+    const char*  separator = dir[strlen(dir) - 1] == '/' ? "" : "/";
+    char         filePath[MAX_PATH_LEN];
+    char         line[MAX_PATH_LEN];
+    FILE*        fp;
+
+    snprintf(filePath, sizeof(filePath), "%s%s%s", dir, separator, FONT_ENGINE_MANIFEST);
+
+    fp = fopen(filePath, "r");
+    if (fp == NULL) {
+        return false;
+    }/* end if */
+
+    while (fgets(line, sizeof(line), fp)) {
+        char*  savePtr = NULL;
+        char*  lib = strtok_r(line, " \t\r\n", &savePtr);
+        char*  name;
+        char*  formats;
+        char*  features;
+        FontEngineNode* node;
+
+        if (lib == NULL || lib[0] == '#') {
+            continue;
+        }/* end if */
+
+        name = strtok_r(NULL, " \t\r\n", &savePtr);
+        formats = name ? strtok_r(NULL, " \t\r\n", &savePtr) : NULL;
+        features = formats ? strtok_r(NULL, " \t\r\n", &savePtr) : NULL;
+
+        if (lib[0] == '/') {
+            snprintf(filePath, sizeof(filePath), "%s", lib);
+        } else {
+            snprintf(filePath, sizeof(filePath), "%s%s%s", dir, separator, lib);
+        }/* end if */
+
+        FEM_LOG("manifest entry : %s, %s\n", filePath, name ? name : "");
+
+        if (formats && strcmp(formats, "-")) {
+            node = newFontEngineNode(filePath, name, parseFontFormats(formats), true);
+        } else {
+            node = newFontEngineNode(filePath, name, fem::FORMAT_UNKNOWN, false);
+        }/* end if */
+
+        if (node && features) {
+            node->manifestFeatures = parseFontEngineFeatures(features) & ~fem::ENGINE_THREAD_SAFE;
+        }/* end if */
+    }/* end while */
+
+    fclose(fp);
+    return true;
+}/* end method readManifest */
+
+/* Allocates an empty registry with room for 'capacity' nodes. */
+FontEngineManager::FontEngineRegistry* FontEngineManager::allocRegistry(size_t capacity)
+{
+    return (FontEngineRegistry*)calloc(1, sizeof(FontEngineRegistry) + (capacity ? capacity - 1 : 0) * sizeof(FontEngineNode*));
+}/* end method allocRegistry */
+
+/* Creates a node owned by the manager; it is not published by this call. */
+FontEngineManager::FontEngineNode* FontEngineManager::newFontEngineNode(const char libPath[], const char name[], uint32_t formats, bool hasFormats)
+{
+    FontEngineNode*  node = (FontEngineNode *)calloc(1, sizeof(FontEngineNode));
+    FontEngineNode** tail = &this->pFontEngineList;
+
+    if (node == NULL) {
+        FEM_LOG("calloc failed to allocate memory for FontEngineNode\n");
+        return NULL;
+    }/* end if */
+
+    node->state = NODE_UNLOADED;
+    node->pLibPath = strdup(libPath);
+    node->pName = name ? strdup(name) : NULL;
+    node->manifestFormats = formats;
+    node->hasManifestFormats = hasFormats;
+
+    while (*tail) {
+        tail = &(*tail)->next;
+    }/* end while */
+    *tail = node;
+
+    return node;
+}/* end method newFontEngineNode */
+
+/*
+   Publishes a copy of the current registry with 'added' appended and
+   'removed' left out; either may be NULL. Must be called with
+   gMutexFontEngines held.
+*/
+void FontEngineManager::publishRegistry(FontEngineNode* added, FontEngineNode* removed)
+{
+    FontEngineRegistry*  current = (FontEngineRegistry*)getRegistry();
+    FontEngineRegistry*  registry = allocRegistry(current->count + 1);
+
+    if (registry == NULL) {
+        FEM_LOG("malloc failed to allocate memory for FontEngineRegistry\n");
+        return;
+    }/* end if */
+
+    for (size_t i = 0; i < current->count; i++) {
+        if (current->nodes[i] != removed) {
+            registry->nodes[registry->count++] = current->nodes[i];
+        }/* end if */
+    }/* end for */
+
+    if (added) {
+        registry->nodes[registry->count++] = added;
+    }/* end if */
+
+    registry->retired = current;
+    releaseStore(&pRegistry, registry);
+}/* end method publishRegistry */
+
+/* Returns the published registry; never NULL. Needs no lock. */
+const FontEngineManager::FontEngineRegistry* FontEngineManager::getRegistry() const
+{
+    return acquireLoad(&pRegistry);
+}/* end method getRegistry */
+
+size_t FontEngineManager::getFontEngineCount() const
+{
+    return getRegistry()->count;
+}/* end method getFontEngineCount */
+
+uint32_t FontEngineManager::getFontEngineFeatures() const
+{
+    const FontEngineRegistry*  registry = getRegistry();
+    uint32_t                   features = registry->count ? ~0u : 0;
+
+    for (size_t i = 0; i < registry->count; i++) {
+        FontEngineNode* node = registry->nodes[i];
+        int32_t         state = acquireLoad(&node->state);
+
+        /* an engine not loaded yet stands for what the manifest declares,
+           which never includes fem::ENGINE_THREAD_SAFE */
+        if (state == NODE_LOADED) {
+            features &= node->features;
+        } else if (state == NODE_UNLOADED) {
+            features &= node->manifestFeatures;
+        } else {
+            features &= ~fem::ENGINE_THREAD_SAFE;
+        }/* end if */
+    }/* end for */
 
-/* #define FEM_ENABLE_LOG */
+    return features;
+}/* end method getFontEngineFeatures */
 
-#ifdef FEM_ENABLE_LOG
-/* fprintf, FILE */
-#include <stdio.h>
+/*
+   Opens the plugin library and creates its engine on first call; returns
+   the engine or NULL if the plugin could not be loaded. A plugin failing to
+   load is dropped from the registry. Loaded engines are returned without
+   taking any lock.
+*/
+FontEngine* FontEngineManager::loadFontEngine(FontEngineNode* node)
+{
+    int32_t state = acquireLoad(&node->state);
 
-static FILE * fplog = NULL;
+    if (state != NODE_UNLOADED) {
+        return state == NODE_LOADED ? node->inst : NULL;
+    }/* end if */
 
-#define FEM_STARTLOG fplog = fopen("/data/femlog.txt", "a");
-#define FEM_LOG(...) \
-        FEM_STARTLOG \
-        fprintf(fplog, __FUNCTION__); \
-        fprintf(fplog, ", "); \
-        fprintf(fplog, __VA_ARGS__); \
-        FEM_ENDLOG
-#define FEM_ENDLOG fclose(fplog);
-#else
-#define FEM_STARTLOG
-#define FEM_LOG(...)
-#define FEM_ENDLOG
-#endif /* FEM_ENABLE_LOG */
+    android::Mutex::Autolock ac(gMutexFontEngines);
 
-#ifdef FEM_UNUSED
-#undef FEM_UNUSED
-#endif
-#define FEM_UNUSED(x) ((void)(x))
+    if (node->state == NODE_UNLOADED) {
+        getFontEngineInstanceType    getFontEngineInstancePtr = NULL;
+        getFontEngineInstanceV2Type  getFontEngineInstanceV2Ptr = NULL;
+        FontEngine*                  inst = NULL;
 
-#define MAX_PATH_LEN 1024
+        FEM_LOG("filePath : %s\n", node->pLibPath);
 
-/* Font engine libraries are decidedly in the system partition. */
-#define ANDROID_FONT_ENGINE_PATH "/system/lib/fontengines/"
+        node->handle = node->pLibPath ? dlopen(node->pLibPath, RTLD_LAZY) : NULL;
+        if (node->handle) {
+            getFontEngineInstanceV2Ptr = (getFontEngineInstanceV2Type)dlsym(node->handle, GET_FONT_ENGINE_INSTANCE_V2);
+            getFontEngineInstancePtr = (getFontEngineInstanceType)dlsym(node->handle, GET_FONT_ENGINE_INSTANCE);
+        }/* end if */
 
-/* Entry point to font engine plugin */
-#define GET_FONT_ENGINE_INSTANCE "getFontEngineInstance"
+        /* newest version first; an older plugin refuses every later one */
+        for (uint32_t version = FEM_ABI_VERSION; getFontEngineInstanceV2Ptr && inst == NULL && version >= 2; version--) {
+            inst = getFontEngineInstanceV2Ptr(version);
+            node->abiVersion = version;
+        }/* end for */
 
-FontEngineManager* FontEngineManager::pFEMInst = NULL;
-typedef int (*direntAlphaSort)(const dirent**, const dirent**);
+        if (inst == NULL && getFontEngineInstancePtr) {
+            inst = getFontEngineInstancePtr();
+            node->abiVersion = 1;
+        }/* end if */
 
-static int dummyMethod(const struct dirent *unused)
+        /* a version 1 engine knows neither formats nor features */
+        if (inst && node->abiVersion >= FEM_ABI_FORMATS) {
+            node->engineFormats = inst->getSupportedFormats();
+            node->features = inst->getFeatures();
+        } else {
+            node->engineFormats = fem::FORMAT_UNKNOWN;
+            node->features = 0;
+        }/* end if */
+
+        if (node->manifestFeatures & ~node->features) {
+            FEM_LOG("engine of %s lacks features %x the manifest declares\n", node->pLibPath, node->manifestFeatures & ~node->features);
+            node->manifestFeatures &= node->features;
+        }/* end if */
+
+        if (inst) {
+            node->inst = inst;
+
+            for (int slot = 0; slot < FEM_STATS_ENGINES; slot++) {
+                if (gStatsEngines[slot] == NULL) {
+                    releaseStore(&gStatsEngines[slot], inst);
+                    break;
+                }/* end if */
+            }/* end for */
+
+            releaseStore(&node->state, (int32_t)NODE_LOADED);
+            FEM_LOG("successfully loaded %s font engine\n", node->pLibPath);
+        } else {
+            FEM_LOG("failed to load %s font engine\n", node->pLibPath);
+
+            if (node->handle) {
+                dlclose(node->handle);
+                node->handle = NULL;
+            }/* end if */
+
+            releaseStore(&node->state, (int32_t)NODE_FAILED);
+            publishRegistry(NULL, node);
+        }/* end if */
+    }/* end if */
+
+    return node->state == NODE_LOADED ? node->inst : NULL;
+}/* end method loadFontEngine */
+
+/*
+   Returns the engine of the node if it may handle a font of the given
+   format in the given dispatch pass, loading the plugin when needed; NULL
+   otherwise. Pass 0 selects the engines declaring the font format, pass 1
+   the engines declaring no format. An unrecognized font is a single pass
+   over every engine. A plugin whose formats are not in the manifest has to
+   be loaded to tell.
+*/
+FontEngine* FontEngineManager::selectFontEngine(FontEngineNode* node, fem::FontFormat format, int pass)
 {
-	return 1;
-}/* end dummyMethod */
+    int32_t   state = acquireLoad(&node->state);
+    uint32_t  formats;
 
-GlyphOutline::GlyphOutline(int16_t nOtlnPts, int16_t nContours)
-    : contourCount(nContours), pointCount(nOtlnPts),
-       x(NULL), y(NULL), contours(NULL), flags(NULL)
+    if (state == NODE_FAILED) {
+        return NULL;
+    }/* end if */
+
+    if (format == fem::FORMAT_UNKNOWN) {
+        return pass == 0 ? loadFontEngine(node) : NULL;
+    }/* end if */
+
+    if (state == NODE_LOADED) {
+        formats = node->engineFormats;
+    } else if (node->hasManifestFormats) {
+        formats = node->manifestFormats;
+    } else if (loadFontEngine(node)) {
+        formats = node->engineFormats;
+    } else {
+        return NULL;
+    }/* end if */
+
+    if (pass == 0 ? (formats & format) != 0 : formats == fem::FORMAT_UNKNOWN) {
+        return loadFontEngine(node);
+    }/* end if */
+
+    return NULL;
+}/* end method selectFontEngine */
+
+/* Loads every font engine not loaded yet. */
+void FontEngineManager::warmFontEngines(bool background)
 {
+    const FontEngineRegistry* registry;
 
-    x = (FEM26Dot6*)malloc(((pointCount + pointCount) * sizeof(FEM26Dot6)) + (nContours * sizeof(int16_t)) + (pointCount * sizeof(uint8_t)));
-    y = (FEM26Dot6*)&x[pointCount];
-    contours = (int16_t*)&y[pointCount];
-    flags = (uint8_t*)&contours[nContours];
-}
+    if (background) {
+        if (android::createThread(warmThread, this)) {
+            return;
+        }/* end if */
 
-GlyphOutline::~GlyphOutline()
+        FEM_LOG("failed to create font engine warm up thread\n");
+    }/* end if */
+
+    registry = getRegistry();
+    for (size_t i = 0; i < registry->count; i++) {
+        loadFontEngine(registry->nodes[i]);
+    }/* end for */
+}/* end method warmFontEngines */
+
+int FontEngineManager::warmThread(void* arg)
 {
-    free(x);
-}
+    ((FontEngineManager*)arg)->warmFontEngines(false);
+    return 0;
+}/* end method warmThread */
 
-FontEngineManager::FontEngineManager()
-    : engineCount(0), pFontEngineList(NULL), pFontEngineInfoArr(NULL)
+bool FontEngineManager::addFontEngine(const char libPath[])
 {
-    const char*      path = ANDROID_FONT_ENGINE_PATH;
-    struct dirent**  eps;
-    int              numEntries;
+    FontEngineNode*  node;
 
-    numEntries = scandir(path, &eps, dummyMethod, (direntAlphaSort)alphasort);
-    if (numEntries >= 0) {
-        char  filePath[MAX_PATH_LEN];
-        int   length, index;
+    {
+        android::Mutex::Autolock ac(gMutexFontEngines);
+        const FontEngineRegistry* registry = getRegistry();
+
+        for (size_t i = 0; i < registry->count; i++) {
+            if (registry->nodes[i]->pLibPath && ! strcmp(registry->nodes[i]->pLibPath, libPath)) {
+                return false;
+            }/* end if */
+        }/* end for */
+
+        node = newFontEngineNode(libPath, NULL, fem::FORMAT_UNKNOWN, false);
+        if (node == NULL) {
+            return false;
+        }/* end if */
 
-        memset(filePath, 0, sizeof(filePath));
+        publishRegistry(node, NULL);
+    }
+
+    /* a plugin failing to load is dropped from the registry again */
+    return loadFontEngine(node) != NULL;
+}/* end method addFontEngine */
+
+FontEngineInfoArrCPtr FontEngineManager::listFontEngines()
+{
+    FontEngineRegistry* registry;
 
-        length = 0;
-        while (path[length]) {
-            filePath[length] = path[length];
-            length++;
-        }
+    warmFontEngines(false);
 
-        assert(length < MAX_PATH_LEN);
+    android::Mutex::Autolock ac(gMutexFontEngines);
 
-        pFontEngineInfoArr = (FontEngineInfoArrPtr)calloc(sizeof(FontEngineInfoPtr), numEntries + 1);
-        assert(pFontEngineInfoArr);
+    /* kept with its registry; callers may hold on to it */
+    registry = (FontEngineRegistry*)getRegistry();
+    if (registry->pInfoArr == NULL) {
+        size_t  count = 0;
 
-        for (index = 0; index < numEntries; index ++) {
-            int i = length;
-            int j = 0;
+        registry->pInfoArr = (FontEngineInfoArrPtr)calloc(sizeof(FontEngineInfoPtr), registry->count + 1);
+        assert(registry->pInfoArr);
 
-            while (eps[index]->d_name[j]) {
-                filePath[i] = eps[index]->d_name[j];
-                i++;
-                j++;
-            }
+        for (size_t i = 0; i < registry->count; i++) {
+            if (registry->nodes[i]->state == NODE_LOADED) {
+                registry->pInfoArr[count] = (FontEngineInfoPtr)malloc(sizeof(FontEngineInfo));
+                assert(registry->pInfoArr[count]);
+                registry->pInfoArr[count]->name = strdup(registry->nodes[i]->inst->getName());
+                count++;
+            }/* end if */
+        }/* end for */
+    }/* end if */
 
-            assert(i < MAX_PATH_LEN);
+    return (FontEngineInfoArrCPtr)registry->pInfoArr;
+}/* end method listFontEngines */
 
-            memset(&filePath[i], 0, MAX_PATH_LEN - i);
+void FontEngineManager::trimMemory(fem::TrimLevel level)
+{
+    const FontEngineRegistry* registry = getRegistry();
 
-            i = i - 3;
-            if ( filePath[i] == '.' && filePath[i + 1] == 's' && filePath[i + 2] == 'o' ) {
-                void*                      handle = NULL;
-                const char*                entryMethodName = GET_FONT_ENGINE_INSTANCE;
-                getFontEngineInstanceType  getFontEngineInstancePtr = NULL;
-                FontEngine*                inst = NULL;
+    for (size_t i = 0; i < registry->count; i++) {
+        FontEngineNode* node = registry->nodes[i];
 
-                FEM_LOG("filePath : %s, engineCount : %d\n", filePath, engineCount);
+        /* engines not loaded hold no memory */
+        if (acquireLoad(&node->state) == NODE_LOADED && node->abiVersion >= FEM_ABI_TRIM) {
+            /* serialized with the other calls, as by DispatchCursor */
+            bool locked = !(node->features & fem::ENGINE_THREAD_SAFE);
 
-                handle = dlopen(filePath, RTLD_LAZY);
-                getFontEngineInstancePtr = (getFontEngineInstanceType)dlsym(handle, entryMethodName);
-                inst = getFontEngineInstancePtr();
-                if (inst) {
-                    FontEngineNode*  node = (FontEngineNode *)malloc(sizeof(FontEngineNode));
-                    node->next = this->pFontEngineList;
-                    node->inst = inst;
-                    this->pFontEngineList = node;
+            if (locked) {
+                lockEngineCalls();
+            }/* end if */
 
-                    pFontEngineInfoArr[engineCount] = (FontEngineInfoPtr)malloc(sizeof(FontEngineInfo));
-                    assert(pFontEngineInfoArr[engineCount]);
-                    pFontEngineInfoArr[engineCount]->name = strdup(inst->getName());
+            node->inst->trimMemory(level);
 
-                    engineCount++;
-                    FEM_LOG("successfully loaded %s font engine, engineCount : %d\n", filePath, engineCount);
-                }/* end if */
+            if (locked) {
+                unlockEngineCalls();
             }/* end if */
+        }/* end if */
+    }/* end for */
+}/* end method trimMemory */
+
+/* Merges the counts of every thread into 'total'. */
+static void collectStats(ThreadStats* total)
+{
+    android::Mutex::Autolock ac(gMutexStats);
+
+    *total = gRetiredStats;
+
+    for (ThreadStats* stats = gThreadStatsList; stats != NULL; stats = stats->next) {
+        if (acquireLoad(&stats->generation) == gStatsGeneration) {
+            addThreadStats(total, stats);
+        }/* end if */
+    }/* end for */
+}/* end collectStats */
+
+size_t FontEngineManager::getFontEngineStats(FontEngineStats stats[], size_t maxCount)
+{
+    ThreadStats*  total = (ThreadStats*)malloc(sizeof(ThreadStats));
+    size_t        count = 0;
+
+    if (total == NULL) {
+        return 0;
+    }/* end if */
+
+    collectStats(total);
+
+    for (int slot = 0; slot < FEM_STATS_ENGINES && count < maxCount; slot++) {
+        FontEngine* inst = acquireLoad(&gStatsEngines[slot]);
+
+        if (inst) {
+            stats[count].name = inst->getName();
+            memcpy(stats[count].apis, total->apis[slot], sizeof(stats[count].apis));
+            count++;
+        }/* end if */
+    }/* end for */
+
+    free(total);
+    return count;
+}/* end method getFontEngineStats */
+
+uint32_t FontEngineManager::getUnhandledCount(fem::StatsApi api)
+{
+    android::Mutex::Autolock ac(gMutexStats);
+    uint32_t                 count = gRetiredStats.unhandled[api];
+
+    for (ThreadStats* stats = gThreadStatsList; stats != NULL; stats = stats->next) {
+        if (acquireLoad(&stats->generation) == gStatsGeneration) {
+            count += stats->unhandled[api];
+        }/* end if */
+    }/* end for */
+
+    return count;
+}/* end method getUnhandledCount */
+
+void FontEngineManager::setStatsEnabled(bool enabled)
+{
+    releaseStore(&gStatsEnabled, (int32_t)enabled);
+}/* end method setStatsEnabled */
+
+void FontEngineManager::resetStats()
+{
+    android::Mutex::Autolock ac(gMutexStats);
+
+    /* the blocks of running threads are cleared by their own threads */
+    memset(&gRetiredStats, 0, sizeof(gRetiredStats));
+    releaseStore(&gStatsGeneration, gStatsGeneration + 1);
+}/* end method resetStats */
+
+/* Writes a string as a JSON string, escaped. */
+static void writeStatsString(int fd, const char* s)
+{
+    char  line[128];
+    int   length = 0;
+
+    line[length++] = '"';
+
+    for (; *s != 0; s++) {
+        unsigned char c = (unsigned char)*s;
+
+        if (length > (int)sizeof(line) - 8) {
+            write(fd, line, length);
+            length = 0;
+        }/* end if */
+
+        if (c == '"' || c == '\\') {
+            line[length++] = '\\';
+            line[length++] = c;
+        } else if (c < 0x20) {
+            length += snprintf(&line[length], 7, "\\u%04x", c);
+        } else {
+            line[length++] = c;
+        }/* end else if */
+    }/* end for */
+
+    line[length++] = '"';
+    write(fd, line, length);
+}/* end writeStatsString */
+
+void FontEngineManager::dumpStats(int fd, fem::StatsFormat format)
+{
+    const FontEngineRegistry*  registry = getRegistry();
+    ThreadStats*  total = (ThreadStats*)malloc(sizeof(ThreadStats));
+    bool          json = format == fem::STATS_JSON;
+    bool          first = true;
+
+    if (total == NULL) {
+        return;
+    }/* end if */
+
+    collectStats(total);
+
+    writeStats(fd, json ? "{\"engines\":[" : "Font engine statistics (latency buckets in microseconds: <1, <2, <4, ...)\n");
+
+    for (int slot = 0; slot < FEM_STATS_ENGINES; slot++) {
+        FontEngine* inst = acquireLoad(&gStatsEngines[slot]);
+
+        if (inst == NULL) {
+            continue;
+        }/* end if */
+
+        if (json) {
+            writeStats(fd, "%s{\"name\":", first ? "" : ",");
+            writeStatsString(fd, inst->getName());
+            writeStats(fd, ",\"apis\":{");
+        } else {
+            writeStats(fd, "engine %s\n", inst->getName());
+        }/* end else if */
+        first = false;
+
+        for (int api = 0; api < fem::API_COUNT; api++) {
+            const FontApiStats* apiStats = &total->apis[slot][api];
+
+            if (json) {
+                writeStats(fd, "%s\"%s\":{\"calls\":%u,\"glyphs\":%u,\"failures\":%u,\"fallthroughs\":%u,\"total_ns\":%llu,\"latency_us\":[",
+                           api ? "," : "", gStatsApiNames[api], apiStats->calls, apiStats->glyphs,
+                           apiStats->failures, apiStats->fallthroughs, (unsigned long long)apiStats->totalNanos);
+            } else {
+                if (apiStats->calls == 0) {
+                    continue;
+                }/* end if */
+
+                writeStats(fd, "  %-14s calls %u glyphs %u failures %u fallthroughs %u total %llu us\n    latency",
+                           gStatsApiNames[api], apiStats->calls, apiStats->glyphs,
+                           apiStats->failures, apiStats->fallthroughs, (unsigned long long)(apiStats->totalNanos / 1000));
+            }/* end else if */
+
+            for (int bucket = 0; bucket < FEM_STATS_LATENCY_BUCKETS; bucket++) {
+                writeStats(fd, json ? "%s%u" : "%s %u", json && bucket ? "," : "", apiStats->latency[bucket]);
+            }/* end for */
+
+            writeStats(fd, json ? "]}" : "\n");
         }/* end for */
+
+        if (json) {
+            writeStats(fd, "}}");
+        }/* end if */
+    }/* end for */
+
+    writeStats(fd, json ? "],\"untracked\":[" : "");
+    first = true;
+
+    /* engines loaded once every slot was taken */
+    for (size_t i = 0; i < registry->count; i++) {
+        FontEngineNode* node = registry->nodes[i];
+
+        if (acquireLoad(&node->state) != NODE_LOADED || findStatsSlot(node->inst) >= 0) {
+            continue;
+        }/* end if */
+
+        if (json) {
+            writeStats(fd, first ? "" : ",");
+            writeStatsString(fd, node->inst->getName());
+        } else {
+            writeStats(fd, "engine %s not counted\n", node->inst->getName());
+        }/* end else if */
+        first = false;
+    }/* end for */
+
+    writeStats(fd, json ? "],\"enabled\":%s,\"unhandled\":{" : "%sunhandled requests\n",
+               json ? (acquireLoad(&gStatsEnabled) ? "true" : "false") : (acquireLoad(&gStatsEnabled) ? "" : "statistics off\n"));
+
+    for (int api = 0; api < fem::API_COUNT; api++) {
+        writeStats(fd, json ? "%s\"%s\":%u" : "%s  %-14s %u\n", json && api ? "," : "", gStatsApiNames[api], total->unhandled[api]);
+    }/* end for */
+
+    if (json) {
+        writeStats(fd, "}}\n");
     }/* end if */
-}/* end method constructor */
+
+    free(total);
+}/* end method dumpStats */
 
 FontEngineManager::~FontEngineManager()
 {
-    register FontEngineInfoArrPtr  pTempFontEngineInfoArr = this->pFontEngineInfoArr;
-    register FontEngineInfoPtr     pFontEngineInfo = *pTempFontEngineInfoArr;
+    register FontEngineRegistry*   registry = (FontEngineRegistry*)this->pRegistry;
 
     register FontEngineNode*       node = this->pFontEngineList;
     register FontEngineNode*       tempNode = NULL;
 
-    while (pFontEngineInfo) {
-        free((void*)pFontEngineInfo->name);
-        free(pFontEngineInfo);
+    while (registry) {
+        FontEngineRegistry*   tempRegistry = registry;
+        FontEngineInfoArrPtr  pTempFontEngineInfoArr = registry->pInfoArr;
 
-        pTempFontEngineInfoArr++;
-        pFontEngineInfo = *pTempFontEngineInfoArr;
-    }/* end while */
+        while (pTempFontEngineInfoArr && *pTempFontEngineInfoArr) {
+            free((void*)(*pTempFontEngineInfoArr)->name);
+            free(*pTempFontEngineInfoArr);
+            pTempFontEngineInfoArr++;
+        }/* end while */
 
-    free(pFontEngineInfoArr);
+        free(registry->pInfoArr);
+
+        registry = registry->retired;
+        free(tempRegistry);
+    }/* end while */
 
     while (node) {
         tempNode = node;
         node = node->next;
+        free(tempNode->pLibPath);
+        free(tempNode->pName);
         free(tempNode);
     }/* end while */
+
+    for (int bucket = 0; bucket < FONT_BINDING_BUCKETS; bucket++) {
+        FontBinding* binding = pFontBindings[bucket];
+
+        while (binding) {
+            FontBinding* tempBinding = binding;
+            binding = binding->next;
+
+            free(tempBinding->pPath);
+            free(tempBinding);
+        }/* end while */
+    }/* end for */
 }/* end method destructor */
 
-/* Returns a singleton instance to a font engine manager. */
+void FontEngineManager::createInstance()
+{
+    FEM_LOG("creating instance\n");
+    releaseStore(&pFEMInst, new FontEngineManager());
+}/* end method createInstance */
+
+/*
+   Returns a singleton instance to a font engine manager. The instance is
+   created exactly once, however many threads ask for it first.
+*/
 FontEngineManager& FontEngineManager::getInstance()
 {
-    if (!pFEMInst)
-    {
-      FEM_LOG("creating instance\n");
-      pFEMInst = new FontEngineManager();
-    }
+    FontEngineManager* inst = acquireLoad(&pFEMInst);
+
+    if (inst == NULL) {
+        pthread_once(&gFEMOnce, createInstance);
+        inst = acquireLoad(&pFEMInst);
+    }/* end if */
 
-    return *pFEMInst;
+    return *inst;
 }/* end method getInstance */
 
+/* Returns the engine remembered for the given font; NULL otherwise. Needs no lock. */
+FontEngine* FontEngineManager::findFontEngine(const FontKey& key)
+{
+    FontBinding* binding = NULL;
+
+    if (key.fontID) {
+        binding = findBinding(hashFontID(key.fontID), key.fontID, NULL, 0, NULL);
+    }/* end if */
+
+    if (!binding && key.pBuffer) {
+        binding = findBinding(hashBuffer(key.pBuffer, key.bufferLength), 0, key.pBuffer, key.bufferLength, NULL);
+    }/* end if */
+
+    if (!binding && key.pPath) {
+        binding = findBinding(hashPath(key.pPath), 0, NULL, 0, key.pPath);
+    }/* end if */
+
+    return binding ? acquireLoad(&binding->inst) : NULL;
+}/* end method findFontEngine */
+
+/* Remembers 'inst' as the engine handling every known identity of the font. */
+void FontEngineManager::bindFontEngine(const FontKey& key, FontEngine* inst)
+{
+    android::Mutex::Autolock ac(gMutexFontBindings);
+
+    if (key.fontID) {
+        addBinding(hashFontID(key.fontID), key.fontID, NULL, 0, NULL, inst);
+    }/* end if */
+
+    if (key.pBuffer) {
+        addBinding(hashBuffer(key.pBuffer, key.bufferLength), 0, key.pBuffer, key.bufferLength, NULL, inst);
+    }/* end if */
+
+    if (key.pPath) {
+        addBinding(hashPath(key.pPath), 0, NULL, 0, key.pPath, inst);
+    }/* end if */
+}/* end method bindFontEngine */
+
+/*
+   Bindings are only ever prepended to their bucket, fully initialized, so
+   the chains can be walked without a lock.
+*/
+FontEngineManager::FontBinding* FontEngineManager::findBinding(uint32_t hash, uint32_t fontID, const void* buffer, uint32_t bufferLength, const char path[])
+{
+    register FontBinding*  binding = acquireLoad(&pFontBindings[hash & (FONT_BINDING_BUCKETS - 1)]);
+
+    while (binding != NULL) {
+        if (binding->hash == hash &&
+            binding->fontID == fontID &&
+            binding->pBuffer == buffer &&
+            binding->bufferLength == bufferLength &&
+            ((path == NULL && binding->pPath == NULL) ||
+             (path != NULL && binding->pPath != NULL && ! strcmp(path, binding->pPath)))) {
+            return binding;
+        }/* end if */
+
+        binding = binding->next;
+    }/* end while */
+
+    return NULL;
+}/* end method findBinding */
+
+/* Must be called with gMutexFontBindings held. */
+void FontEngineManager::addBinding(uint32_t hash, uint32_t fontID, const void* buffer, uint32_t bufferLength, const char path[], FontEngine* inst)
+{
+    FontBinding* binding = findBinding(hash, fontID, buffer, bufferLength, path);
+
+    if (binding) {
+        /* the font moved to another engine */
+        releaseStore(&binding->inst, inst);
+        return;
+    }/* end if */
+
+    if (fontBindingCount >= FONT_BINDING_MAX) {
+        FEM_LOG("font to engine table is full\n");
+        return;
+    }/* end if */
+
+    binding = (FontBinding*)malloc(sizeof(FontBinding));
+    if (binding == NULL) {
+        FEM_LOG("malloc failed to allocate memory for FontBinding\n");
+        return;
+    }/* end if */
+
+    binding->hash = hash;
+    binding->fontID = fontID;
+    binding->pBuffer = buffer;
+    binding->bufferLength = bufferLength;
+    binding->pPath = path ? strdup(path) : NULL;
+    binding->inst = inst;
+
+    if (path && binding->pPath == NULL) {
+        free(binding);
+        return;
+    }/* end if */
+
+    binding->next = pFontBindings[hash & (FONT_BINDING_BUCKETS - 1)];
+    releaseStore(&pFontBindings[hash & (FONT_BINDING_BUCKETS - 1)], binding);
+    fontBindingCount++;
+}/* end method addBinding */
+
 /*
-   FontEngine list is traversed and a request for font scaler is performed
-   against a font engine. The API returns immediately if the font scaler
-   is successfully created; a request for font scaler creation is made
-   to the next font engine in the list otherwise.
+   A request for font scaler is first made to the font engine which handled
+   the font before; the rest of the FontEngine list is traversed otherwise.
+   The API returns immediately if the font scaler is successfully created;
+   a request for font scaler creation is made to the next font engine in
+   the list otherwise.
 */
 FontScaler* FontEngineManager::createFontScalerContext(const FontScalerInfo& desc)
 {
-    register FontEngineNode*  node = this->pFontEngineList;
-    FontScaler*  pFontScalerContext = NULL;
+    return createFontScalerContext(desc, NULL);
+}/* end method createFontScalerContext */
+
+FontScaler* FontEngineManager::createFontScalerContext(const FontScalerInfo& desc, uint32_t* features)
+{
+    FontKey         key(desc);
+    DispatchCursor  cursor(*this, key, fem::API_CREATE_SCALER);
+    FontEngine*     inst;
+    FontScaler*     pFontScalerContext = NULL;
 
     FEM_LOG("creating font scaler\n");
 
-    while (node != NULL) {
-        pFontScalerContext = node->inst->createFontScalerContext(desc);
+    while ((inst = cursor.next()) != NULL) {
+        pFontScalerContext = inst->createFontScalerContext(desc);
         if (pFontScalerContext) {
             FEM_LOG("successfully created font scaler\n");
+            cursor.accept();
+
+            if (features) {
+                *features = cursor.getFeatures();
+            }/* end if */
+
+            /* old engines must not be asked for the calls they lack */
+            if (cursor.getSlot() >= 0 || cursor.getAbiVersion() < FEM_ABI_FUSED) {
+                pFontScalerContext = new FontScalerProxy(pFontScalerContext, cursor.getSlot(), cursor.getAbiVersion(),
+                                                         (cursor.getFeatures() & fem::ENGINE_BATCHED_GLYPHS) != 0);
+            }/* end if */
+
             return pFontScalerContext;
         }/* end if */
-        node = node->next;
     }/* end while */
 
     return NULL;
@@ -226,32 +1979,38 @@ FontScaler* FontEngineManager::createFontScalerContext(const FontScalerInfo& des
 
 FontEngine* FontEngineManager::getFontEngine(const char name[])
 {
-    register FontEngineNode*  node = this->pFontEngineList;
+    const FontEngineRegistry*  registry = getRegistry();
 
-    while (node != NULL) {
-        if ( ! strcmp(name, node->inst->getName()) ) {
-            return node->inst;
-        }/* end if */
+    for (size_t i = 0; i < registry->count; i++) {
+        FontEngineNode* node = registry->nodes[i];
 
-        node = node->next;
-    }/* end while */
+        /* the manifest names engines before they are loaded */
+        if (node->pName == NULL || ! strcmp(name, node->pName)) {
+            FontEngine* inst = loadFontEngine(node);
+
+            if (inst && ! strcmp(name, inst->getName())) {
+                return inst;
+            }/* end if */
+        }/* end if */
+    }/* end for */
 
     return NULL;
 }/* end method getFontEngine */
 
 size_t FontEngineManager::getFontNameAndAttribute(const char path[], char name[], size_t length, fem::FontStyle* style, bool* isFixedWidth)
 {
-    register FontEngineNode*  node = this->pFontEngineList;
+    FontKey         key(path);
+    DispatchCursor  cursor(*this, key, fem::API_FONT_QUERY);
+    FontEngine*     inst;
     size_t count;
 
-    while (node != NULL) {
-        count = node->inst->getFontNameAndAttribute(path, name, length, style, isFixedWidth);
+    while ((inst = cursor.next()) != NULL) {
+        count = inst->getFontNameAndAttribute(path, name, length, style, isFixedWidth);
 
         if (count) {
+            cursor.accept();
             return count;
         }/* end if */
-
-        node = node->next;
     }/* end while */
 
     return 0;
@@ -259,17 +2018,18 @@ size_t FontEngineManager::getFontNameAndAttribute(const char path[], char name[]
 
 size_t FontEngineManager::getFontNameAndAttribute(const void* buffer, const uint32_t bufferLength, char name[], size_t length, fem::FontStyle* style, bool* isFixedWidth)
 {
-    register FontEngineNode*  node = this->pFontEngineList;
+    FontKey         key(buffer, bufferLength);
+    DispatchCursor  cursor(*this, key, fem::API_FONT_QUERY);
+    FontEngine*     inst;
     size_t count;
 
-    while (node != NULL) {
-        count = node->inst->getFontNameAndAttribute(buffer, bufferLength, name, length, style, isFixedWidth);
+    while ((inst = cursor.next()) != NULL) {
+        count = inst->getFontNameAndAttribute(buffer, bufferLength, name, length, style, isFixedWidth);
 
         if (count) {
+            cursor.accept();
             return count;
         }/* end if */
-
-        node = node->next;
     }/* end while */
 
     return 0;
@@ -277,14 +2037,15 @@ size_t FontEngineManager::getFontNameAndAttribute(const void* buffer, const uint
 
 bool FontEngineManager::isFontSupported(const char path[], bool isLoad)
 {
-    register FontEngineNode*  node = this->pFontEngineList;
+    FontKey         key(path);
+    DispatchCursor  cursor(*this, key, fem::API_FONT_QUERY);
+    FontEngine*     inst;
 
-    while (node != NULL) {
-        if (node->inst->isFontSupported(path, isLoad)) {
+    while ((inst = cursor.next()) != NULL) {
+        if (inst->isFontSupported(path, isLoad)) {
+            cursor.accept();
             return true;
         }/* end if */
-
-        node = node->next;
     }/* end while */
 
     return false;
@@ -292,14 +2053,15 @@ bool FontEngineManager::isFontSupported(const char path[], bool isLoad)
 
 bool FontEngineManager::isFontSupported(const void* buffer, const uint32_t bufferLength)
 {
-    register FontEngineNode*  node = this->pFontEngineList;
+    FontKey         key(buffer, bufferLength);
+    DispatchCursor  cursor(*this, key, fem::API_FONT_QUERY);
+    FontEngine*     inst;
 
-    while (node != NULL) {
-        if (node->inst->isFontSupported(buffer, bufferLength)) {
+    while ((inst = cursor.next()) != NULL) {
+        if (inst->isFontSupported(buffer, bufferLength)) {
+            cursor.accept();
             return true;
         }/* end if */
-
-        node = node->next;
     }/* end while */
 
     return false;
@@ -307,16 +2069,17 @@ bool FontEngineManager::isFontSupported(const void* buffer, const uint32_t buffe
 
 uint32_t FontEngineManager::getFontUnitsPerEm(const char path[])
 {
-    register FontEngineNode*  node = this->pFontEngineList;
+    FontKey         key(path);
+    DispatchCursor  cursor(*this, key, fem::API_FONT_QUERY);
+    FontEngine*     inst;
     uint32_t unitsPerEm = 0;
 
-    while (node != NULL) {
-        unitsPerEm = node->inst->getFontUnitsPerEm(path);
+    while ((inst = cursor.next()) != NULL) {
+        unitsPerEm = inst->getFontUnitsPerEm(path);
         if (unitsPerEm) {
+            cursor.accept();
             break;
         }/* end if */
-
-        node = node->next;
     }/* end while */
 
     return unitsPerEm;
@@ -324,16 +2087,17 @@ uint32_t FontEngineManager::getFontUnitsPerEm(const char path[])
 
 uint32_t FontEngineManager::getFontUnitsPerEm(const void* buffer, const uint32_t bufferLength)
 {
-    register FontEngineNode*  node = this->pFontEngineList;
+    FontKey         key(buffer, bufferLength);
+    DispatchCursor  cursor(*this, key, fem::API_FONT_QUERY);
+    FontEngine*     inst;
     uint32_t unitsPerEm = 0;
 
-    while (node != NULL) {
-        unitsPerEm = node->inst->getFontUnitsPerEm(buffer, bufferLength);
+    while ((inst = cursor.next()) != NULL) {
+        unitsPerEm = inst->getFontUnitsPerEm(buffer, bufferLength);
         if (unitsPerEm) {
+            cursor.accept();
             break;
         }/* end if */
-
-        node = node->next;
     }/* end while */
 
     return unitsPerEm;
@@ -341,14 +2105,15 @@ uint32_t FontEngineManager::getFontUnitsPerEm(const void* buffer, const uint32_t
 
 bool FontEngineManager::canEmbed(const char path[])
 {
-    register FontEngineNode*  node = this->pFontEngineList;
+    FontKey         key(path);
+    DispatchCursor  cursor(*this, key, fem::API_FONT_QUERY);
+    FontEngine*     inst;
 
-    while (node != NULL) {
-        if (node->inst->canEmbed(path)) {
+    while ((inst = cursor.next()) != NULL) {
+        if (inst->canEmbed(path)) {
+            cursor.accept();
             return true;
         }/* end if */
-
-        node = node->next;
     }/* end while */
 
     return false;
@@ -356,14 +2121,15 @@ bool FontEngineManager::canEmbed(const char path[])
 
 bool FontEngineManager::canEmbed(const void* buffer, const uint32_t bufferLength)
 {
-    register FontEngineNode*  node = this->pFontEngineList;
+    FontKey         key(buffer, bufferLength);
+    DispatchCursor  cursor(*this, key, fem::API_FONT_QUERY);
+    FontEngine*     inst;
 
-    while (node != NULL) {
-        if (node->inst->canEmbed(buffer, bufferLength)) {
+    while ((inst = cursor.next()) != NULL) {
+        if (inst->canEmbed(buffer, bufferLength)) {
+            cursor.accept();
             return true;
         }/* end if */
-
-        node = node->next;
     }/* end while */
 
     return false;
@@ -371,16 +2137,17 @@ bool FontEngineManager::canEmbed(const void* buffer, const uint32_t bufferLength
 
 uint32_t FontEngineManager::getGlyphsAdvance(const char path[], uint32_t start, uint32_t count, FEM16Dot16* pGlyphsAdvance)
 {
-    register FontEngineNode*  node = this->pFontEngineList;
+    FontKey         key(path);
+    DispatchCursor  cursor(*this, key, fem::API_FONT_QUERY);
+    FontEngine*     inst;
     uint32_t errCode = 0;
 
-    while (node != NULL) {
-        errCode = node->inst->getGlyphsAdvance(path, start, count, pGlyphsAdvance);
+    while ((inst = cursor.next()) != NULL) {
+        errCode = inst->getGlyphsAdvance(path, start, count, pGlyphsAdvance);
         if (errCode == 0) {
+            cursor.accept();
             break;
         }/* end if */
-
-        node = node->next;
     }/* end while */
 
     return errCode;
@@ -388,16 +2155,17 @@ uint32_t FontEngineManager::getGlyphsAdvance(const char path[], uint32_t start,
 
 uint32_t FontEngineManager::getGlyphsAdvance(const void* buffer, const uint32_t bufferLength, uint32_t start, uint32_t count, FEM16Dot16* pGlyphsAdvance)
 {
-    register FontEngineNode*  node = this->pFontEngineList;
+    FontKey         key(buffer, bufferLength);
+    DispatchCursor  cursor(*this, key, fem::API_FONT_QUERY);
+    FontEngine*     inst;
     uint32_t errCode = 0;
 
-    while (node != NULL) {
-        errCode = node->inst->getGlyphsAdvance(buffer, bufferLength, start, count, pGlyphsAdvance);
+    while ((inst = cursor.next()) != NULL) {
+        errCode = inst->getGlyphsAdvance(buffer, bufferLength, start, count, pGlyphsAdvance);
         if (errCode == 0) {
+            cursor.accept();
             break;
         }/* end if */
-
-        node = node->next;
     }/* end while */
 
     return errCode;
@@ -405,16 +2173,17 @@ uint32_t FontEngineManager::getGlyphsAdvance(const void* buffer, const uint32_t
 
 uint32_t FontEngineManager::getGlyphsName(const char path[], uint32_t start, uint32_t count, char** pGlyphsName)
 {
-    register FontEngineNode*  node = this->pFontEngineList;
+    FontKey         key(path);
+    DispatchCursor  cursor(*this, key, fem::API_FONT_QUERY);
+    FontEngine*     inst;
     uint32_t errCode = 0;
 
-    while (node != NULL) {
-        errCode = node->inst->getGlyphsName(path, start, count, pGlyphsName);
+    while ((inst = cursor.next()) != NULL) {
+        errCode = inst->getGlyphsName(path, start, count, pGlyphsName);
         if (errCode == 0) {
+            cursor.accept();
             break;
         }/* end if */
-
-        node = node->next;
     }/* end while */
 
     return errCode;
@@ -422,16 +2191,17 @@ uint32_t FontEngineManager::getGlyphsName(const char path[], uint32_t start, uin
 
 uint32_t FontEngineManager::getGlyphsName(const void* buffer, const uint32_t bufferLength, uint32_t start, uint32_t count, char** pGlyphsName)
 {
-    register FontEngineNode*  node = this->pFontEngineList;
+    FontKey         key(buffer, bufferLength);
+    DispatchCursor  cursor(*this, key, fem::API_FONT_QUERY);
+    FontEngine*     inst;
     uint32_t errCode = 0;
 
-    while (node != NULL) {
-        errCode = node->inst->getGlyphsName(buffer, bufferLength, start, count, pGlyphsName);
+    while ((inst = cursor.next()) != NULL) {
+        errCode = inst->getGlyphsName(buffer, bufferLength, start, count, pGlyphsName);
         if (errCode == 0) {
+            cursor.accept();
             break;
         }/* end if */
-
-        node = node->next;
     }/* end while */
 
     return errCode;
@@ -439,16 +2209,17 @@ uint32_t FontEngineManager::getGlyphsName(const void* buffer, const uint32_t buf
 
 uint32_t FontEngineManager::getGlyphsUnicode(const char path[], uint32_t start, uint32_t count, int32_t* pGlyphsUnicode)
 {
-    register FontEngineNode*  node = this->pFontEngineList;
+    FontKey         key(path);
+    DispatchCursor  cursor(*this, key, fem::API_FONT_QUERY);
+    FontEngine*     inst;
     uint32_t errCode = 0;
 
-    while (node != NULL) {
-        errCode = node->inst->getGlyphsUnicode(path, start, count, pGlyphsUnicode);
+    while ((inst = cursor.next()) != NULL) {
+        errCode = inst->getGlyphsUnicode(path, start, count, pGlyphsUnicode);
         if (errCode == 0) {
+            cursor.accept();
             break;
         }/* end if */
-
-        node = node->next;
     }/* end while */
 
     return errCode;
@@ -456,16 +2227,17 @@ uint32_t FontEngineManager::getGlyphsUnicode(const char path[], uint32_t start,
 
 uint32_t FontEngineManager::getGlyphsUnicode(const void* buffer, const uint32_t bufferLength, uint32_t start, uint32_t count, int32_t* pGlyphsUnicode)
 {
-    register FontEngineNode*  node = this->pFontEngineList;
+    FontKey         key(buffer, bufferLength);
+    DispatchCursor  cursor(*this, key, fem::API_FONT_QUERY);
+    FontEngine*     inst;
     uint32_t errCode = 0;
 
-    while (node != NULL) {
-        errCode = node->inst->getGlyphsUnicode(buffer, bufferLength, start, count, pGlyphsUnicode);
+    while ((inst = cursor.next()) != NULL) {
+        errCode = inst->getGlyphsUnicode(buffer, bufferLength, start, count, pGlyphsUnicode);
         if (errCode == 0) {
+            cursor.accept();
             break;
         }/* end if */
-
-        node = node->next;
     }/* end while */
 
     return errCode;
@@ -473,18 +2245,20 @@ uint32_t FontEngineManager::getGlyphsUnicode(const void* buffer, const uint32_t
 
 AdvancedTypefaceMetrics* FontEngineManager::getAdvancedTypefaceMetrics(const char path[])
 {
-    register FontEngineNode*  node = this->pFontEngineList;
+    FontKey         key(path);
+    DispatchCursor  cursor(*this, key, fem::API_FONT_QUERY);
+    FontEngine*     inst;
     AdvancedTypefaceMetrics*  pAdvancedTypefaceMetrics = NULL;
 
     FEM_LOG("creating AdvancedTypefaceMetrics\n");
 
-    while (node != NULL) {
-        pAdvancedTypefaceMetrics = node->inst->getAdvancedTypefaceMetrics(path);
+    while ((inst = cursor.next()) != NULL) {
+        pAdvancedTypefaceMetrics = inst->getAdvancedTypefaceMetrics(path);
         if (pAdvancedTypefaceMetrics) {
             FEM_LOG("successfully created AdvancedTypefaceMetrics\n");
+            cursor.accept();
             return pAdvancedTypefaceMetrics;
         }/* end if */
-        node = node->next;
     }/* end while */
 
     return NULL;
@@ -492,18 +2266,20 @@ AdvancedTypefaceMetrics* FontEngineManager::getAdvancedTypefaceMetrics(const cha
 
 AdvancedTypefaceMetrics* FontEngineManager::getAdvancedTypefaceMetrics(const void* buffer, const uint32_t bufferLength)
 {
-    register FontEngineNode*  node = this->pFontEngineList;
+    FontKey         key(buffer, bufferLength);
+    DispatchCursor  cursor(*this, key, fem::API_FONT_QUERY);
+    FontEngine*     inst;
     AdvancedTypefaceMetrics*  pAdvancedTypefaceMetrics = NULL;
 
     FEM_LOG("creating AdvancedTypefaceMetrics\n");
 
-    while (node != NULL) {
-        pAdvancedTypefaceMetrics = node->inst->getAdvancedTypefaceMetrics(buffer, bufferLength);
+    while ((inst = cursor.next()) != NULL) {
+        pAdvancedTypefaceMetrics = inst->getAdvancedTypefaceMetrics(buffer, bufferLength);
         if (pAdvancedTypefaceMetrics) {
             FEM_LOG("successfully created AdvancedTypefaceMetrics\n");
+            cursor.accept();
             return pAdvancedTypefaceMetrics;
         }/* end if */
-        node = node->next;
     }/* end while */
 
     return NULL;